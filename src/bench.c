@@ -0,0 +1,316 @@
+/** @file bench.c
+ *
+ *  @brief Throughput and latency benchmark: runs the sender and the receiver over loopback through the impairment shim.
+ *
+ *  The benchmark writes a random input file, starts the shim (see netem.h), starts ./receiver and
+ *  ./sender as child processes and reports goodput, retransmit ratio, CPU time per GB and the
+ *  latency percentiles from a packet's first transmission until its ack reached the sender.
+ *  It exits with 1 if the received file differs from the input, so `make bench` doubles as a
+ *  regression check of the protocol under loss.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "netem.h"
+
+
+#define bench_usage "usage: %s [-b bytes[K|M|G]] [-l loss%%] [-L ack_loss%%] [-d delay_ms] [-j jitter_ms] [-o reorder%%] [-r rate_mbps] [-q queue_ms] [-z seed] [-p port] [-t timeout_s] [-u] [-e aes-gcm|chacha20]\n"
+
+
+/** @brief Parses a byte count with an optional K, M or G suffix
+ *
+ *  @param text The command line argument
+ *  @return The number of bytes
+ */
+static unsigned long long parse_size(const char* text) {
+    char* end;
+    unsigned long long size = strtoull(text, &end, 10);
+    switch (*end) {
+        case 'G': case 'g': size <<= 10; /* fall through */
+        case 'M': case 'm': size <<= 10; /* fall through */
+        case 'K': case 'k': size <<= 10; break;
+        default: break;
+    }
+    return size;
+}
+
+/** @brief Writes size random bytes to a new file
+ *
+ *  @param path Where to write
+ *  @param size Number of bytes
+ *  @param seed Seed so runs are repeatable
+ *  @return 0 on success, -1 on error
+ */
+static int write_input(const char* path, unsigned long long size, unsigned int seed) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    unsigned char block[65536];
+    while (size > 0) {
+        size_t length = size < sizeof(block) ? size : sizeof(block);
+        for (size_t i = 0; i < length; i++) {
+            block[i] = rand_r(&seed) >> 7;
+        }
+        fwrite(block, 1, length, file);
+        size -= length;
+    }
+    return fclose(file);
+}
+
+/** @brief Writes a random key for both programs, as 64 hex digits
+ *
+ *  @param path Where to write
+ *  @param seed Seed so runs are repeatable
+ *  @return 0 on success, -1 on error
+ */
+static int write_key(const char* path, unsigned int seed) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < 32; i++) {
+        fprintf(file, "%02x", (rand_r(&seed) >> 7) & 0xff);
+    }
+    fprintf(file, "\n");
+    return fclose(file);
+}
+
+/** @brief Appends the options both programs take alike: -u, and -K and -E with a cipher
+ *
+ *  @param argv The argument vector being built
+ *  @param count Arguments in it so far
+ *  @param uring Whether to use the io_uring engine
+ *  @param cipher The cipher, NULL to send in the clear
+ *  @param key The key file
+ *  @return Arguments in it now
+ */
+static int add_options(char** argv, int count, int uring, char* cipher, char* key) {
+    if (uring) {
+        argv[count++] = "-u";
+    }
+    if (cipher != NULL) {
+        argv[count++] = "-K";
+        argv[count++] = key;
+        argv[count++] = "-E";
+        argv[count++] = cipher;
+    }
+    return count;
+}
+
+/** @brief Compares two files byte by byte
+ *
+ *  @return 1 if they are equal
+ */
+static int same_file(const char* a, const char* b) {
+    FILE* fa = fopen(a, "rb");
+    FILE* fb = fopen(b, "rb");
+    int same = (fa != NULL && fb != NULL);
+
+    unsigned char ba[65536], bb[65536];
+    while (same) {
+        size_t la = fread(ba, 1, sizeof(ba), fa);
+        size_t lb = fread(bb, 1, sizeof(bb), fb);
+        if (la != lb || memcmp(ba, bb, la) != 0) {
+            same = 0;
+        }
+        if (la == 0) {
+            break;
+        }
+    }
+
+    if (fa != NULL) fclose(fa);
+    if (fb != NULL) fclose(fb);
+    return same;
+}
+
+/** @brief Starts one of the programs with its output thrown away
+ *
+ *  @param argv Program and arguments
+ *  @return The child's pid
+ */
+static pid_t spawn(char* const argv[]) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    return pid;
+}
+
+/** @brief Waits for a child, killing it after a deadline
+ *
+ *  @param pid The child
+ *  @param deadline_us netem_now_us() value after which the child is killed
+ *  @return The child's exit status, -1 if it had to be killed
+ */
+static int wait_child(pid_t pid, uint64_t deadline_us) {
+    int status;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        if (netem_now_us() > deadline_us) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return -1;
+        }
+        usleep(1000);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/// qsort comparison for the latency samples
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/// Latency percentile in milliseconds from sorted samples
+static double percentile_ms(const double* sorted, size_t count, double p) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t at = (size_t)(p * (count - 1));
+    return sorted[at] / 1000.0;
+}
+
+/** @brief Runs one benchmark scenario and prints a one line report
+ *
+ * @return 0 if the file arrived intact, 1 otherwise
+ */
+int main(int argc, char** argv) {
+    unsigned long long bytes = 1 << 20;
+    struct netem_link forward = { 0, 0, 0, 0, 0, 50 };
+    struct netem_link reverse = { 0, 0, 0, 0, 0, 50 };
+    unsigned int seed = 1;
+    int port = 20000 + getpid() % 20000;
+    int timeout_s = 120;
+    int uring = 0; /// -u runs both programs with their io_uring engine
+    char* cipher = NULL; /// -e encrypts the transfer with a random key
+    int option;
+
+    while ((option = getopt(argc, argv, "b:l:L:d:j:o:r:q:z:p:t:ue:")) != -1) {
+        switch (option) {
+            case 'b': bytes = parse_size(optarg); break;
+            case 'l': forward.loss = atof(optarg) / 100; break;
+            case 'L': reverse.loss = atof(optarg) / 100; break;
+            case 'd': forward.delay_ms = reverse.delay_ms = atof(optarg); break;
+            case 'j': forward.jitter_ms = reverse.jitter_ms = atof(optarg); break;
+            case 'o': forward.reorder = atof(optarg) / 100; break;
+            case 'r': forward.rate_mbps = atof(optarg); break;
+            case 'q': forward.queue_ms = atof(optarg); break;
+            case 'z': seed = atoi(optarg); break;
+            case 'p': port = atoi(optarg); break;
+            case 't': timeout_s = atoi(optarg); break;
+            case 'u': uring = 1; break;
+            case 'e': cipher = optarg; break;
+            default:
+                fprintf(stderr, bench_usage, argv[0]);
+                exit(1);
+        }
+    }
+
+    /// Scratch directory for the input and the output file
+    char directory[] = "/tmp/rudp-bench-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+    char input[64], output[64], key[64], shim_port[12], receiver_port[12], size[24];
+    snprintf(input, sizeof(input), "%s/input", directory);
+    snprintf(output, sizeof(output), "%s/output", directory);
+    snprintf(key, sizeof(key), "%s/key", directory);
+    snprintf(shim_port, sizeof(shim_port), "%d", port);
+    snprintf(receiver_port, sizeof(receiver_port), "%d", port + 1);
+    snprintf(size, sizeof(size), "%llu", bytes);
+
+    if (write_input(input, bytes, seed) < 0) {
+        perror("writing the input file");
+        exit(EXIT_FAILURE);
+    }
+    if (cipher != NULL && write_key(key, seed) < 0) {
+        perror("writing the key file");
+        exit(EXIT_FAILURE);
+    }
+
+    struct netem em;
+    if (netem_start(&em, port, port + 1, &forward, &reverse, seed) < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    /// Receiver first, give it a moment to bind before the sender starts
+    char* receiver_argv[10];
+    int count = 0;
+    receiver_argv[count++] = "./receiver";
+    count = add_options(receiver_argv, count, uring, cipher, key);
+    receiver_argv[count++] = receiver_port;
+    receiver_argv[count++] = output;
+    receiver_argv[count] = NULL;
+    pid_t receiver = spawn(receiver_argv);
+    usleep(200000);
+
+    char* sender_argv[12];
+    count = 0;
+    sender_argv[count++] = "./sender";
+    count = add_options(sender_argv, count, uring, cipher, key);
+    sender_argv[count++] = "127.0.0.1";
+    sender_argv[count++] = shim_port;
+    sender_argv[count++] = input;
+    sender_argv[count++] = size;
+    sender_argv[count] = NULL;
+    uint64_t start_us = netem_now_us();
+    uint64_t deadline_us = start_us + (uint64_t)timeout_s * 1000000;
+    pid_t sender = spawn(sender_argv);
+
+    int sender_status = wait_child(sender, deadline_us);
+    double elapsed = (netem_now_us() - start_us) / 1000000.0;
+    int receiver_status = wait_child(receiver, netem_now_us() + 5000000);
+    netem_stop(&em);
+
+    /// CPU time of both programs together
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+
+    int intact = (sender_status == 0 && receiver_status == 0 && same_file(input, output));
+
+    struct netem_stats* stats = &em.stats;
+    qsort(stats->latency_us, stats->latency_count, sizeof(double), compare_double);
+    double retransmit = stats->unique_packets ? (double)(stats->data_packets - stats->unique_packets) / stats->unique_packets : 0;
+
+    printf("bytes=%llu loss=%.1f%% ack_loss=%.1f%% delay=%.1fms jitter=%.1fms reorder=%.1f%% rate=%.1fMbit/s%s%s%s | "
+           "time %.3fs goodput %.3f Mbit/s retransmit %.2f%% cpu %.2f s/GB "
+           "latency p50 %.3fms p99 %.3fms p99.9 %.3fms max %.3fms drops %llu %s\n",
+           bytes, forward.loss * 100, reverse.loss * 100, forward.delay_ms, forward.jitter_ms, forward.reorder * 100, forward.rate_mbps,
+           uring ? " io_uring" : "", cipher != NULL ? " " : "", cipher != NULL ? cipher : "",
+           elapsed, elapsed > 0 ? bytes * 8 / elapsed / 1000000.0 : 0, retransmit * 100,
+           bytes ? cpu / (bytes / 1000000000.0) : 0,
+           percentile_ms(stats->latency_us, stats->latency_count, 0.5),
+           percentile_ms(stats->latency_us, stats->latency_count, 0.99),
+           percentile_ms(stats->latency_us, stats->latency_count, 0.999),
+           percentile_ms(stats->latency_us, stats->latency_count, 1.0),
+           stats->dropped, intact ? "OK" : "FAILED");
+
+    netem_free(&em);
+    unlink(input);
+    unlink(output);
+    unlink(key);
+    rmdir(directory);
+    return intact ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+/** @file check.c
+ *
+ *  @brief Unit checks of library internals that a transfer over loopback would rarely or never reach.
+ *
+ *  `make check` runs every check once and exits with 1 if any of them failed, naming it. A check
+ *  builds the state it needs by hand (a scheduler with entries queued, a crafted packet) and looks
+ *  at what the library did with it, so it runs in a moment and needs no network.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+
+#include "librudp.h"
+#include "sched.h"
+#include "pacer.h"
+#include "delta.h"
+
+
+/// Checks that failed so far
+static int failures = 0;
+
+/** @brief Counts and names a failed check
+ *
+ *  @param ok Whether the check passed
+ *  @param name What was checked
+ *  @return void
+ */
+static void expect(int ok, const char *name) {
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", name);
+        failures++;
+    }
+}
+
+/// Release callback of entries that must not go out during a check
+static void count_release(struct sched_entry *entry, uint64_t send_at) {
+    (void)send_at;
+    (*(int *)entry->arg)++;
+}
+
+/** @brief A turn that is queued already and scheduled again stays queued once, and the others stay behind it
+ *
+ *  @return void
+ */
+static void check_sched_requeue(void) {
+    struct evloop loop;
+    struct rudp_scheduler *scheduler;
+    if (evloop_init(&loop) < 0 || rudp_scheduler_open(&scheduler, &loop, 0) != rudp_ok) {
+        expect(0, "sched requeue: setting up a scheduler");
+        return;
+    }
+
+    int released = 0;
+    struct sched_flow flow = { 0, 1, 0 };
+    struct sched_entry entries[3];
+    memset(entries, 0, sizeof(entries));
+    uint64_t later = pacer_now() + 1000000000ULL;
+    for (int i = 0; i < 3; i++) {
+        entries[i].flow = &flow;
+        entries[i].release = count_release;
+        entries[i].arg = &released;
+        expect(sched_enqueue(scheduler, &entries[i], later, 1000) == 0, "sched requeue: first enqueue");
+    }
+
+    /// The middle one and the tail again, as a nack for a packet that is still waiting would
+    expect(sched_enqueue(scheduler, &entries[1], later, 1000) < 0, "sched requeue: a queued middle entry is refused");
+    expect(sched_enqueue(scheduler, &entries[2], later, 1000) < 0, "sched requeue: a queued tail entry is refused");
+
+    int queued = 0;
+    for (struct sched_entry *entry = scheduler->queue; entry != NULL && queued <= 3; entry = entry->next) {
+        queued++;
+    }
+    expect(queued == 3, "sched requeue: every entry is queued once and the queue ends");
+    expect(released == 0, "sched requeue: nothing went out before its time");
+
+    for (int i = 0; i < 3; i++) {
+        sched_cancel(scheduler, &entries[i]);
+    }
+    expect(scheduler->queue == NULL, "sched requeue: cancelling empties the queue");
+    rudp_scheduler_close(scheduler);
+    evloop_close(&loop);
+}
+
+/** @brief A signature reply whose block count or size disagrees with chunk 0 is refused, and so is a later chunk before chunk 0
+ *
+ *  @return void
+ */
+static void check_sig_chunk_count(void) {
+    uint8_t reply[max_data_size];
+    memset(reply, 0, sizeof(reply));
+    uint32_t block_size = delta_min_block;
+    uint32_t nblocks = 2 * sig_per_chunk;
+    memcpy(reply, &block_size, 4);
+    memcpy(reply+4, &nblocks, 4);
+
+    struct delta_sig *sigs = NULL;
+    uint32_t got_nblocks = 0, got_block_size = 0;
+    expect(delta_sig_parse(reply, sizeof(reply), 1, &sigs, &got_nblocks, &got_block_size) < 0, "sig chunk: a later chunk before chunk 0 is refused");
+    expect(delta_sig_parse(reply, sizeof(reply), 0, &sigs, &got_nblocks, &got_block_size) == 0, "sig chunk: chunk 0 is taken");
+    expect(got_nblocks == nblocks && got_block_size == block_size, "sig chunk: chunk 0 sets the block count and size");
+
+    /// A peer that claims more blocks in chunk 1 than chunk 0 allocated for
+    uint32_t more = 100 * sig_per_chunk;
+    memcpy(reply+4, &more, 4);
+    expect(delta_sig_parse(reply, sizeof(reply), 1, &sigs, &got_nblocks, &got_block_size) < 0, "sig chunk: a different block count is refused");
+    expect(got_nblocks == nblocks, "sig chunk: a refused chunk leaves the block count alone");
+
+    uint32_t other_size = 2 * delta_min_block;
+    memcpy(reply, &other_size, 4);
+    memcpy(reply+4, &nblocks, 4);
+    expect(delta_sig_parse(reply, sizeof(reply), 1, &sigs, &got_nblocks, &got_block_size) < 0, "sig chunk: a different block size is refused");
+
+    memcpy(reply, &block_size, 4);
+    expect(delta_sig_parse(reply, sizeof(reply), 1, &sigs, &got_nblocks, &got_block_size) == 0, "sig chunk: a matching chunk 1 is taken");
+    free(sigs);
+}
+
+/** @brief Userspace pacers lower the thread's timer slack while any of them is open and give it back after the last
+ *
+ *  @return void
+ */
+static void check_pacer_slack(void) {
+    long before = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+    struct sockaddr_in nowhere;
+    memset(&nowhere, 0, sizeof(nowhere));
+    nowhere.sin_family = AF_INET;
+
+    struct pacer first, second;
+    pacer_init(&first, -1, (struct sockaddr *)&nowhere, pacer_user);
+    pacer_init(&second, -1, (struct sockaddr *)&nowhere, pacer_user);
+    expect(prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0) == 1, "pacer slack: lowered while pacing in userspace");
+    pacer_close(&first);
+    expect(prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0) == 1, "pacer slack: still lowered while a pacer is open");
+    pacer_close(&second);
+    pacer_close(&second);
+    expect(prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0) == before, "pacer slack: given back after the last pacer");
+}
+
+int main(void) {
+    check_sched_requeue();
+    check_sig_chunk_count();
+    check_pacer_slack();
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,461 @@
+/** @file delta.c
+ *
+ *  @brief Block signatures, delta generation (sender) and delta application (receiver).
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "rudp.h"
+#include "delta.h"
+
+
+/** @brief Picks the block size the receiver cuts its file into
+ *
+ *  Roughly the square root of the file size so the number of signatures and the size of
+ *  one block grow together, rounded to a power of two and clamped.
+ *
+ *  @param file_size Size of the receiver's existing file
+ *  @return The block size in bytes
+ */
+uint32_t delta_block_size(unsigned long long file_size) {
+    uint32_t block_size = delta_min_block;
+    while ((unsigned long long)block_size * block_size < file_size && block_size < delta_max_block) {
+        block_size <<= 1;
+    }
+    return block_size;
+}
+
+/** @brief Weak rolling checksum of a block (the rsync a + b * 2^16 checksum)
+ *
+ *  The two sums are kept in separate plain loops so the compiler can vectorize them.
+ *
+ *  @param buf The block
+ *  @param len Length of the block
+ *  @return The checksum
+ */
+uint32_t delta_weak(const uint8_t *buf, size_t len) {
+    uint32_t a = 0;
+    uint32_t b = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        a += buf[i];
+    }
+    for (size_t i = 0; i < len; i++) {
+        b += (uint32_t)(len - i) * buf[i];
+    }
+    return (a & 0xffff) | ((b & 0xffff) << 16);
+}
+
+/// 64 bit rotate left
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+/// Final avalanche so every input bit affects every output bit
+static inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/** @brief Strong hash of a block, only computed once the weak checksum matched
+ *
+ *  @param buf The block
+ *  @param len Length of the block
+ *  @return 64 bit hash
+ */
+uint64_t delta_strong(const uint8_t *buf, size_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+    uint64_t k;
+
+    /// Mix 8 bytes at a time
+    while (len >= 8) {
+        memcpy(&k, buf, 8);
+        k *= 0x87c37b91114253d5ULL;
+        k = rotl64(k, 31);
+        k *= 0x4cf5ad432745937fULL;
+        h ^= k;
+        h = rotl64(h, 27) * 5 + 0x52dce729;
+        buf += 8;
+        len -= 8;
+    }
+
+    /// Mix whatever is left
+    k = 0;
+    memcpy(&k, buf, len);
+    k *= 0x87c37b91114253d5ULL;
+    h ^= rotl64(k, 31);
+
+    return fmix64(h);
+}
+
+/** @brief Computes the signatures of every whole block of a file
+ *
+ *  A trailing partial block is left out, it always goes over as literal bytes.
+ *
+ *  @param file The receiver's existing file, opened for reading
+ *  @param block_size Block size from delta_block_size()
+ *  @param nblocks Set to the number of signatures returned
+ *  @return malloc'd array of signatures (NULL if there are none, or no memory for them)
+ */
+struct delta_sig *delta_signatures(FILE *file, uint32_t block_size, uint32_t *nblocks) {
+    *nblocks = 0;
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (file_size <= 0) {
+        return NULL;
+    }
+
+    uint32_t count = file_size / block_size;
+    if (count == 0) {
+        return NULL;
+    }
+
+    struct delta_sig *sigs = malloc(count * sizeof(struct delta_sig));
+    uint8_t *block = malloc(block_size);
+    if (sigs == NULL || block == NULL) {
+        /// Without signatures the file simply has no blocks to match against
+        free(sigs);
+        free(block);
+        return NULL;
+    }
+
+    /// Read the file one block at a time and describe every block
+    for (uint32_t i = 0; i < count; i++) {
+        if (fread(block, 1, block_size, file) != block_size) {
+            count = i;
+            break;
+        }
+        sigs[i].weak = delta_weak(block, block_size);
+        sigs[i].strong = delta_strong(block, block_size);
+    }
+
+    free(block);
+    *nblocks = count;
+    return sigs;
+}
+
+/** @brief Encodes one chunk of signatures as the payload of a pkt_sig reply
+ *
+ *  Payload: block size (4 bytes), total number of blocks (4 bytes), then up to
+ *  sig_per_chunk entries of weak checksum (4 bytes) + strong hash (8 bytes).
+ *
+ *  @param sigs All signatures of the receiver's file
+ *  @param nblocks Number of signatures
+ *  @param block_size Block size the signatures were computed with
+ *  @param chunk Which chunk the sender asked for
+ *  @param out Buffer of at least max_data_size bytes
+ *  @return Number of payload bytes written
+ */
+size_t delta_sig_chunk(const struct delta_sig *sigs, uint32_t nblocks, uint32_t block_size, uint32_t chunk, uint8_t *out) {
+    memcpy(out, &block_size, 4);
+    memcpy(out+4, &nblocks, 4);
+
+    size_t length = sig_chunk_header;
+    unsigned long long first = (unsigned long long)chunk * sig_per_chunk;
+    for (unsigned long long i = first; i < nblocks && i < first + sig_per_chunk; i++) {
+        memcpy(out+length, &sigs[i].weak, 4);
+        memcpy(out+length+4, &sigs[i].strong, 8);
+        length += sig_entry_size;
+    }
+    return length;
+}
+
+/** @brief Decodes one pkt_sig reply into the sender's copy of the signatures
+ *
+ *  @param in The payload of the reply
+ *  @param len Length of the payload
+ *  @param chunk The chunk that was asked for
+ *  @param sigs Signature array, allocated when chunk 0 arrives
+ *  @param nblocks Set to the total number of blocks by chunk 0, later chunks must repeat it
+ *  @param block_size Set to the receiver's block size by chunk 0, later chunks must repeat it
+ *  @return 0 on success, -1 if the reply is malformed, disagrees with chunk 0 or memory ran out
+ */
+int delta_sig_parse(const uint8_t *in, size_t len, uint32_t chunk, struct delta_sig **sigs, uint32_t *nblocks, uint32_t *block_size) {
+    if (len < sig_chunk_header) {
+        return -1;
+    }
+
+    uint32_t reply_block_size, reply_nblocks;
+    memcpy(&reply_block_size, in, 4);
+    memcpy(&reply_nblocks, in+4, 4);
+
+    if (chunk == 0) {
+        if (reply_block_size < delta_min_block || reply_block_size > delta_max_block) {
+            return -1;
+        }
+        *block_size = reply_block_size;
+        *nblocks = reply_nblocks;
+        if (*nblocks > 0) {
+            *sigs = malloc((size_t)*nblocks * sizeof(struct delta_sig));
+            if (*sigs == NULL) {
+                return -1;
+            }
+        }
+    } else if (*sigs == NULL || reply_block_size != *block_size || reply_nblocks != *nblocks) {
+        /// Only chunk 0 sizes the array, a later chunk has to describe the same file or it would write past it
+        return -1;
+    }
+
+    unsigned long long first = (unsigned long long)chunk * sig_per_chunk;
+    size_t offset = sig_chunk_header;
+    for (unsigned long long i = first; i < *nblocks && i < first + sig_per_chunk; i++) {
+        if (offset + sig_entry_size > len) {
+            return -1;
+        }
+        memcpy(&(*sigs)[i].weak, in+offset, 4);
+        memcpy(&(*sigs)[i].strong, in+offset+4, 8);
+        offset += sig_entry_size;
+    }
+    return 0;
+}
+
+/// Slot a weak checksum hashes to
+static inline uint32_t index_slot(const struct delta_index *index, uint32_t weak) {
+    return (weak * 2654435761u) & index->mask;
+}
+
+/** @brief Builds the weak checksum lookup table on the sender
+ *
+ *  @param index Table to fill in
+ *  @param sigs The receiver's signatures
+ *  @param nblocks Number of signatures
+ *  @return 0 on success, -1 if memory ran out
+ */
+int delta_index_build(struct delta_index *index, const struct delta_sig *sigs, uint32_t nblocks) {
+    /// Keep the table at most half full so probes stay short
+    uint32_t size = 16;
+    while (size < 2 * (unsigned long long)nblocks) {
+        size <<= 1;
+    }
+
+    index->slots = calloc(size, sizeof(uint32_t));
+    if (index->slots == NULL) {
+        return -1;
+    }
+    index->mask = size - 1;
+
+    for (uint32_t i = 0; i < nblocks; i++) {
+        uint32_t slot = index_slot(index, sigs[i].weak);
+        while (index->slots[slot] != 0) {
+            slot = (slot + 1) & index->mask;
+        }
+        index->slots[slot] = i + 1;
+    }
+    return 0;
+}
+
+/** @brief Frees the lookup table
+ *
+ *  @param index Table from delta_index_build()
+ *  @return void
+ */
+void delta_index_free(struct delta_index *index) {
+    free(index->slots);
+    index->slots = NULL;
+}
+
+/** @brief Finds a block of the receiver's file equal to the current window
+ *
+ *  @param gen Generator state
+ *  @param weak Weak checksum of the window
+ *  @return The block number, or -1 if nothing matches
+ */
+static long long find_block(struct delta_gen *gen, uint32_t weak) {
+    const uint8_t *window = gen->src + gen->pos;
+    uint64_t strong = 0;
+    int have_strong = 0;
+
+    /// Data usually continues where the last copy ended, so try that block first
+    if (gen->next_block < gen->nblocks && gen->sigs[gen->next_block].weak == weak) {
+        strong = delta_strong(window, gen->block_size);
+        have_strong = 1;
+        if (gen->sigs[gen->next_block].strong == strong) {
+            return gen->next_block;
+        }
+    }
+
+    uint32_t slot = index_slot(gen->index, weak);
+    while (gen->index->slots[slot] != 0) {
+        uint32_t block = gen->index->slots[slot] - 1;
+        if (gen->sigs[block].weak == weak) {
+            if (!have_strong) {
+                strong = delta_strong(window, gen->block_size);
+                have_strong = 1;
+            }
+            if (gen->sigs[block].strong == strong) {
+                return block;
+            }
+        }
+        slot = (slot + 1) & gen->index->mask;
+    }
+    return -1;
+}
+
+/** @brief Prepares the generator for walking the sender's file
+ *
+ *  @param gen Generator state
+ *  @param src The sender's file contents
+ *  @param len Number of bytes to transfer
+ *  @param sigs The receiver's signatures
+ *  @param index Lookup table over sigs
+ *  @param nblocks Number of signatures
+ *  @param block_size The receiver's block size
+ *  @return void
+ */
+void delta_gen_init(struct delta_gen *gen, const uint8_t *src, size_t len, const struct delta_sig *sigs, const struct delta_index *index, uint32_t nblocks, uint32_t block_size) {
+    memset(gen, 0, sizeof(*gen));
+    gen->src = src;
+    gen->len = len;
+    gen->sigs = sigs;
+    gen->index = index;
+    gen->nblocks = nblocks;
+    gen->block_size = block_size;
+}
+
+/// Writes a literal op for the pending bytes up to end, bounded by the packet size
+static size_t emit_literal(struct delta_gen *gen, uint8_t *out, size_t cap, size_t end) {
+    size_t length = end - gen->lit_start;
+    if (length > cap - 1) {
+        length = cap - 1;
+    }
+
+    out[0] = delta_op_literal;
+    memcpy(out+1, gen->src + gen->lit_start, length);
+    gen->lit_start += length;
+    gen->literal_bytes += length;
+    return length + 1;
+}
+
+/** @brief Produces the next delta operation
+ *
+ *  Operations come out in file order: either a literal with up to cap - 1 bytes or a copy
+ *  of a run of consecutive blocks of the receiver's file.
+ *
+ *  @param gen Generator state
+ *  @param out Buffer for the operation
+ *  @param cap Size of out (at most the data part of one packet)
+ *  @return Length of the operation, 0 once the whole file has been described
+ */
+size_t delta_next(struct delta_gen *gen, uint8_t *out, size_t cap) {
+    size_t block_size = gen->block_size;
+
+    while (1) {
+        /// Not enough bytes left for a whole block, the tail goes out as literals
+        if (gen->nblocks == 0 || gen->pos + block_size > gen->len) {
+            if (gen->lit_start >= gen->len) {
+                return 0;
+            }
+            return emit_literal(gen, out, cap, gen->len);
+        }
+
+        /// Flush pending bytes once they fill a packet
+        if (gen->pos - gen->lit_start >= cap - 1) {
+            return emit_literal(gen, out, cap, gen->pos);
+        }
+
+        if (!gen->rolling) {
+            uint32_t weak = delta_weak(gen->src + gen->pos, block_size);
+            gen->a = weak & 0xffff;
+            gen->b = weak >> 16;
+            gen->rolling = 1;
+        }
+
+        long long block = find_block(gen, (gen->a & 0xffff) | ((gen->b & 0xffff) << 16));
+        if (block >= 0) {
+            /// Bytes before the match have to go out first
+            if (gen->lit_start < gen->pos) {
+                return emit_literal(gen, out, cap, gen->pos);
+            }
+
+            /// Extend the copy over following blocks that match too
+            uint32_t first = block;
+            uint32_t count = 1;
+            while (first + count < gen->nblocks && gen->pos + (count + 1) * block_size <= gen->len) {
+                const uint8_t *next = gen->src + gen->pos + count * block_size;
+                const struct delta_sig *sig = &gen->sigs[first + count];
+                if (sig->weak != delta_weak(next, block_size) || sig->strong != delta_strong(next, block_size)) {
+                    break;
+                }
+                count++;
+            }
+
+            out[0] = delta_op_copy;
+            memcpy(out+1, &first, 4);
+            memcpy(out+5, &count, 4);
+
+            gen->pos += (size_t)count * block_size;
+            gen->lit_start = gen->pos;
+            gen->next_block = first + count;
+            gen->matched_bytes += (unsigned long long)count * block_size;
+            gen->rolling = 0;
+            return delta_copy_size;
+        }
+
+        /// No match, roll the window forward by one byte
+        if (gen->pos + block_size < gen->len) {
+            uint8_t out_byte = gen->src[gen->pos];
+            uint8_t in_byte = gen->src[gen->pos + block_size];
+            gen->a = gen->a - out_byte + in_byte;
+            gen->b = gen->b - (uint32_t)block_size * out_byte + gen->a;
+        } else {
+            gen->rolling = 0;
+        }
+        gen->pos++;
+    }
+}
+
+/** @brief Applies one delta operation on the receiver
+ *
+ *  @param basis The receiver's old file (may be NULL if it had none)
+ *  @param out The file being rebuilt
+ *  @param block_size Block size the signatures were computed with
+ *  @param op The operation as sent by delta_next()
+ *  @param len Length of the operation
+ *  @param block_buffer Scratch buffer of block_size bytes
+ *  @return 0 on success, -1 if the operation is malformed or the I/O failed
+ */
+int delta_apply(FILE *basis, FILE *out, uint32_t block_size, const uint8_t *op, size_t len, uint8_t *block_buffer) {
+    if (len < 1) {
+        return -1;
+    }
+
+    if (op[0] == delta_op_literal) {
+        return (fwrite(op+1, 1, len-1, out) == len-1) ? 0 : -1;
+    }
+
+    if (op[0] != delta_op_copy || len != delta_copy_size || basis == NULL) {
+        return -1;
+    }
+
+    uint32_t first, count;
+    memcpy(&first, op+1, 4);
+    memcpy(&count, op+5, 4);
+
+    /// Copy the blocks over from the old file one at a time
+    if (fseek(basis, (long)first * block_size, SEEK_SET) != 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (fread(block_buffer, 1, block_size, basis) != block_size) {
+            return -1;
+        }
+        if (fwrite(block_buffer, 1, block_size, out) != block_size) {
+            return -1;
+        }
+    }
+    return 0;
+}
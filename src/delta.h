@@ -0,0 +1,79 @@
+/** @file delta.h
+ *
+ *  @brief Block signatures and delta encoding for the sync mode (rsync style).
+ *
+ *  The receiver cuts its existing copy of the destination file into fixed size blocks
+ *  and describes every block with a weak rolling checksum and a strong 64 bit hash.
+ *  The sender slides a window over its own file, looks the rolling checksum up in those
+ *  signatures and only transmits the bytes that did not match anything.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rudp.h"
+
+#define delta_min_block 1024 /// Smallest block size picked by the receiver
+#define delta_max_block 65536 /// Largest block size picked by the receiver
+
+#define sig_entry_size 12 /// 4 byte weak checksum + 8 byte strong hash
+#define sig_chunk_header 8 /// block size + total number of blocks
+#define sig_per_chunk ((max_data_size - sig_chunk_header) / sig_entry_size) /// Signatures per pkt_sig reply
+
+#define delta_op_copy 1 /// Copy a run of blocks from the receiver's old file: first block (4 bytes), count (4 bytes)
+#define delta_op_literal 2 /// The rest of the payload are literal bytes
+#define delta_copy_size 9 /// op + first block + count
+
+/// Signature of one block of the receiver's file
+struct delta_sig {
+    uint32_t weak;
+    uint64_t strong;
+};
+
+/// Hash table from weak checksum to block number, built by the sender
+struct delta_index {
+    uint32_t *slots; /// block number + 1, 0 marks an empty slot
+    uint32_t mask;
+};
+
+/// State of the sender while it walks its file and produces delta operations
+struct delta_gen {
+    const uint8_t *src; /// The sender's file
+    size_t len;
+    const struct delta_sig *sigs; /// The receiver's block signatures
+    const struct delta_index *index;
+    uint32_t nblocks;
+    uint32_t block_size;
+    size_t pos; /// Start of the rolling window
+    size_t lit_start; /// Start of the bytes not yet sent
+    uint32_t next_block; /// Block that would continue the last copy, tried first
+    uint32_t a, b; /// Rolling checksum halves of the current window
+    int rolling; /// Whether a and b describe the window at pos
+    unsigned long long literal_bytes; /// Bytes sent as literals so far
+    unsigned long long matched_bytes; /// Bytes replaced by block copies so far
+};
+
+uint32_t delta_block_size(unsigned long long file_size);
+uint32_t delta_weak(const uint8_t *buf, size_t len);
+uint64_t delta_strong(const uint8_t *buf, size_t len);
+
+struct delta_sig *delta_signatures(FILE *file, uint32_t block_size, uint32_t *nblocks);
+size_t delta_sig_chunk(const struct delta_sig *sigs, uint32_t nblocks, uint32_t block_size, uint32_t chunk, uint8_t *out);
+int delta_sig_parse(const uint8_t *in, size_t len, uint32_t chunk, struct delta_sig **sigs, uint32_t *nblocks, uint32_t *block_size);
+
+int delta_index_build(struct delta_index *index, const struct delta_sig *sigs, uint32_t nblocks);
+void delta_index_free(struct delta_index *index);
+
+void delta_gen_init(struct delta_gen *gen, const uint8_t *src, size_t len, const struct delta_sig *sigs, const struct delta_index *index, uint32_t nblocks, uint32_t block_size);
+size_t delta_next(struct delta_gen *gen, uint8_t *out, size_t cap);
+
+int delta_apply(FILE *basis, FILE *out, uint32_t block_size, const uint8_t *op, size_t len, uint8_t *block_buffer);
+
+#endif
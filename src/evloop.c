@@ -0,0 +1,341 @@
+/** @file evloop.c
+ *
+ *  @brief epoll/timerfd event loop shared by the sender and the receiver.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "evloop.h"
+
+
+#define ev_batch 64 /// Events handled per epoll_wait() call
+#define ev_initial_slots 64 /// Handler slots of a new loop, doubled whenever they run out
+
+
+/** @brief Where a descriptor's slot is, or would go, in the index
+ *
+ *  @param loop The loop
+ *  @param fd The descriptor
+ *  @return Position in loop->index: the descriptor's, or the empty one its probe ends at
+ */
+static int index_find(const struct evloop *loop, int fd) {
+    unsigned mask = loop->index_size - 1;
+    for (unsigned at = ((unsigned)fd * 2654435761u) & mask; ; at = (at + 1) & mask) {
+        int slot = loop->index[at];
+        if (slot == -1 || loop->handlers[slot].fd == fd) {
+            return at;
+        }
+    }
+}
+
+/** @brief Empties a position of the index, moving later entries of the probe back so none gets lost
+ *
+ *  @param loop The loop
+ *  @param at The position
+ *  @return void
+ */
+static void index_remove(struct evloop *loop, unsigned at) {
+    unsigned mask = loop->index_size - 1;
+    loop->index[at] = -1;
+    for (unsigned next = (at + 1) & mask; loop->index[next] != -1; next = (next + 1) & mask) {
+        int slot = loop->index[next];
+        unsigned home = ((unsigned)loop->handlers[slot].fd * 2654435761u) & mask;
+        /// An entry may fill the hole if the hole lies on its probe, between its home and where it is
+        if (((next - home) & mask) >= ((next - at) & mask)) {
+            loop->index[at] = slot;
+            loop->index[next] = -1;
+            at = next;
+        }
+    }
+}
+
+/** @brief Doubles the handler slots and rebuilds the index for them
+ *
+ *  @param loop The loop
+ *  @return 0 on success, -1 if out of memory
+ */
+static int grow(struct evloop *loop) {
+    int capacity = loop->capacity > 0 ? loop->capacity * 2 : ev_initial_slots;
+    struct ev_handler *handlers = realloc(loop->handlers, capacity * sizeof(*handlers));
+    if (handlers == NULL) {
+        return -1;
+    }
+    loop->handlers = handlers;
+    int *index = malloc(2 * capacity * sizeof(*index));
+    if (index == NULL) {
+        return -1;
+    }
+    free(loop->index);
+    loop->index = index;
+    loop->index_size = 2 * capacity;
+    memset(index, -1, loop->index_size * sizeof(*index));
+
+    for (int slot = loop->capacity; slot < capacity; slot++) {
+        handlers[slot].fd = -1;
+        handlers[slot].generation = 0;
+        handlers[slot].next_free = slot + 1 < capacity ? slot + 1 : loop->free_slot;
+    }
+    loop->free_slot = loop->capacity;
+    loop->capacity = capacity;
+    for (int slot = 0; slot < capacity; slot++) {
+        if (handlers[slot].fd != -1) {
+            index[index_find(loop, handlers[slot].fd)] = slot;
+        }
+    }
+    return 0;
+}
+
+/** @brief Creates the epoll instance
+ *
+ *  @param loop The loop to set up
+ *  @return 0 on success, -1 on error
+ */
+int evloop_init(struct evloop *loop) {
+    memset(loop, 0, sizeof(*loop));
+    loop->free_slot = -1;
+    if (grow(loop) < 0) {
+        free(loop->handlers);
+        return -1;
+    }
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        free(loop->handlers);
+        free(loop->index);
+        return -1;
+    }
+    return 0;
+}
+
+/** @brief Watches a descriptor
+ *
+ *  @param loop The loop
+ *  @param fd The descriptor
+ *  @param events epoll events to wait for (EPOLLIN, EPOLLOUT, ...)
+ *  @param callback Called when one of the events fires
+ *  @param arg Passed to the callback
+ *  @return 0 on success, -1 on error
+ */
+int evloop_add(struct evloop *loop, int fd, uint32_t events, ev_callback callback, void *arg) {
+    if (loop->free_slot == -1 && grow(loop) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    int slot = loop->free_slot;
+    struct ev_handler *handler = &loop->handlers[slot];
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.u64 = (uint64_t)++loop->generation << 32 | (uint32_t)slot;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        return -1;
+    }
+
+    loop->free_slot = handler->next_free;
+    handler->fd = fd;
+    handler->generation = loop->generation;
+    handler->callback = callback;
+    handler->arg = arg;
+    loop->index[index_find(loop, fd)] = slot;
+    return 0;
+}
+
+/** @brief Stops watching a descriptor (it is not closed)
+ *
+ *  @param loop The loop
+ *  @param fd The descriptor
+ *  @return void
+ */
+void evloop_del(struct evloop *loop, int fd) {
+    if (loop->index == NULL) {
+        return;
+    }
+    int at = index_find(loop, fd);
+    int slot = loop->index[at];
+    if (slot == -1) {
+        return;
+    }
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    index_remove(loop, at);
+    loop->handlers[slot].fd = -1;
+    loop->handlers[slot].next_free = loop->free_slot;
+    loop->free_slot = slot;
+}
+
+/** @brief Calls the callbacks of a batch of events
+ *
+ *  A callback may remove any descriptor and add new ones, which can take the slot of one with an event
+ *  further on in the batch; the generation in the event tells that it was not for the new one.
+ *
+ *  @param loop The loop
+ *  @param events What epoll_wait() returned
+ *  @param ready How many
+ *  @param until_stopped Leave the rest of the batch once evloop_stop() was called
+ *  @return void
+ */
+static void dispatch(struct evloop *loop, const struct epoll_event *events, int ready, int until_stopped) {
+    for (int i = 0; i < ready && (!until_stopped || loop->running); i++) {
+        int slot = (int)(uint32_t)events[i].data.u64;
+        uint32_t generation = (uint32_t)(events[i].data.u64 >> 32);
+        struct ev_handler *handler = &loop->handlers[slot];
+        if (handler->fd != -1 && handler->generation == generation) {
+            handler->callback(loop, handler->fd, events[i].events, handler->arg);
+        }
+    }
+}
+
+/** @brief Dispatches events until evloop_stop() is called
+ *
+ *  @param loop The loop
+ *  @return 0 when stopped, -1 if epoll_wait() failed
+ */
+int evloop_run(struct evloop *loop) {
+    struct epoll_event events[ev_batch];
+    loop->running = 1;
+
+    while (loop->running) {
+        int ready = epoll_wait(loop->epoll_fd, events, ev_batch, -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        dispatch(loop, events, ready, 1);
+    }
+    return 0;
+}
+
+/** @brief Waits once for events and dispatches them, for callers that run their own loop around ours
+ *
+ *  The epoll descriptor (loop->epoll_fd) becomes readable whenever this has something to do, so it
+ *  can be watched by another event loop and polled with a timeout of 0.
+ *
+ *  @param loop The loop
+ *  @param timeout_ms How long to wait, -1 for as long as it takes
+ *  @return Number of events dispatched, -1 if epoll_wait() failed
+ */
+int evloop_poll(struct evloop *loop, int timeout_ms) {
+    struct epoll_event events[ev_batch];
+    int ready = epoll_wait(loop->epoll_fd, events, ev_batch, timeout_ms);
+    if (ready < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        return -1;
+    }
+    dispatch(loop, events, ready, 0);
+    return ready;
+}
+
+/** @brief Makes evloop_run() return after the current callback
+ *
+ *  @param loop The loop
+ *  @return void
+ */
+void evloop_stop(struct evloop *loop) {
+    loop->running = 0;
+}
+
+/** @brief Closes the epoll instance and frees the handler table
+ *
+ *  @param loop The loop
+ *  @return void
+ */
+void evloop_close(struct evloop *loop) {
+    close(loop->epoll_fd);
+    loop->epoll_fd = -1;
+    free(loop->handlers);
+    free(loop->index);
+    loop->handlers = NULL;
+    loop->index = NULL;
+    loop->capacity = loop->index_size = 0;
+}
+
+/** @brief Creates a disarmed timer and registers it with the loop
+ *
+ *  The callback must call ev_timer_ack() first, so the timerfd stops being readable, and return if it got 0.
+ *
+ *  @param loop The loop
+ *  @param timer The timer
+ *  @param callback Called when the timer expires
+ *  @param arg Passed to the callback
+ *  @return 0 on success, -1 on error
+ */
+int ev_timer_init(struct evloop *loop, struct ev_timer *timer, ev_callback callback, void *arg) {
+    timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer->fd < 0) {
+        return -1;
+    }
+    return evloop_add(loop, timer->fd, EPOLLIN, callback, arg);
+}
+
+/** @brief Arms a timer, replacing whatever it was set to
+ *
+ *  @param timer The timer
+ *  @param delay_us Microseconds until the first expiry (0 is bumped to 1, timerfd treats 0 as disarm)
+ *  @param interval_us Microseconds between later expiries, 0 for a one shot timer
+ *  @return void
+ */
+void ev_timer_arm(struct ev_timer *timer, uint64_t delay_us, uint64_t interval_us) {
+    if (delay_us == 0) {
+        delay_us = 1;
+    }
+
+    struct itimerspec spec;
+    spec.it_value.tv_sec = delay_us / 1000000;
+    spec.it_value.tv_nsec = (delay_us % 1000000) * 1000;
+    spec.it_interval.tv_sec = interval_us / 1000000;
+    spec.it_interval.tv_nsec = (interval_us % 1000000) * 1000;
+    timerfd_settime(timer->fd, 0, &spec, NULL);
+}
+
+/** @brief Disarms a timer
+ *
+ *  @param timer The timer
+ *  @return void
+ */
+void ev_timer_disarm(struct ev_timer *timer) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    timerfd_settime(timer->fd, 0, &spec, NULL);
+}
+
+/** @brief Consumes the expiry count so the timerfd is no longer readable
+ *
+ *  A timer re-armed or disarmed after epoll_wait() returned it, by an earlier callback of the same batch,
+ *  has not expired any more: its callback gets 0 here and has to return without doing anything.
+ *
+ *  @param timer The timer
+ *  @return How often it expired since the last ack, 0 if it has not (EAGAIN)
+ */
+uint64_t ev_timer_ack(struct ev_timer *timer) {
+    uint64_t expirations;
+    if (read(timer->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return 0;
+    }
+    return expirations;
+}
+
+/** @brief Unregisters and closes a timer
+ *
+ *  @param loop The loop
+ *  @param timer The timer
+ *  @return void
+ */
+void ev_timer_close(struct evloop *loop, struct ev_timer *timer) {
+    evloop_del(loop, timer->fd);
+    close(timer->fd);
+    timer->fd = -1;
+}
@@ -0,0 +1,64 @@
+/** @file evloop.h
+ *
+ *  @brief Small epoll event loop with timerfd timers.
+ *
+ *  Sockets and timers register a callback; evloop_run() waits in epoll_wait() and calls the
+ *  callbacks of whatever became ready. Every session keeps its state in its own struct and
+ *  only reacts to callbacks, so one thread can drive as many sessions as it has descriptors:
+ *  the table of handlers grows as descriptors are added.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <stdint.h>
+
+struct evloop;
+
+/// Called with the epoll events (EPOLLIN, ...) that fired on fd
+typedef void (*ev_callback)(struct evloop *loop, int fd, uint32_t events, void *arg);
+
+/// A registered descriptor
+struct ev_handler {
+    int fd; /// -1 marks a free slot
+    uint32_t generation; /// Tells its events from those of an earlier descriptor in the same slot
+    int next_free; /// The next free slot after this one while it is free
+    ev_callback callback;
+    void *arg;
+};
+
+/// The loop
+struct evloop {
+    int epoll_fd;
+    int running;
+    struct ev_handler *handlers; /// Slots, the epoll events carry the slot and its generation
+    int capacity;
+    int free_slot; /// Head of the free slots, -1 when all of them are taken
+    int *index; /// Descriptor to slot, open addressing over index_size entries (twice the slots), -1 when empty
+    int index_size;
+    uint32_t generation; /// Of the last descriptor added
+};
+
+/// A one shot or periodic timer backed by a timerfd
+struct ev_timer {
+    int fd;
+};
+
+int evloop_init(struct evloop *loop);
+int evloop_add(struct evloop *loop, int fd, uint32_t events, ev_callback callback, void *arg);
+void evloop_del(struct evloop *loop, int fd);
+int evloop_run(struct evloop *loop);
+int evloop_poll(struct evloop *loop, int timeout_ms);
+void evloop_stop(struct evloop *loop);
+void evloop_close(struct evloop *loop);
+
+int ev_timer_init(struct evloop *loop, struct ev_timer *timer, ev_callback callback, void *arg);
+void ev_timer_arm(struct ev_timer *timer, uint64_t delay_us, uint64_t interval_us);
+void ev_timer_disarm(struct ev_timer *timer);
+uint64_t ev_timer_ack(struct ev_timer *timer);
+void ev_timer_close(struct evloop *loop, struct ev_timer *timer);
+
+#endif
@@ -0,0 +1,134 @@
+/** @file fanout.cpp
+ *
+ *  @brief Sends several files at once from one thread, an example of librudp through rudp.hpp.
+ *
+ *  ./rudp_fanout [-R rate_mbps] host port[:weight[:priority]] file [...] starts a session per port and
+ *  file on one event loop and runs it until every transfer is over. The sessions share one
+ *  scheduler: -R caps what they send together, a transfer of a lower priority number goes first
+ *  and among the same priority the rate is split by weight (1 and 0 when not given), so an urgent
+ *  transfer keeps its pace however many bulk ones run beside it.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rudp.hpp"
+
+/// Reads port[:weight[:priority]] into the config, false if it is not that
+static bool parse_transfer(const char *text, rudp_sender_config &config) {
+    char *end;
+    long port = strtol(text, &end, 10);
+    if (end == text || port <= 0 || port > 65535) {
+        return false;
+    }
+    config.port = (unsigned short)port;
+    if (*end == ':') {
+        const char *weight = end + 1;
+        long value = strtol(weight, &end, 10);
+        if (end == weight || value < 1) {
+            return false;
+        }
+        config.weight = (unsigned)value;
+    }
+    if (*end == ':') {
+        const char *priority = end + 1;
+        config.priority = (int)strtol(priority, &end, 10);
+        if (end == priority) {
+            return false;
+        }
+    }
+    return *end == 0;
+}
+
+int main(int argc, char **argv) {
+    double rate_mbps = 0;
+    bool usage = false;
+    int option;
+    while ((option = getopt(argc, argv, "R:")) != -1) {
+        switch (option) {
+            case 'R': rate_mbps = atof(optarg); break;
+            default: usage = true; break;
+        }
+    }
+    if (usage || argc - optind < 3 || (argc - optind - 1) % 2 != 0) {
+        fprintf(stderr, "usage: %s [-R rate_mbps] receiver_hostname port[:weight[:priority]] file [port[:weight[:priority]] file ...]\n\n", argv[0]);
+        return 1;
+    }
+    const char *hostname = argv[optind];
+
+    rudp::Loop loop;
+    if (loop.error() != rudp_ok) {
+        perror("epoll_create1");
+        return 1;
+    }
+    rudp::Scheduler scheduler;
+    int error = scheduler.start(loop, rate_mbps);
+    if (error != rudp_ok) {
+        fprintf(stderr, "-R %g: %s\n", rate_mbps, rudp::strerror(error));
+        return 1;
+    }
+
+    size_t count = (argc - optind - 1) / 2;
+    std::vector<rudp::Sender> senders(count);
+    size_t running = 0;
+    int failures = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const char *transfer = argv[optind + 1 + 2 * i];
+        const char *filename = argv[optind + 2 + 2 * i];
+        rudp_sender_config config = rudp::Sender::config();
+        if (!parse_transfer(transfer, config)) {
+            fprintf(stderr, "%s: not port[:weight[:priority]]\n", transfer);
+            failures++;
+            continue;
+        }
+        struct stat info;
+        if (stat(filename, &info) < 0) {
+            fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+            failures++;
+            continue;
+        }
+
+        config.hostname = hostname;
+        config.filename = filename;
+        config.bytes = info.st_size;
+        config.scheduler = scheduler.get();
+
+        senders[i].on_log([filename](const char *message) { printf("%s: %s\n", filename, message); });
+        senders[i].on_done([&, i, filename](int error) {
+            const rudp_stats &stats = senders[i].stats();
+            if (error == rudp_ok) {
+                printf("%s: %llu bytes in %.3f s, %llu retransmits\n", filename, stats.bytes, stats_now() - stats.start_time, stats.retransmits);
+            } else {
+                printf("%s: %s\n", filename, rudp::strerror(error));
+                failures++;
+            }
+            if (--running == 0) {
+                loop.stop();
+            }
+        });
+
+        error = senders[i].start(loop, config);
+        if (error != rudp_ok) {
+            fprintf(stderr, "%s: %s\n", filename, rudp::strerror(error));
+            failures++;
+            continue;
+        }
+        running++;
+    }
+
+    if (running > 0) {
+        loop.run();
+    }
+    /// Sessions close here, before the scheduler and the loop they run on
+    senders.clear();
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+/** @file librudp.c
+ *
+ *  @brief What the library shares between its sending and receiving sides.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include "librudp.h"
+
+
+/** @brief Describes an error code
+ *
+ *  @param error rudp_ok or one of the rudp_err_ codes
+ *  @return A short message, never NULL
+ */
+const char *rudp_strerror(int error) {
+    switch (error) {
+        case rudp_ok: return "success";
+        case rudp_err_system: return "system call failed";
+        case rudp_err_memory: return "out of memory";
+        case rudp_err_resolve: return "hostname did not resolve";
+        case rudp_err_file: return "could not open, read or write the file";
+        case rudp_err_short_file: return "the file is shorter than the bytes to transfer";
+        case rudp_err_timeout: return "the other side went silent";
+        case rudp_err_protocol: return "malformed reply from the other side";
+        case rudp_err_aborted: return "transfer aborted";
+        case rudp_err_invalid: return "invalid configuration";
+        case rudp_err_overflow: return "the transfer does not fit the buffer";
+        case rudp_err_remote_file: return "the receiver could not write the file";
+        default: return "unknown error";
+    }
+}
@@ -0,0 +1,159 @@
+/** @file librudp.h
+ *
+ *  @brief librudp: the sender and the receiver as sessions on a caller's event loop.
+ *
+ *  A session is opened on a struct evloop the caller owns and from then on runs from the loop's
+ *  callbacks: rudp_sender_open() and rudp_receiver_open() set up the socket and return right away,
+ *  and the done callback reports how the transfer ended. Any number of sessions can share one
+ *  loop, so one thread drives many transfers. Run the loop with evloop_run() (stopping it from a
+ *  done callback) or embed it with evloop_poll(), whose epoll descriptor can sit in another loop.
+ *
+ *  Either end can stay in memory: the sender takes iovecs in place of a file and sends the packets
+ *  straight out of them, and the receiver fills a caller's buffer (the socket reads payloads right
+ *  into it) or only hands each payload to the data callback. Bytes of the buffer past stats.bytes
+ *  are scratch until the transfer is done.
+ *
+ *  A file is sent sparse: its holes and runs of zeros go as zero ranges, and a destination file gets
+ *  them back as holes.
+ *
+ *  A sender can go out on several local addresses or interfaces at once (multipath), a packet in
+ *  flight on each; the receiver holds packets that arrive ahead of a gap and writes them in order.
+ *
+ *  Given a cipher and the same pre-shared key on both ends, every datagram both ways is encrypted
+ *  and authenticated (AES-256-GCM or ChaCha20-Poly1305); forged, foreign and replayed datagrams
+ *  are dropped and counted in stats.rejected. rudp_key_load() reads a key from a file.
+ *
+ *  Senders on one loop can share a scheduler (rudp_scheduler_open()) instead of each pacing alone:
+ *  it lets their packets out under a global rate cap, the lowest priority number first and by weight
+ *  among transfers of the same priority, so an urgent transfer is not slowed down by bulk ones.
+ *
+ *  Nothing in the library exits or prints: every call returns rudp_ok or one of the negative
+ *  rudp_err_ codes (rudp_strerror() names them), and messages go to the log callback. The progress
+ *  line is the program's to print (stats_format() makes it from rudp_*_stats()).
+ *  Callbacks run on the loop's thread; rudp_*_close() may be called from the done callback.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef LIBRUDP_H
+#define LIBRUDP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "evloop.h"
+#include "stats.h"
+#include "socktune.h"
+
+/*   Error Codes   */
+#define rudp_ok 0
+#define rudp_err_system -1 /// A system call failed, errno is left as it was
+#define rudp_err_memory -2 /// Out of memory
+#define rudp_err_resolve -3 /// The receiver's hostname did not resolve
+#define rudp_err_file -4 /// The file could not be opened, read or written
+#define rudp_err_short_file -5 /// The file holds fewer bytes than asked to send
+#define rudp_err_timeout -6 /// The other side went silent
+#define rudp_err_protocol -7 /// The other side sent something malformed
+#define rudp_err_aborted -8 /// The session was closed before it finished
+#define rudp_err_invalid -9 /// The config asks for something the session can not do
+#define rudp_err_overflow -10 /// The transfer does not fit the receiver's buffer
+#define rudp_err_remote_file -11 /// The receiver could not write the file it was sent
+
+#define rudp_max_paths 8 /// Local addresses or interfaces a multipath transfer can go out on
+
+/*   Ciphers   */
+#define rudp_cipher_none 0 /// Datagrams in the clear
+#define rudp_cipher_aes_gcm 1 /// AES-256-GCM, the fastest where the CPU has AES instructions
+#define rudp_cipher_chacha20 2 /// ChaCha20-Poly1305, the fastest without them
+#define rudp_key_size 32 /// Bytes of a pre-shared key
+
+/// What a session reports back, all optional; arg is passed to each of them
+struct rudp_callbacks {
+    /// After every acknowledged packet (sender) or written packet (receiver)
+    void (*progress)(void *arg, const struct rudp_stats *stats);
+    /// Receiver: every payload of a plain transfer, in order, as it is written at offset (a hole as pieces of zeros); the memory is only lent
+    void (*data)(void *arg, const uint8_t *data, size_t length, unsigned long long offset);
+    /// Once, when the transfer is over: rudp_ok, or why it failed
+    void (*done)(void *arg, int error);
+    /// A line of information for a person ("Pacing with SO_TXTIME"), without the newline
+    void (*log)(void *arg, const char *message);
+    void *arg;
+};
+
+/// How to send; fill in with rudp_sender_config_init() and then set what differs
+struct rudp_sender_config {
+    const char *hostname; /// IPv4 or IPv6 address or name of the receiver
+    unsigned short port;
+    int family; /// AF_UNSPEC races all the receiver's addresses, AF_INET or AF_INET6 keeps to one family
+    const char *const *paths; /// Multipath: local addresses or interface names to spread the packets over, one path each
+    int path_count; /// 0 for a single path wherever the routing table says (at most rudp_max_paths, not with sync)
+    const char *filename; /// The file to send, unless iov is set
+    const struct iovec *iov; /// Send this memory instead, in order and without copying it (a sync takes one iovec)
+    int iovcnt;
+    unsigned long long bytes; /// How much of it
+    int sync; /// Send only the blocks that differ from the receiver's copy
+    int use_uring; /// Socket and file I/O through io_uring where available
+    int pacing_mode; /// pacer_auto, pacer_txtime or pacer_user (pacer.h)
+    int cipher; /// rudp_cipher_none, or seal every datagram with key
+    uint8_t key[rudp_key_size]; /// Pre-shared key, the receiver's has to be the same
+    struct socket_tuning tuning;
+    struct rudp_scheduler *scheduler; /// Send through this shared pacer, NULL to pace alone; it has to outlive the session
+    int priority; /// With a scheduler: transfers of a lower number go first, strictly (0 by default)
+    unsigned weight; /// With a scheduler: share of the rate among transfers of the same priority (1 by default)
+    const char *metrics_path; /// Metrics file (JSON if it ends in .json, Prometheus text otherwise) or unix:/path to serve them on, NULL for none; one per session
+    int metrics_interval_ms; /// How often the metrics file is rewritten, 0 for every second
+    const char *metrics_label; /// Names the transfer in its metrics, NULL for the receiver's host:port
+};
+
+/// How to receive; fill in with rudp_receiver_config_init() and then set what differs
+struct rudp_receiver_config {
+    unsigned short port; /// UDP port to listen on
+    const char *destination; /// The file to write, NULL to receive into memory
+    uint8_t *buffer; /// Without a destination: payloads land here at their offset (NULL leaves them to the data callback)
+    size_t buffer_size; /// A larger transfer fails with rudp_err_overflow
+    double idle_timeout; /// Seconds without a packet, once the transfer started, before giving up (0 waits forever)
+    int use_uring; /// Socket and disk I/O through io_uring where available
+    const char *xdp_interface; /// Take datagrams off this interface with AF_XDP, NULL for the socket only
+    uint32_t xdp_queue;
+    int cipher; /// rudp_cipher_none, or accept only datagrams sealed with key (and seal the replies)
+    uint8_t key[rudp_key_size]; /// Pre-shared key, the sender's has to be the same
+    struct socket_tuning tuning;
+    const char *metrics_path; /// Metrics file (JSON if it ends in .json, Prometheus text otherwise) or unix:/path to serve them on, NULL for none; one per session
+    int metrics_interval_ms; /// How often the metrics file is rewritten, 0 for every second
+    const char *metrics_label; /// Names the transfer in its metrics, NULL for the port
+};
+
+struct rudp_sender;
+struct rudp_receiver;
+struct rudp_scheduler;
+
+const char *rudp_strerror(int error);
+int rudp_key_derive(const char *secret, uint8_t key[rudp_key_size]);
+int rudp_key_load(const char *path, uint8_t key[rudp_key_size]);
+
+void rudp_sender_config_init(struct rudp_sender_config *config);
+int rudp_sender_open(struct rudp_sender **sender, struct evloop *loop, const struct rudp_sender_config *config,
+                     const struct rudp_callbacks *callbacks);
+const struct rudp_stats *rudp_sender_stats(const struct rudp_sender *sender);
+void rudp_sender_close(struct rudp_sender *sender);
+
+int rudp_scheduler_open(struct rudp_scheduler **scheduler, struct evloop *loop, double rate_mbps);
+void rudp_scheduler_close(struct rudp_scheduler *scheduler);
+
+void rudp_receiver_config_init(struct rudp_receiver_config *config);
+int rudp_receiver_open(struct rudp_receiver **receiver, struct evloop *loop, const struct rudp_receiver_config *config,
+                       const struct rudp_callbacks *callbacks);
+const struct rudp_stats *rudp_receiver_stats(const struct rudp_receiver *receiver);
+void rudp_receiver_close(struct rudp_receiver *receiver);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
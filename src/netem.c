@@ -0,0 +1,324 @@
+/** @file netem.c
+ *
+ *  @brief UDP relay that drops, delays, reorders and rate limits packets between the sender and the receiver.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#define _GNU_SOURCE /// for ppoll()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "rudp.h"
+#include "netem.h"
+
+
+/** @brief Microseconds on the monotonic clock
+ *
+ *  @return The current time
+ */
+uint64_t netem_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/// Uniform random number in [0, 1) from the shim's own seed, so runs can be repeated
+static double random01(struct netem *em) {
+    return rand_r(&em->seed) / ((double)RAND_MAX + 1);
+}
+
+/** @brief Records the first transmission of a data packet and counts retransmissions
+ *
+ *  @param em The relay
+ *  @param data The packet from the sender
+ *  @param length Length of the packet
+ *  @return void
+ */
+static void observe_data(struct netem *em, const uint8_t *data, size_t length) {
+    /// The header of a sealed packet is in the clear too, only its type carries the flag
+    uint8_t type = length >= header_size ? data[type_offset] & ~pkt_sealed : pkt_fin;
+    if (length < header_size || data[ack_offset] != 0 || (type != pkt_data && type != pkt_delta)) {
+        return;
+    }
+
+    uint32_t index;
+    memcpy(&index, data+index_offset, 4);
+    em->stats.data_packets++;
+    em->stats.data_bytes += length - header_size - (data[type_offset] & pkt_sealed ? seal_overhead : 0);
+
+    /// Grow the per index table as the transfer moves on
+    if (index >= em->first_sent_cap) {
+        size_t cap = em->first_sent_cap ? em->first_sent_cap : 1024;
+        while (cap <= index) {
+            cap *= 2;
+        }
+        uint64_t *grown = realloc(em->first_sent_us, cap * sizeof(uint64_t));
+        if (grown == NULL) {
+            return;
+        }
+        memset(grown + em->first_sent_cap, 0, (cap - em->first_sent_cap) * sizeof(uint64_t));
+        em->first_sent_us = grown;
+        em->first_sent_cap = cap;
+    }
+
+    if (em->first_sent_us[index] == 0) {
+        em->first_sent_us[index] = netem_now_us();
+        em->stats.unique_packets++;
+    }
+}
+
+/** @brief Measures the time from the first transmission of a packet until its ack reaches the sender
+ *
+ *  @param em The relay
+ *  @param data The ack being delivered to the sender
+ *  @param length Length of the ack
+ *  @return void
+ */
+static void observe_ack(struct netem *em, const uint8_t *data, size_t length) {
+    uint8_t type = length >= header_size ? data[type_offset] & ~pkt_sealed : pkt_fin;
+    if (length < header_size || data[ack_offset] != 1 || (type != pkt_data && type != pkt_delta)) {
+        return;
+    }
+
+    uint32_t index;
+    memcpy(&index, data+index_offset, 4);
+    em->stats.acks++;
+
+    /// Only the first ack of an index counts, UINT64_MAX marks it as measured
+    if (index >= em->first_sent_cap || em->first_sent_us[index] == 0 || em->first_sent_us[index] == UINT64_MAX) {
+        return;
+    }
+
+    if (em->stats.latency_count == em->latency_cap) {
+        size_t cap = em->latency_cap ? em->latency_cap * 2 : 1024;
+        double *grown = realloc(em->stats.latency_us, cap * sizeof(double));
+        if (grown == NULL) {
+            return;
+        }
+        em->stats.latency_us = grown;
+        em->latency_cap = cap;
+    }
+    em->stats.latency_us[em->stats.latency_count++] = netem_now_us() - em->first_sent_us[index];
+    em->first_sent_us[index] = UINT64_MAX;
+}
+
+/** @brief Applies the impairments of one direction and queues the packet for delivery
+ *
+ *  @param em The relay
+ *  @param to_receiver 1 for sender -> receiver, 0 for the way back
+ *  @param data The packet
+ *  @param length Length of the packet
+ *  @return void
+ */
+static void schedule(struct netem *em, int to_receiver, const uint8_t *data, size_t length) {
+    const struct netem_link *link = to_receiver ? &em->forward : &em->reverse;
+    uint64_t now = netem_now_us();
+
+    if (random01(em) < link->loss) {
+        em->stats.dropped++;
+        return;
+    }
+
+    /// The rate limit serializes packets one after another, tail dropping once the queue is too long
+    uint64_t depart = now;
+    if (link->rate_mbps > 0) {
+        uint64_t *free_at = &em->link_free_us[to_receiver];
+        if (*free_at < now) {
+            *free_at = now;
+        }
+        if (link->queue_ms > 0 && *free_at - now > link->queue_ms * 1000) {
+            em->stats.dropped++;
+            return;
+        }
+        *free_at += (uint64_t)(length * 8 / link->rate_mbps);
+        depart = *free_at;
+    }
+
+    uint64_t due = depart + (uint64_t)(link->delay_ms * 1000) + (uint64_t)(link->jitter_ms * 1000 * random01(em));
+    if (random01(em) < link->reorder) {
+        due += (uint64_t)(link->delay_ms * 1000) + 1000;
+    }
+
+    if (em->pending_count == netem_max_pending) {
+        em->stats.dropped++;
+        return;
+    }
+
+    struct netem_packet *packet = malloc(sizeof(struct netem_packet));
+    if (packet == NULL) {
+        em->stats.dropped++;
+        return;
+    }
+    packet->due_us = due;
+    packet->to_receiver = to_receiver;
+    packet->length = length;
+    memcpy(packet->data, data, length);
+    em->pending[em->pending_count++] = packet;
+}
+
+/** @brief Sends every queued packet whose time has come, earliest first
+ *
+ *  @param em The relay
+ *  @return Microseconds until the next packet is due, or -1 if nothing is queued
+ */
+static long long deliver_due(struct netem *em) {
+    while (em->pending_count > 0) {
+        /// Only a handful of packets are in flight, a linear scan for the earliest one is enough
+        size_t earliest = 0;
+        for (size_t i = 1; i < em->pending_count; i++) {
+            if (em->pending[i]->due_us < em->pending[earliest]->due_us) {
+                earliest = i;
+            }
+        }
+
+        struct netem_packet *packet = em->pending[earliest];
+        uint64_t now = netem_now_us();
+        if (packet->due_us > now) {
+            return packet->due_us - now;
+        }
+
+        /// Keep the arrival order of the remaining packets
+        memmove(&em->pending[earliest], &em->pending[earliest+1], (em->pending_count - earliest - 1) * sizeof(struct netem_packet*));
+        em->pending_count--;
+
+        if (packet->to_receiver) {
+            sendto(em->back_fd, packet->data, packet->length, 0, (struct sockaddr*)&em->receiver_addr, sizeof(em->receiver_addr));
+        } else if (em->have_sender) {
+            observe_ack(em, packet->data, packet->length);
+            sendto(em->front_fd, packet->data, packet->length, 0, (struct sockaddr*)&em->sender_addr, sizeof(em->sender_addr));
+        }
+        free(packet);
+    }
+    return -1;
+}
+
+/** @brief Relay loop, runs until netem_stop()
+ *
+ *  @param arg The relay
+ *  @return NULL
+ */
+static void* netem_loop(void* arg) {
+    struct netem *em = arg;
+    uint8_t buffer[netem_max_packet];
+
+    while (!em->stop) {
+        /// Wake up for the next delivery, or every 10ms to notice the stop flag
+        long long wait_us = deliver_due(em);
+        if (wait_us < 0 || wait_us > 10000) {
+            wait_us = 10000;
+        }
+        struct timespec timeout = { 0, wait_us * 1000 };
+
+        struct pollfd fds[2] = {
+            { .fd = em->front_fd, .events = POLLIN },
+            { .fd = em->back_fd, .events = POLLIN },
+        };
+        if (ppoll(fds, 2, &timeout, NULL) <= 0) {
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            unsigned int address_length = sizeof(em->sender_addr);
+            ssize_t length = recvfrom(em->front_fd, buffer, sizeof(buffer), 0, (struct sockaddr*)&em->sender_addr, &address_length);
+            if (length > 0) {
+                em->have_sender = 1;
+                observe_data(em, buffer, length);
+                schedule(em, 1, buffer, length);
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            ssize_t length = recv(em->back_fd, buffer, sizeof(buffer), 0);
+            if (length > 0) {
+                schedule(em, 0, buffer, length);
+            }
+        }
+    }
+    return NULL;
+}
+
+/** @brief Opens the relay sockets and starts relaying on a thread
+ *
+ *  @param em The relay, zeroed by this function
+ *  @param listen_port Loopback port the sender sends to
+ *  @param receiver_port Loopback port the receiver listens on
+ *  @param forward Impairments from the sender to the receiver
+ *  @param reverse Impairments from the receiver back to the sender
+ *  @param seed Seed for the random drops, delays and reorders
+ *  @return 0 on success, -1 on error
+ */
+int netem_start(struct netem *em, unsigned short listen_port, unsigned short receiver_port, const struct netem_link *forward, const struct netem_link *reverse, unsigned int seed) {
+    memset(em, 0, sizeof(*em));
+    em->forward = *forward;
+    em->reverse = *reverse;
+    em->seed = seed;
+
+    em->front_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    em->back_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (em->front_fd < 0 || em->back_fd < 0) {
+        perror("netem socket");
+        return -1;
+    }
+
+    struct sockaddr_in front_addr;
+    memset(&front_addr, 0, sizeof(front_addr));
+    front_addr.sin_family = AF_INET;
+    front_addr.sin_port = htons(listen_port);
+    front_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(em->front_fd, (struct sockaddr*)&front_addr, sizeof(front_addr)) < 0) {
+        perror("netem bind");
+        return -1;
+    }
+
+    em->receiver_addr.sin_family = AF_INET;
+    em->receiver_addr.sin_port = htons(receiver_port);
+    em->receiver_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (pthread_create(&em->thread, NULL, netem_loop, em) != 0) {
+        perror("netem thread");
+        return -1;
+    }
+    return 0;
+}
+
+/** @brief Stops the relay thread and closes its sockets
+ *
+ *  @param em The relay
+ *  @return void
+ */
+void netem_stop(struct netem *em) {
+    em->stop = 1;
+    pthread_join(em->thread, NULL);
+    close(em->front_fd);
+    close(em->back_fd);
+
+    for (size_t i = 0; i < em->pending_count; i++) {
+        free(em->pending[i]);
+    }
+    em->pending_count = 0;
+}
+
+/** @brief Frees the statistics kept by the relay
+ *
+ *  @param em The relay, already stopped
+ *  @return void
+ */
+void netem_free(struct netem *em) {
+    free(em->first_sent_us);
+    free(em->stats.latency_us);
+    em->first_sent_us = NULL;
+    em->stats.latency_us = NULL;
+}
@@ -0,0 +1,84 @@
+/** @file netem.h
+ *
+ *  @brief In-process network impairment shim used by the benchmark.
+ *
+ *  The shim is a UDP relay on loopback: the sender talks to the shim's port, the shim forwards
+ *  to the receiver and relays the acknowledgements back. Each direction can drop, delay,
+ *  reorder and rate limit packets, and the shim watches the headers go by to count
+ *  retransmissions and measure how long every packet took to get acknowledged.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef NETEM_H
+#define NETEM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define netem_max_packet 4096 /// Largest datagram relayed (the receiver's acks are bigger than our data packets)
+#define netem_max_pending 4096 /// Most packets held back at once
+
+/// Impairments applied to one direction of the relay
+struct netem_link {
+    double loss; /// Probability of dropping a packet (0..1)
+    double delay_ms; /// Fixed one way delay
+    double jitter_ms; /// Uniform random extra delay
+    double reorder; /// Probability of holding a packet back by an extra delay_ms + 1ms so later ones overtake it
+    double rate_mbps; /// Link rate, 0 for unlimited
+    double queue_ms; /// Tail drop once this much is queued in front of the rate limit
+};
+
+/// A packet waiting for its delivery time
+struct netem_packet {
+    uint64_t due_us;
+    int to_receiver;
+    size_t length;
+    uint8_t data[netem_max_packet];
+};
+
+/// What the shim saw during the run
+struct netem_stats {
+    unsigned long long data_packets; /// Data and delta packets from the sender (retransmissions included)
+    unsigned long long data_bytes;
+    unsigned long long unique_packets; /// Distinct indices among them
+    unsigned long long dropped; /// Packets dropped by the impairments, both directions
+    unsigned long long acks; /// Positive acks relayed back to the sender
+    double *latency_us; /// First transmission of an index until its ack came back
+    size_t latency_count;
+};
+
+/// The relay and its state
+struct netem {
+    int front_fd; /// The sender sends to this socket
+    int back_fd; /// Talks to the receiver
+    struct sockaddr_in sender_addr;
+    struct sockaddr_in receiver_addr;
+    int have_sender;
+
+    struct netem_link forward; /// sender -> receiver
+    struct netem_link reverse; /// receiver -> sender
+    uint64_t link_free_us[2]; /// When each direction's rate limit is idle again
+    unsigned int seed;
+
+    struct netem_packet *pending[netem_max_pending];
+    size_t pending_count;
+
+    uint64_t *first_sent_us; /// Per index, when the sender first sent it (0 = not seen yet)
+    size_t first_sent_cap;
+    size_t latency_cap;
+    struct netem_stats stats;
+
+    pthread_t thread;
+    volatile int stop;
+};
+
+uint64_t netem_now_us(void);
+int netem_start(struct netem *em, unsigned short listen_port, unsigned short receiver_port, const struct netem_link *forward, const struct netem_link *reverse, unsigned int seed);
+void netem_stop(struct netem *em);
+void netem_free(struct netem *em);
+
+#endif
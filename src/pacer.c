@@ -0,0 +1,266 @@
+/** @file pacer.c
+ *
+ *  @brief Send times, SO_TXTIME and finding out whether the egress qdisc is fq.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/prctl.h>
+#include <linux/net_tstamp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "pacer.h"
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+
+/// Userspace pacers on this thread, which lower its timer slack while any of them is open
+static __thread int slack_users = 0;
+/// The thread's timer slack before the first of them lowered it
+static __thread long slack_before = 0;
+
+/** @brief Finds the interface packets to the destination leave through
+ *
+ *  @param destination The receiver, IPv4, IPv6 or IPv4 mapped into IPv6
+ *  @return The interface index, 0 if it could not be found
+ */
+static int egress_interface(const struct sockaddr *destination) {
+    /// Connecting a UDP socket sends nothing but makes the kernel pick the route and the source address
+    int family = destination->sa_family;
+    socklen_t destination_length = family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    int probe = socket(family, SOCK_DGRAM, 0);
+    struct sockaddr_storage local;
+    socklen_t length = sizeof(local);
+    if (probe < 0) {
+        return 0;
+    }
+    if (connect(probe, destination, destination_length) < 0 ||
+        getsockname(probe, (struct sockaddr *)&local, &length) < 0) {
+        close(probe);
+        return 0;
+    }
+    close(probe);
+
+    /// A mapped address left through an IPv4 address
+    const void *source = family == AF_INET6 ? (const void *)&((struct sockaddr_in6 *)&local)->sin6_addr
+                                            : (const void *)&((struct sockaddr_in *)&local)->sin_addr;
+    size_t source_length = family == AF_INET6 ? 16 : 4;
+    if (family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&((struct sockaddr_in6 *)&local)->sin6_addr)) {
+        family = AF_INET;
+        source = &((struct sockaddr_in6 *)&local)->sin6_addr.s6_addr[12];
+        source_length = 4;
+    }
+
+    struct ifaddrs *addresses;
+    if (getifaddrs(&addresses) < 0) {
+        return 0;
+    }
+    int ifindex = 0;
+    for (struct ifaddrs *entry = addresses; entry != NULL && ifindex == 0; entry = entry->ifa_next) {
+        if (entry->ifa_addr == NULL || entry->ifa_addr->sa_family != family) {
+            continue;
+        }
+        const void *address = family == AF_INET6 ? (const void *)&((struct sockaddr_in6 *)entry->ifa_addr)->sin6_addr
+                                                 : (const void *)&((struct sockaddr_in *)entry->ifa_addr)->sin_addr;
+        if (memcmp(address, source, source_length) == 0) {
+            ifindex = if_nametoindex(entry->ifa_name);
+        }
+    }
+    freeifaddrs(addresses);
+    return ifindex;
+}
+
+/** @brief Checks whether an fq qdisc sits on the interface (as root or under mq)
+ *
+ *  @param ifindex The interface
+ *  @return 1 if it has fq, 0 otherwise
+ */
+static int has_fq(int ifindex) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct {
+        struct nlmsghdr header;
+        struct tcmsg tc;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+    request.header.nlmsg_type = RTM_GETQDISC;
+    request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.header.nlmsg_seq = 1;
+    request.tc.tcm_family = AF_UNSPEC;
+    if (send(fd, &request, request.header.nlmsg_len, 0) < 0) {
+        close(fd);
+        return 0;
+    }
+
+    /// Walk the dump until NLMSG_DONE, in a buffer of this call's own: senders on other threads may be looking too
+    size_t buffer_size = 32768;
+    char *buffer = malloc(buffer_size);
+    if (buffer == NULL) {
+        close(fd);
+        return 0;
+    }
+    int found = 0;
+    int done = 0;
+    while (!done) {
+        ssize_t length = recv(fd, buffer, buffer_size, 0);
+        if (length <= 0) {
+            break;
+        }
+        for (struct nlmsghdr *header = (struct nlmsghdr *)buffer; NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+            if (header->nlmsg_type == NLMSG_DONE || header->nlmsg_type == NLMSG_ERROR) {
+                done = 1;
+                break;
+            }
+            if (header->nlmsg_type != RTM_NEWQDISC) {
+                continue;
+            }
+            struct tcmsg *tc = NLMSG_DATA(header);
+            if (tc->tcm_ifindex != ifindex) {
+                continue;
+            }
+            int attributes_length = header->nlmsg_len - NLMSG_LENGTH(sizeof(*tc));
+            for (struct rtattr *attribute = (struct rtattr *)((char *)tc + NLMSG_ALIGN(sizeof(*tc)));
+                 RTA_OK(attribute, attributes_length); attribute = RTA_NEXT(attribute, attributes_length)) {
+                if (attribute->rta_type == TCA_KIND && strcmp(RTA_DATA(attribute), "fq") == 0) {
+                    found = 1;
+                }
+            }
+        }
+    }
+    free(buffer);
+    close(fd);
+    return found;
+}
+
+/** @brief Picks how to pace and sets the socket up for it
+ *
+ *  @param pacer The pacer
+ *  @param socket_desc The sender's socket
+ *  @param destination The receiver, to find the egress interface
+ *  @param mode pacer_auto, pacer_txtime or pacer_user
+ *  @return 1 if the socket uses SO_TXTIME, 0 if the sender waits itself
+ */
+int pacer_init(struct pacer *pacer, int socket_desc, const struct sockaddr *destination, int mode) {
+    memset(pacer, 0, sizeof(*pacer));
+
+    int ifindex = 0;
+    if (mode == pacer_txtime || (mode == pacer_auto && (ifindex = egress_interface(destination)) > 0 && has_fq(ifindex))) {
+        /// fq compares the send times against CLOCK_MONOTONIC
+        struct sock_txtime config;
+        memset(&config, 0, sizeof(config));
+        config.clockid = CLOCK_MONOTONIC;
+        if (setsockopt(socket_desc, SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) == 0) {
+            pacer->txtime = 1;
+        } else {
+            pacer->txtime_error = errno;
+        }
+    }
+
+    /// Timers otherwise fire up to 50 us late (the default timer slack), which is most of a short gap
+    if (!pacer->txtime) {
+        if (slack_users == 0) {
+            slack_before = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+            prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+        }
+        slack_users++;
+        pacer->slack_lowered = 1;
+    }
+    return pacer->txtime;
+}
+
+/** @brief Gives the thread its timer slack back once the last userspace pacer on it is closed
+ *
+ *  Call it on the thread that called pacer_init(), as often as that was called.
+ *
+ *  @param pacer The pacer, zeroed or from pacer_init()
+ *  @return void
+ */
+void pacer_close(struct pacer *pacer) {
+    if (!pacer->slack_lowered) {
+        return;
+    }
+    pacer->slack_lowered = 0;
+    if (slack_users > 0 && --slack_users == 0 && slack_before > 0) {
+        prctl(PR_SET_TIMERSLACK, (unsigned long)slack_before, 0, 0, 0);
+    }
+}
+
+/** @brief The clock send times are on
+ *
+ *  @return Nanoseconds on CLOCK_MONOTONIC
+ */
+uint64_t pacer_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/** @brief Works out when the next packet goes out: gap after the last one, or now if that has passed
+ *
+ *  @param pacer The pacer
+ *  @param gap_ns Time between packets at the current rate
+ *  @return The send time
+ */
+uint64_t pacer_schedule(struct pacer *pacer, uint64_t gap_ns) {
+    uint64_t now = pacer_now();
+    uint64_t send_at = pacer->last_ns + gap_ns;
+    if (send_at < now) {
+        send_at = now;
+    }
+    pacer->last_ns = send_at;
+    return send_at;
+}
+
+/** @brief Attaches the send time to a message (SCM_TXTIME), or clears its control data without SO_TXTIME
+ *
+ *  @param pacer The pacer, its control buffer has to stay untouched until the message is sent
+ *  @param msg The message
+ *  @param send_at From pacer_schedule()
+ *  @return void
+ */
+void pacer_prepare(struct pacer *pacer, struct msghdr *msg, uint64_t send_at) {
+    if (!pacer->txtime) {
+        msg->msg_control = NULL;
+        msg->msg_controllen = 0;
+        return;
+    }
+
+    msg->msg_control = pacer->control;
+    msg->msg_controllen = CMSG_SPACE(sizeof(uint64_t));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+    memcpy(CMSG_DATA(cmsg), &send_at, sizeof(send_at));
+}
+
+/** @brief Spins until the send time, for the stretch too short to sleep through
+ *
+ *  @param send_at From pacer_schedule()
+ *  @return void
+ */
+void pacer_spin_until(uint64_t send_at) {
+    while (pacer_now() < send_at) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
@@ -0,0 +1,44 @@
+/** @file pacer.h
+ *
+ *  @brief Packet pacing: SO_TXTIME when the qdisc honours it, a precise userspace pacer otherwise.
+ *
+ *  The sender asks for a send time (the last send plus the current gap). With SO_TXTIME the packet
+ *  is handed to the kernel right away carrying that time and the fq qdisc holds it until then, so
+ *  nothing sleeps per packet. Without such a qdisc the sender waits itself: a timerfd with
+ *  the timer slack lowered to 1 ns for longer gaps and a short spin for the last microseconds.
+ *  The slack is the calling thread's, it is lowered by pacer_init() and given back by pacer_close().
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define pacer_spin_ns 50000 /// Gaps shorter than this are waited out by spinning instead of a timer
+
+/// How the sender paces
+#define pacer_auto 0 /// SO_TXTIME if the egress qdisc is fq, userspace otherwise
+#define pacer_txtime 1 /// SO_TXTIME whatever the qdisc (a qdisc other than fq ignores the times)
+#define pacer_user 2 /// Always wait in userspace
+
+struct pacer {
+    int txtime; /// SO_TXTIME is on
+    int txtime_error; /// errno of turning SO_TXTIME on when that was tried and failed, 0 otherwise
+    int slack_lowered; /// This pacer lowered the thread's timer slack, pacer_close() gives it back
+    uint64_t last_ns; /// Send time of the last packet
+    uint64_t control[CMSG_SPACE(sizeof(uint64_t)) / sizeof(uint64_t)]; /// SCM_TXTIME message of the last pacer_prepare(), aligned for cmsghdr
+};
+
+int pacer_init(struct pacer *pacer, int socket_desc, const struct sockaddr *destination, int mode);
+void pacer_close(struct pacer *pacer);
+uint64_t pacer_now(void);
+uint64_t pacer_schedule(struct pacer *pacer, uint64_t gap_ns);
+void pacer_prepare(struct pacer *pacer, struct msghdr *msg, uint64_t send_at);
+void pacer_spin_until(uint64_t send_at);
+
+#endif
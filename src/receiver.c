@@ -1,6 +1,6 @@
 /**
  * @file receiver.c
- *  @brief Server functionality for a more reliable file transfer using UDP sockets. 
+ *  @brief Server functionality for a more reliable file transfer using UDP sockets: the command line on top of librudp.
  *
  *  @author Ana Bandari (anabandari)
  *  @author Dajeong Kim (dkim2)
@@ -15,198 +15,137 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <sys/types.h>
-#include <sys/socket.h>
 #include <unistd.h>
-#include <pthread.h>
 #include <errno.h>
 
+#include "librudp.h"
+#include "trace.h"
 
 
-/// the total amount of data we want to send over our UDP socket payload in one packet
-#define max_payload_size 1024 
+/// Options from the command line (-t, -u, -x, -K, -E, -B, -Y, -C, -i, -m)
+static struct rudp_receiver_config options;
+/// Milliseconds between progress lines (-i), 0 for none
+static int interval_ms = 0;
 
+/// How the transfer on the loop ended
+struct transfer {
+    struct evloop *loop;
+    int error;
+    const struct rudp_stats *stats; /// The session's counters, for the progress lines
+    struct ev_timer progress_timer;
+};
+
+
+/**
+ * @brief Log callback: the library's messages go to stdout, one per line
+ * 
+ * @return void
+*/
+static void print_message(void* arg, const char* message){
+
+    (void)arg;
+    printf("%s\n", message);
+}
+
+/**
+ * @brief Timer callback: prints the progress line to stderr every -i interval
+ * 
+ * @return void
+*/
+static void print_progress(struct evloop* loop, int fd, uint32_t events, void* arg){
+
+    struct transfer* transfer = arg;
+    (void)loop; (void)fd; (void)events;
+    if (ev_timer_ack(&transfer->progress_timer) == 0) {
+        return;
+    }
+    char line[512];
+    fprintf(stderr, "%s\n", stats_format(transfer->stats, 0, line, sizeof(line)));
+}
+
+/**
+ * @brief Done callback: keeps the result and stops the loop
+ * 
+ * @return void
+*/
+static void transfer_done(void* arg, int error){
+
+    struct transfer* transfer = arg;
+    transfer->error = error;
+    evloop_stop(transfer->loop);
+}
 
 /**
  * @brief receiver function for receiving data packets and sending acknowledgements back to client
  * 
+ * Runs one receiving session of librudp on its own event loop until the FIN, or until the sender
+ * has been silent for the idle timeout.
+ * 
  * @param myUDPport hostport
  * @param destinationFIle pointer to destinationFile where received ata will be written
  * @param writeRate not used
  * 
- * @return void
+ * @return rudp_ok or an error code
  * 
  * 
 */
-void rrecv(unsigned short int myUDPport, 
+int rrecv(unsigned short int myUDPport, 
             char* destinationFile, 
             unsigned long long int writeRate){
-    
-    ///  Initalizing file I/O and test that the file exists, opening in write only mode
-    FILE *write_file = fopen(destinationFile, "wb");
-    if (write_file == NULL){  
-        printf("Error! Could not open file\n");
-        exit(EXIT_FAILURE); 
-        }
 
-    /// Initalizing address struct and the structure of the clients address for receiving
-    struct sockaddr_in address, client_addr;
-    address.sin_family = AF_INET;
-    address.sin_port = htons(myUDPport);
-    address.sin_addr.s_addr = htonl(INADDR_ANY);   
-    unsigned int client_struct_length = sizeof(client_addr);
-
-
-    /// Create UDP socket and check it exists
- 
-    int socket_desc = socket(AF_INET, SOCK_DGRAM, 0);
-    if(socket_desc < 0){
-        printf("Error while creating socket\n");
+    /// Write rate not implemented
+    if(writeRate != 0){
+        printf("Error Have not yet implemented Task 8\n");
         exit(EXIT_FAILURE);
     }
 
-    /// Bind socket to the receive address
-    if(bind(socket_desc, (struct sockaddr*)&address, sizeof(address)) < 0){
-        printf("Couldn't bind to the port\n");
-        exit(EXIT_FAILURE);
-    }
+    struct rudp_receiver_config config = options;
+    config.port = myUDPport;
+    config.destination = destinationFile;
 
-    /// Check if socket was created successfully
-    printf("Socket binding successful! Will now Listen for Messages! \n\n");
-
-    /// acknowledgement flag value holder, initialized to 0
-    uint8_t ack = 0;
-    /// index for data packets, initialized to 0
-    int index = 0;
-    /// pointer to memory for storing data to send
-    void* sendmemorypointer;
-    /// pointer to memory for storing data received
-    void* receivedmemorypointer;
-    /// pointer to address of acknowledgement flag
-    void* ackpointer;
-    /// pointer to address of finish flag
-    void* finpointer;
-    /// pointer to address of data
-    void* datapointer;
-    /// pointer to address of data index
-    void* indexpointer;
-
-    /// Set size of buffer and assign memory block to pointers
-    size_t buffer_size = 4000; 
-    receivedmemorypointer = malloc(buffer_size);
-    sendmemorypointer = malloc(buffer_size);
-
-    /// Set acknowledgement flag pointer to first byte of memory storing data to send
-    ackpointer = sendmemorypointer;
-
-    /// Set pointers to respective byte of memory storing received data
-    finpointer = ((char*)receivedmemorypointer + 1);
-    indexpointer = ((char*)receivedmemorypointer + 2);
-    datapointer = ((char*)receivedmemorypointer + 6);
-
-    /// While loop to continue receiving data and sending acknowledgements until a finish flag is received
-    while(1){ 
-
-        /// reset memory blocks to null
-        memset(sendmemorypointer, 0, buffer_size);
-        memset(receivedmemorypointer, 0, buffer_size);
-
-        /// Wait for sender to send message, and store size of message in variable client_message
-        size_t client_message = recvfrom(socket_desc, receivedmemorypointer, max_payload_size, 0, (struct sockaddr*)&address, &client_struct_length);  
-
-        /// Variable to hold value of finish flag received
-        uint8_t fincomp;
-        /// Variable to hold value of index received
-        uint32_t indexcomp;
-
-        /// Copy data stored at address of finpointer and indexpointer into variable to use for comparisons
-        memcpy(&fincomp, (uint8_t*)finpointer, 1);
-        memcpy(&indexcomp, (uint8_t*)indexpointer, 4);
-
-        /// Check if the recvfrom function received has size greater than 0
-        if (client_message < 0){
-
-            /// Set acknowledgement to 0, indicating a nack flag meaning data transfer was not successful
-            /// Copy value of acknowledgement flag into memory
-            ack = 0;
-            memcpy(ackpointer, &ack, 1);
-
-
-            /// Send nack flag to sender
-            sendto(socket_desc, sendmemorypointer, buffer_size, 0, (struct sockaddr*)&address, client_struct_length);
+    struct evloop loop;
+    if (evloop_init(&loop) < 0) {
+        return rudp_err_system;
+    }
+    tuning_busy_poll_epoll(loop.epoll_fd, &config.tuning);
+    if (tuning_pin_thread(&config.tuning) < 0) {
+        fprintf(stderr, "pinning to CPU %d: %s\n", config.tuning.cpu, strerror(errno));
+    }
 
+    struct transfer transfer = { &loop, rudp_ok, NULL, { -1 } };
+    struct rudp_callbacks callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.done = transfer_done;
+    callbacks.log = print_message;
+    callbacks.arg = &transfer;
+
+    struct rudp_receiver* receiver;
+    int error = rudp_receiver_open(&receiver, &loop, &config, &callbacks);
+    if (error == rudp_ok) {
+        printf("Socket binding successful! Will now Listen for Messages! \n\n");
+
+        transfer.stats = rudp_receiver_stats(receiver);
+        if (interval_ms > 0 && ev_timer_init(&loop, &transfer.progress_timer, print_progress, &transfer) == 0) {
+            ev_timer_arm(&transfer.progress_timer, interval_ms * 1000ULL, interval_ms * 1000ULL);
         }
-        /// Check if value of finish flag is set to 1, in which case the while loop must be exited
-        else if (fincomp == 1) {
-
-            /// Set acknowledgement flag high, to indicate that the finish flag was received to the sender
-            ack = 1;
-            /// Copy value of acknowledgement flag into memory
-            memcpy(ackpointer, &ack, 1);
-
-            /// Send the acknowledgement to the sender, then exit the while loop
-            sendto(socket_desc, sendmemorypointer, buffer_size, 0, (struct sockaddr*)&address, client_struct_length);
-            break;
-
-        } 
-        /// Check if the index of the data is equal to the index count of the receiver
-        else if(indexcomp == index) {
-
-            /// Write the data from the data portion of the received memory
-            size_t written = fwrite(datapointer, 1, client_message-6, write_file);
-
-            /// Check if write was successful
-            if (written < client_message-6) {
-                printf("Error during writing to file!");
-            }
-
-            /// Set acknowledgement flag high, to indicate that the correct index was received to the sender
-            ack = 1;
-            /// Copy value of acknowledgement flag into memory
-            memcpy(ackpointer, &ack, 1);
-
-            /// Send the acknowledgement to the sender
-            sendto(socket_desc, sendmemorypointer, buffer_size, 0, (struct sockaddr*)&address, client_struct_length);
-
-            /// Increment the index keeping count of how many successful data packets were received and written to the destination
-            index++;
 
+        /// Receive data and send acknowledgements until a finish flag is received
+        if (evloop_run(&loop) < 0) {
+            perror("epoll_wait");
         }
-        /// If none of the above conditions were met, assume that the index of the data packet was incorrect or no data was received during the bounds of the timeout period
-        else {
-
-            /// Set acknowledgement flag low, to indicate that an incorrect index was received to the sender
-            ack = 0;
-            /// Copy value of acknowledgement flag into memory
-            memcpy(ackpointer, &ack, 1);
-            /// Copy value of current index to be received into memory
-            memcpy(indexpointer, &index, 4);
-
-            /// Send the nack to the sender
-            sendto(socket_desc, sendmemorypointer, buffer_size, 0, (struct sockaddr*)&address, client_struct_length);
+        error = transfer.error;
+        if (interval_ms > 0) {
+            char line[512];
+            fprintf(stderr, "%s\n", stats_format(transfer.stats, 1, line, sizeof(line)));
         }
-
-        /// Set the acknowledgement flag low
-        ack = 0;
-
-        /// This is the end of the while loop. 
-    
+        rudp_receiver_close(receiver);
+        printf("Socket closed\n");
     }
-
-    /// Close the destination file opened for writing 
-    fclose(write_file);
-    /// Close the socket conneciton
-    close(socket_desc);
-    printf("Socket closed\n");
-
-    /// Write rate not implemented
-    if(writeRate != 0){
-        printf("Error Have not yet implemented Task 8\n");
-        exit(EXIT_FAILURE);
-    }
-
+    int saved_errno = errno;
+    ev_timer_close(&loop, &transfer.progress_timer);
+    evloop_close(&loop);
+    errno = saved_errno;
+    return error;
 }
 
 /**
@@ -215,26 +154,121 @@ void rrecv(unsigned short int myUDPport,
  * @param arcg argument count, indicating number of arguments passed from the command line
  * @param argv argument vector, pointing to an array of strings, each of which contains an argument passed from the command line
  * 
- * @return 0
+ * @return 0, 1 if the transfer failed
  * 
 */
 int main(int argc, char** argv){
 
     ///initialize variable to hold udpPort name passed from the command line
     unsigned short int udpPort;
+    /// file holding the pre-shared key, no encryption without one
+    char* key_path = NULL;
+    int option;
+
+    /// Parse the options: -i interval_ms for progress lines, -m file (.json or Prometheus text) or unix:/socket for metrics, -t seconds of sender silence to give up after, -u for the io_uring engine, -x to receive with AF_XDP,
+    /// -K key file to accept only datagrams encrypted with (-E the cipher, AES-256-GCM by default),
+    /// -B socket buffer size (bytes with K/M/G, or Mbit/s x RTT ms), -Y busy poll microseconds, -C CPU to pin to and steer the socket to
+    rudp_receiver_config_init(&options);
+    while ((option = getopt(argc, argv, "ux:B:Y:C:i:m:t:K:E:")) != -1) {
+        switch (option) {
+            case 'K':
+                key_path = optarg;
+                break;
+            case 'E':
+                if (strcmp(optarg, "aes-gcm") == 0) {
+                    options.cipher = rudp_cipher_aes_gcm;
+                } else if (strcmp(optarg, "chacha20") == 0) {
+                    options.cipher = rudp_cipher_chacha20;
+                } else {
+                    fprintf(stderr, "-E takes aes-gcm or chacha20\n");
+                    exit(1);
+                }
+                break;
+            case 'B':
+                options.tuning.buffer_bytes = tuning_parse_buffer(optarg);
+                if (options.tuning.buffer_bytes < 0) {
+                    fprintf(stderr, "-B takes a size like 4M or a bandwidth-delay product like 1000x32\n");
+                    exit(1);
+                }
+                break;
+            case 'Y':
+                options.tuning.busy_poll_us = atoi(optarg);
+                break;
+            case 'C':
+                options.tuning.cpu = atoi(optarg);
+                break;
+            case 'i':
+                interval_ms = atoi(optarg);
+                options.metrics_interval_ms = interval_ms;
+                break;
+            case 'm':
+                options.metrics_path = optarg;
+                break;
+            case 't':
+                options.idle_timeout = atof(optarg);
+                break;
+            case 'u':
+                options.use_uring = 1;
+                break;
+            case 'x': {
+                /// ifname or ifname:queue
+                options.xdp_interface = optarg;
+                char* colon = strchr(optarg, ':');
+                if (colon != NULL) {
+                    *colon = '\0';
+                    options.xdp_queue = atoi(colon + 1);
+                }
+                break;
+            }
+            default:
+                fprintf(stderr, "usage: %s [-u] [-x ifname[:queue]] [-K keyfile [-E aes-gcm|chacha20]] [-B bytes|MbpsxRTTms] [-Y busy_poll_us] [-C cpu] [-i interval_ms] [-m metrics_path] [-t idle_timeout_s] UDP_port filename_to_write\n\n", argv[0]);
+                exit(1);
+        }
+    }
+
+    /// Check if both arguments were passed from the command line
+    if (argc - optind != 2) {
+        fprintf(stderr, "usage: %s [-u] [-x ifname[:queue]] [-K keyfile [-E aes-gcm|chacha20]] [-B bytes|MbpsxRTTms] [-Y busy_poll_us] [-C cpu] [-i interval_ms] [-m metrics_path] [-t idle_timeout_s] UDP_port filename_to_write\n\n", argv[0]);
+        exit(1);
+    }
 
-    /// Check if all three arguments were passed from the command line
-    if (argc != 3) {
-        fprintf(stderr, "usage: %s UDP_port filename_to_write\n\n", argv[0]);
+    /// Both ends need the same key file; -K alone encrypts with AES-256-GCM
+    if (options.cipher != rudp_cipher_none && key_path == NULL) {
+        fprintf(stderr, "-E needs a key file (-K)\n");
         exit(1);
     }
+    if (key_path != NULL) {
+        int key_error = rudp_key_load(key_path, options.key);
+        if (key_error != rudp_ok) {
+            fprintf(stderr, "Could not read a key from %s: %s\n", key_path, rudp_strerror(key_error));
+            exit(1);
+        }
+        if (options.cipher == rudp_cipher_none) {
+            options.cipher = rudp_cipher_aes_gcm;
+        }
+    }
 
     /// Parse the command-line arguments
-    udpPort = (unsigned short int) atoi(argv[1]);
-    char* destinationFile = argv[2];
+    udpPort = (unsigned short int) atoi(argv[optind]);
+    char* destinationFile = argv[optind+1];
+    trace_init("receiver");
 
     /// Call the rrecv function with the provided arguments, passing 0 for writeRate
-    rrecv(udpPort, destinationFile, 0);
+    int error = rrecv(udpPort, destinationFile, 0);
+    int saved_errno = errno;
+    if (trace_dump() < 0) {
+        perror("trace file");
+    }
+    errno = saved_errno;
+
+    if (error != rudp_ok) {
+        if (error == rudp_err_system) {
+            printf("Error: %s (%s)\n", rudp_strerror(error), strerror(errno));
+        } else {
+            printf("Error: %s\n", rudp_strerror(error));
+        }
+        return EXIT_FAILURE;
+    }
 
     /// return 0 and end
     return 0;
@@ -0,0 +1,370 @@
+/** @file resolve.c
+ *
+ *  @brief Name resolution off the event loop, with a cache, for IPv4 and IPv6 receivers.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+
+#include "resolve.h"
+
+/// A looked up name
+struct cache_entry {
+    char host[256];
+    unsigned short port;
+    int family;
+    time_t expires; /// 0 marks a free entry
+    struct resolve_result result;
+};
+
+/// Shared by every session in the process, whichever thread runs its loop
+static struct cache_entry cache[resolve_cache_entries];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct resolve_request {
+    pthread_mutex_t lock;
+    int finished; /// The thread is done and has signalled event_fd
+    int cancelled; /// The owner is gone, whoever sees the other side done frees the request
+    int event_fd;
+    struct evloop *loop;
+    char host[256];
+    unsigned short port;
+    int family;
+    int error;
+    struct resolve_result result;
+    resolve_fn callback;
+    void *arg;
+};
+
+
+/** @brief Orders the addresses for Happy Eyeballs: the families take turns, starting with the first one
+ *
+ *  @param result The addresses in getaddrinfo() order, reordered in place
+ *  @return void
+ */
+static void interleave(struct resolve_result *result) {
+    struct resolve_result sorted;
+    int taken[resolve_max_addresses] = {0};
+    int family = result->count > 0 ? result->addresses[0].ss_family : AF_UNSPEC;
+
+    sorted.count = 0;
+    while (sorted.count < result->count) {
+        /// The next address of the family whose turn it is, or of any family once that one has run out
+        int pick = -1;
+        for (int i = 0; i < result->count && pick < 0; i++) {
+            if (!taken[i] && result->addresses[i].ss_family == family) {
+                pick = i;
+            }
+        }
+        for (int i = 0; i < result->count && pick < 0; i++) {
+            if (!taken[i]) {
+                pick = i;
+            }
+        }
+        taken[pick] = 1;
+        sorted.addresses[sorted.count] = result->addresses[pick];
+        sorted.lengths[sorted.count] = result->lengths[pick];
+        sorted.count++;
+        family = result->addresses[pick].ss_family == AF_INET6 ? AF_INET : AF_INET6;
+    }
+    *result = sorted;
+}
+
+/** @brief Runs getaddrinfo() for UDP
+ *
+ *  @param host Name or numeric address
+ *  @param port The port every address gets
+ *  @param family AF_UNSPEC, AF_INET or AF_INET6
+ *  @param flags AI_NUMERICHOST to only parse an address
+ *  @param result Filled in, in the order to try the addresses
+ *  @return 0 or the getaddrinfo() error
+ */
+static int lookup(const char *host, unsigned short port, int family, int flags, struct resolve_result *result) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+    /// Names only get the families this host has addresses of; a numeric address is taken as it is (::1 included)
+    hints.ai_flags = flags != 0 ? flags : AI_ADDRCONFIG;
+
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    struct addrinfo *list;
+    int error = getaddrinfo(host, service, &hints, &list);
+    if (error != 0) {
+        return error;
+    }
+
+    result->count = 0;
+    for (struct addrinfo *entry = list; entry != NULL && result->count < resolve_max_addresses; entry = entry->ai_next) {
+        if ((entry->ai_family == AF_INET || entry->ai_family == AF_INET6) && entry->ai_addrlen <= sizeof(struct sockaddr_storage)) {
+            memcpy(&result->addresses[result->count], entry->ai_addr, entry->ai_addrlen);
+            result->lengths[result->count] = entry->ai_addrlen;
+            result->count++;
+        }
+    }
+    freeaddrinfo(list);
+    if (result->count == 0) {
+        return EAI_NONAME;
+    }
+    interleave(result);
+    return 0;
+}
+
+/** @brief Remembers what a name resolved to, in place of the entry that expires first
+ *
+ *  @return void
+ */
+static void cache_store(const char *host, unsigned short port, int family, const struct resolve_result *result) {
+    if (strlen(host) >= sizeof(cache[0].host)) {
+        return;
+    }
+    pthread_mutex_lock(&cache_lock);
+    struct cache_entry *slot = &cache[0];
+    for (int i = 0; i < resolve_cache_entries; i++) {
+        struct cache_entry *entry = &cache[i];
+        if (entry->expires != 0 && entry->port == port && entry->family == family && strcmp(entry->host, host) == 0) {
+            slot = entry;
+            break;
+        }
+        if (entry->expires < slot->expires) {
+            slot = entry;
+        }
+    }
+    strcpy(slot->host, host);
+    slot->port = port;
+    slot->family = family;
+    slot->expires = time(NULL) + resolve_cache_ttl;
+    slot->result = *result;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/** @brief Answers without waiting if that is possible: a numeric address, or a name looked up recently
+ *
+ *  @param host Name or numeric address
+ *  @param port The port every address gets
+ *  @param family AF_UNSPEC, AF_INET or AF_INET6
+ *  @param result Filled in when it returns 1
+ *  @return 1 with the addresses, 0 if the name has to be looked up with resolve_start()
+ */
+int resolve_cached(const char *host, unsigned short port, int family, struct resolve_result *result) {
+    if (lookup(host, port, family, AI_NUMERICHOST, result) == 0) {
+        return 1;
+    }
+
+    int found = 0;
+    time_t now = time(NULL);
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < resolve_cache_entries && !found; i++) {
+        struct cache_entry *entry = &cache[i];
+        if (entry->expires > now && entry->port == port && entry->family == family && strcmp(entry->host, host) == 0) {
+            *result = entry->result;
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return found;
+}
+
+/** @brief Frees a request once neither its thread nor its owner needs it
+ *
+ *  @return void
+ */
+static void request_free(struct resolve_request *request) {
+    close(request->event_fd);
+    pthread_mutex_destroy(&request->lock);
+    free(request);
+}
+
+/** @brief The lookup thread: resolves, caches and wakes the loop
+ *
+ *  @return NULL
+ */
+static void *resolve_thread(void *arg) {
+    struct resolve_request *request = arg;
+    request->error = lookup(request->host, request->port, request->family, 0, &request->result);
+    if (request->error == 0) {
+        cache_store(request->host, request->port, request->family, &request->result);
+    }
+
+    /// The eventfd is written under the lock, so a cancel can not close it in between
+    pthread_mutex_lock(&request->lock);
+    request->finished = 1;
+    if (request->cancelled) {
+        pthread_mutex_unlock(&request->lock);
+        request_free(request);
+        return NULL;
+    }
+    /// One increment of an eventfd nobody else writes to can not overflow it, so this does not fail
+    uint64_t one = 1;
+    ssize_t written = write(request->event_fd, &one, sizeof(one));
+    (void)written;
+    pthread_mutex_unlock(&request->lock);
+    return NULL;
+}
+
+/** @brief Loop callback: the lookup is done, hand the addresses over
+ *
+ *  @return void
+ */
+static void on_resolved(struct evloop *loop, int fd, uint32_t events, void *arg) {
+    struct resolve_request *request = arg;
+    (void)events;
+
+    evloop_del(loop, fd);
+    request->callback(request->arg, request->error, &request->result);
+    request_free(request);
+}
+
+/** @brief Looks a name up on a thread of its own
+ *
+ *  @param loop The loop the callback runs on
+ *  @param host Name or numeric address, copied
+ *  @param port The port every address gets
+ *  @param family AF_UNSPEC, AF_INET or AF_INET6
+ *  @param callback Called once on the loop's thread, unless the request is cancelled first; the request is gone by then
+ *  @param arg For the callback
+ *  @return The request, NULL with errno set if it could not be started
+ */
+struct resolve_request *resolve_start(struct evloop *loop, const char *host, unsigned short port, int family,
+                                      resolve_fn callback, void *arg) {
+    if (strlen(host) >= sizeof(((struct resolve_request *)0)->host)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    struct resolve_request *request = calloc(1, sizeof(*request));
+    if (request == NULL) {
+        return NULL;
+    }
+    request->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (request->event_fd < 0) {
+        free(request);
+        return NULL;
+    }
+    pthread_mutex_init(&request->lock, NULL);
+    request->loop = loop;
+    strcpy(request->host, host);
+    request->port = port;
+    request->family = family;
+    request->callback = callback;
+    request->arg = arg;
+
+    pthread_t thread;
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    if (evloop_add(loop, request->event_fd, EPOLLIN, on_resolved, request) < 0) {
+        pthread_attr_destroy(&attributes);
+        request_free(request);
+        return NULL;
+    }
+    int error = pthread_create(&thread, &attributes, resolve_thread, request);
+    pthread_attr_destroy(&attributes);
+    if (error != 0) {
+        evloop_del(loop, request->event_fd);
+        request_free(request);
+        errno = error;
+        return NULL;
+    }
+    return request;
+}
+
+/** @brief Gives up on a lookup whose callback has not run yet; the thread finishes on its own
+ *
+ *  @param request The request, gone afterwards; NULL does nothing
+ *  @return void
+ */
+void resolve_cancel(struct resolve_request *request) {
+    if (request == NULL) {
+        return;
+    }
+    evloop_del(request->loop, request->event_fd);
+
+    pthread_mutex_lock(&request->lock);
+    request->cancelled = 1;
+    int finished = request->finished;
+    pthread_mutex_unlock(&request->lock);
+    if (finished) {
+        request_free(request);
+    }
+}
+
+/** @brief Compares two socket addresses: family, address and port
+ *
+ *  @return 1 if they are the same endpoint
+ */
+int resolve_same_address(const struct sockaddr *a, const struct sockaddr *b) {
+    if (a->sa_family != b->sa_family) {
+        return 0;
+    }
+    if (a->sa_family == AF_INET) {
+        const struct sockaddr_in *a4 = (const struct sockaddr_in *)a;
+        const struct sockaddr_in *b4 = (const struct sockaddr_in *)b;
+        return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+    }
+    if (a->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)a;
+        const struct sockaddr_in6 *b6 = (const struct sockaddr_in6 *)b;
+        return a6->sin6_port == b6->sin6_port && memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+    }
+    return 0;
+}
+
+/** @brief Puts an address in the form a dual stack (AF_INET6) socket uses: IPv4 as ::ffff:a.b.c.d
+ *
+ *  @param address An IPv4 or IPv6 address
+ *  @param mapped Set to the IPv6 form
+ *  @return Its length
+ */
+socklen_t resolve_map_v6(const struct sockaddr *address, struct sockaddr_storage *mapped) {
+    memset(mapped, 0, sizeof(*mapped));
+    if (address->sa_family == AF_INET6) {
+        memcpy(mapped, address, sizeof(struct sockaddr_in6));
+        return sizeof(struct sockaddr_in6);
+    }
+    const struct sockaddr_in *v4 = (const struct sockaddr_in *)address;
+    struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)mapped;
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = v4->sin_port;
+    v6->sin6_addr.s6_addr[10] = 0xff;
+    v6->sin6_addr.s6_addr[11] = 0xff;
+    memcpy(&v6->sin6_addr.s6_addr[12], &v4->sin_addr, 4);
+    return sizeof(struct sockaddr_in6);
+}
+
+/** @brief Writes an address for a person, a mapped IPv4 address as plain IPv4
+ *
+ *  @param address The address
+ *  @param text Where to write it
+ *  @param size Room in text, INET6_ADDRSTRLEN is enough
+ *  @return text
+ */
+const char *resolve_format(const struct sockaddr *address, char *text, size_t size) {
+    text[0] = '\0';
+    if (address->sa_family == AF_INET) {
+        inet_ntop(AF_INET, &((const struct sockaddr_in *)address)->sin_addr, text, size);
+    } else if (address->sa_family == AF_INET6) {
+        const struct in6_addr *v6 = &((const struct sockaddr_in6 *)address)->sin6_addr;
+        if (IN6_IS_ADDR_V4MAPPED(v6)) {
+            inet_ntop(AF_INET, &v6->s6_addr[12], text, size);
+        } else {
+            inet_ntop(AF_INET6, v6, text, size);
+        }
+    }
+    return text;
+}
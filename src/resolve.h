@@ -0,0 +1,49 @@
+/** @file resolve.h
+ *
+ *  @brief Name resolution off the event loop, with a cache, for IPv4 and IPv6 receivers.
+ *
+ *  getaddrinfo() blocks for as long as DNS takes, so names are looked up on a short lived thread
+ *  that wakes the loop through an eventfd when it is done. Numeric addresses and names looked up
+ *  in the last resolve_cache_ttl seconds are answered right away from the calling thread. The
+ *  addresses come back in the order to try them in: the families interleaved, the first one
+ *  getaddrinfo() preferred (normally IPv6) first, as Happy Eyeballs (RFC 8305) wants.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "evloop.h"
+
+#define resolve_max_addresses 8 /// Addresses kept per name
+#define resolve_cache_ttl 60 /// Seconds a looked up name is reused for
+#define resolve_cache_entries 32 /// Names the cache holds, the oldest goes first
+
+/// What a name resolved to
+struct resolve_result {
+    int count;
+    struct sockaddr_storage addresses[resolve_max_addresses];
+    socklen_t lengths[resolve_max_addresses];
+};
+
+/// A lookup running on its thread
+struct resolve_request;
+
+/// Called on the loop's thread with 0 and the addresses, or with the getaddrinfo() error
+typedef void (*resolve_fn)(void *arg, int error, const struct resolve_result *result);
+
+int resolve_cached(const char *host, unsigned short port, int family, struct resolve_result *result);
+struct resolve_request *resolve_start(struct evloop *loop, const char *host, unsigned short port, int family,
+                                      resolve_fn callback, void *arg);
+void resolve_cancel(struct resolve_request *request);
+
+int resolve_same_address(const struct sockaddr *a, const struct sockaddr *b);
+socklen_t resolve_map_v6(const struct sockaddr *address, struct sockaddr_storage *mapped);
+const char *resolve_format(const struct sockaddr *address, char *text, size_t size);
+
+#endif
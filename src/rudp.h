@@ -0,0 +1,55 @@
+/** @file rudp.h
+ *
+ *  @brief Wire format shared by the sender and the receiver.
+ *
+ *  Every datagram starts with a 6 byte header:
+ *
+ *      byte 0      ack flag   (1 = positive acknowledgement, 0 = data or nack)
+ *      byte 1      packet type (data, fin, signature request/reply, delta op)
+ *      bytes 2-5   packet index (host byte order)
+ *
+ *  The receiver echoes the type and the index of the packet it is answering so the
+ *  sender can throw away late acknowledgements of earlier retransmissions.
+ *
+ *  With encryption on (seal.h) the type carries pkt_sealed, everything after the header is
+ *  ciphertext and a 36 byte trailer follows it: the transfer's salt (12), the datagram's
+ *  counter (8) and the authentication tag (16).
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef RUDP_H
+#define RUDP_H
+
+#include <stdint.h>
+
+/*   Packet Layout   */
+#define max_payload_size 1024 /// The maximum payload size sent over through the socket.
+#define header_size 6 /// ack flag + packet type + 4 byte index
+#define max_data_size (max_payload_size - header_size) /// The maximum payload size subtracted by the 6 byte header.
+
+#define ack_offset 0 /// Byte offset of the ack flag
+#define type_offset 1 /// Byte offset of the packet type (used to be only the fin flag)
+#define index_offset 2 /// Byte offset of the packet index
+#define data_offset 6 /// Byte offset of the payload
+
+#define seal_salt_size 12 /// Picks the key of the transfer, the same on every datagram of it: 8 random bytes and a 4 byte tag over them
+#define seal_counter_size 8 /// Per side and datagram, the nonce and the replay check
+#define seal_tag_size 16 /// AEAD authentication tag
+#define seal_overhead (seal_salt_size + seal_counter_size + seal_tag_size) /// Trailer of a sealed datagram
+#define max_datagram_size (max_payload_size + seal_overhead) /// Largest datagram on the wire, sealed
+
+#define zero_frame_size 8 /// Payload of a pkt_zero: the run's length in bytes, 64 bit host order
+
+#define reorder_window 64 /// Data packets the receiver holds ahead of the next index, so a sender's packets in flight stay within this many of the oldest
+
+/*   Packet Types   */
+#define pkt_data 0 /// Raw file bytes
+#define pkt_fin 1 /// Terminate the transfer (same value as the old fin flag)
+#define pkt_sig 2 /// Sender asks for / receiver answers with a chunk of block signatures
+#define pkt_delta 3 /// Payload is one delta operation instead of raw file bytes
+#define pkt_zero 4 /// Payload is the length of a run of zeros (a hole) in place of raw file bytes
+#define pkt_sealed 0x80 /// Flag on the type: the datagram is encrypted and authenticated
+
+#endif
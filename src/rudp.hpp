@@ -0,0 +1,206 @@
+/** @file rudp.hpp
+ *
+ *  @brief C++ wrapper of librudp: RAII sessions and loops, std::function callbacks.
+ *
+ *  Header only, over the C API in librudp.h; link with librudp.a. A rudp::Loop owns the event
+ *  loop, a rudp::Sender or rudp::Receiver owns one session on it and closes it when it goes out
+ *  of scope, so a session has to go before its loop does. Errors are the rudp_err_ codes, as in C.
+ *  A rudp::Scheduler shared by senders has to outlive them as well.
+ *
+ *      rudp::Loop loop;
+ *      rudp::Sender sender;
+ *      sender.on_done([&](int error) { loop.stop(); });
+ *      if (sender.start(loop, config) == rudp_ok) loop.run();
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef RUDP_HPP
+#define RUDP_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "librudp.h"
+
+namespace rudp {
+
+/// The name of a rudp_ status or error code
+inline const char *strerror(int error) { return rudp_strerror(error); }
+
+/// An event loop any number of sessions can run on
+class Loop {
+public:
+    Loop() { error_ = evloop_init(&loop_) < 0 ? rudp_err_system : rudp_ok; }
+    ~Loop() {
+        if (error_ == rudp_ok) {
+            evloop_close(&loop_);
+        }
+    }
+    Loop(const Loop &) = delete;
+    Loop &operator=(const Loop &) = delete;
+
+    /// rudp_ok, or rudp_err_system if the epoll descriptor could not be created
+    int error() const { return error_; }
+    /// Runs callbacks until stop()
+    int run() { return evloop_run(&loop_); }
+    /// One round of callbacks, waiting at most timeout_ms (-1 forever)
+    int poll(int timeout_ms) { return evloop_poll(&loop_, timeout_ms); }
+    void stop() { evloop_stop(&loop_); }
+    /// For registering descriptors of one's own, or for tuning_busy_poll_epoll()
+    struct evloop *get() { return &loop_; }
+
+private:
+    struct evloop loop_;
+    int error_;
+};
+
+namespace detail {
+
+/// The callbacks, on the heap so the C side's arg stays put when the session object moves
+struct Handlers {
+    std::function<void(const rudp_stats &)> progress;
+    std::function<void(const uint8_t *, size_t, unsigned long long)> data;
+    std::function<void(int)> done;
+    std::function<void(const char *)> log;
+
+    static void on_progress(void *arg, const rudp_stats *stats) {
+        Handlers *self = static_cast<Handlers *>(arg);
+        if (self->progress) self->progress(*stats);
+    }
+    static void on_data(void *arg, const uint8_t *data, size_t length, unsigned long long offset) {
+        Handlers *self = static_cast<Handlers *>(arg);
+        if (self->data) self->data(data, length, offset);
+    }
+    static void on_done(void *arg, int error) {
+        Handlers *self = static_cast<Handlers *>(arg);
+        if (self->done) self->done(error);
+    }
+    static void on_log(void *arg, const char *message) {
+        Handlers *self = static_cast<Handlers *>(arg);
+        if (self->log) self->log(message);
+    }
+
+    /// Only the callbacks that are set, so the library skips the others
+    rudp_callbacks callbacks() {
+        rudp_callbacks callbacks = {};
+        callbacks.progress = progress ? on_progress : nullptr;
+        callbacks.data = data ? on_data : nullptr;
+        callbacks.done = on_done;
+        callbacks.log = log ? on_log : nullptr;
+        callbacks.arg = this;
+        return callbacks;
+    }
+};
+
+/// A session of either kind: Session, Config, the open function and the close function
+template <typename Session, typename Config, int (*Open)(Session **, struct evloop *, const Config *, const rudp_callbacks *),
+          void (*Close)(Session *), const rudp_stats *(*Stats)(const Session *)>
+class Endpoint {
+public:
+    Endpoint() : handlers_(new Handlers) {}
+    /// The session and its callbacks move over; the source is left closed with no callbacks, ready to be set up again
+    Endpoint(Endpoint &&other) : handlers_(std::move(other.handlers_)), session_(std::move(other.session_)) {
+        other.handlers_.reset(new Handlers);
+    }
+    Endpoint &operator=(Endpoint &&other) {
+        if (this != &other) {
+            close();
+            handlers_ = std::move(other.handlers_);
+            session_ = std::move(other.session_);
+            other.handlers_.reset(new Handlers);
+        }
+        return *this;
+    }
+
+    /// Set before start(); the done callback may close() the session but not destroy this object
+    void on_progress(std::function<void(const rudp_stats &)> callback) { handlers_->progress = std::move(callback); }
+    void on_done(std::function<void(int)> callback) { handlers_->done = std::move(callback); }
+    void on_log(std::function<void(const char *)> callback) { handlers_->log = std::move(callback); }
+
+    /// Opens the session on the loop, closing one started before; rudp_ok or an rudp_err_ code
+    int start(Loop &loop, const Config &config) {
+        close();
+        rudp_callbacks callbacks = handlers_->callbacks();
+        Session *session = nullptr;
+        int error = Open(&session, loop.get(), &config, &callbacks);
+        if (error == rudp_ok) {
+            session_.reset(session);
+        }
+        return error;
+    }
+    /// Stops and frees the session now; a session that had not finished ends as rudp_err_aborted
+    void close() { session_.reset(); }
+    bool open() const { return session_ != nullptr; }
+    /// The session's counters, which stay valid until close(); only while open()
+    const rudp_stats &stats() const {
+        assert(session_ != nullptr);
+        return *Stats(session_.get());
+    }
+
+protected:
+    struct Closer {
+        void operator()(Session *session) const { Close(session); }
+    };
+    /// Declared first so it outlives the session, whose teardown may still call into it
+    std::unique_ptr<Handlers> handlers_;
+    std::unique_ptr<Session, Closer> session_;
+};
+
+} // namespace detail
+
+/// Sends one file to a receiver
+class Sender : public detail::Endpoint<rudp_sender, rudp_sender_config, rudp_sender_open, rudp_sender_close, rudp_sender_stats> {
+public:
+    /// The defaults of rudp_sender_config_init()
+    static rudp_sender_config config() {
+        rudp_sender_config config;
+        rudp_sender_config_init(&config);
+        return config;
+    }
+};
+
+/// A pacer senders on one loop share: a rate cap over all of them, priorities and weights (rudp_sender_config)
+class Scheduler {
+public:
+    Scheduler() = default;
+    ~Scheduler() { close(); }
+    Scheduler(const Scheduler &) = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    /// Opens it on the loop, capped at rate_mbps (0 for no cap); rudp_ok or an rudp_err_ code
+    int start(Loop &loop, double rate_mbps) {
+        close();
+        return rudp_scheduler_open(&scheduler_, loop.get(), rate_mbps);
+    }
+    /// The senders that use it have to be closed first
+    void close() {
+        rudp_scheduler_close(scheduler_);
+        scheduler_ = nullptr;
+    }
+    /// For rudp_sender_config.scheduler
+    rudp_scheduler *get() { return scheduler_; }
+
+private:
+    rudp_scheduler *scheduler_ = nullptr;
+};
+
+/// Receives one file from a sender
+class Receiver : public detail::Endpoint<rudp_receiver, rudp_receiver_config, rudp_receiver_open, rudp_receiver_close, rudp_receiver_stats> {
+public:
+    /// The defaults of rudp_receiver_config_init()
+    static rudp_receiver_config config() {
+        rudp_receiver_config config;
+        rudp_receiver_config_init(&config);
+        return config;
+    }
+    /// Every payload of a plain transfer as it is written, with its offset in the file
+    void on_data(std::function<void(const uint8_t *, size_t, unsigned long long)> callback) { handlers_->data = std::move(callback); }
+};
+
+} // namespace rudp
+
+#endif
@@ -0,0 +1,1826 @@
+/**
+ * @file rudp_recv.c
+ *  @brief Receiving side of librudp: a reliable file transfer over UDP, run from an event loop.
+ *
+ *  @author Ana Bandari (anabandari)
+ *  @author Dajeong Kim (dkim2)
+ * 
+ */
+
+
+
+/*   Includes   */
+#define _GNU_SOURCE /// for O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+
+#include "librudp.h"
+#include "rudp.h"
+#include "delta.h"
+#include "trace.h"
+#include "uring.h"
+#include "xdp.h"
+#include "resolve.h"
+#include "seal.h"
+
+
+#define housekeeping_interval_us 100000 /// How often the receiver reports progress and checks for a silent sender
+
+
+/// State of a sync (delta) transfer on the receiving side
+struct sync_state {
+    int active; /// Set once the sender asked for signatures
+    FILE *basis; /// The old destination file the copy operations read from (NULL if there was none)
+    FILE *temp; /// The file being rebuilt, renamed over the destination at FIN
+    char *temp_name;
+    struct delta_sig *sigs; /// Signatures of the blocks of the basis file
+    uint32_t nblocks;
+    uint32_t block_size;
+    uint8_t *block_buffer; /// Scratch buffer for copying one block
+};
+
+
+/**
+ * @brief Opens the destination file for a plain transfer, truncating it
+ * 
+ * @param destinationFile name of the file
+ * 
+ * @return the opened file, NULL if it could not be opened
+*/
+static FILE* open_destination(const char* destinationFile){
+
+    return fopen(destinationFile, "wb");
+}
+
+/**
+ * @brief Closes a destination written with stdio once its data is on the disk
+ * 
+ * @param file the file
+ * 
+ * @return 0, EOF if a write, the fsync or the close failed
+*/
+static int close_durably(FILE* file){
+
+    int failed = fflush(file) != 0 || fdatasync(fileno(file)) < 0;
+    if (fclose(file) != 0 || failed) {
+        return EOF;
+    }
+    return 0;
+}
+
+/**
+ * @brief Appends a run of zeros to a destination written with stdio as a hole
+ * 
+ * @param file the destination, written up to its end
+ * @param length bytes of zeros
+ * 
+ * @return 0, -1 if it could not be extended
+*/
+static int skip_zeros(FILE* file, unsigned long long length){
+
+    /// Seeking past the end leaves a hole once something is written behind it; the truncate keeps a hole at the very end
+    if (fseeko(file, length, SEEK_CUR) != 0 || ftruncate(fileno(file), ftello(file)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Starts a sync transfer: computes the signatures of the existing destination file and opens the file it gets rebuilt into
+ * 
+ * @param sync sync state to fill in
+ * @param destinationFile name of the destination file
+ * 
+ * @return rudp_ok or an error code
+*/
+static int sync_begin(struct sync_state* sync, const char* destinationFile){
+
+    memset(sync, 0, sizeof(*sync));
+    sync->active = 1;
+
+    /// A missing destination file simply has no blocks to match against
+    sync->basis = fopen(destinationFile, "rb");
+    unsigned long long basis_size = 0;
+    if (sync->basis != NULL) {
+        fseek(sync->basis, 0, SEEK_END);
+        basis_size = ftell(sync->basis);
+    }
+    sync->block_size = delta_block_size(basis_size);
+    if (sync->basis != NULL) {
+        sync->sigs = delta_signatures(sync->basis, sync->block_size, &sync->nblocks);
+    }
+
+    /// Rebuild next to the destination so the final rename stays on the same file system
+    size_t name_length = strlen(destinationFile) + sizeof(".rudp-tmp");
+    sync->temp_name = malloc(name_length);
+    sync->block_buffer = malloc(sync->block_size);
+    if (sync->temp_name == NULL || sync->block_buffer == NULL) {
+        return rudp_err_memory;
+    }
+    snprintf(sync->temp_name, name_length, "%s.rudp-tmp", destinationFile);
+    sync->temp = open_destination(sync->temp_name);
+    return sync->temp != NULL ? rudp_ok : rudp_err_file;
+}
+
+/**
+ * @brief Finishes a sync transfer by replacing the destination file with the rebuilt one
+ * 
+ * @param sync sync state from sync_begin()
+ * @param destinationFile name of the destination file
+ * 
+ * @return rudp_ok, rudp_err_file if the destination could not be replaced
+*/
+static int sync_finish(struct sync_state* sync, const char* destinationFile){
+
+    int error = rudp_ok;
+    /// The rebuilt file has to be on the disk before it replaces the old one
+    if (close_durably(sync->temp) != 0 || rename(sync->temp_name, destinationFile) != 0) {
+        error = rudp_err_file;
+    }
+    if (sync->basis != NULL) {
+        fclose(sync->basis);
+    }
+
+    free(sync->temp_name);
+    free(sync->sigs);
+    free(sync->block_buffer);
+    memset(sync, 0, sizeof(*sync));
+    return error;
+}
+
+/**
+ * @brief Gives up on a sync transfer, removing the half rebuilt file and keeping the old destination
+ * 
+ * @param sync sync state from sync_begin()
+ * 
+ * @return void
+*/
+static void sync_abort(struct sync_state* sync){
+
+    /// Also cleans up after a sync_begin() that failed half way
+    if (sync->temp != NULL) {
+        fclose(sync->temp);
+        unlink(sync->temp_name);
+    }
+    if (sync->basis != NULL) {
+        fclose(sync->basis);
+    }
+
+    free(sync->temp_name);
+    free(sync->sigs);
+    free(sync->block_buffer);
+    memset(sync, 0, sizeof(*sync));
+}
+
+
+/// Largest reply: the header and a chunk of signatures, sealed
+#define reply_size max_datagram_size
+
+/*   io_uring Engine (-u)   */
+#define ring_entries 256 /// Submission queue size of the socket ring
+#define recv_buffers 256 /// Provided buffers multishot recvmsg fills, a power of two
+#define recv_buffer_size (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in6) + tuning_control_size + max_datagram_size)
+#define reply_slots 64 /// Replies that can be in flight at once, more fall back to sendto()
+#define disk_chunk_size (256 * 1024) /// Payloads are gathered into chunks this big before they are written
+#define disk_chunks 8 /// Chunks being filled or written at once
+#define disk_alignment 4096 /// O_DIRECT wants buffers, offsets and lengths aligned to the logical block size
+#define zero_piece_size 65536 /// A zero range reaches the data callback in pieces this big
+
+/// user_data of the socket ring: the kind of request in the low byte, the reply slot above it
+#define ud_recv 1
+#define ud_reply 2
+
+/// A reply handed to the kernel, its memory has to stay put until the send completes
+struct reply_slot {
+    uint8_t packet[reply_size];
+    struct sockaddr_storage address;
+    struct iovec iov;
+    struct msghdr msg;
+    int busy;
+};
+
+/// The socket side of the io_uring engine: one multishot recvmsg and the replies
+struct recv_ring {
+    struct uring ring;
+    struct uring_buf_ring buffers;
+    struct msghdr recv_msg; /// Tells multishot recvmsg how much room to leave for the address and the drop counter
+    struct reply_slot replies[reply_slots];
+    int replies_busy;
+};
+
+/// Zeros to write the ends of a zero range with, and to hand to the data callback
+static const uint8_t zero_piece[zero_piece_size];
+
+/// Plain transfers write through a disk writer: payloads are copied into aligned chunks, written with O_DIRECT where the file system
+/// allows it, through their own ring with -u and by a thread of their own otherwise, so the loop never waits for the disk
+struct disk_writer {
+    struct uring ring; /// Unused when threaded
+    int fd;
+    int direct; /// The file is open with O_DIRECT
+    uint8_t *chunks; /// disk_chunks registered buffers of disk_chunk_size
+    int busy[disk_chunks];
+    int in_flight;
+    int current; /// The chunk being filled
+    size_t fill;
+    unsigned long long offset; /// File offset of the current chunk
+    int failed;
+    struct rudp_stats *stats; /// The transfer's counters: how long each chunk took to reach the file goes into their write latencies
+    double submitted[disk_chunks]; /// When each busy chunk went to the ring
+
+    /// The writer thread; it takes the chunks in the order they fill, and busy, in_flight and failed are shared with it under lock
+    int threaded;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t queued; /// A chunk is waiting to be written, or the thread is to stop
+    pthread_cond_t written; /// A chunk is free again
+    size_t length[disk_chunks]; /// Bytes to write of each busy chunk
+    unsigned long long at[disk_chunks]; /// and where in the file
+    int next_write; /// The chunk the thread writes next
+    int stopping;
+    unsigned long long dropped; /// Without O_DIRECT: the file up to here is on the disk and out of the page cache
+    struct rudp_stats writes; /// Write latencies the thread measured, under lock until the loop moves them into stats
+};
+
+
+/// One transfer on the receiving side, driven by callbacks from the event loop
+struct rudp_receiver {
+    struct evloop *loop;
+    struct rudp_receiver_config config;
+    struct rudp_callbacks callbacks;
+    int socket_desc;
+    struct sockaddr_storage address; /// Where the last packet came from, acknowledgements go back there
+    unsigned int client_struct_length;
+    socklen_t address_length; /// Size of an address of the socket's family
+    const char *destinationFile;
+
+    /// The destination is opened once the first packet tells us whether this is a plain transfer or a sync
+    FILE *write_file;
+    struct disk_writer *disk; /// Used instead of write_file for plain transfers
+    struct sync_state sync;
+    /// index for data packets, initialized to 0
+    int index;
+    /// Payloads of data packets that arrived ahead of index (multipath), reorder_window slots of max_data_size; allocated with the first
+    uint8_t *reorder;
+    int reorder_length[reorder_window]; /// Length of the payload in each slot, -1 when it is empty
+    uint8_t reorder_type[reorder_window]; /// pkt_data or pkt_zero
+
+    struct seal seal; /// Encryption state with a cipher
+    int warned_sealed; /// Said once that sealed datagrams arrive without a cipher
+
+    /// pointer to memory for storing data to send
+    void* sendmemorypointer;
+    /// pointer to memory for storing data received
+    void* receivedmemorypointer;
+
+    struct recv_ring *ring; /// NULL when the socket is read with recvmsg()
+    struct xdp_socket *xsk; /// Points at xdp with an xdp_interface, NULL otherwise; the UDP socket is read either way
+    struct xdp_socket xdp;
+
+    struct ev_timer housekeeping_timer; /// Progress reports and the idle check
+    struct ev_timer done_timer; /// Finishes the transfer from a callback of its own, once nothing else is running
+    double last_packet; /// When the last packet arrived, 0 before the first one
+    unsigned long long udp_drops; /// The socket's SO_RXQ_OVFL counter as of the last datagram that carried it
+    int finished; /// The FIN was acknowledged
+    int timed_out; /// The sender went silent
+    int done; /// The transfer is over, the files are closed from done_timer
+    int error; /// How it ended; a failed write is remembered here while the transfer goes on
+    int finalized; /// The engines and files are closed
+    int destination_closed; /// The destination file was closed, from the FIN or from session_finish()
+
+    struct rudp_stats stats;
+    struct stats_sink metrics; /// Where config.metrics_path sends the stats
+};
+
+
+/**
+ * @brief Hands a line of information to the log callback
+ * 
+ * @param session the transfer
+ * @param format printf format of the line, without the newline
+ * 
+ * @return void
+*/
+static void session_log(struct rudp_receiver* session, const char* format, ...){
+
+    if (session->callbacks.log == NULL) {
+        return;
+    }
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    session->callbacks.log(session->callbacks.arg, message);
+}
+
+/**
+ * @brief Ends the transfer: nothing more is read, and done_timer finishes it from the loop shortly
+ * 
+ * @param session the transfer
+ * @param error rudp_ok or why it failed, an earlier error sticks
+ * 
+ * @return void
+*/
+static void session_end(struct rudp_receiver* session, int error){
+
+    if (session->done) {
+        return;
+    }
+    session->done = 1;
+    if (session->error == rudp_ok) {
+        session->error = error;
+    }
+    ev_timer_disarm(&session->housekeeping_timer);
+    ev_timer_arm(&session->done_timer, 0, 0);
+}
+
+/**
+ * @brief Remembers the first error of a transfer that keeps going
+ * 
+ * @param session the transfer
+ * @param error an error code
+ * 
+ * @return void
+*/
+static void session_error(struct rudp_receiver* session, int error){
+
+    if (session->error == rudp_ok) {
+        session->error = error;
+    }
+}
+
+/**
+ * @brief Waits for the oldest chunk write of the disk ring and checks it
+ * 
+ * @param disk the writer
+ * 
+ * @return void
+*/
+static void disk_reap(struct disk_writer* disk){
+
+    struct io_uring_cqe* cqe = uring_peek_cqe(&disk->ring);
+    if (cqe == NULL) {
+        if (uring_submit(&disk->ring, 1) < 0) {
+            /// A ring we can not wait on any more: count its writes as lost so nobody waits for them
+            disk->failed = 1;
+            disk->in_flight = 0;
+            memset(disk->busy, 0, sizeof(disk->busy));
+            return;
+        }
+        cqe = uring_peek_cqe(&disk->ring);
+    }
+
+    while (cqe != NULL) {
+        int chunk = (int)cqe->user_data;
+        if (cqe->res < 0) {
+            disk->failed = 1;
+        }
+        /// From submission to completion: what the kernel took to write the chunk
+        double latency = stats_now() - disk->submitted[chunk];
+        stats_write_latency(disk->stats, latency * 1000000);
+        trace_event(trace_write, disk->at[chunk] / disk_chunk_size, (uint32_t)(latency * 1000000000));
+        disk->busy[chunk] = 0;
+        disk->in_flight--;
+        uring_cqe_seen(&disk->ring);
+        cqe = uring_peek_cqe(&disk->ring);
+    }
+}
+
+/**
+ * @brief Hands the current chunk to the kernel and moves on to a free one
+ * 
+ * @param disk the writer
+ * @param length bytes to write, a multiple of disk_alignment unless the file is not O_DIRECT
+ * 
+ * @return void
+*/
+static void disk_submit_chunk(struct disk_writer* disk, size_t length){
+
+    /// The thread writes the chunks round robin, the next one is free once it got past it
+    if (disk->threaded) {
+        pthread_mutex_lock(&disk->lock);
+        disk->length[disk->current] = length;
+        disk->at[disk->current] = disk->offset;
+        disk->busy[disk->current] = 1;
+        disk->in_flight++;
+        pthread_cond_signal(&disk->queued);
+        disk->offset += length;
+        disk->fill = 0;
+        disk->current = (disk->current + 1) % disk_chunks;
+        while (disk->busy[disk->current]) {
+            pthread_cond_wait(&disk->written, &disk->lock);
+        }
+        pthread_mutex_unlock(&disk->lock);
+        return;
+    }
+
+    /// The ring has a slot per chunk, so it never runs out before the chunks do
+    struct io_uring_sqe* sqe = uring_get_sqe(&disk->ring);
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;
+    sqe->addr = (uint64_t)(uintptr_t)(disk->chunks + (size_t)disk->current * disk_chunk_size);
+    sqe->len = length;
+    sqe->off = disk->offset;
+    sqe->buf_index = disk->current;
+    sqe->user_data = disk->current;
+    disk->at[disk->current] = disk->offset;
+    disk->submitted[disk->current] = stats_now();
+    if (uring_submit(&disk->ring, 0) < 0) {
+        disk->failed = 1;
+    }
+
+    disk->busy[disk->current] = 1;
+    disk->in_flight++;
+    disk->offset += length;
+    disk->fill = 0;
+
+    /// Pick the next free chunk, waiting for a write to finish if all of them are on their way to the disk
+    while (disk->in_flight == disk_chunks) {
+        disk_reap(disk);
+    }
+    while (disk->busy[disk->current]) {
+        disk->current = (disk->current + 1) % disk_chunks;
+    }
+}
+
+/**
+ * @brief Writes a whole chunk at its offset, however many pwrite() calls it takes
+ * 
+ * @param fd the destination
+ * @param data the chunk
+ * @param length its length
+ * @param offset where it goes in the file
+ * 
+ * @return 0, -1 if a write failed
+*/
+static int write_chunk(int fd, const uint8_t* data, size_t length, unsigned long long offset){
+
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        length -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+/**
+ * @brief Write-behind without O_DIRECT: starts writing back the chunk just written, and waits for the ones before it
+ * to reach the disk and drops them from the page cache, so dirty pages never pile up and our file does not push other
+ * programs' pages out
+ * 
+ * @param disk the writer
+ * @param offset where the chunk just written starts
+ * @param length its length
+ * 
+ * @return void
+*/
+static void write_behind(struct disk_writer* disk, unsigned long long offset, size_t length){
+
+    sync_file_range(disk->fd, offset, length, SYNC_FILE_RANGE_WRITE);
+    if (offset > disk->dropped) {
+        sync_file_range(disk->fd, disk->dropped, offset - disk->dropped,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(disk->fd, disk->dropped, offset - disk->dropped, POSIX_FADV_DONTNEED);
+        disk->dropped = offset;
+    }
+}
+
+/**
+ * @brief The writer thread: writes the chunks as they fill, in order, until the writer closes
+ * 
+ * @param arg the writer
+ * 
+ * @return NULL
+*/
+static void* disk_thread(void* arg){
+
+    struct disk_writer* disk = arg;
+    pthread_mutex_lock(&disk->lock);
+    for (;;) {
+        while (!disk->busy[disk->next_write] && !disk->stopping) {
+            pthread_cond_wait(&disk->queued, &disk->lock);
+        }
+        int chunk = disk->next_write;
+        if (!disk->busy[chunk]) {
+            break;
+        }
+        pthread_mutex_unlock(&disk->lock);
+
+        double start = stats_now();
+        int failed = write_chunk(disk->fd, disk->chunks + (size_t)chunk * disk_chunk_size, disk->length[chunk], disk->at[chunk]) < 0;
+        double latency = stats_now() - start;
+        trace_event(trace_write, disk->at[chunk] / disk_chunk_size, (uint32_t)(latency * 1000000000));
+        if (!disk->direct && !failed) {
+            write_behind(disk, disk->at[chunk], disk->length[chunk]);
+        }
+
+        pthread_mutex_lock(&disk->lock);
+        stats_write_latency(&disk->writes, latency * 1000000);
+        disk->failed |= failed;
+        disk->busy[chunk] = 0;
+        disk->in_flight--;
+        disk->next_write = (chunk + 1) % disk_chunks;
+        pthread_cond_signal(&disk->written);
+    }
+    pthread_mutex_unlock(&disk->lock);
+    return NULL;
+}
+
+/**
+ * @brief Starts the writer thread
+ * 
+ * @param disk the writer, with its file and chunks
+ * 
+ * @return 0, -1 if the thread could not be started
+*/
+static int disk_start_thread(struct disk_writer* disk){
+
+    disk->threaded = 1;
+    pthread_mutex_init(&disk->lock, NULL);
+    pthread_cond_init(&disk->queued, NULL);
+    pthread_cond_init(&disk->written, NULL);
+    if (pthread_create(&disk->thread, NULL, disk_thread, disk) != 0) {
+        pthread_mutex_destroy(&disk->lock);
+        pthread_cond_destroy(&disk->queued);
+        pthread_cond_destroy(&disk->written);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Opens the destination of a plain transfer for writing in aligned chunks, through io_uring or a writer thread
+ * 
+ * @param destinationFile name of the file
+ * @param use_ring write through io_uring; the thread takes over where it can not be set up
+ * @param stats the transfer's counters, the latency of every chunk write is added to them
+ * 
+ * @return the writer, NULL if neither could be set up (the caller falls back to stdio)
+*/
+static struct disk_writer* disk_open(const char* destinationFile, int use_ring, struct rudp_stats* stats){
+
+    struct disk_writer* disk = calloc(1, sizeof(*disk));
+    if (disk == NULL) {
+        return NULL;
+    }
+    disk->stats = stats;
+
+    /// tmpfs and a few others refuse O_DIRECT, the writes still go through the ring there
+    disk->fd = open(destinationFile, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    disk->direct = 1;
+    if (disk->fd < 0 && errno == EINVAL) {
+        disk->fd = open(destinationFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        disk->direct = 0;
+    }
+    if (disk->fd < 0) {
+        free(disk);
+        return NULL;
+    }
+
+    if (posix_memalign((void**)&disk->chunks, disk_alignment, (size_t)disk_chunks * disk_chunk_size) != 0) {
+        close(disk->fd);
+        free(disk);
+        return NULL;
+    }
+
+    struct iovec iovecs[disk_chunks];
+    for (int i = 0; i < disk_chunks; i++) {
+        iovecs[i].iov_base = disk->chunks + (size_t)i * disk_chunk_size;
+        iovecs[i].iov_len = disk_chunk_size;
+    }
+    if (use_ring && uring_init(&disk->ring, disk_chunks) == 0) {
+        if (uring_register_files(&disk->ring, &disk->fd, 1) == 0 && uring_register_buffers(&disk->ring, iovecs, disk_chunks) == 0) {
+            return disk;
+        }
+        uring_close(&disk->ring);
+    }
+    if (disk_start_thread(disk) < 0) {
+        close(disk->fd);
+        free(disk->chunks);
+        free(disk);
+        return NULL;
+    }
+    return disk;
+}
+
+/**
+ * @brief Appends a payload to the destination
+ * 
+ * @param disk the writer
+ * @param data the payload
+ * @param length its length
+ * 
+ * @return 1 if the earlier writes all succeeded, 0 otherwise
+*/
+static int disk_append(struct disk_writer* disk, const uint8_t* data, size_t length){
+
+    while (length > 0) {
+        size_t room = disk_chunk_size - disk->fill;
+        size_t part = length < room ? length : room;
+        memcpy(disk->chunks + (size_t)disk->current * disk_chunk_size + disk->fill, data, part);
+        disk->fill += part;
+        data += part;
+        length -= part;
+
+        if (disk->fill == disk_chunk_size) {
+            disk_submit_chunk(disk, disk_chunk_size);
+        }
+    }
+    if (disk->threaded) {
+        pthread_mutex_lock(&disk->lock);
+        int failed = disk->failed;
+        if (disk->writes.writes > 0) {
+            stats_merge_writes(disk->stats, &disk->writes);
+        }
+        pthread_mutex_unlock(&disk->lock);
+        return !failed;
+    }
+    return !disk->failed;
+}
+
+/**
+ * @brief Appends a run of zeros to the destination as a hole: the whole blocks in it are skipped, only its ends are written
+ * 
+ * The file is new, so what is skipped reads back as zeros and takes no space.
+ * 
+ * @param disk the writer
+ * @param length bytes of zeros
+ * 
+ * @return 1 if the earlier writes all succeeded, 0 otherwise
+*/
+static int disk_skip(struct disk_writer* disk, unsigned long long length){
+
+    /// Zeros up to the next block boundary go into the chunk like any payload, so the chunk ends on one
+    size_t head = (disk_alignment - (disk->offset + disk->fill) % disk_alignment) % disk_alignment;
+    if (head > length) {
+        head = length;
+    }
+    disk_append(disk, zero_piece, head);
+    length -= head;
+
+    if (length >= disk_alignment) {
+        if (disk->fill > 0) {
+            disk_submit_chunk(disk, disk->fill);
+        }
+        unsigned long long skip = length & ~(unsigned long long)(disk_alignment - 1);
+        disk->offset += skip;
+        length -= skip;
+    }
+    return disk_append(disk, zero_piece, length);
+}
+
+/**
+ * @brief Writes what is left, waits for every write, makes the file durable and closes it
+ * 
+ * This is the only fsync of a transfer: it runs once the FIN came in, before the FIN is acknowledged, never per chunk.
+ * 
+ * @param disk the writer, freed
+ * 
+ * @return rudp_ok, rudp_err_file if a write failed
+*/
+static int disk_close(struct disk_writer* disk){
+
+    unsigned long long size = disk->offset + disk->fill;
+
+    /// O_DIRECT only writes whole blocks: write the tail rounded up and cut the file back to size afterwards
+    if (disk->fill > 0) {
+        size_t length = disk->fill;
+        if (disk->direct) {
+            length = (length + disk_alignment - 1) & ~(size_t)(disk_alignment - 1);
+            memset(disk->chunks + (size_t)disk->current * disk_chunk_size + disk->fill, 0, length - disk->fill);
+        }
+        disk_submit_chunk(disk, length);
+    }
+    if (disk->threaded) {
+        pthread_mutex_lock(&disk->lock);
+        disk->stopping = 1;
+        pthread_cond_signal(&disk->queued);
+        pthread_mutex_unlock(&disk->lock);
+        pthread_join(disk->thread, NULL);
+        stats_merge_writes(disk->stats, &disk->writes);
+        pthread_mutex_destroy(&disk->lock);
+        pthread_cond_destroy(&disk->queued);
+        pthread_cond_destroy(&disk->written);
+    } else {
+        while (disk->in_flight > 0) {
+            disk_reap(disk);
+        }
+        uring_close(&disk->ring);
+    }
+
+    int error = disk->failed ? rudp_err_file : rudp_ok;
+    if (ftruncate(disk->fd, size) < 0 || fdatasync(disk->fd) < 0 || close(disk->fd) < 0) {
+        error = rudp_err_file;
+    }
+    free(disk->chunks);
+    free(disk);
+    return error;
+}
+
+/**
+ * @brief Queues a multishot recvmsg on the socket, it keeps completing until it runs out of buffers
+ * 
+ * @param ring the socket ring
+ * 
+ * @return rudp_ok or an error code
+*/
+static int ring_arm_recv(struct recv_ring* ring){
+
+    struct io_uring_sqe* sqe = uring_get_sqe(&ring->ring);
+    if (sqe == NULL) {
+        return rudp_err_system;
+    }
+    uring_prep_recvmsg_multishot(sqe, 0, &ring->recv_msg, 0);
+    sqe->user_data = ud_recv;
+    return rudp_ok;
+}
+
+/**
+ * @brief Sets up the io_uring engine for the socket
+ * 
+ * @param socket_desc the bound socket
+ * @param address_length size of an address of its family
+ * 
+ * @return the engine, NULL if io_uring is not available
+*/
+static struct recv_ring* ring_open(int socket_desc, socklen_t address_length){
+
+    struct recv_ring* ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    if (uring_init(&ring->ring, ring_entries) < 0) {
+        free(ring);
+        return NULL;
+    }
+    if (uring_register_files(&ring->ring, &socket_desc, 1) < 0 ||
+        uring_buf_ring_init(&ring->ring, &ring->buffers, 0, recv_buffers, recv_buffer_size) < 0) {
+        uring_close(&ring->ring);
+        free(ring);
+        return NULL;
+    }
+    ring->recv_msg.msg_namelen = address_length;
+    ring->recv_msg.msg_controllen = tuning_control_size;
+
+    for (int i = 0; i < reply_slots; i++) {
+        struct reply_slot* slot = &ring->replies[i];
+        slot->iov.iov_base = slot->packet;
+        slot->msg.msg_name = &slot->address;
+        slot->msg.msg_iov = &slot->iov;
+        slot->msg.msg_iovlen = 1;
+    }
+
+    if (ring_arm_recv(ring) != rudp_ok || uring_submit(&ring->ring, 0) < 0) {
+        uring_buf_ring_free(&ring->buffers);
+        uring_close(&ring->ring);
+        free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+/**
+ * @brief Closes the destination file opened for writing: a sync swaps the rebuilt file in, an empty transfer still creates the file
+ * 
+ * Runs when the FIN comes in, before it is acknowledged, so the sender only hears of success once the
+ * file is on the disk; a transfer that ended any other way closes it from session_finish().
+ * 
+ * @param session the transfer, its error decides what happens to the files and a failure is recorded in it
+ * 
+ * @return void
+*/
+static void close_destination(struct rudp_receiver* session){
+
+    if (session->destination_closed) {
+        return;
+    }
+    session->destination_closed = 1;
+
+    struct sync_state* sync = &session->sync;
+    if (sync->active && session->error != rudp_ok) {
+        /// Half a rebuild is worse than the old file, leave that one alone
+        sync_abort(sync);
+    } else if (sync->active) {
+        if (sync_finish(sync, session->destinationFile) != rudp_ok) {
+            session_log(session, "Could not replace the destination file");
+            session->error = rudp_err_file;
+        }
+    } else if (session->disk != NULL) {
+        session_error(session, disk_close(session->disk));
+    } else if (session->destinationFile != NULL) {
+        if (session->write_file == NULL && session->error == rudp_ok) {
+            session->write_file = open_destination(session->destinationFile);
+            if (session->write_file == NULL) {
+                session->error = rudp_err_file;
+            }
+        }
+        if (session->write_file != NULL && close_durably(session->write_file) != 0) {
+            session_error(session, rudp_err_file);
+        }
+    }
+    session->disk = NULL;
+    session->write_file = NULL;
+}
+
+/**
+ * @brief Sends the reply built in sendmemorypointer to whoever sent the last packet
+ * 
+ * With io_uring the reply is copied into a free slot and queued, it goes out with the next submission.
+ * With a cipher it is sealed first.
+ * 
+ * @param session the transfer
+ * @param length length of the reply
+ * 
+ * @return void
+*/
+static void send_reply(struct rudp_receiver* session, size_t length){
+
+    /// Sealed in place, with a counter of its own: a repeated ack is a new datagram to the sender
+    if (session->config.cipher != rudp_cipher_none) {
+        struct iovec reply = { session->sendmemorypointer, length };
+        length = seal_packet(&session->seal, &reply, 1, session->sendmemorypointer);
+        if (length == 0) {
+            return;
+        }
+    }
+
+    struct recv_ring* ring = session->ring;
+    if (ring != NULL && ring->replies_busy < reply_slots) {
+        int i = 0;
+        while (ring->replies[i].busy) {
+            i++;
+        }
+        struct io_uring_sqe* sqe = uring_get_sqe(&ring->ring);
+        if (sqe != NULL) {
+            struct reply_slot* slot = &ring->replies[i];
+            memcpy(slot->packet, session->sendmemorypointer, length);
+            slot->address = session->address;
+            slot->msg.msg_namelen = session->client_struct_length;
+            slot->iov.iov_len = length;
+            slot->busy = 1;
+            ring->replies_busy++;
+
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->flags = IOSQE_FIXED_FILE;
+            sqe->fd = 0;
+            sqe->addr = (uint64_t)(uintptr_t)&slot->msg;
+            sqe->len = 1;
+            sqe->user_data = ud_reply | (i << 8);
+            return;
+        }
+    }
+
+    sendto(session->socket_desc, session->sendmemorypointer, length, 0, (struct sockaddr*)&session->address, session->client_struct_length);
+}
+
+/**
+ * @brief Delivers a payload of a transfer into memory: copied to its offset in the buffer sink, unless the socket already read it there
+ * 
+ * @param session the transfer, without a destination file
+ * @param data the payload
+ * @param length its length
+ * 
+ * @return rudp_ok, rudp_err_overflow if it does not fit the buffer
+*/
+static int memory_write(struct rudp_receiver* session, const uint8_t* data, size_t length){
+
+    /// Without a buffer the data callback is the only sink
+    if (session->config.buffer == NULL) {
+        return rudp_ok;
+    }
+    if (length > session->config.buffer_size - session->stats.bytes) {
+        return rudp_err_overflow;
+    }
+    uint8_t* destination = session->config.buffer + session->stats.bytes;
+    if (data != destination) {
+        memcpy(destination, data, length);
+    }
+    return rudp_ok;
+}
+
+/**
+ * @brief Delivers a zero range of a transfer into memory: the buffer sink gets the zeros at their offset
+ * 
+ * @param session the transfer, without a destination file
+ * @param length bytes of zeros
+ * 
+ * @return rudp_ok, rudp_err_overflow if they do not fit the buffer
+*/
+static int memory_zero(struct rudp_receiver* session, unsigned long long length){
+
+    if (session->config.buffer == NULL) {
+        return rudp_ok;
+    }
+    if (length > session->config.buffer_size - session->stats.bytes) {
+        return rudp_err_overflow;
+    }
+    memset(session->config.buffer + session->stats.bytes, 0, length);
+    return rudp_ok;
+}
+
+/**
+ * @brief Counts a zero range as written, handing its zeros to the data callback a piece at a time
+ * 
+ * @param session the transfer
+ * @param length bytes of zeros
+ * 
+ * @return void
+*/
+static void deliver_zeros(struct rudp_receiver* session, unsigned long long length){
+
+    while (length > 0) {
+        size_t piece = length < zero_piece_size ? length : zero_piece_size;
+        if (session->callbacks.data != NULL) {
+            session->callbacks.data(session->callbacks.arg, zero_piece, piece, session->stats.bytes);
+        }
+        session->stats.bytes += piece;
+        length -= piece;
+    }
+}
+
+/**
+ * @brief Points recvmsg() at where the next datagram goes: into the receive buffer, or with a buffer sink its header
+ * there and its payload right where the next data belongs in the caller's buffer
+ * 
+ * Whatever else arrives (a retransmission, a FIN) lands in the undelivered part of the buffer as well, which is
+ * scratch until the data that belongs there arrives; a payload longer than the room left spills into the receive buffer.
+ * 
+ * @param session the transfer
+ * @param iov filled in, room for three
+ * 
+ * @return the number of iovecs
+*/
+static int receive_iov(struct rudp_receiver* session, struct iovec* iov){
+
+    uint8_t* received = session->receivedmemorypointer;
+    size_t room = 0;
+    /// A sealed datagram is opened in one piece, so it always lands in the receive buffer
+    if (session->destinationFile == NULL && session->config.buffer != NULL && session->config.cipher == rudp_cipher_none) {
+        room = session->config.buffer_size - session->stats.bytes;
+        if (room > max_data_size) {
+            room = max_data_size;
+        }
+    }
+    if (room == 0) {
+        iov[0].iov_base = received;
+        iov[0].iov_len = max_datagram_size;
+        return 1;
+    }
+
+    iov[0].iov_base = received;
+    iov[0].iov_len = header_size;
+    iov[1].iov_base = session->config.buffer + session->stats.bytes;
+    iov[1].iov_len = room;
+    iov[2].iov_base = received + header_size + room;
+    iov[2].iov_len = max_data_size - room;
+    return 3;
+}
+
+/**
+ * @brief Writes the payload of the next data packet or applies the next delta operation, and reports the progress
+ * 
+ * A zero range writes its zeros as a hole in a file, and as zeros into memory and to the data callback.
+ * 
+ * @param session the transfer
+ * @param type pkt_data, pkt_zero or pkt_delta
+ * @param index the packet's index
+ * @param data the payload
+ * @param length its length
+ * 
+ * @return 1, 0 if the transfer ended
+*/
+static int deliver_payload(struct rudp_receiver* session, uint8_t type, uint32_t index, uint8_t* data, size_t length){
+
+    struct sync_state* sync = &session->sync;
+    struct rudp_stats* stats = &session->stats;
+    (void)index; /// Only traced
+
+    /// A zero range stands for that many zeros
+    uint64_t zeros = 0;
+    if (type == pkt_zero) {
+        if (length != zero_frame_size) {
+            session_log(session, "Malformed zero range packet");
+            session_end(session, rudp_err_protocol);
+            return 0;
+        }
+        memcpy(&zeros, data, zero_frame_size);
+        stats->sparse_bytes += zeros;
+    }
+
+    /// Check if write was successful, timing the write for the latency histogram
+    int write_ok;
+    double write_start = stats_now();
+    if (type == pkt_delta) {
+        /// Apply the delta operation on top of the old file
+        write_ok = (delta_apply(sync->basis, session->write_file, sync->block_size, data, length, sync->block_buffer) == 0);
+        stats->bytes = ftell(session->write_file);
+    } else if (session->destinationFile == NULL) {
+        /// Receiving into memory
+        int error = type == pkt_zero ? memory_zero(session, zeros) : memory_write(session, data, length);
+        if (error != rudp_ok) {
+            session_log(session, "The transfer does not fit the %zu byte buffer", session->config.buffer_size);
+            session_end(session, error);
+            return 0;
+        }
+        write_ok = 1;
+        if (type == pkt_zero) {
+            deliver_zeros(session, zeros);
+        } else {
+            if (session->callbacks.data != NULL) {
+                session->callbacks.data(session->callbacks.arg, data, length, stats->bytes);
+            }
+            stats->bytes += length;
+        }
+    } else {
+        if (session->write_file == NULL && session->disk == NULL) {
+            session->disk = disk_open(session->destinationFile, session->ring != NULL, stats);
+            if (session->disk == NULL) {
+                session->write_file = open_destination(session->destinationFile);
+            }
+            if (session->disk == NULL && session->write_file == NULL) {
+                session_log(session, "Could not open %s", session->destinationFile);
+                session_end(session, rudp_err_file);
+                return 0;
+            }
+        }
+
+        /// Write the data from the data portion of the received memory, or leave a hole for a zero range
+        if (type == pkt_zero) {
+            write_ok = session->disk != NULL ? disk_skip(session->disk, zeros) : skip_zeros(session->write_file, zeros) == 0;
+            deliver_zeros(session, zeros);
+        } else {
+            if (session->disk != NULL) {
+                write_ok = disk_append(session->disk, data, length);
+            } else {
+                size_t written = fwrite(data, 1, length, session->write_file);
+                write_ok = (written == length);
+            }
+            if (session->callbacks.data != NULL) {
+                session->callbacks.data(session->callbacks.arg, data, length, stats->bytes);
+            }
+            stats->bytes += length;
+        }
+    }
+
+    /// The disk writer times its own writes, copying a payload into a chunk is not one
+    if (session->disk == NULL) {
+        double write_latency = stats_now() - write_start;
+        stats_write_latency(stats, write_latency * 1000000);
+        trace_event(trace_write, index, (uint32_t)(write_latency * 1000000000));
+    }
+
+    if (!write_ok && session->error == rudp_ok) {
+        session_log(session, "Error during writing to file!");
+        session_error(session, rudp_err_file);
+    }
+    if (session->callbacks.progress != NULL) {
+        session->callbacks.progress(session->callbacks.arg, stats);
+    }
+    return 1;
+}
+
+/**
+ * @brief Keeps the payload of a data packet that arrived ahead of the next index until the ones before it are in
+ * 
+ * @param session the transfer
+ * @param index the packet's index, within reorder_window of the next one
+ * @param type pkt_data or pkt_zero
+ * @param data the payload
+ * @param length its length
+ * 
+ * @return rudp_ok or rudp_err_memory
+*/
+static int hold_payload(struct rudp_receiver* session, uint32_t index, uint8_t type, const uint8_t* data, size_t length){
+
+    if (session->reorder == NULL) {
+        session->reorder = malloc(reorder_window * max_data_size);
+        if (session->reorder == NULL) {
+            return rudp_err_memory;
+        }
+        for (int i = 0; i < reorder_window; i++) {
+            session->reorder_length[i] = -1;
+        }
+    }
+
+    int slot = index % reorder_window;
+    if (session->reorder_length[slot] >= 0) {
+        /// Sent again over another path before its ack got back
+        session->stats.duplicates++;
+        return rudp_ok;
+    }
+    memcpy(session->reorder + slot * max_data_size, data, length);
+    session->reorder_length[slot] = length;
+    session->reorder_type[slot] = type;
+    session->stats.reordered++;
+    return rudp_ok;
+}
+
+/**
+ * @brief Handles one packet from the sender and sends the acknowledgement
+ * 
+ * With a cipher the datagram is opened first, in place; one that does not authenticate, belongs to another
+ * transfer or was seen before is dropped without an answer.
+ * 
+ * @param session the transfer
+ * @param packet the packet
+ * @param client_message size of the packet
+ * @param payload the packet's payload, packet + header_size unless the socket read it straight into the buffer sink
+ * 
+ * @return void
+*/
+static void handle_packet(struct rudp_receiver* session, uint8_t* packet, size_t client_message, uint8_t* payload){
+
+    if (session->config.cipher != rudp_cipher_none) {
+        ssize_t opened = seal_open(&session->seal, packet, client_message);
+        if (opened < 0) {
+            session->stats.rejected++;
+            return;
+        }
+        client_message = opened;
+    } else if (packet[type_offset] & pkt_sealed) {
+        if (!session->warned_sealed) {
+            session_log(session, "The sender encrypts but no key is set, dropping its datagrams");
+            session->warned_sealed = 1;
+        }
+        session->stats.rejected++;
+        return;
+    }
+
+    /// acknowledgement flag value holder, initialized to 0
+    uint8_t ack = 0;
+    /// pointer to address of acknowledgement flag
+    void* ackpointer = session->sendmemorypointer;
+    /// pointers to the respective bytes of the received packet
+    void* finpointer = packet + 1;
+    void* indexpointer = packet + 2;
+    void* datapointer = payload;
+    void* sendmemorypointer = session->sendmemorypointer;
+    struct sync_state* sync = &session->sync;
+    struct rudp_stats* stats = &session->stats;
+
+    /// reset the reply header
+    memset(sendmemorypointer, 0, header_size);
+
+    stats->packets_received++;
+    if (stats->packets_received == 1) {
+        /// Rates count from the first packet, not from when we started listening
+        stats->start_time = stats_now();
+    }
+    stats_tick(stats, &session->metrics);
+
+    /// Variable to hold value of finish flag received
+    uint8_t fincomp;
+    /// Variable to hold value of index received
+    uint32_t indexcomp = 0;
+
+    /// Copy data stored at address of finpointer and indexpointer into variable to use for comparisons
+    memcpy(&fincomp, (uint8_t*)finpointer, 1);
+    if (client_message >= header_size) {
+        memcpy(&indexcomp, (uint8_t*)indexpointer, 4);
+    }
+    trace_event(trace_recv, indexcomp, client_message);
+
+    /// Check if value of finish flag is set to 1, in which case the transfer is over
+    if (fincomp == 1) {
+
+        trace_event(trace_fin, indexcomp, 0);
+        /// The sender reports success as soon as the FIN is acknowledged, so the file has to be on the disk first
+        close_destination(session);
+
+        /// Set acknowledgement flag high if the file was written, low to tell the sender it was not
+        ack = session->error == rudp_ok;
+        /// Copy value of acknowledgement flag and the packet type into memory
+        memcpy(ackpointer, &ack, 1);
+        memcpy((char*)sendmemorypointer+type_offset, &fincomp, 1);
+
+        /// Send the reply to the sender, then wrap the transfer up
+        send_reply(session, header_size);
+        if (!ack) {
+            session_log(session, "Could not write the file: %s", rudp_strerror(session->error));
+        }
+        session->finished = ack;
+        session_end(session, rudp_ok);
+
+    } 
+    /// Check if the sender is asking for a chunk of the block signatures of our existing file
+    else if (fincomp == pkt_sig) {
+
+        /// The first request starts the sync, later ones (and retransmissions) are answered from the same signatures
+        if (!sync->active) {
+            if (session->destinationFile == NULL) {
+                session_log(session, "A sync needs a destination file to compare against");
+                session_end(session, rudp_err_invalid);
+                return;
+            }
+            int error = sync_begin(sync, session->destinationFile);
+            if (error != rudp_ok) {
+                session_log(session, "Could not start the sync: %s", rudp_strerror(error));
+                sync_abort(sync);
+                session_end(session, error);
+                return;
+            }
+            session_log(session, "Sync requested, existing file has %u blocks of %u bytes", sync->nblocks, sync->block_size);
+            session->write_file = sync->temp;
+        }
+
+        /// Answer with the requested chunk, echoing the type and index of the request
+        ack = 1;
+        memcpy(ackpointer, &ack, 1);
+        memcpy((char*)sendmemorypointer+type_offset, &fincomp, 1);
+        memcpy((char*)sendmemorypointer+index_offset, &indexcomp, 4);
+        size_t length = delta_sig_chunk(sync->sigs, sync->nblocks, sync->block_size, indexcomp, (uint8_t*)sendmemorypointer+data_offset);
+
+        send_reply(session, header_size+length);
+
+    }
+    /// Check if the index of the data is equal to the index count of the receiver (delta operations only make sense during a sync)
+    else if(indexcomp == session->index && client_message >= header_size && (fincomp == pkt_data || fincomp == pkt_zero || (fincomp == pkt_delta && sync->active))) {
+
+        if (!deliver_payload(session, fincomp, indexcomp, datapointer, client_message-6)) {
+            return;
+        }
+
+        /// Set acknowledgement flag high, to indicate that the correct index was received to the sender
+        ack = 1;
+        /// Copy value of acknowledgement flag, the packet type and the index into memory
+        memcpy(ackpointer, &ack, 1);
+        memcpy((char*)sendmemorypointer+type_offset, &fincomp, 1);
+        memcpy((char*)sendmemorypointer+index_offset, &indexcomp, 4);
+
+        /// Send the acknowledgement to the sender
+        send_reply(session, header_size);
+        trace_event(trace_ack_sent, indexcomp, 0);
+
+        /// Increment the index keeping count of how many successful data packets were received and written to the destination
+        session->index++;
+
+        /// Packets that arrived ahead of this one over other paths follow it out of the reorder buffer
+        while (session->reorder != NULL && fincomp != pkt_delta) {
+            int slot = session->index % reorder_window;
+            int length = session->reorder_length[slot];
+            if (length < 0) {
+                break;
+            }
+            session->reorder_length[slot] = -1;
+            if (!deliver_payload(session, session->reorder_type[slot], session->index, session->reorder + slot * max_data_size, length)) {
+                return;
+            }
+            session->index++;
+        }
+
+    }
+    /// Check if this data packet is ahead of the next index but within the reorder window, hold it until the gap is filled and acknowledge it
+    else if((fincomp == pkt_data || fincomp == pkt_zero) && client_message >= header_size && indexcomp > (uint32_t)session->index && indexcomp - session->index < reorder_window) {
+
+        int error = hold_payload(session, indexcomp, fincomp, datapointer, client_message-6);
+        if (error != rudp_ok) {
+            session_end(session, error);
+            return;
+        }
+
+        ack = 1;
+        memcpy(ackpointer, &ack, 1);
+        memcpy((char*)sendmemorypointer+type_offset, &fincomp, 1);
+        memcpy((char*)sendmemorypointer+index_offset, &indexcomp, 4);
+
+        send_reply(session, header_size);
+        trace_event(trace_ack_sent, indexcomp, 0);
+    }
+    /// Check if this is a retransmission of a packet we already wrote (its ack got lost), acknowledge it again without writing
+    else if(indexcomp < session->index && (fincomp == pkt_data || fincomp == pkt_zero || fincomp == pkt_delta)) {
+
+        stats->duplicates++;
+
+        ack = 1;
+        memcpy(ackpointer, &ack, 1);
+        memcpy((char*)sendmemorypointer+type_offset, &fincomp, 1);
+        memcpy((char*)sendmemorypointer+index_offset, &indexcomp, 4);
+
+        send_reply(session, header_size);
+        trace_event(trace_ack_sent, indexcomp, 0);
+    }
+    /// If none of the above conditions were met, assume that the index of the data packet was incorrect
+    else {
+
+        stats->out_of_order++;
+
+        /// Set acknowledgement flag low, to indicate that an incorrect index was received to the sender
+        ack = 0;
+        /// Copy value of acknowledgement flag into memory
+        memcpy(ackpointer, &ack, 1);
+        /// Copy value of current index to be received into memory
+        memcpy((char*)sendmemorypointer+index_offset, &session->index, 4);
+
+        /// Send the nack to the sender
+        send_reply(session, header_size);
+        trace_event(trace_nack_sent, session->index, 0);
+    }
+}
+
+/**
+ * @brief Socket callback: handles every packet that is waiting
+ * 
+ * @return void
+*/
+static void on_socket(struct evloop* loop, int fd, uint32_t events, void* arg){
+
+    struct rudp_receiver* session = arg;
+    uint64_t control[(tuning_control_size + 7) / 8];
+    (void)loop;
+    (void)events;
+
+    while (!session->done) {
+
+        /// Read a message from the sender, and store size of message in variable client_message (the socket never blocks)
+        struct iovec iov[3];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &session->address;
+        msg.msg_namelen = sizeof(session->address);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = receive_iov(session, iov);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t client_message = recvmsg(fd, &msg, 0);
+        if (client_message < 0) {
+            return;
+        }
+        session->client_struct_length = msg.msg_namelen;
+        tuning_drops(&msg, &session->udp_drops);
+
+        /// Anything shorter than a FIN is not ours
+        session->last_packet = stats_now();
+        uint8_t* packet = session->receivedmemorypointer;
+        uint8_t* payload = packet + header_size;
+        if (msg.msg_iovlen > 1) {
+            if ((size_t)client_message <= header_size + iov[1].iov_len) {
+                payload = iov[1].iov_base;
+            } else {
+                /// Spilled over, put the payload back together behind the header
+                memcpy(payload, iov[1].iov_base, iov[1].iov_len);
+            }
+        }
+        if (client_message >= 2) {
+            handle_packet(session, packet, client_message, payload);
+        }
+    }
+}
+
+/**
+ * @brief Handles one completion of the socket ring
+ * 
+ * @param session the transfer
+ * @param cqe the completion
+ * 
+ * @return void
+*/
+static void ring_complete(struct rudp_receiver* session, struct io_uring_cqe* cqe){
+
+    struct recv_ring* ring = session->ring;
+
+    if ((cqe->user_data & 0xff) == ud_reply) {
+        struct reply_slot* slot = &ring->replies[cqe->user_data >> 8];
+        if (cqe->res < 0) {
+            session_log(session, "reply: %s", strerror(-cqe->res));
+        }
+        slot->busy = 0;
+        ring->replies_busy--;
+        return;
+    }
+
+    /// A multishot recvmsg without IORING_CQE_F_MORE has ended (out of buffers, for one) and needs to be queued again
+    if (!(cqe->flags & IORING_CQE_F_MORE) && !session->done && ring_arm_recv(ring) != rudp_ok) {
+        session_end(session, rudp_err_system);
+    }
+
+    uint8_t* payload;
+    size_t length;
+    struct sockaddr* name;
+    int id = uring_recvmsg_payload(&ring->buffers, cqe, &ring->recv_msg, &payload, &length, &name);
+    if (id < 0) {
+        return;
+    }
+    if (cqe->res >= 0 && !session->done) {
+        struct msghdr control;
+        uring_recvmsg_control(&ring->buffers, cqe, &ring->recv_msg, &control);
+        tuning_drops(&control, &session->udp_drops);
+        memcpy(&session->address, name, session->address_length);
+        session->client_struct_length = session->address_length;
+        session->last_packet = stats_now();
+        if (length >= 2) {
+            handle_packet(session, payload, length, payload + header_size);
+        }
+    }
+    uring_buf_ring_recycle(&ring->buffers, id);
+}
+
+/**
+ * @brief Ring callback: handles every completion, then submits the replies they queued in one go
+ * 
+ * @return void
+*/
+static void on_ring(struct evloop* loop, int fd, uint32_t events, void* arg){
+
+    struct rudp_receiver* session = arg;
+    struct io_uring_cqe* cqe;
+    (void)loop; (void)fd; (void)events;
+
+    while ((cqe = uring_peek_cqe(&session->ring->ring)) != NULL) {
+        ring_complete(session, cqe);
+        uring_cqe_seen(&session->ring->ring);
+    }
+    if (uring_submit(&session->ring->ring, 0) < 0) {
+        session_end(session, rudp_err_system);
+    }
+}
+
+/**
+ * @brief Sends the replies still queued (the FIN acknowledgement, at least) and closes the engine
+ * 
+ * @param session the transfer
+ * 
+ * @return void
+*/
+static void ring_close(struct rudp_receiver* session){
+
+    struct recv_ring* ring = session->ring;
+    uring_submit(&ring->ring, 0);
+    while (ring->replies_busy > 0 && uring_submit(&ring->ring, 1) >= 0) {
+        struct io_uring_cqe* cqe;
+        while ((cqe = uring_peek_cqe(&ring->ring)) != NULL) {
+            ring_complete(session, cqe);
+            uring_cqe_seen(&ring->ring);
+        }
+    }
+
+    uring_close(&ring->ring);
+    uring_buf_ring_free(&ring->buffers);
+    free(ring);
+    session->ring = NULL;
+}
+
+/**
+ * @brief Handles a datagram that came in through AF_XDP
+ * 
+ * @return void
+*/
+static void xdp_packet(void* arg, uint8_t* payload, size_t length, const struct sockaddr_in* from){
+
+    struct rudp_receiver* session = arg;
+    if (session->done) {
+        return;
+    }
+
+    /// AF_XDP only takes IPv4 off the wire, a dual stack socket replies to it mapped into IPv6
+    if (session->address_length == sizeof(struct sockaddr_in6)) {
+        session->client_struct_length = resolve_map_v6((const struct sockaddr*)from, &session->address);
+    } else {
+        memcpy(&session->address, from, sizeof(*from));
+        session->client_struct_length = sizeof(*from);
+    }
+    session->last_packet = stats_now();
+    if (length >= 2) {
+        handle_packet(session, payload, length, payload + header_size);
+    }
+}
+
+/**
+ * @brief AF_XDP callback: handles every datagram in the rx ring
+ * 
+ * @return void
+*/
+static void on_xdp(struct evloop* loop, int fd, uint32_t events, void* arg){
+
+    struct rudp_receiver* session = arg;
+    (void)loop; (void)fd; (void)events;
+
+    xdp_receive(session->xsk, xdp_packet, session);
+    if (session->ring != NULL && uring_submit(&session->ring->ring, 0) < 0) {
+        session_end(session, rudp_err_system);
+    }
+}
+
+/**
+ * @brief Brings the kernel drop count in the stats up to date
+ * 
+ * @param session the transfer
+ * 
+ * @return void
+*/
+static void update_drops(struct rudp_receiver* session){
+
+    session->stats.socket_drops = session->udp_drops;
+    if (session->xsk != NULL) {
+        session->stats.socket_drops += xdp_drops(session->xsk);
+    }
+}
+
+
+/**
+ * @brief Timer callback: progress reports while nothing arrives, and giving up on a sender that went silent
+ * 
+ * @return void
+*/
+static void on_housekeeping(struct evloop* loop, int fd, uint32_t events, void* arg){
+
+    struct rudp_receiver* session = arg;
+    double idle_timeout = session->config.idle_timeout;
+    (void)loop; (void)fd; (void)events;
+
+    if (ev_timer_ack(&session->housekeeping_timer) == 0) {
+        return;
+    }
+    update_drops(session);
+    stats_tick(&session->stats, &session->metrics);
+
+    /// Before the first packet we wait as long as it takes, after it the sender has idle_timeout seconds between packets
+    if (session->last_packet > 0 && idle_timeout > 0 && stats_now() - session->last_packet > idle_timeout) {
+        session_log(session, "No packet from the sender for %.1f seconds, giving up", idle_timeout);
+        session->timed_out = 1;
+        session_end(session, rudp_err_timeout);
+    }
+}
+
+/**
+ * @brief Stops the engines and closes the destination: a finished sync swaps the rebuilt file in, a failed one is thrown away
+ * 
+ * @param session the transfer, its error decides what happens to the files
+ * 
+ * @return void
+*/
+static void session_finish(struct rudp_receiver* session){
+
+    if (session->finalized) {
+        return;
+    }
+    session->finalized = 1;
+
+    if (session->ring != NULL) {
+        evloop_del(session->loop, session->ring->ring.fd);
+        ring_close(session);
+    }
+    /// Nothing is read any more, and a sender still retrying would keep the socket ready for the loop
+    if (session->socket_desc >= 0) {
+        evloop_del(session->loop, session->socket_desc);
+    }
+    update_drops(session);
+    if (session->stats.socket_drops > 0) {
+        session_log(session, "The kernel dropped %llu datagrams before they were read, raise -B", session->stats.socket_drops);
+    }
+    if (session->config.tuning.cpu >= 0 && session->socket_desc >= 0) {
+        session_log(session, "Last packet was handled in the kernel on CPU %d", tuning_incoming_cpu(session->socket_desc));
+    }
+    if (session->xsk != NULL) {
+        if (session->xsk->bad_packets > 0) {
+            session_log(session, "AF_XDP dropped %llu frames with a bad length or checksum", session->xsk->bad_packets);
+        }
+        evloop_del(session->loop, session->xsk->fd);
+        xdp_close(session->xsk);
+        session->xsk = NULL;
+    }
+    close_destination(session);
+}
+
+/**
+ * @brief Timer callback: the transfer is over, close the files and tell the owner
+ * 
+ * Runs from its own timer so the engines are not torn down under their own callbacks, and the
+ * owner may close the session from the done callback.
+ * 
+ * @return void
+*/
+static void on_done(struct evloop* loop, int fd, uint32_t events, void* arg){
+
+    struct rudp_receiver* session = arg;
+    (void)loop; (void)fd; (void)events;
+
+    if (ev_timer_ack(&session->done_timer) == 0) {
+        return;
+    }
+    session_finish(session);
+    stats_finish(&session->stats, &session->metrics);
+    if (session->callbacks.done != NULL) {
+        session->callbacks.done(session->callbacks.arg, session->error);
+    }
+}
+
+/**
+ * @brief Fills in the defaults: a 30 second idle timeout, BDP-sized socket buffers, no io_uring or AF_XDP
+ * 
+ * @param config the config to fill in; port and destination are left for the caller
+ * 
+ * @return void
+*/
+void rudp_receiver_config_init(struct rudp_receiver_config *config){
+
+    memset(config, 0, sizeof(*config));
+    config->idle_timeout = 30;
+    tuning_defaults(&config->tuning);
+}
+
+/**
+ * @brief Starts receiving: binds the socket and waits for the sender on the loop
+ * 
+ * The socket and a housekeeping timer are registered with the event loop; packets are handled
+ * as they arrive and the transfer ends at the FIN or once the sender has been silent for idle_timeout seconds.
+ * With use_uring the socket is read by a multishot recvmsg on an io_uring instead, whose descriptor the loop
+ * watches, and plain transfers are written through a second ring. With an xdp_interface the datagrams arriving
+ * on one queue of it are taken off with AF_XDP before the socket layer sees them. With a cipher the transfer
+ * belongs to the first sender whose datagram authenticates under the pre-shared key.
+ * 
+ * @param receiver set to the new session
+ * @param loop the event loop the session runs on
+ * @param config where to listen and what to write, copied (the strings must outlive the session)
+ * @param callbacks what to report back, copied (may be NULL)
+ * 
+ * @return rudp_ok or an error code, *receiver is NULL after an error
+*/
+int rudp_receiver_open(struct rudp_receiver **receiver, struct evloop *loop, const struct rudp_receiver_config *config,
+                       const struct rudp_callbacks *callbacks){
+
+    *receiver = NULL;
+    struct rudp_receiver* session = calloc(1, sizeof(*session));
+    if (session == NULL) {
+        return rudp_err_memory;
+    }
+    session->loop = loop;
+    session->config = *config;
+    if (callbacks != NULL) {
+        session->callbacks = *callbacks;
+    }
+    session->destinationFile = config->destination;
+    session->housekeeping_timer.fd = session->done_timer.fd = -1;
+    session->metrics.listen_fd = -1;
+
+    /// Create UDP socket and bind it to the receive address, non blocking since the event loop does the waiting.
+    /// One dual stack socket takes IPv6 and (mapped) IPv4 senders alike, a kernel without IPv6 gets a plain IPv4 one
+    int error = rudp_ok;
+    struct sockaddr_storage address;
+    memset(&address, 0, sizeof(address));
+    session->socket_desc = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (session->socket_desc >= 0) {
+        int v6only = 0;
+        setsockopt(session->socket_desc, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+        struct sockaddr_in6* any6 = (struct sockaddr_in6*)&address;
+        any6->sin6_family = AF_INET6;
+        any6->sin6_port = htons(config->port);
+        any6->sin6_addr = in6addr_any;
+        session->address_length = sizeof(struct sockaddr_in6);
+    } else if (errno == EAFNOSUPPORT) {
+        session->socket_desc = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        struct sockaddr_in* any4 = (struct sockaddr_in*)&address;
+        any4->sin_family = AF_INET;
+        any4->sin_port = htons(config->port);
+        any4->sin_addr.s_addr = htonl(INADDR_ANY);
+        session->address_length = sizeof(struct sockaddr_in);
+    }
+    if (session->socket_desc < 0 || bind(session->socket_desc, (struct sockaddr*)&address, session->address_length) < 0) {
+        error = rudp_err_system;
+    }
+
+    /// Assign memory blocks for one packet each way
+    if (error == rudp_ok) {
+        char problems[256];
+        if (tuning_apply(session->socket_desc, &config->tuning, 1, problems, sizeof(problems)) < 0) {
+            session_log(session, "Socket tuning: %s", problems);
+        }
+        session->receivedmemorypointer = malloc(max_datagram_size);
+        session->sendmemorypointer = malloc(reply_size);
+        if (session->receivedmemorypointer == NULL || session->sendmemorypointer == NULL) {
+            error = rudp_err_memory;
+        }
+    }
+
+    /// Counters for the progress report and the metrics, which are labelled with our port unless the caller names the transfer
+    stats_init(&session->stats, "receiver", 0);
+    if (error == rudp_ok) {
+        char label[stats_label_size];
+        if (config->metrics_label != NULL) {
+            snprintf(label, sizeof(label), "%s", config->metrics_label);
+        } else {
+            snprintf(label, sizeof(label), "%u", config->port);
+        }
+        if (stats_sink_open(&session->metrics, config->metrics_path, config->metrics_interval_ms, label) < 0) {
+            error = rudp_err_system;
+        }
+    }
+
+    if (error == rudp_ok && config->cipher != rudp_cipher_none) {
+        error = seal_init(&session->seal, config->cipher, config->key, 1);
+        if (error == rudp_ok) {
+            session_log(session, "Accepting only datagrams sealed with %s", seal_name(config->cipher));
+        }
+    }
+
+    if (error == rudp_ok && config->use_uring) {
+        session->ring = ring_open(session->socket_desc, session->address_length);
+        if (session->ring == NULL) {
+            session_log(session, "io_uring is not available (%s), using plain system calls", strerror(errno));
+        }
+    }
+
+    if (error == rudp_ok) {
+        int registered;
+        if (session->ring != NULL) {
+            registered = evloop_add(loop, session->ring->ring.fd, EPOLLIN, on_ring, session);
+        } else {
+            registered = evloop_add(loop, session->socket_desc, EPOLLIN, on_socket, session);
+        }
+        if (registered < 0 ||
+            ev_timer_init(loop, &session->housekeeping_timer, on_housekeeping, session) < 0 ||
+            ev_timer_init(loop, &session->done_timer, on_done, session) < 0) {
+            error = rudp_err_system;
+        }
+    }
+
+    if (error == rudp_ok && config->xdp_interface != NULL) {
+        if (xdp_open(&session->xdp, config->xdp_interface, config->xdp_queue, config->port) == 0) {
+            session_log(session, "AF_XDP on %s queue %u (%s XDP)", config->xdp_interface, config->xdp_queue, session->xdp.mode);
+            session->xsk = &session->xdp;
+            if (evloop_add(loop, session->xsk->fd, EPOLLIN, on_xdp, session) < 0) {
+                error = rudp_err_system;
+            }
+        } else {
+            session_log(session, "AF_XDP is not available on %s (%s: %s), using the UDP socket only",
+                        config->xdp_interface, session->xdp.failed, strerror(errno));
+        }
+    }
+
+    if (error != rudp_ok) {
+        int saved_errno = errno;
+        rudp_receiver_close(session);
+        errno = saved_errno;
+        return error;
+    }
+    ev_timer_arm(&session->housekeeping_timer, housekeeping_interval_us, housekeeping_interval_us);
+    *receiver = session;
+    return rudp_ok;
+}
+
+/**
+ * @brief The counters of a transfer, up to date after every callback
+ * 
+ * @param receiver the session
+ * 
+ * @return its counters
+*/
+const struct rudp_stats *rudp_receiver_stats(const struct rudp_receiver *receiver){
+
+    return &receiver->stats;
+}
+
+/**
+ * @brief Closes the session; a transfer still going is aborted (no done callback, a sync keeps the old file)
+ * 
+ * @param receiver the session, freed; NULL does nothing
+ * 
+ * @return void
+*/
+void rudp_receiver_close(struct rudp_receiver *receiver){
+
+    if (receiver == NULL) {
+        return;
+    }
+    if (!receiver->done) {
+        receiver->done = 1;
+        receiver->error = rudp_err_aborted;
+    }
+    session_finish(receiver);
+
+    struct evloop* loop = receiver->loop;
+    if (receiver->housekeeping_timer.fd >= 0) {
+        ev_timer_close(loop, &receiver->housekeeping_timer);
+    }
+    if (receiver->done_timer.fd >= 0) {
+        ev_timer_close(loop, &receiver->done_timer);
+    }
+    if (receiver->socket_desc >= 0) {
+        evloop_del(loop, receiver->socket_desc);
+        close(receiver->socket_desc);
+    }
+    free(receiver->receivedmemorypointer);
+    free(receiver->sendmemorypointer);
+    free(receiver->reorder);
+    seal_free(&receiver->seal);
+    stats_sink_close(&receiver->metrics);
+    free(receiver);
+}
@@ -0,0 +1,1784 @@
+/**  @file rudp_send.c
+ *
+ *  @brief Sending side of librudp: a reliable file transfer over UDP, run from an event loop.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ *
+ *  @bug When sending two competing UDP protocols in a lossy/noisy channel, the second socket entering experiences delays and a greater timeout. Works fine for no loss.
+ *
+ */
+
+
+/*   Includes   */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+
+#include "librudp.h"
+#include "rudp.h"
+#include "delta.h"
+#include "trace.h"
+#include "uring.h"
+#include "pacer.h"
+#include "resolve.h"
+#include "seal.h"
+#include "sparse.h"
+#include "sched.h"
+
+#define fin_retries 100 /// How many times the FIN is sent before giving up on its acknowledgement
+#define ack_timeout_us 10000 /// Ack timeout of a path without a round trip time yet, and the least an ack may be late by (was the SO_RCVTIMEO of the socket)
+#define ack_timeout_max_us 1000000 /// Ceiling of the ack timeout as it backs off
+#define race_delay_us 100000 /// Happy Eyeballs: how long the addresses in the race get before the next one joins
+#define max_payload_pieces 8 /// iovecs of the caller's memory one packet is gathered from, a packet ends early at more
+#define path_dead_timeouts 6 /// Multipath: timeouts in a row (each twice as long as the last) after which a path is given up and its packet moves to another
+
+/*   io_uring Engine (-u)   */
+#define ring_entries 64 /// Submission queue size
+#define ack_buffers 16 /// Provided buffers multishot recvmsg puts the acks in, a power of two
+#define ack_buffer_size (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in6) + max_datagram_size)
+
+/// user_data of the requests
+#define ud_recv 1
+#define ud_send 2
+#define ud_read 3
+
+/// The io_uring engine: one multishot recvmsg for the acks, and a read linked to a sendmsg per packet
+struct send_ring {
+    struct uring ring;
+    struct uring_buf_ring buffers;
+    struct msghdr recv_msg; /// Tells multishot recvmsg how much room to leave for the address
+    struct msghdr send_msg; /// Always the packet in flight, to the receiver
+    struct iovec send_iov[1 + max_payload_pieces];
+    size_t read_length; /// Length of the read in flight, checked when it completes
+};
+
+/// Where a plain transfer is in the file
+struct file_source {
+    FILE *read_file;
+    unsigned long long bytesToTransfer;
+    unsigned long long bytesRead; /// Number of bytes already read from the file
+    unsigned index; /// The index of the packet. It needs to send and receive the index in order.
+    unsigned long long data_end; /// End of the data region bytesRead is in (the next hole), 0 until it is looked up
+    uint8_t *scan; /// sparse_scan_size bytes to look for runs of zeros in, allocated with the first all zero payload
+};
+
+/// Where a plain transfer from memory is in the caller's iovecs
+struct memory_source {
+    const struct iovec *iov;
+    int iovcnt;
+    int current; /// The iovec the next packet starts in
+    size_t offset; /// and where in it
+    unsigned long long bytesToTransfer;
+    unsigned long long bytesRead;
+    unsigned index;
+};
+
+/// Where a sync is: fetching signatures, then sending delta operations
+struct sync_source {
+    FILE *read_file; /// NULL when syncing from memory
+    const uint8_t *source; /// Our file, mapped, or the caller's memory
+    unsigned long long bytesToTransfer;
+    int delta_phase; /// 0 while fetching signatures
+    uint32_t chunk; /// Next signature chunk to ask for
+    struct delta_sig *sigs;
+    uint32_t nblocks;
+    uint32_t block_size;
+    struct delta_index sig_index;
+    struct delta_gen gen;
+    unsigned index; /// Index of the next delta packet
+};
+
+
+struct rudp_sender;
+
+/// A way to the receiver with a packet in flight of its own: the only one, or one per local address with multipath
+struct send_path {
+    struct rudp_sender *session;
+    const char *local; /// The local address or interface it goes out from, NULL for wherever the routing table says
+    int socket_desc;
+    struct sockaddr_storage server_addr; /// The receiver: the address that answered first, the first candidate until then
+    socklen_t server_len;
+    struct ev_timer rto_timer; /// Fires when the ack of the packet in flight is late
+    struct ev_timer pace_timer; /// Waits for the send time when the pacer is in userspace
+    struct pacer pacer;
+    uint64_t send_at; /// Send time of the packet in flight
+    struct sched_entry turn; /// The packet in flight waiting in the scheduler's queue, with a scheduler
+
+    uint8_t *sender_buffer; /// The packet in flight, header included
+    size_t length;
+    struct iovec payload[max_payload_pieces]; /// The payload of the packet in flight when it stays in the caller's memory
+    int payload_count; /// 0 when sender_buffer holds the whole packet
+    uint8_t *sealed; /// The packet in flight as it goes out encrypted, NULL without a cipher
+    useconds_t t; /// Time between sends in microseconds, the pacing gap AIMD adjusts
+    int attempts; /// Sends of the packet in flight
+    double sent_at; /// When it was last sent
+    int busy; /// A packet is in flight, or waiting for its send time
+    int finishing; /// The packet in flight is the FIN
+
+    double srtt_us; /// Smoothed round trip time of this path, 0 before the first sample
+    double rttvar_us; /// Its mean deviation
+    double rto_us; /// How long a packet on this path waits for its ack: srtt + max(ack_timeout_us, 4 rttvar) (RFC 6298), doubled by every timeout
+    int timeouts; /// Timeouts in a row, a path that reaches path_dead_timeouts is given up
+    int dead; /// Given up (or never set up); a packet it still holds waits for another path
+    unsigned long long packets; /// Packets acknowledged on this path
+};
+
+/// One transfer, driven by callbacks from the event loop
+struct rudp_sender {
+    struct evloop *loop;
+    struct rudp_sender_config config;
+    struct rudp_callbacks callbacks;
+    struct send_path *paths; /// One, or config.path_count with multipath
+    int path_count;
+    int paths_alive;
+    struct resolve_request *resolving; /// The lookup of the hostname while it runs
+    struct resolve_result candidates; /// The receiver's addresses in the socket's form, in the order they are tried
+    int racing; /// Candidates the first packet goes to while none has answered, 0 once one did
+    double race_step; /// When the last of them joined
+    struct ev_timer done_timer; /// Reports the end from a callback of its own, once nothing else is running
+
+    uint8_t *ack_buffer; /// The last matching ack, opened if it came sealed
+    struct seal seal; /// Encryption state with a cipher
+    unsigned next_index; /// Index of the packet after the last one produced
+    int drained; /// next_packet has nothing left, the FIN follows once every path is idle
+    int done; /// The transfer is over, only the done callback is left
+    int error; /// How it ended
+
+    /// Fills the path's sender_buffer (or payload) with the next packet and returns its length, 0 once there is nothing left
+    size_t (*next_packet)(struct rudp_sender *session, struct send_path *path);
+    /// Called with every matching ack before the next packet is produced (may be NULL)
+    void (*on_ack)(struct rudp_sender *session, ssize_t length);
+    struct file_source file;
+    struct memory_source memory;
+    struct sync_source sync;
+
+    struct send_ring *ring; /// NULL when sending with sendmsg(), always with multipath
+    int source_fd; /// File the ring reads the payloads from, -1 if next_packet always fills them in itself
+    size_t pending_read; /// Set by next_packet instead of reading when the ring reads the payload on its way out
+    unsigned long long read_offset;
+
+    struct rudp_stats stats;
+    struct stats_sink metrics; /// Where config.metrics_path sends the stats
+    struct sched_flow flow; /// Priority and weight in the scheduler's queue
+};
+
+/** @brief Hands a line of information to the log callback
+ *
+ *  @param session The transfer
+ *  @param format printf format of the line, without the newline
+ *  @return void
+ */
+static void session_log(struct rudp_sender* session, const char* format, ...) {
+    if (session->callbacks.log == NULL) {
+        return;
+    }
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    session->callbacks.log(session->callbacks.arg, message);
+}
+
+/** @brief Ends the transfer: the timers stop and the done callback runs from the loop shortly
+ *
+ *  @param session The transfer
+ *  @param error rudp_ok or why it failed, the first error sticks
+ *  @return void
+ */
+static void session_end(struct rudp_sender* session, int error) {
+    if (session->done) {
+        return;
+    }
+    session->done = 1;
+    session->error = error;
+    for (int i = 0; i < session->path_count; i++) {
+        struct send_path* path = &session->paths[i];
+        ev_timer_disarm(&path->rto_timer);
+        ev_timer_disarm(&path->pace_timer);
+        if (session->config.scheduler != NULL) {
+            sched_cancel(session->config.scheduler, &path->turn);
+        }
+        /// Late acks are not read any more, they must not keep the socket ready for the loop
+        if (path->socket_desc >= 0) {
+            evloop_del(session->loop, path->socket_desc);
+        }
+    }
+    ev_timer_arm(&session->done_timer, 0, 0);
+}
+
+/** @brief Creates the UDP socket for the receiver's addresses, dual stack (AF_INET6) if any of them is IPv6
+ *
+ *  @param session The transfer
+ *  @param result What the hostname resolved to
+ *  @return rudp_ok or an error code
+ */
+static int setup_socket(struct rudp_sender* session, const struct resolve_result* result) {
+    int family = AF_INET;
+    for (int i = 0; i < result->count; i++) {
+        if (result->addresses[i].ss_family == AF_INET6) {
+            family = AF_INET6;
+        }
+    }
+    struct send_path* path = &session->paths[0];
+
+    /// Creating the socket. The event loop does the waiting, the socket itself never blocks (acks time out on the rto timer)
+    path->socket_desc = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (path->socket_desc < 0 && family == AF_INET6 && errno == EAFNOSUPPORT) {
+        /// A kernel without IPv6 can still reach the IPv4 addresses
+        family = AF_INET;
+        path->socket_desc = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    }
+    if (path->socket_desc < 0) {
+        return rudp_err_system;
+    }
+    int v6only = 0;
+    if (family == AF_INET6) {
+        setsockopt(path->socket_desc, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+    }
+
+    /// The addresses to race, IPv4 ones mapped into IPv6 on a dual stack socket
+    struct resolve_result* candidates = &session->candidates;
+    char line[256] = "";
+    size_t used = 0;
+    candidates->count = 0;
+    for (int i = 0; i < result->count; i++) {
+        const struct sockaddr* address = (const struct sockaddr*)&result->addresses[i];
+        if (family == AF_INET6) {
+            candidates->lengths[candidates->count] = resolve_map_v6(address, &candidates->addresses[candidates->count]);
+        } else if (address->sa_family == AF_INET) {
+            memcpy(&candidates->addresses[candidates->count], address, sizeof(struct sockaddr_in));
+            candidates->lengths[candidates->count] = sizeof(struct sockaddr_in);
+        } else {
+            continue;
+        }
+        char text[INET6_ADDRSTRLEN];
+        resolve_format(address, text, sizeof(text));
+        if (used < sizeof(line)) {
+            used += snprintf(line + used, sizeof(line) - used, "%s%s", candidates->count > 0 ? ", " : "", text);
+        }
+        candidates->count++;
+    }
+    if (candidates->count == 0) {
+        return rudp_err_resolve;
+    }
+    path->server_addr = candidates->addresses[0];
+    path->server_len = candidates->lengths[0];
+    session->racing = candidates->count > 1 ? 1 : 0;
+    session->race_step = stats_now();
+
+    if (session->racing) {
+        session_log(session, "sending to: %s (the first to answer is used)", line);
+    } else {
+        session_log(session, "sending to: %s", line);
+    }
+    session_log(session, "Socket created successfully");
+    return rudp_ok;
+}
+
+/** @brief Creates the socket of one path of a multipath transfer, bound to its local address or interface
+ *
+ *  A local address only sets the source of the packets, so the path follows whatever route (or policy routing
+ *  rule) the system has for it; an interface name binds the socket to the interface itself. The path sends to
+ *  the first of the receiver's addresses it can reach, there is no race.
+ *
+ *  @param session The transfer
+ *  @param path The path, with its local address or interface
+ *  @param result What the hostname resolved to
+ *  @return rudp_ok or an error code
+ */
+static int setup_path(struct rudp_sender* session, struct send_path* path, const struct resolve_result* result) {
+    struct sockaddr_storage local;
+    socklen_t local_length = 0;
+    memset(&local, 0, sizeof(local));
+    struct sockaddr_in* local4 = (struct sockaddr_in*)&local;
+    struct sockaddr_in6* local6 = (struct sockaddr_in6*)&local;
+    if (inet_pton(AF_INET, path->local, &local4->sin_addr) == 1) {
+        local4->sin_family = AF_INET;
+        local_length = sizeof(*local4);
+    } else if (inet_pton(AF_INET6, path->local, &local6->sin6_addr) == 1) {
+        local6->sin6_family = AF_INET6;
+        local_length = sizeof(*local6);
+    }
+
+    /// An address can only reach the receiver's addresses of its own family, an interface any of them
+    int chosen = -1;
+    for (int i = 0; i < result->count && chosen < 0; i++) {
+        if (local_length == 0 || result->addresses[i].ss_family == local.ss_family) {
+            chosen = i;
+        }
+    }
+    if (chosen < 0) {
+        session_log(session, "Path %s: the receiver has no address of its family", path->local);
+        return rudp_err_resolve;
+    }
+    const struct sockaddr* server = (const struct sockaddr*)&result->addresses[chosen];
+
+    path->socket_desc = socket(server->sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (path->socket_desc < 0) {
+        return rudp_err_system;
+    }
+    int bound;
+    if (local_length > 0) {
+        bound = bind(path->socket_desc, (struct sockaddr*)&local, local_length);
+    } else {
+        bound = setsockopt(path->socket_desc, SOL_SOCKET, SO_BINDTODEVICE, path->local, strlen(path->local));
+    }
+    if (bound < 0) {
+        session_log(session, "Path %s: %s", path->local, strerror(errno));
+        return rudp_err_system;
+    }
+    memcpy(&path->server_addr, server, result->lengths[chosen]);
+    path->server_len = result->lengths[chosen];
+
+    char text[INET6_ADDRSTRLEN];
+    session_log(session, "Path %s: sending to %s", path->local, resolve_format(server, text, sizeof(text)));
+    return rudp_ok;
+}
+
+/** @brief Sends the first packet to every address in the race, letting the next one join every race_delay_us
+ *
+ *  An address that can not even be sent to (no route for its family) makes room for the next one right away.
+ *
+ *  @param session The transfer
+ *  @param msg The packet, msg_name is set here
+ *  @return void
+ */
+static void race_send(struct rudp_sender* session, struct msghdr* msg) {
+    struct resolve_result* candidates = &session->candidates;
+    double now = stats_now();
+    if (session->racing < candidates->count && now - session->race_step >= race_delay_us / 1000000.0) {
+        session->racing++;
+        session->race_step = now;
+    }
+
+    int sent = 0;
+    for (int i = 0; i < candidates->count && (i < session->racing || sent == 0); i++) {
+        if (i >= session->racing) {
+            session->racing = i + 1;
+            session->race_step = now;
+        }
+        msg->msg_name = &candidates->addresses[i];
+        msg->msg_namelen = candidates->lengths[i];
+        if (sendmsg(session->paths[0].socket_desc, msg, 0) >= 0) {
+            sent++;
+        }
+    }
+    if (sent == 0) {
+        session_log(session, "Unable to send message");
+    }
+}
+
+/** @brief Ends the race: the address the first ack came from gets the rest of the transfer
+ *
+ *  @param session The transfer
+ *  @param from Where the ack came from
+ *  @return void
+ */
+static void race_won(struct rudp_sender* session, const struct sockaddr* from) {
+    struct resolve_result* candidates = &session->candidates;
+    struct send_path* path = &session->paths[0];
+    for (int i = 0; i < candidates->count; i++) {
+        if (resolve_same_address((const struct sockaddr*)&candidates->addresses[i], from)) {
+            path->server_addr = candidates->addresses[i];
+            path->server_len = candidates->lengths[i];
+            break;
+        }
+    }
+    session->racing = 0;
+
+    char text[INET6_ADDRSTRLEN];
+    session_log(session, "Receiver answered on %s", resolve_format((const struct sockaddr*)&path->server_addr, text, sizeof(text)));
+}
+
+/** @brief Describes the packet in flight for sendmsg(): the header, then the payload wherever it is
+ *
+ *  @param path The path it is in flight on
+ *  @param iov Filled in, room for 1 + max_payload_pieces
+ *  @return The number of iovecs
+ */
+static int packet_iov(struct send_path* path, struct iovec* iov) {
+    iov[0].iov_base = path->sender_buffer;
+    if (path->payload_count == 0) {
+        iov[0].iov_len = path->length;
+        return 1;
+    }
+    iov[0].iov_len = header_size;
+    memcpy(iov + 1, path->payload, path->payload_count * sizeof(*iov));
+    return 1 + path->payload_count;
+}
+
+/** @brief Describes the packet in flight as it goes on the wire: as it is, or sealed into the path's sealed buffer
+ *
+ *  A retransmission is sealed again, under a new counter, so the receiver never takes it for a replay.
+ *
+ *  @param path The path it is in flight on
+ *  @param iov Filled in, room for 1 + max_payload_pieces
+ *  @return The number of iovecs, 0 if it could not be sealed
+ */
+static int wire_iov(struct send_path* path, struct iovec* iov) {
+    struct rudp_sender* session = path->session;
+    int count = packet_iov(path, iov);
+    if (session->config.cipher == rudp_cipher_none) {
+        return count;
+    }
+    size_t length = seal_packet(&session->seal, iov, count, path->sealed);
+    if (length == 0) {
+        return 0;
+    }
+    iov[0].iov_base = path->sealed;
+    iov[0].iov_len = length;
+    return 1;
+}
+
+/** @brief Queues the packet in flight on the ring, behind the read of its payload if that is still to be done
+ *
+ *  Read and send are linked, so the kernel starts the send as soon as the read completed and both
+ *  cost one io_uring_enter() together. The ring only ever runs with a single path.
+ *
+ *  @param session The transfer
+ *  @return rudp_ok or an error code
+ */
+static int ring_send(struct rudp_sender* session) {
+    struct send_ring* ring = session->ring;
+    struct send_path* path = &session->paths[0];
+    struct io_uring_sqe* sqe;
+
+    if (session->pending_read > 0) {
+        sqe = uring_get_sqe(&ring->ring);
+        if (sqe == NULL) {
+            return rudp_err_system;
+        }
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+        sqe->fd = 1;
+        sqe->addr = (uint64_t)(uintptr_t)(path->sender_buffer+data_offset);
+        sqe->len = session->pending_read;
+        sqe->off = session->read_offset;
+        sqe->buf_index = 0;
+        sqe->user_data = ud_read;
+        ring->read_length = session->pending_read;
+        session->pending_read = 0;
+    }
+
+    sqe = uring_get_sqe(&ring->ring);
+    if (sqe == NULL) {
+        return rudp_err_system;
+    }
+    ring->send_msg.msg_iovlen = wire_iov(path, ring->send_iov);
+    if (ring->send_msg.msg_iovlen == 0) {
+        return rudp_err_system;
+    }
+    ring->send_msg.msg_namelen = path->server_len;
+    pacer_prepare(&path->pacer, &ring->send_msg, path->send_at);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;
+    sqe->addr = (uint64_t)(uintptr_t)&ring->send_msg;
+    sqe->len = 1;
+    sqe->user_data = ud_send;
+
+    return uring_submit(&ring->ring, 0) < 0 ? rudp_err_system : rudp_ok;
+}
+
+/** @brief Sends the packet in flight on a path (again) and starts waiting for its ack
+ *
+ *  @param path The path
+ *  @return void
+ */
+static void send_packet(struct send_path* path) {
+    struct rudp_sender* session = path->session;
+    uint32_t index;
+    memcpy(&index, path->sender_buffer+index_offset, 4);
+
+    /// Without SO_TXTIME we are the ones holding the packet until its send time; with it the qdisc is
+    uint64_t now = pacer_now();
+    uint64_t lead_ns = 0;
+    if (!path->pacer.txtime) {
+        pacer_spin_until(path->send_at);
+    } else if (path->send_at > now) {
+        lead_ns = path->send_at - now;
+    }
+
+    /// Sends a message to the receiver (to all the addresses in the race until one answered, those go out directly)
+    if (session->ring != NULL && !session->racing) {
+        int error = ring_send(session);
+        if (error != rudp_ok) {
+            session_end(session, error);
+            return;
+        }
+    } else {
+        struct iovec iov[1 + max_payload_pieces];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &path->server_addr;
+        msg.msg_namelen = path->server_len;
+        msg.msg_iov = iov;
+        msg.msg_iovlen = wire_iov(path, iov);
+        if (msg.msg_iovlen == 0) {
+            session_end(session, rudp_err_system);
+            return;
+        }
+        pacer_prepare(&path->pacer, &msg, path->send_at);
+        if (session->racing) {
+            race_send(session, &msg);
+        } else if(sendmsg(path->socket_desc, &msg, 0)<0){
+            session_log(session, "Unable to send message");
+        }
+    }
+    path->sent_at = stats_now() + lead_ns / 1000000000.0;
+    session->stats.packets_sent++;
+    if (path->attempts++ > 0) {
+        session->stats.retransmits++;
+        trace_event(trace_retransmit, index, path->length);
+    } else {
+        trace_event(path->finishing ? trace_fin : trace_send, index, path->length);
+    }
+
+    /// Waits to receive an acknowlegement for the timeout time specified prior, counted from when the packet leaves
+    ev_timer_arm(&path->rto_timer, (uint64_t)path->rto_us + lead_ns / 1000, 0);
+}
+
+/** @brief The scheduler lets the packet in flight on a path go
+ *
+ *  @param entry The path's turn
+ *  @param send_at When it goes, no earlier than its own pacing time
+ *  @return void
+ */
+static void on_turn(struct sched_entry* entry, uint64_t send_at) {
+    struct send_path* path = entry->arg;
+    path->send_at = send_at;
+    /// The next gap counts from when it really went
+    path->pacer.last_ns = send_at;
+    send_packet(path);
+}
+
+/** @brief Sends the packet in flight on a path at its pacing time, t after the path's previous send
+ *
+ *  With a scheduler that is only the earliest it may go; the scheduler picks when among the transfers sharing it.
+ *
+ *  @param path The path
+ *  @return void
+ */
+static void schedule_send(struct send_path* path) {
+    /// Slows down how fast our data is being sent. With SO_TXTIME the packet goes to the kernel right away;
+    /// otherwise short waits are spun out in send_packet() and longer ones sleep on the pace timer
+    path->send_at = pacer_schedule(&path->pacer, (uint64_t)path->t * 1000);
+    struct rudp_scheduler* scheduler = path->session->config.scheduler;
+    if (scheduler != NULL) {
+        /// A nack or timeout for a packet still waiting for its turn: it goes when that turn comes, as it is now
+        if (!path->turn.queued) {
+            sched_enqueue(scheduler, &path->turn, path->send_at, path->length);
+        }
+        return;
+    }
+    uint64_t now = pacer_now();
+    if (path->pacer.txtime || path->send_at <= now + pacer_spin_ns) {
+        send_packet(path);
+    } else {
+        ev_timer_arm(&path->pace_timer, (path->send_at - now) / 1000, 0);
+    }
+}
+
+/** @brief Puts the FIN in flight to terminate the connection
+ *
+ *  @param path The path it goes on
+ *  @return void
+ */
+static void start_fin(struct send_path* path) {
+    /// Raising FIN Flag HIGH
+    memset(path->sender_buffer, 0, max_payload_size);
+    path->sender_buffer[type_offset] = pkt_fin;
+    path->length = 2;
+    path->payload_count = 0;
+    path->finishing = 1;
+    path->attempts = 0;
+    path->busy = 1;
+    schedule_send(path);
+}
+
+/** @brief Puts the next packet in flight on an idle path
+ *
+ *  @param session The transfer
+ *  @param path The path
+ *  @return void, session->drained is set if there was nothing left
+ */
+static void next_packet(struct rudp_sender* session, struct send_path* path) {
+    memset(path->sender_buffer, 0, max_payload_size);
+    path->payload_count = 0;
+    path->length = session->next_packet(session, path);
+    path->attempts = 0;
+    if (session->done) {
+        /// Producing the packet failed
+        return;
+    }
+    if (path->length == 0) {
+        session->drained = 1;
+        return;
+    }
+    uint32_t index;
+    memcpy(&index, path->sender_buffer+index_offset, 4);
+    session->next_index = index + 1;
+    path->busy = 1;
+    schedule_send(path);
+}
+
+/** @brief The fastest path that is up and has nothing in flight
+ *
+ *  @param session The transfer
+ *  @return The path, NULL if every path is busy or dead
+ */
+static struct send_path* idle_path(struct rudp_sender* session) {
+    struct send_path* best = NULL;
+    for (int i = 0; i < session->path_count; i++) {
+        struct send_path* path = &session->paths[i];
+        if (!path->dead && !path->busy && (best == NULL || path->srtt_us < best->srtt_us)) {
+            best = path;
+        }
+    }
+    return best;
+}
+
+/** @brief Checks that the next packet on a path stays within the receiver's reorder window
+ *
+ *  The packets in flight have to stay within reorder_window of the oldest of them or the receiver can not hold
+ *  them. A path slower than the fastest one only takes the next index if the fastest can send as many packets
+ *  as fit in one round trip of the slow path meanwhile without reaching that limit, so a packet on the slow
+ *  path does not hold up the others (the lowest round trip time goes first, as in MPTCP's default scheduler).
+ *
+ *  @param session The transfer
+ *  @param path The idle path
+ *  @return 1 if it may take the next packet
+ */
+static int window_allows(struct rudp_sender* session, const struct send_path* path) {
+    unsigned oldest = session->next_index;
+    double fastest = 0;
+    for (int i = 0; i < session->path_count; i++) {
+        const struct send_path* other = &session->paths[i];
+        if (other->busy) {
+            uint32_t index;
+            memcpy(&index, other->sender_buffer+index_offset, 4);
+            if ((int)(index - oldest) < 0) {
+                oldest = index;
+            }
+        }
+        if (!other->dead && other->srtt_us > 0 && (fastest == 0 || other->srtt_us < fastest)) {
+            fastest = other->srtt_us;
+        }
+    }
+
+    unsigned needed = 1;
+    if (fastest > 0 && path->srtt_us > fastest) {
+        needed = (unsigned)(path->srtt_us / fastest + 0.999);
+    }
+    return session->next_index - oldest + needed <= reorder_window;
+}
+
+/** @brief Hands the packet a dead path was left with to an idle path that is up
+ *
+ *  @param path The idle path
+ *  @param dead The dead path, idle afterwards
+ *  @return void
+ */
+static void take_over(struct send_path* path, struct send_path* dead) {
+    uint8_t* buffer = path->sender_buffer;
+    path->sender_buffer = dead->sender_buffer;
+    dead->sender_buffer = buffer;
+    path->length = dead->length;
+    memcpy(path->payload, dead->payload, sizeof(path->payload));
+    path->payload_count = dead->payload_count;
+    /// It was sent before, so its ack says nothing about this path's round trip time
+    path->attempts = dead->attempts;
+    path->busy = 1;
+    dead->busy = 0;
+    schedule_send(path);
+}
+
+/** @brief Gives every idle path a packet, fastest path first: one a dead path left behind, else the next one
+ *
+ *  The FIN goes out on the fastest path once there is nothing left to send and every packet was acknowledged.
+ *
+ *  @param session The transfer
+ *  @return void
+ */
+static void fill_paths(struct rudp_sender* session) {
+    struct send_path* path;
+    while (!session->done && (path = idle_path(session)) != NULL) {
+        struct send_path* dead = NULL;
+        for (int i = 0; i < session->path_count; i++) {
+            if (session->paths[i].dead && session->paths[i].busy) {
+                dead = &session->paths[i];
+            }
+        }
+        if (dead != NULL) {
+            take_over(path, dead);
+        } else if (session->drained || !window_allows(session, path)) {
+            break;
+        } else {
+            next_packet(session, path);
+        }
+    }
+    if (session->done || !session->drained) {
+        return;
+    }
+    for (int i = 0; i < session->path_count; i++) {
+        if (session->paths[i].busy) {
+            return;
+        }
+    }
+    if ((path = idle_path(session)) != NULL) {
+        start_fin(path);
+    }
+}
+
+/** @brief Gives up on a path that stopped answering, the others carry on with its packet
+ *
+ *  @param path The path
+ *  @return void
+ */
+static void path_failed(struct send_path* path) {
+    struct rudp_sender* session = path->session;
+    ev_timer_disarm(&path->rto_timer);
+    ev_timer_disarm(&path->pace_timer);
+    if (session->config.scheduler != NULL) {
+        sched_cancel(session->config.scheduler, &path->turn);
+    }
+    path->dead = 1;
+    session->paths_alive--;
+    session->stats.window = session->paths_alive;
+    session_log(session, "Path %s stopped answering, going on without it", path->local);
+    fill_paths(session);
+}
+
+/** @brief The packet in flight on a path was acknowledged
+ *
+ *  @param path The path
+ *  @param length Length of the ack
+ *  @return void
+ */
+static void packet_acked(struct send_path* path, ssize_t length) {
+    struct rudp_sender* session = path->session;
+    ev_timer_disarm(&path->rto_timer);
+
+    uint32_t index;
+    memcpy(&index, path->sender_buffer+index_offset, 4);
+
+    /// Only packets sent once give an unambiguous round trip time (Karn's algorithm)
+    if (path->attempts == 1) {
+        double rtt_us = (stats_now() - path->sent_at) * 1000000;
+        stats_rtt_sample(&session->stats, rtt_us);
+        if (path->srtt_us == 0) {
+            path->srtt_us = rtt_us;
+            path->rttvar_us = rtt_us / 2;
+        } else {
+            double error = path->srtt_us - rtt_us;
+            path->rttvar_us = 0.75 * path->rttvar_us + 0.25 * (error < 0 ? -error : error);
+            path->srtt_us = 0.875 * path->srtt_us + 0.125 * rtt_us;
+        }
+        /// A sample ends the backoff. On a steady path rttvar goes to 0, ack_timeout_us is the clock granularity G
+        /// that keeps the timer from racing acks that are right on time
+        path->rto_us = path->srtt_us + (4 * path->rttvar_us > ack_timeout_us ? 4 * path->rttvar_us : ack_timeout_us);
+        if (path->rto_us > ack_timeout_max_us) {
+            path->rto_us = ack_timeout_max_us;
+        }
+    }
+
+    /// Using a multiplicative decrease to reduce our socket waiting time.
+    if(path->t>0){
+        path->t = path->t/2;
+    }
+    session->stats.send_delay_us = path->t;
+    trace_event(trace_ack, index, path->t);
+
+    path->busy = 0;
+    path->timeouts = 0;
+    path->packets++;
+    if (path->dead) {
+        /// A path given up on with its packet still on it, and no other path free to take it over
+        path->dead = 0;
+        session->paths_alive++;
+        session->stats.window = session->paths_alive;
+        session_log(session, "Path %s answers again", path->local);
+    }
+
+    if (path->finishing) {
+        session_end(session, rudp_ok);
+        return;
+    }
+
+    if (path->sender_buffer[type_offset] == pkt_data) {
+        session->stats.bytes += path->length - header_size;
+    } else if (path->sender_buffer[type_offset] == pkt_zero) {
+        uint64_t run;
+        memcpy(&run, path->sender_buffer+data_offset, zero_frame_size);
+        session->stats.bytes += run;
+        session->stats.sparse_bytes += run;
+    }
+    if (session->on_ack != NULL) {
+        session->on_ack(session, length);
+        if (session->done) {
+            return;
+        }
+    }
+    stats_tick(&session->stats, &session->metrics);
+    if (session->callbacks.progress != NULL) {
+        session->callbacks.progress(session->callbacks.arg, &session->stats);
+    }
+    fill_paths(session);
+}
+
+/** @brief The packet in flight on a path was not acknowledged, send it again after backing off
+ *
+ *  We implement an additive increase to reduce the sending time if there is packet loss to try and mitigate packet loss.
+ *
+ *  @param path The path
+ *  @return void
+ */
+static void packet_lost(struct send_path* path) {
+    struct rudp_sender* session = path->session;
+    ev_timer_disarm(&path->rto_timer);
+
+    /// The receiver stops listening once it has acknowledged the FIN, so if that ack gets lost we give up eventually
+    if (path->finishing && path->attempts >= fin_retries) {
+        session_log(session, "No FIN acknowledgement from the receiver, closing anyway");
+        session_end(session, rudp_ok);
+        return;
+    }
+
+    /// Note that these times are in microseconds
+    if(path->t<1000000) {
+        path->t += 1000;
+    }
+    session->stats.send_delay_us = path->t;
+    stats_tick(&session->stats, &session->metrics);
+    schedule_send(path);
+}
+
+/** @brief Acts on a reply from the receiver, which is in ack_buffer
+ *
+ *  Only an acknowledgement that echoes the type and index of a packet in flight counts, so a late ack
+ *  of an earlier retransmission can not move the transfer forward; such stale acks are counted and
+ *  otherwise ignored. An ack may come in on another path than its packet is on now, after a path
+ *  failed. A nack makes the path it came in on resend right away instead of waiting for the timeout,
+ *  except a nack of the FIN, which ends the transfer because the receiver could not write the file.
+ *  With a cipher, a reply that is not sealed with the transfer's key, or that was seen before, is dropped.
+ *
+ *  @param session The transfer
+ *  @param path The path the reply came in on
+ *  @param client_message Length of the reply
+ *  @param from Where it came from
+ *  @return void
+ */
+static void handle_ack(struct rudp_sender* session, struct send_path* path, ssize_t client_message, const struct sockaddr* from) {
+    /// With a cipher only what authenticates as the receiver's counts, and it is read in the clear from here on
+    if (session->config.cipher != rudp_cipher_none) {
+        client_message = seal_open(&session->seal, session->ack_buffer, client_message);
+        if (client_message < 0) {
+            session->stats.rejected++;
+            return;
+        }
+    }
+
+    /// Instantializes variables for checking the ack_message from the received ack_buffer
+    uint8_t ack_message, ack_type;
+    uint32_t ack_index, index;
+    memcpy(&ack_message, session->ack_buffer+ack_offset, 1);
+    memcpy(&ack_type, session->ack_buffer+type_offset, 1);
+    memcpy(&ack_index, session->ack_buffer+index_offset, 4);
+
+    /// Only moving onto the next index if the ack matches a packet we sent
+    if (client_message >= header_size && ack_message == 1) {
+        for (int i = 0; i < session->path_count; i++) {
+            struct send_path* sent = &session->paths[i];
+            memcpy(&index, sent->sender_buffer+index_offset, 4);
+            if (sent->busy && ack_type == sent->sender_buffer[type_offset] && ack_index == index) {
+                if (session->racing) {
+                    race_won(session, from);
+                }
+                packet_acked(sent, client_message);
+                return;
+            }
+        }
+    }
+
+    /// A nack of the FIN: the receiver got every byte but could not get the file onto its disk
+    if (client_message >= header_size && ack_message == 0 && ack_type == pkt_fin) {
+        for (int i = 0; i < session->path_count; i++) {
+            if (session->paths[i].busy && session->paths[i].finishing) {
+                session_log(session, "The receiver could not write the file");
+                session_end(session, rudp_err_remote_file);
+                return;
+            }
+        }
+    }
+
+    memcpy(&index, path->sender_buffer+index_offset, 4);
+    session->stats.nacks++;
+    trace_event(trace_nack, index, path->t);
+    if (client_message >= header_size && ack_message == 0 && path->busy && !path->dead) {
+        packet_lost(path);
+    }
+}
+
+/** @brief Socket callback: reads every ack that arrived on a path
+ *
+ *  @return void
+ */
+static void on_socket(struct evloop* loop, int fd, uint32_t events, void* arg) {
+    struct send_path* path = arg;
+    struct rudp_sender* session = path->session;
+    struct sockaddr_storage reply_addr;
+    (void)loop; (void)events;
+
+    while (!session->done) {
+        unsigned int struct_length = sizeof(reply_addr);
+        ssize_t client_message = recvfrom(fd, session->ack_buffer, max_datagram_size, 0, (struct sockaddr*)&reply_addr, &struct_length);
+        if (client_message < 0) {
+            return;
+        }
+        handle_ack(session, path, client_message, (struct sockaddr*)&reply_addr);
+    }
+}
+
+/** @brief Queues the multishot recvmsg the acks arrive through
+ *
+ *  @param ring The engine
+ *  @return rudp_ok or an error code
+ */
+static int ring_arm_recv(struct send_ring* ring) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&ring->ring);
+    if (sqe == NULL) {
+        return rudp_err_system;
+    }
+    uring_prep_recvmsg_multishot(sqe, 0, &ring->recv_msg, 0);
+    sqe->user_data = ud_recv;
+    return rudp_ok;
+}
+
+/** @brief Ring callback: handles every completion (acks, and the reads and sends of the packets)
+ *
+ *  @return void
+ */
+static void on_ring(struct evloop* loop, int fd, uint32_t events, void* arg) {
+    struct rudp_sender* session = arg;
+    struct send_ring* ring = session->ring;
+    struct io_uring_cqe* cqe;
+    (void)loop; (void)fd; (void)events;
+
+    while ((cqe = uring_peek_cqe(&ring->ring)) != NULL) {
+        if (cqe->user_data == ud_read) {
+            if (cqe->res < 0 || (size_t)cqe->res != ring->read_length) {
+                session_log(session, "Error reading the file");
+                session_end(session, rudp_err_file);
+            }
+        } else if (cqe->user_data == ud_send) {
+            if (cqe->res < 0 && cqe->res != -ECANCELED) {
+                session_log(session, "Unable to send message");
+            }
+        } else {
+            /// A multishot recvmsg without IORING_CQE_F_MORE has ended (out of buffers, for one) and needs to be queued again
+            if (!(cqe->flags & IORING_CQE_F_MORE) && !session->done && ring_arm_recv(ring) != rudp_ok) {
+                session_end(session, rudp_err_system);
+            }
+
+            uint8_t* payload;
+            size_t length;
+            struct sockaddr* name;
+            int id = uring_recvmsg_payload(&ring->buffers, cqe, &ring->recv_msg, &payload, &length, &name);
+            if (id >= 0) {
+                if (cqe->res >= 0 && !session->done) {
+                    memcpy(session->ack_buffer, payload, length);
+                    handle_ack(session, &session->paths[0], length, name);
+                }
+                uring_buf_ring_recycle(&ring->buffers, id);
+            }
+        }
+        uring_cqe_seen(&ring->ring);
+    }
+
+    if (uring_submit(&ring->ring, 0) < 0) {
+        session_end(session, rudp_err_system);
+    }
+}
+
+/** @brief Sets up the io_uring engine: the socket and the source file registered, the packet buffer pinned
+ *
+ *  @param session The transfer, with its one path's socket and sender_buffer
+ *  @return The engine, NULL if io_uring is not available
+ */
+static struct send_ring* ring_open(struct rudp_sender* session) {
+    struct send_path* path = &session->paths[0];
+    struct send_ring* ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    if (uring_init(&ring->ring, ring_entries) < 0) {
+        free(ring);
+        return NULL;
+    }
+
+    int files[2] = { path->socket_desc, session->source_fd };
+    struct iovec packet = { path->sender_buffer, max_payload_size };
+    if (uring_register_files(&ring->ring, files, session->source_fd >= 0 ? 2 : 1) < 0 ||
+        uring_register_buffers(&ring->ring, &packet, 1) < 0 ||
+        uring_buf_ring_init(&ring->ring, &ring->buffers, 0, ack_buffers, ack_buffer_size) < 0) {
+        uring_close(&ring->ring);
+        free(ring);
+        return NULL;
+    }
+
+    ring->recv_msg.msg_namelen = sizeof(struct sockaddr_in6);
+    ring->send_msg.msg_name = &path->server_addr;
+    ring->send_msg.msg_iov = ring->send_iov;
+
+    if (ring_arm_recv(ring) != rudp_ok || uring_submit(&ring->ring, 0) < 0) {
+        uring_buf_ring_free(&ring->buffers);
+        uring_close(&ring->ring);
+        free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+/** @brief Timer callback: the ack of the packet in flight on a path did not come back in time
+ *
+ *  With several paths, one that keeps timing out is given up so its packet can go another way.
+ *
+ *  @return void
+ */
+static void on_rto(struct evloop* loop, int fd, uint32_t events, void* arg) {
+    struct send_path* path = arg;
+    struct rudp_sender* session = path->session;
+    uint32_t index;
+    (void)loop; (void)fd; (void)events;
+
+    if (ev_timer_ack(&path->rto_timer) == 0) {
+        return;
+    }
+    if (session->done || path->dead) {
+        return;
+    }
+    memcpy(&index, path->sender_buffer+index_offset, 4);
+    session->stats.timeouts++;
+    trace_event(trace_timeout, index, path->t);
+    if (++path->timeouts >= path_dead_timeouts && !path->finishing && session->paths_alive > 1) {
+        path_failed(path);
+        return;
+    }
+    /// Backing off until an ack that was not for a resent packet gives a new round trip time (the FIN
+    /// does not, as the receiver may be gone and fin_retries bounds it)
+    if (!path->finishing) {
+        path->rto_us = path->rto_us * 2 < ack_timeout_max_us ? path->rto_us * 2 : ack_timeout_max_us;
+    }
+    packet_lost(path);
+}
+
+/** @brief Timer callback: the send time has (nearly) come
+ *
+ *  @return void
+ */
+static void on_pace(struct evloop* loop, int fd, uint32_t events, void* arg) {
+    struct send_path* path = arg;
+    (void)loop; (void)fd; (void)events;
+
+    if (ev_timer_ack(&path->pace_timer) == 0) {
+        return;
+    }
+    if (!path->session->done && !path->dead) {
+        send_packet(path);
+    }
+}
+
+/** @brief Produces a zero range packet of a plain transfer in place of that many zeros in the file
+ *
+ *  @param session The transfer
+ *  @param path The path it goes on
+ *  @param length Bytes of zeros from where the file source is
+ *  @return Length of the packet
+ */
+static size_t zero_packet(struct rudp_sender* session, struct send_path* path, unsigned long long length) {
+    struct file_source* source = &session->file;
+    uint64_t run = length;
+    path->sender_buffer[ack_offset] = 0;
+    path->sender_buffer[type_offset] = pkt_zero;
+    memcpy(path->sender_buffer+index_offset, &source->index, 4);
+    memcpy(path->sender_buffer+data_offset, &run, zero_frame_size);
+
+    source->index++;
+    source->bytesRead += length;
+    return header_size + zero_frame_size;
+}
+
+/** @brief Produces the next data packet of a plain transfer
+ *
+ *  Holes in the file and runs of at least sparse_min_run zeros go as zero range packets instead.
+ *
+ *  @param session The transfer
+ *  @param path The path it goes on
+ *  @return Length of the packet, 0 at the end of the file
+ */
+static size_t next_file_packet(struct rudp_sender* session, struct send_path* path) {
+    struct file_source* source = &session->file;
+    if (source->bytesRead >= source->bytesToTransfer) {
+        return 0;
+    }
+
+    /// A hole goes as one zero range, however long; leaving a data region, ask the file system where the next one is
+    if (source->bytesRead >= source->data_end) {
+        unsigned long long data;
+        sparse_data_region(session->source_fd, source->bytesRead, &data, &source->data_end);
+        if (data > source->bytesRead) {
+            unsigned long long end = data < source->bytesToTransfer ? data : source->bytesToTransfer;
+            return zero_packet(session, path, end - source->bytesRead);
+        }
+    }
+
+    /// Determine number of bytes to read based on how many unread bytes remain
+    int byteNumber = (max_data_size < (source->bytesToTransfer - source->bytesRead)) ? max_data_size : (source->bytesToTransfer - source->bytesRead);
+
+    /// Read 'byteNumber' of bytes from the read_file straight into the packet (with io_uring the read is linked to the send instead,
+    /// except while the first packet races to several addresses with plain sendmsg(), or when it has to be sealed before it goes)
+    if (session->ring != NULL && !session->racing && session->config.cipher == rudp_cipher_none) {
+        session->pending_read = byteNumber;
+        session->read_offset = source->bytesRead;
+    } else {
+        fseek(source->read_file, source->bytesRead, SEEK_SET);
+        if (fread(path->sender_buffer+data_offset, 1, byteNumber, source->read_file) != (size_t)byteNumber) {
+            session_log(session, "Error reading the file");
+            session_end(session, rudp_err_file);
+            return 0;
+        }
+    }
+
+    /// A payload of zeros may start a run long enough to go as a zero range instead, read ahead to the end of it
+    if (session->pending_read == 0 && sparse_zero_prefix(path->sender_buffer+data_offset, byteNumber) == (size_t)byteNumber) {
+        unsigned long long limit = source->data_end < source->bytesToTransfer ? source->data_end : source->bytesToTransfer;
+        unsigned long long run = byteNumber;
+        if (source->scan == NULL) {
+            source->scan = malloc(sparse_scan_size);
+        }
+        if (source->scan != NULL) {
+            run += sparse_zero_run(session->source_fd, source->bytesRead + byteNumber, limit, source->scan);
+        }
+        if (run >= sparse_min_run) {
+            return zero_packet(session, path, run);
+        }
+    }
+
+    /// Copy the two uint8_t values and the current index to the start of the packet
+    path->sender_buffer[ack_offset] = 0;
+    path->sender_buffer[type_offset] = pkt_data;
+    memcpy(path->sender_buffer+index_offset, &source->index, 4);
+
+    source->index++;
+    source->bytesRead += byteNumber;
+    return byteNumber+6;
+}
+
+/** @brief Produces the next data packet of a transfer from memory, its payload left where it is
+ *
+ *  @param session The transfer
+ *  @param path The path it goes on
+ *  @return Length of the packet, 0 once all the bytes are sent
+ */
+static size_t next_memory_packet(struct rudp_sender* session, struct send_path* path) {
+    struct memory_source* source = &session->memory;
+    if (source->bytesRead >= source->bytesToTransfer) {
+        return 0;
+    }
+
+    /// Point the payload at the next bytes of the iovecs, as many as fit in one packet
+    size_t room = (max_data_size < (source->bytesToTransfer - source->bytesRead)) ? max_data_size : (source->bytesToTransfer - source->bytesRead);
+    size_t length = 0;
+    while (length < room && path->payload_count < max_payload_pieces) {
+        const struct iovec* piece = &source->iov[source->current];
+        size_t take = piece->iov_len - source->offset;
+        if (take > room - length) {
+            take = room - length;
+        }
+        if (take > 0) {
+            path->payload[path->payload_count].iov_base = (uint8_t*)piece->iov_base + source->offset;
+            path->payload[path->payload_count].iov_len = take;
+            path->payload_count++;
+            source->offset += take;
+            length += take;
+        }
+        if (source->offset == piece->iov_len) {
+            source->current++;
+            source->offset = 0;
+        }
+    }
+
+    path->sender_buffer[ack_offset] = 0;
+    path->sender_buffer[type_offset] = pkt_data;
+    memcpy(path->sender_buffer+index_offset, &source->index, 4);
+
+    source->index++;
+    source->bytesRead += length;
+    return length+6;
+}
+
+/** @brief Produces the next packet of a sync: a signature request or a delta operation
+ *
+ *  @param session The transfer
+ *  @param path The path it goes on
+ *  @return Length of the packet, 0 once the whole file is described
+ */
+static size_t next_sync_packet(struct rudp_sender* session, struct send_path* path) {
+    struct sync_source* sync = &session->sync;
+
+    if (!sync->delta_phase) {
+        /// Fetching the receiver's block signatures one chunk at a time
+        if (sync->chunk == 0 || (unsigned long long)sync->chunk * sig_per_chunk < sync->nblocks) {
+            path->sender_buffer[type_offset] = pkt_sig;
+            memcpy(path->sender_buffer+index_offset, &sync->chunk, 4);
+            return header_size;
+        }
+
+        session_log(session, "Receiver has %u blocks of %u bytes", sync->nblocks, sync->block_size);
+        if (delta_index_build(&sync->sig_index, sync->sigs, sync->nblocks) < 0) {
+            session_end(session, rudp_err_memory);
+            return 0;
+        }
+        delta_gen_init(&sync->gen, sync->source, sync->bytesToTransfer, sync->sigs, &sync->sig_index, sync->nblocks, sync->block_size);
+        sync->delta_phase = 1;
+    }
+
+    /// Sending one delta operation per packet, in order, with the same stop-and-wait as a plain transfer
+    size_t op_length = delta_next(&sync->gen, path->sender_buffer+data_offset, max_data_size);
+    if (op_length == 0) {
+        return 0;
+    }
+    path->sender_buffer[type_offset] = pkt_delta;
+    memcpy(path->sender_buffer+index_offset, &sync->index, 4);
+    sync->index++;
+    return header_size+op_length;
+}
+
+/** @brief Takes in a signature reply, or counts the progress of an acknowledged delta operation
+ *
+ *  @param session The transfer
+ *  @param length Length of the ack
+ *  @return void
+ */
+static void sync_acked(struct rudp_sender* session, ssize_t length) {
+    struct sync_source* sync = &session->sync;
+
+    if (sync->delta_phase) {
+        /// Progress counts how far into our file the operations have got
+        session->stats.bytes = sync->gen.lit_start;
+        return;
+    }
+
+    if (delta_sig_parse(session->ack_buffer+data_offset, length-header_size, sync->chunk, &sync->sigs, &sync->nblocks, &sync->block_size) < 0) {
+        session_log(session, "Malformed signature reply from the receiver");
+        session_end(session, rudp_err_protocol);
+        return;
+    }
+    sync->chunk++;
+}
+
+/** @brief Opens the file to send and checks it holds enough bytes
+ *
+ *  @param filename The file you are reading from.
+ *  @param bytesToTransfer The number of bytes you want to read from filename.
+ *  @param read_file Set to the opened file
+ *  @return rudp_ok or an error code
+ */
+static int open_source(const char* filename, unsigned long long int bytesToTransfer, FILE** read_file) {
+    /// Initalizing file I/O and test that the file exists
+    *read_file = fopen(filename, "rb");
+    if (*read_file == NULL){
+       return rudp_err_file;
+    }
+
+    /// Determining the maximum value of the readfile to check that bytestotransfer doesnt exceed the file
+    fseek(*read_file, 0, SEEK_END);
+    long readfile_size = ftell(*read_file);
+    fseek(*read_file, 0, SEEK_SET);
+    if(bytesToTransfer>readfile_size){
+        fclose(*read_file);
+        *read_file = NULL;
+        return rudp_err_short_file;
+    }
+    return rudp_ok;
+}
+
+/** @brief Prepares the source of a plain transfer: the file, read a packet at a time
+ *
+ *  @param session The transfer
+ *  @return rudp_ok or an error code
+ */
+static int file_begin(struct rudp_sender* session) {
+    int error = open_source(session->config.filename, session->config.bytes, &session->file.read_file);
+    if (error != rudp_ok) {
+        return error;
+    }
+    session->file.bytesToTransfer = session->config.bytes;
+    session->next_packet = next_file_packet;
+    session->source_fd = fileno(session->file.read_file);
+    return rudp_ok;
+}
+
+/** @brief Prepares the source of a plain transfer from memory: the caller's iovecs, sent without copying
+ *
+ *  @param session The transfer
+ *  @return rudp_ok, rudp_err_short_file if the iovecs hold fewer than bytes
+ */
+static int memory_begin(struct rudp_sender* session) {
+    unsigned long long total = 0;
+    for (int i = 0; i < session->config.iovcnt; i++) {
+        total += session->config.iov[i].iov_len;
+    }
+    if (session->config.bytes > total) {
+        return rudp_err_short_file;
+    }
+    session->memory.iov = session->config.iov;
+    session->memory.iovcnt = session->config.iovcnt;
+    session->memory.bytesToTransfer = session->config.bytes;
+    session->next_packet = next_memory_packet;
+    session->source_fd = -1;
+    return rudp_ok;
+}
+
+/** @brief Prepares the source of a sync: the file mapped, so the rolling window can move over it byte by byte
+ *
+ *   Sync Algorithm Skeleton:
+ *        - Ask the receiver for the signatures of the blocks of its existing file (pkt_sig).
+ *        - Slide a window over our file and look its rolling checksum up in the signatures.
+ *        - Send matching runs of blocks as copy operations and everything else as literals (pkt_delta).
+ *        - Terminate connection, the receiver swaps the rebuilt file in.
+ *
+ *  @param session The transfer
+ *  @return rudp_ok or an error code
+ */
+static int sync_begin(struct rudp_sender* session) {
+    struct sync_source* sync = &session->sync;
+    sync->bytesToTransfer = session->config.bytes;
+
+    if (session->config.iov != NULL) {
+        /// The rolling window needs the bytes in one piece
+        if (session->config.iovcnt != 1) {
+            return rudp_err_invalid;
+        }
+        if (sync->bytesToTransfer > session->config.iov[0].iov_len) {
+            return rudp_err_short_file;
+        }
+        sync->source = session->config.iov[0].iov_base;
+    } else {
+        int error = open_source(session->config.filename, session->config.bytes, &sync->read_file);
+        if (error != rudp_ok) {
+            return error;
+        }
+    }
+
+    if (sync->read_file != NULL && sync->bytesToTransfer > 0) {
+        void *mapped = mmap(NULL, sync->bytesToTransfer, PROT_READ, MAP_PRIVATE, fileno(sync->read_file), 0);
+        if (mapped == MAP_FAILED) {
+            return rudp_err_system;
+        }
+        sync->source = mapped;
+    }
+    session->next_packet = next_sync_packet;
+    session->on_ack = sync_acked;
+    session->source_fd = -1;
+    return rudp_ok;
+}
+
+/** @brief Releases the source: closes the file, unmaps it and frees the signatures
+ *
+ *  @param session The transfer
+ *  @return void
+ */
+static void source_close(struct rudp_sender* session) {
+    if (session->file.read_file != NULL) {
+        fclose(session->file.read_file);
+    }
+    free(session->file.scan);
+
+    struct sync_source* sync = &session->sync;
+    if (sync->source != NULL && sync->read_file != NULL) {
+        munmap((void*)sync->source, sync->bytesToTransfer);
+    }
+    if (sync->read_file != NULL) {
+        fclose(sync->read_file);
+    }
+    if (sync->delta_phase) {
+        delta_index_free(&sync->sig_index);
+    }
+    free(sync->sigs);
+    memset(&session->file, 0, sizeof(session->file));
+    memset(&session->memory, 0, sizeof(session->memory));
+    memset(sync, 0, sizeof(*sync));
+}
+
+/** @brief Timer callback: the transfer is over, tell the owner
+ *
+ *  Runs from its own timer so the owner may close the session from the done callback.
+ *
+ *  @return void
+ */
+static void on_done(struct evloop* loop, int fd, uint32_t events, void* arg) {
+    struct rudp_sender* session = arg;
+    (void)loop; (void)fd; (void)events;
+
+    if (ev_timer_ack(&session->done_timer) == 0) {
+        return;
+    }
+    if (session->config.sync && session->error == rudp_ok) {
+        session_log(session, "Sent %llu literal bytes, %llu bytes matched the receiver's copy",
+                    session->sync.gen.literal_bytes, session->sync.gen.matched_bytes);
+    }
+    for (int i = 0; i < session->path_count && session->path_count > 1; i++) {
+        struct send_path* path = &session->paths[i];
+        if (path->socket_desc < 0) {
+            session_log(session, "Path %s: not used", path->local);
+        } else {
+            session_log(session, "Path %s: %llu packets, srtt %.3f ms, ack timeout %.3f ms%s", path->local, path->packets,
+                        path->srtt_us / 1000, path->rto_us / 1000, path->dead ? ", failed" : "");
+        }
+    }
+    stats_finish(&session->stats, &session->metrics);
+    if (session->callbacks.done != NULL) {
+        session->callbacks.done(session->callbacks.arg, session->error);
+    }
+}
+
+/** @brief Sets up the sockets for the receiver's addresses and puts the first packets in flight
+ *
+ *  @param session The transfer, with its source and timers
+ *  @param result What the hostname resolved to
+ *  @return rudp_ok or an error code
+ */
+static int start_transfer(struct rudp_sender* session, const struct resolve_result* result) {
+    int error = rudp_ok;
+    if (session->config.path_count == 0) {
+        error = setup_socket(session, result);
+        if (error != rudp_ok) {
+            return error;
+        }
+        session->paths_alive = 1;
+    } else {
+        /// A path that can not be set up is left out, the transfer goes on as long as one is left
+        for (int i = 0; i < session->path_count; i++) {
+            struct send_path* path = &session->paths[i];
+            int path_error = setup_path(session, path, result);
+            if (path_error != rudp_ok) {
+                if (path->socket_desc >= 0) {
+                    close(path->socket_desc);
+                    path->socket_desc = -1;
+                }
+                path->dead = 1;
+                error = path_error;
+                continue;
+            }
+            session->paths_alive++;
+        }
+        if (session->paths_alive == 0) {
+            return error;
+        }
+    }
+    session->stats.window = session->paths_alive;
+
+    int txtime = 0;
+    for (int i = 0; i < session->path_count; i++) {
+        struct send_path* path = &session->paths[i];
+        if (path->socket_desc >= 0) {
+            char problems[256];
+            if (tuning_apply(path->socket_desc, &session->config.tuning, 0, problems, sizeof(problems)) < 0) {
+                session_log(session, "Socket tuning: %s", problems);
+            }
+            txtime |= pacer_init(&path->pacer, path->socket_desc, (struct sockaddr*)&path->server_addr, session->config.pacing_mode);
+            if (path->pacer.txtime_error != 0) {
+                session_log(session, "SO_TXTIME: %s, pacing in userspace", strerror(path->pacer.txtime_error));
+            }
+        }
+    }
+    if (txtime) {
+        session_log(session, "Pacing with SO_TXTIME");
+    }
+
+    if (session->config.use_uring && session->path_count > 1) {
+        session_log(session, "io_uring is not used with multipath, using plain system calls");
+    } else if (session->config.use_uring) {
+        session->ring = ring_open(session);
+        if (session->ring == NULL) {
+            session_log(session, "io_uring is not available (%s), using plain system calls", strerror(errno));
+        }
+    }
+
+    if (session->ring != NULL) {
+        if (evloop_add(session->loop, session->ring->ring.fd, EPOLLIN, on_ring, session) < 0) {
+            return rudp_err_system;
+        }
+    } else {
+        for (int i = 0; i < session->path_count; i++) {
+            struct send_path* path = &session->paths[i];
+            if (path->socket_desc >= 0 && evloop_add(session->loop, path->socket_desc, EPOLLIN, on_socket, path) < 0) {
+                return rudp_err_system;
+            }
+        }
+    }
+
+    /// Put the first packets in flight and let the callbacks do the rest
+    fill_paths(session);
+    return rudp_ok;
+}
+
+/** @brief Resolver callback: the hostname was looked up, start sending
+ *
+ *  @return void
+ */
+static void on_resolved(void* arg, int error, const struct resolve_result* result) {
+    struct rudp_sender* session = arg;
+    session->resolving = NULL;
+
+    if (error != 0) {
+        session_log(session, "Could not resolve %s: %s", session->config.hostname, gai_strerror(error));
+        session_end(session, rudp_err_resolve);
+        return;
+    }
+    error = start_transfer(session, result);
+    if (error != rudp_ok) {
+        session_end(session, error);
+    }
+}
+
+/** @brief Releases a session that could not be opened, keeping errno for the caller
+ *
+ *  @param session The half opened session, freed
+ *  @param error Why it could not be opened
+ *  @return error
+ */
+static int open_failed(struct rudp_sender* session, int error) {
+    int saved_errno = errno;
+    rudp_sender_close(session);
+    errno = saved_errno;
+    return error;
+}
+
+/** @brief Fills in the defaults: pacing picked automatically, BDP-sized socket buffers, no io_uring, no scheduler
+ *
+ *  @param config The config to fill in; hostname, port, filename and bytes are left for the caller
+ *  @return void
+ */
+void rudp_sender_config_init(struct rudp_sender_config *config) {
+    memset(config, 0, sizeof(*config));
+    config->family = AF_UNSPEC;
+    config->pacing_mode = pacer_auto;
+    tuning_defaults(&config->tuning);
+    config->weight = 1;
+}
+
+/** @brief Starts sending a file (or memory): opens it and the socket and puts the first packet in flight
+ *
+ *   Sender Algorithm Skeleton:
+ *        - Read from File (raw data).
+ *        - Splice the file into sendable bits.
+ *        - Create socket.
+ *        - Send the file bits over through the socket.
+ *        - Check for ack and increase index, repeat if nack received.
+ *        - Terminate connection and close socket and file.
+ *
+ *  A hostname that is not an address and was not looked up in the last minute is resolved on a thread while
+ *  the loop runs. The first packet goes to the first of the receiver's addresses, and every 100 ms to one more
+ *  of them (Happy Eyeballs) until one answers, which gets the rest of the transfer. Everything after that
+ *  happens in the loop's callbacks; the done callback reports the end.
+ *
+ *  With paths in the config every local address or interface gets a socket and a packet in flight of its own,
+ *  with its own pacing gap, round trip time and ack timeout. An idle path takes the next packet, so a faster path carries
+ *  more of them, and a path that stops answering is given up and its packet goes out on another one.
+ *
+ *  With a cipher every packet is sealed on its way out (seal.h) and only sealed replies are believed.
+ *
+ *  With a scheduler every packet waits in its queue once the path's own pacing gap is over, and goes when
+ *  the scheduler gives this transfer its turn among the others (sched.h).
+ *
+ *  @param sender Set to the new session
+ *  @param loop The event loop the session runs on
+ *  @param config What to send where, copied (the strings, iovecs and the memory they point at must outlive the session)
+ *  @param callbacks What to report back, copied (may be NULL)
+ *  @return rudp_ok or an error code, *sender is NULL after an error
+ */
+int rudp_sender_open(struct rudp_sender **sender, struct evloop *loop, const struct rudp_sender_config *config,
+                     const struct rudp_callbacks *callbacks) {
+    *sender = NULL;
+    struct rudp_sender* session = calloc(1, sizeof(*session));
+    if (session == NULL) {
+        return rudp_err_memory;
+    }
+    session->loop = loop;
+    session->config = *config;
+    if (callbacks != NULL) {
+        session->callbacks = *callbacks;
+    }
+    session->done_timer.fd = -1;
+    session->metrics.listen_fd = -1;
+    session->flow.priority = config->priority;
+    session->flow.weight = config->weight > 0 ? config->weight : 1;
+
+    /// Multipath is for plain transfers: a sync has to go one request at a time
+    if (config->path_count < 0 || config->path_count > rudp_max_paths || (config->path_count > 0 && config->sync)) {
+        return open_failed(session, rudp_err_invalid);
+    }
+    session->path_count = config->path_count > 0 ? config->path_count : 1;
+    session->paths = calloc(session->path_count, sizeof(*session->paths));
+    if (session->paths == NULL) {
+        return open_failed(session, rudp_err_memory);
+    }
+
+    /// Initializing a sender buffer of max payload size which is the total data send with a header of 6 bytes for every path,
+    /// and a buffer of the maximum payload size to receieve acknowladgements from the receiver
+    for (int i = 0; i < session->path_count; i++) {
+        struct send_path* path = &session->paths[i];
+        path->session = session;
+        path->local = config->path_count > 0 ? config->paths[i] : NULL;
+        path->socket_desc = -1;
+        path->rto_timer.fd = path->pace_timer.fd = -1;
+        path->turn.flow = &session->flow;
+        path->turn.release = on_turn;
+        path->turn.arg = path;
+        path->sender_buffer = calloc(1, max_payload_size);
+        if (config->cipher != rudp_cipher_none) {
+            path->sealed = calloc(1, max_datagram_size);
+        }
+        path->t = 1000;
+        path->rto_us = ack_timeout_us;
+    }
+    session->ack_buffer = calloc(1, max_datagram_size);
+    for (int i = 0; i < session->path_count; i++) {
+        if (session->paths[i].sender_buffer == NULL || (config->cipher != rudp_cipher_none && session->paths[i].sealed == NULL)) {
+            return open_failed(session, rudp_err_memory);
+        }
+    }
+    if (session->ack_buffer == NULL) {
+        return open_failed(session, rudp_err_memory);
+    }
+
+    int error;
+    if (config->sync) {
+        error = sync_begin(session);
+    } else {
+        error = config->iov != NULL ? memory_begin(session) : file_begin(session);
+    }
+    if (error != rudp_ok) {
+        return open_failed(session, error);
+    }
+
+    /// Counters for the progress report and the metrics, which are labelled with the receiver unless the caller names the transfer
+    stats_init(&session->stats, "sender", config->bytes);
+    char label[stats_label_size];
+    if (config->metrics_label != NULL) {
+        snprintf(label, sizeof(label), "%s", config->metrics_label);
+    } else if (strchr(config->hostname, ':') != NULL) {
+        snprintf(label, sizeof(label), "[%s]:%u", config->hostname, config->port);
+    } else {
+        snprintf(label, sizeof(label), "%s:%u", config->hostname, config->port);
+    }
+    if (stats_sink_open(&session->metrics, config->metrics_path, config->metrics_interval_ms, label) < 0) {
+        return open_failed(session, rudp_err_system);
+    }
+
+    if (config->cipher != rudp_cipher_none) {
+        error = seal_init(&session->seal, config->cipher, config->key, 0);
+        if (error != rudp_ok) {
+            return open_failed(session, error);
+        }
+        session_log(session, "Encrypting with %s", seal_name(config->cipher));
+    }
+
+    for (int i = 0; i < session->path_count; i++) {
+        struct send_path* path = &session->paths[i];
+        if (ev_timer_init(loop, &path->rto_timer, on_rto, path) < 0 ||
+            ev_timer_init(loop, &path->pace_timer, on_pace, path) < 0) {
+            return open_failed(session, rudp_err_system);
+        }
+    }
+    if (ev_timer_init(loop, &session->done_timer, on_done, session) < 0) {
+        return open_failed(session, rudp_err_system);
+    }
+
+    /// Addresses and recently used names go on right away, other names are looked up on a thread first
+    struct resolve_result result;
+    if (resolve_cached(config->hostname, config->port, config->family, &result)) {
+        error = start_transfer(session, &result);
+        if (error != rudp_ok) {
+            return open_failed(session, error);
+        }
+    } else {
+        session->resolving = resolve_start(loop, config->hostname, config->port, config->family, on_resolved, session);
+        if (session->resolving == NULL) {
+            return open_failed(session, rudp_err_system);
+        }
+    }
+    *sender = session;
+    return rudp_ok;
+}
+
+/** @brief The counters of a transfer, up to date after every callback
+ *
+ *  @param sender The session
+ *  @return Its counters
+ */
+const struct rudp_stats *rudp_sender_stats(const struct rudp_sender *sender) {
+    return &sender->stats;
+}
+
+/** @brief Closes the session, aborting the transfer if it is still going (no done callback then)
+ *
+ *  @param sender The session, freed; NULL does nothing
+ *  @return void
+ */
+void rudp_sender_close(struct rudp_sender *sender) {
+    if (sender == NULL) {
+        return;
+    }
+    struct evloop* loop = sender->loop;
+    resolve_cancel(sender->resolving);
+    if (sender->done_timer.fd >= 0) {
+        ev_timer_close(loop, &sender->done_timer);
+    }
+    if (sender->ring != NULL) {
+        evloop_del(loop, sender->ring->ring.fd);
+        uring_close(&sender->ring->ring);
+        uring_buf_ring_free(&sender->ring->buffers);
+        free(sender->ring);
+    }
+    for (int i = 0; sender->paths != NULL && i < sender->path_count; i++) {
+        struct send_path* path = &sender->paths[i];
+        if (path->rto_timer.fd >= 0) {
+            ev_timer_close(loop, &path->rto_timer);
+        }
+        if (path->pace_timer.fd >= 0) {
+            ev_timer_close(loop, &path->pace_timer);
+        }
+        pacer_close(&path->pacer);
+        if (sender->config.scheduler != NULL) {
+            sched_cancel(sender->config.scheduler, &path->turn);
+        }
+        if (path->socket_desc >= 0) {
+            evloop_del(loop, path->socket_desc);
+            close(path->socket_desc);
+        }
+        free(path->sender_buffer);
+        free(path->sealed);
+    }
+    source_close(sender);
+    seal_free(&sender->seal);
+    stats_sink_close(&sender->metrics);
+    free(sender->paths);
+    free(sender->ack_buffer);
+    free(sender);
+}
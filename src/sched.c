@@ -0,0 +1,209 @@
+/** @file sched.c
+ *
+ *  @brief The transfer scheduler: strict priorities, weighted fair queuing and a global rate cap over sender sessions.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include <stdlib.h>
+
+#include "librudp.h"
+#include "sched.h"
+#include "pacer.h"
+
+
+/** @brief Whether a waiting packet goes before another one
+ *
+ *  @param entry The packet
+ *  @param other The one it is compared with
+ *  @return 1 if entry is more urgent, or of the same priority and finishes first in virtual time
+ */
+static int goes_before(const struct sched_entry *entry, const struct sched_entry *other) {
+    if (entry->flow->priority != other->flow->priority) {
+        return entry->flow->priority < other->flow->priority;
+    }
+    return entry->finish < other->finish;
+}
+
+/** @brief Arms the timer to run the scheduler at a time, unless it already is
+ *
+ *  @param scheduler The scheduler
+ *  @param at When, pacer_now() clock
+ *  @param now pacer_now()
+ *  @return void
+ */
+static void wake_at(struct rudp_scheduler *scheduler, uint64_t at, uint64_t now) {
+    if (scheduler->wake_ns == at) {
+        return;
+    }
+    scheduler->wake_ns = at;
+    ev_timer_arm(&scheduler->timer, (at - now) / 1000, 0);
+}
+
+/** @brief Lets out every packet whose turn it is, then sleeps until the next one's
+ *
+ *  A packet goes once its own pacing allows it and the rate cap has room, the most urgent of those first,
+ *  within a priority the one with the smallest virtual finish time. Sending it may end its session, which
+ *  takes that session's other packets off the queue, so the queue is looked at afresh after every one.
+ *
+ *  @param scheduler The scheduler
+ *  @return void
+ */
+static void sched_run(struct rudp_scheduler *scheduler) {
+    if (scheduler->running) {
+        return;
+    }
+    scheduler->running = 1;
+    for (;;) {
+        uint64_t now = pacer_now();
+        uint64_t horizon = now + pacer_spin_ns;
+        uint64_t start = scheduler->link_free_ns > now ? scheduler->link_free_ns : now;
+
+        struct sched_entry **best = NULL;
+        uint64_t next_eligible = 0;
+        for (struct sched_entry **link = &scheduler->queue; *link != NULL; link = &(*link)->next) {
+            struct sched_entry *entry = *link;
+            if (entry->eligible_ns > horizon) {
+                if (next_eligible == 0 || entry->eligible_ns < next_eligible) {
+                    next_eligible = entry->eligible_ns;
+                }
+            } else if (best == NULL || goes_before(entry, *best)) {
+                best = link;
+            }
+        }
+        if (best == NULL) {
+            if (next_eligible != 0) {
+                wake_at(scheduler, next_eligible > start ? next_eligible : start, now);
+            }
+            break;
+        }
+        if (start > horizon) {
+            wake_at(scheduler, start, now);
+            break;
+        }
+
+        struct sched_entry *entry = *best;
+        *best = entry->next;
+        entry->next = NULL;
+        entry->queued = 0;
+        uint64_t send_at = entry->eligible_ns > start ? entry->eligible_ns : start;
+        scheduler->vtime = entry->finish;
+        if (scheduler->rate_mbps > 0) {
+            /// Bytes times 8 bits at rate_mbps bits per microsecond, in nanoseconds
+            scheduler->link_free_ns = send_at + (uint64_t)(entry->bytes * 8000.0 / scheduler->rate_mbps);
+        }
+        entry->release(entry, send_at);
+    }
+    scheduler->running = 0;
+}
+
+/** @brief Timer callback: the link or a waiting packet is free
+ *
+ *  @return void
+ */
+static void on_wake(struct evloop *loop, int fd, uint32_t events, void *arg) {
+    struct rudp_scheduler *scheduler = arg;
+    (void)loop; (void)fd; (void)events;
+
+    if (ev_timer_ack(&scheduler->timer) == 0) {
+        return;
+    }
+    scheduler->wake_ns = 0;
+    sched_run(scheduler);
+}
+
+/** @brief Queues a packet, which may go out (entry->release) before this returns
+ *
+ *  Its virtual finish time is where its flow's last packet finished, or the scheduler's virtual time if the
+ *  flow fell behind that (an idle flow gets no credit), plus its bytes over the flow's weight.
+ *
+ *  @param scheduler The scheduler
+ *  @param entry The packet, with flow, release and arg set
+ *  @param eligible_ns When the flow's own pacing would send it, pacer_now() clock
+ *  @param bytes Its length, what the rate cap counts
+ *  @return 0, -1 if the entry is queued already (it is left where it is, linking it twice would loop the queue)
+ */
+int sched_enqueue(struct rudp_scheduler *scheduler, struct sched_entry *entry, uint64_t eligible_ns, size_t bytes) {
+    if (entry->queued) {
+        return -1;
+    }
+    struct sched_flow *flow = entry->flow;
+    double start = flow->finish > scheduler->vtime ? flow->finish : scheduler->vtime;
+    entry->eligible_ns = eligible_ns;
+    entry->bytes = bytes;
+    entry->finish = start + (double)bytes / (flow->weight > 0 ? flow->weight : 1);
+    flow->finish = entry->finish;
+
+    /// At the tail, so packets that tie go in the order they came
+    struct sched_entry **link = &scheduler->queue;
+    while (*link != NULL) {
+        link = &(*link)->next;
+    }
+    entry->next = NULL;
+    entry->queued = 1;
+    *link = entry;
+    sched_run(scheduler);
+    return 0;
+}
+
+/** @brief Takes a packet off the queue, if it is on it
+ *
+ *  @param scheduler The scheduler
+ *  @param entry The packet
+ *  @return void
+ */
+void sched_cancel(struct rudp_scheduler *scheduler, struct sched_entry *entry) {
+    if (!entry->queued) {
+        return;
+    }
+    for (struct sched_entry **link = &scheduler->queue; *link != NULL; link = &(*link)->next) {
+        if (*link == entry) {
+            *link = entry->next;
+            break;
+        }
+    }
+    entry->next = NULL;
+    entry->queued = 0;
+}
+
+/** @brief Opens a scheduler for sender sessions on a loop to share
+ *
+ *  @param scheduler Set to the new scheduler
+ *  @param loop The event loop the sessions run on
+ *  @param rate_mbps What all of them together may send at most, in Mbit/s of datagrams; 0 for no cap
+ *  @return rudp_ok or an error code, *scheduler is NULL after an error
+ */
+int rudp_scheduler_open(struct rudp_scheduler **scheduler, struct evloop *loop, double rate_mbps) {
+    *scheduler = NULL;
+    if (!(rate_mbps >= 0)) {
+        return rudp_err_invalid;
+    }
+    struct rudp_scheduler *opened = calloc(1, sizeof(*opened));
+    if (opened == NULL) {
+        return rudp_err_memory;
+    }
+    opened->loop = loop;
+    opened->rate_mbps = rate_mbps;
+    if (ev_timer_init(loop, &opened->timer, on_wake, opened) < 0) {
+        free(opened);
+        return rudp_err_system;
+    }
+    *scheduler = opened;
+    return rudp_ok;
+}
+
+/** @brief Closes a scheduler; the sessions that use it have to be closed first
+ *
+ *  @param scheduler The scheduler, freed; NULL does nothing
+ *  @return void
+ */
+void rudp_scheduler_close(struct rudp_scheduler *scheduler) {
+    if (scheduler == NULL) {
+        return;
+    }
+    ev_timer_close(scheduler->loop, &scheduler->timer);
+    free(scheduler);
+}
@@ -0,0 +1,60 @@
+/** @file sched.h
+ *
+ *  @brief The transfer scheduler: one pacer shared by sender sessions, with priorities, weights and a rate cap.
+ *
+ *  Without a scheduler every session paces itself and they split the link by however their AIMD
+ *  gaps settle. Sessions opened with the same struct rudp_scheduler instead hand each packet to it
+ *  once their own gap is over, and it lets them out one at a time: the most urgent priority first,
+ *  within a priority by weighted fair queuing (the smallest virtual finish time, self-clocked, so a
+ *  transfer of weight 3 gets three times the packets of one of weight 1 while both have some ready),
+ *  and never faster than the global rate. A packet that waits here has not left yet, so its ack
+ *  timeout only starts when the scheduler sends it.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "evloop.h"
+
+/// A transfer as the scheduler sees it
+struct sched_flow {
+    int priority; /// Lower goes first, strictly
+    unsigned weight; /// Share among the flows of the same priority, at least 1
+    double finish; /// Virtual finish time of its last packet
+};
+
+/// A packet waiting for its turn, one per path
+struct sched_entry {
+    struct sched_flow *flow;
+    uint64_t eligible_ns; /// Its own pacing lets it go from then on
+    size_t bytes;
+    double finish; /// Virtual finish time, the order within a priority
+    int queued;
+    struct sched_entry *next;
+    /// Sends it at send_at (pacer_now() clock, at most pacer_spin_ns ahead); it is off the queue already
+    void (*release)(struct sched_entry *entry, uint64_t send_at);
+    void *arg;
+};
+
+/// The shared pacer; struct rudp_scheduler in librudp.h
+struct rudp_scheduler {
+    struct evloop *loop;
+    struct ev_timer timer; /// Wakes it when the link or the next packet is free
+    double rate_mbps; /// Global cap, 0 for none
+    uint64_t link_free_ns; /// When the cap lets the next packet go
+    double vtime; /// Finish time of the last packet sent
+    uint64_t wake_ns; /// What the timer is armed for, 0 when it is not
+    struct sched_entry *queue;
+    int running; /// Letting packets out, a packet queued meanwhile is picked up by that same round
+};
+
+int sched_enqueue(struct rudp_scheduler *scheduler, struct sched_entry *entry, uint64_t eligible_ns, size_t bytes);
+void sched_cancel(struct rudp_scheduler *scheduler, struct sched_entry *entry);
+
+#endif
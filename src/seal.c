@@ -0,0 +1,377 @@
+/** @file seal.c
+ *
+ *  @brief Sealing and opening datagrams with an AEAD, key derivation and the replay window.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+
+#include "seal.h"
+
+#define seal_nonce_size 12
+#define key_iterations 100000 /// PBKDF2 rounds turning a passphrase into a key
+#define key_salt "librudp pre-shared key" /// Fixed, both ends have to come to the same key from the same passphrase
+#define salt_key_info "librudp salt tags" /// HKDF info of the key that tags salts, so it differs from every transfer's key
+
+
+/** @brief The OpenSSL cipher of one of ours
+ *
+ *  @param cipher rudp_cipher_aes_gcm or rudp_cipher_chacha20
+ *  @return The cipher, NULL for anything else
+ */
+static const EVP_CIPHER *evp_cipher(int cipher) {
+    switch (cipher) {
+        case rudp_cipher_aes_gcm: return EVP_aes_256_gcm();
+        case rudp_cipher_chacha20: return EVP_chacha20_poly1305();
+        default: return NULL;
+    }
+}
+
+/** @brief The name of a cipher for the log
+ *
+ *  @param cipher One of the rudp_cipher_ values
+ *  @return Its name, never NULL
+ */
+const char *seal_name(int cipher) {
+    switch (cipher) {
+        case rudp_cipher_aes_gcm: return "AES-256-GCM";
+        case rudp_cipher_chacha20: return "ChaCha20-Poly1305";
+        default: return "none";
+    }
+}
+
+/** @brief Derives a key from the pre-shared key (HKDF-SHA256)
+ *
+ *  @param seal The state, with the pre-shared key
+ *  @param salt The transfer's salt, NULL for none
+ *  @param info What the key is for
+ *  @param key Set to the key
+ *  @return 0, -1 if OpenSSL failed
+ */
+static int derive_key(const struct seal *seal, const uint8_t *salt, const char *info, uint8_t *key) {
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    size_t length = rudp_key_size;
+    int ok = ctx != NULL &&
+             EVP_PKEY_derive_init(ctx) > 0 &&
+             EVP_PKEY_CTX_set_hkdf_md(ctx, EVP_sha256()) > 0 &&
+             (salt == NULL || EVP_PKEY_CTX_set1_hkdf_salt(ctx, salt, seal_salt_size) > 0) &&
+             EVP_PKEY_CTX_set1_hkdf_key(ctx, seal->master, rudp_key_size) > 0 &&
+             EVP_PKEY_CTX_add1_hkdf_info(ctx, (const unsigned char *)info, strlen(info)) > 0 &&
+             EVP_PKEY_derive(ctx, key, &length) > 0;
+    EVP_PKEY_CTX_free(ctx);
+    return ok ? 0 : -1;
+}
+
+/** @brief Derives the key of a transfer from the pre-shared key and the transfer's salt
+ *
+ *  @param seal The state, with the pre-shared key and cipher
+ *  @param salt The transfer's salt
+ *  @param key Set to the transfer's key
+ *  @return 0, -1 if OpenSSL failed
+ */
+static int transfer_key(const struct seal *seal, const uint8_t *salt, uint8_t *key) {
+    return derive_key(seal, salt, seal_name(seal->cipher), key);
+}
+
+/** @brief The tag of a salt: its random bytes encrypted under the salt key, cut short
+ *
+ *  @param seal The state, with salts keyed
+ *  @param salt The salt, only its first seal_salt_random bytes are read
+ *  @param tag Set to the tag, seal_salt_size - seal_salt_random bytes
+ *  @return 0, -1 if OpenSSL failed
+ */
+static int salt_tag(struct seal *seal, const uint8_t *salt, uint8_t *tag) {
+    uint8_t block[16];
+    uint8_t encrypted[16];
+    int written;
+    memset(block, 0, sizeof(block));
+    memcpy(block, salt, seal_salt_random);
+    if (EVP_EncryptUpdate(seal->salts, encrypted, &written, block, sizeof(block)) <= 0 || written != sizeof(block)) {
+        return -1;
+    }
+    memcpy(tag, encrypted, seal_salt_size - seal_salt_random);
+    return 0;
+}
+
+/** @brief Keys a cipher context once, so a datagram only has to set its nonce
+ *
+ *  @param ctx The context
+ *  @param cipher One of the rudp_cipher_ values
+ *  @param key The transfer's key
+ *  @param encrypt 1 to seal, 0 to open
+ *  @return 0, -1 if OpenSSL failed
+ */
+static int key_context(EVP_CIPHER_CTX *ctx, int cipher, const uint8_t *key, int encrypt) {
+    return EVP_CipherInit_ex(ctx, evp_cipher(cipher), NULL, key, NULL, encrypt) > 0 ? 0 : -1;
+}
+
+/** @brief The nonce of a datagram: the direction it goes in and its counter
+ *
+ *  @param nonce Filled in, seal_nonce_size bytes
+ *  @param direction 0 from the sender, 1 from the receiver
+ *  @param counter The datagram's counter
+ *  @return void
+ */
+static void make_nonce(uint8_t *nonce, int direction, uint64_t counter) {
+    memset(nonce, 0, seal_nonce_size);
+    nonce[0] = direction;
+    memcpy(nonce + 4, &counter, seal_counter_size);
+}
+
+/** @brief Sets up sealing for one side of a transfer
+ *
+ *  The sender picks the transfer's salt and key right away; the receiver learns the salt from the first
+ *  datagram that authenticates with the key derived from it. Both key the context that tags salts.
+ *
+ *  @param seal The state to fill in
+ *  @param cipher rudp_cipher_aes_gcm or rudp_cipher_chacha20
+ *  @param key The pre-shared key, rudp_key_size bytes
+ *  @param direction 0 for the sender, 1 for the receiver
+ *  @return rudp_ok, rudp_err_invalid for an unknown cipher, rudp_err_memory or rudp_err_system
+ */
+int seal_init(struct seal *seal, int cipher, const uint8_t *key, int direction) {
+    memset(seal, 0, sizeof(*seal));
+    if (evp_cipher(cipher) == NULL) {
+        return rudp_err_invalid;
+    }
+    seal->cipher = cipher;
+    seal->direction = direction;
+    memcpy(seal->master, key, rudp_key_size);
+    seal->out = EVP_CIPHER_CTX_new();
+    seal->in = EVP_CIPHER_CTX_new();
+    seal->salts = EVP_CIPHER_CTX_new();
+    if (seal->out == NULL || seal->in == NULL || seal->salts == NULL) {
+        return rudp_err_memory;
+    }
+
+    uint8_t salt_key[rudp_key_size];
+    int failed = derive_key(seal, NULL, salt_key_info, salt_key) < 0 ||
+                 EVP_EncryptInit_ex(seal->salts, EVP_aes_256_ecb(), NULL, salt_key, NULL) <= 0 ||
+                 EVP_CIPHER_CTX_set_padding(seal->salts, 0) <= 0;
+    memset(salt_key, 0, sizeof(salt_key));
+    if (failed) {
+        return rudp_err_system;
+    }
+    if (direction != 0) {
+        return rudp_ok;
+    }
+
+    uint8_t transfer[rudp_key_size];
+    failed = RAND_bytes(seal->salt, seal_salt_random) <= 0 || salt_tag(seal, seal->salt, seal->salt + seal_salt_random) < 0 ||
+             transfer_key(seal, seal->salt, transfer) < 0 ||
+             key_context(seal->out, cipher, transfer, 1) < 0 || key_context(seal->in, cipher, transfer, 0) < 0;
+    memset(transfer, 0, sizeof(transfer));
+    if (failed) {
+        return rudp_err_system;
+    }
+    seal->keyed = 1;
+    return rudp_ok;
+}
+
+/** @brief Seals a datagram: the header flagged and authenticated, everything after it encrypted, the trailer behind
+ *
+ *  The packet is gathered from the iovecs (the header, or the first two bytes of a FIN, in the first one) and
+ *  written to out, which may be the first iovec itself for a packet in one piece.
+ *
+ *  @param seal The state, keyed
+ *  @param iov The packet in the clear
+ *  @param count Number of iovecs
+ *  @param out Room for the packet and seal_overhead more bytes
+ *  @return Length of the sealed datagram, 0 if OpenSSL failed
+ */
+size_t seal_packet(struct seal *seal, const struct iovec *iov, int count, uint8_t *out) {
+    uint8_t nonce[seal_nonce_size];
+    uint64_t counter = seal->counter++;
+    make_nonce(nonce, seal->direction, counter);
+    if (EVP_EncryptInit_ex(seal->out, NULL, NULL, NULL, nonce) <= 0) {
+        return 0;
+    }
+
+    size_t clear = iov[0].iov_len < header_size ? iov[0].iov_len : header_size;
+    int written;
+    memmove(out, iov[0].iov_base, clear);
+    out[type_offset] |= pkt_sealed;
+    if (EVP_EncryptUpdate(seal->out, NULL, &written, out, clear) <= 0) {
+        return 0;
+    }
+
+    size_t length = clear;
+    for (int i = 0; i < count; i++) {
+        const uint8_t *piece = iov[i].iov_base;
+        size_t piece_length = iov[i].iov_len;
+        if (i == 0) {
+            piece += clear;
+            piece_length -= clear;
+        }
+        if (piece_length > 0) {
+            if (EVP_EncryptUpdate(seal->out, out + length, &written, piece, piece_length) <= 0) {
+                return 0;
+            }
+            length += written;
+        }
+    }
+    if (EVP_EncryptFinal_ex(seal->out, out + length, &written) <= 0) {
+        return 0;
+    }
+    length += written;
+
+    memcpy(out + length, seal->salt, seal_salt_size);
+    memcpy(out + length + seal_salt_size, &counter, seal_counter_size);
+    if (EVP_CIPHER_CTX_ctrl(seal->out, EVP_CTRL_AEAD_GET_TAG, seal_tag_size, out + length + seal_salt_size + seal_counter_size) <= 0) {
+        return 0;
+    }
+    return length + seal_overhead;
+}
+
+/** @brief Checks a counter of the other side against the replay window
+ *
+ *  @param seal The state
+ *  @param counter The datagram's counter
+ *  @return 1 if it was accepted before or is too old to tell
+ */
+static int replayed(const struct seal *seal, uint64_t counter) {
+    if (counter > seal->highest) {
+        return 0;
+    }
+    if (seal->highest - counter >= seal_replay_window) {
+        return 1;
+    }
+    return (seal->seen >> (seal->highest - counter)) & 1;
+}
+
+/** @brief Opens a sealed datagram in place: checks it and decrypts it, leaving the packet as it was sent
+ *
+ *  @param seal The state
+ *  @param packet The datagram, decrypted in place
+ *  @param length Its length
+ *  @return Length of the packet in the clear, -1 if it is not sealed, forged, for another transfer or a replay
+ */
+ssize_t seal_open(struct seal *seal, uint8_t *packet, size_t length) {
+    if (length < seal_overhead + 2 || !(packet[type_offset] & pkt_sealed)) {
+        return -1;
+    }
+    size_t clear_length = length - seal_overhead;
+    uint8_t *salt = packet + clear_length;
+    uint8_t *tag = salt + seal_salt_size + seal_counter_size;
+    uint64_t counter;
+    memcpy(&counter, salt + seal_salt_size, seal_counter_size);
+
+    /// Until a datagram authenticated, a salt with a good tag gets a try with the key derived from it, once
+    if (!seal->keyed) {
+        uint8_t tag[seal_salt_size - seal_salt_random];
+        if (salt_tag(seal, salt, tag) < 0 || CRYPTO_memcmp(tag, salt + seal_salt_random, sizeof(tag)) != 0) {
+            return -1;
+        }
+        if (!seal->has_tried || memcmp(salt, seal->tried, seal_salt_size) != 0) {
+            uint8_t transfer[rudp_key_size];
+            seal->has_tried = 0;
+            int failed = transfer_key(seal, salt, transfer) < 0 || key_context(seal->in, seal->cipher, transfer, 0) < 0 ||
+                         key_context(seal->out, seal->cipher, transfer, 1) < 0;
+            memset(transfer, 0, sizeof(transfer));
+            if (failed) {
+                return -1;
+            }
+            memcpy(seal->tried, salt, seal_salt_size);
+            seal->has_tried = 1;
+        }
+    } else if (memcmp(salt, seal->salt, seal_salt_size) != 0 || replayed(seal, counter)) {
+        return -1;
+    }
+
+    uint8_t nonce[seal_nonce_size];
+    make_nonce(nonce, !seal->direction, counter);
+    size_t clear = clear_length < header_size ? clear_length : header_size;
+    int written;
+    int ok = EVP_DecryptInit_ex(seal->in, NULL, NULL, NULL, nonce) > 0 &&
+             EVP_DecryptUpdate(seal->in, NULL, &written, packet, clear) > 0 &&
+             (clear_length == clear || EVP_DecryptUpdate(seal->in, packet + clear, &written, packet + clear, clear_length - clear) > 0) &&
+             EVP_CIPHER_CTX_ctrl(seal->in, EVP_CTRL_AEAD_SET_TAG, seal_tag_size, tag) > 0 &&
+             EVP_DecryptFinal_ex(seal->in, packet + clear_length, &written) > 0;
+    if (!ok) {
+        return -1;
+    }
+    if (!seal->keyed) {
+        /// This is the transfer: its salt sticks and the replies are sealed under its key, which out already has
+        memcpy(seal->salt, salt, seal_salt_size);
+        seal->keyed = 1;
+    }
+
+    if (counter > seal->highest) {
+        uint64_t shift = counter - seal->highest;
+        seal->seen = shift >= seal_replay_window ? 0 : seal->seen << shift;
+        seal->highest = counter;
+    }
+    seal->seen |= (uint64_t)1 << (seal->highest - counter);
+    packet[type_offset] &= ~pkt_sealed;
+    return clear_length;
+}
+
+/** @brief Frees the cipher contexts and wipes the keys
+ *
+ *  @param seal The state, may never have been set up (all zero)
+ *  @return void
+ */
+void seal_free(struct seal *seal) {
+    EVP_CIPHER_CTX_free(seal->out);
+    EVP_CIPHER_CTX_free(seal->in);
+    EVP_CIPHER_CTX_free(seal->salts);
+    memset(seal, 0, sizeof(*seal));
+}
+
+/** @brief Turns a secret into a key: 64 hex digits are the key itself, anything else is a passphrase (PBKDF2-HMAC-SHA256)
+ *
+ *  @param secret The secret, without a newline
+ *  @param key Set to the key, rudp_key_size bytes
+ *  @return rudp_ok, rudp_err_invalid for an empty secret, rudp_err_system if OpenSSL failed
+ */
+int rudp_key_derive(const char *secret, uint8_t key[rudp_key_size]) {
+    size_t length = strlen(secret);
+    if (length == 0) {
+        return rudp_err_invalid;
+    }
+    if (length == 2 * rudp_key_size && strspn(secret, "0123456789abcdefABCDEF") == length) {
+        for (int i = 0; i < rudp_key_size; i++) {
+            unsigned int byte;
+            sscanf(secret + 2 * i, "%2x", &byte);
+            key[i] = byte;
+        }
+        return rudp_ok;
+    }
+    if (PKCS5_PBKDF2_HMAC(secret, length, (const unsigned char *)key_salt, strlen(key_salt), key_iterations,
+                          EVP_sha256(), rudp_key_size, key) <= 0) {
+        return rudp_err_system;
+    }
+    return rudp_ok;
+}
+
+/** @brief Reads the secret from the first line of a file and turns it into a key, as rudp_key_derive()
+ *
+ *  @param path The key file, best readable by its owner only
+ *  @param key Set to the key, rudp_key_size bytes
+ *  @return rudp_ok, rudp_err_file if it can not be read, or an error of rudp_key_derive()
+ */
+int rudp_key_load(const char *path, uint8_t key[rudp_key_size]) {
+    char line[1024];
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return rudp_err_file;
+    }
+    if (fgets(line, sizeof(line), file) == NULL) {
+        line[0] = '\0';
+    }
+    fclose(file);
+    line[strcspn(line, "\r\n")] = '\0';
+    int error = rudp_key_derive(line, key);
+    memset(line, 0, sizeof(line));
+    return error;
+}
@@ -0,0 +1,61 @@
+/** @file seal.h
+ *
+ *  @brief Authenticated encryption of every datagram (AES-256-GCM or ChaCha20-Poly1305, through OpenSSL).
+ *
+ *  A sealed datagram keeps its header in the clear, with pkt_sealed set in the type, and encrypts the
+ *  rest; the header is authenticated with it, so nobody without the key can forge a FIN or an ack. Behind
+ *  the ciphertext come the transfer's salt, the datagram's counter and the tag (see rudp.h). The salt is
+ *  random per transfer and the key of the transfer is derived from it and the pre-shared key (HKDF), so
+ *  counters starting at 0 never repeat a nonce under one key; each side keeps a counter of its own and
+ *  a retransmission is sealed again under the next one. A counter seen before is a replay and dropped.
+ *
+ *  Deriving a transfer's key is the expensive step, and until the receiver has one every new salt would
+ *  make it derive another. So a salt carries a short tag of its random part, made with a key both ends
+ *  derive once from the pre-shared key: a salt someone made up without the key fails one block cipher
+ *  call and never gets as far as HKDF, and each salt with a good tag is derived only once.
+ *
+ *  The cipher contexts are keyed once per transfer and only get a new nonce per datagram, so sealing
+ *  is one pass over the payload with OpenSSL's AES-NI/VAES (or AVX2 ChaCha20) code.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef SEAL_H
+#define SEAL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <openssl/evp.h>
+
+#include "rudp.h"
+#include "librudp.h"
+
+#define seal_replay_window 64 /// Counters this far below the highest one seen are still accepted once
+#define seal_salt_random 8 /// Random bytes at the start of a salt, the rest of it is their tag
+
+/// One side's sealing state of a transfer
+struct seal {
+    int cipher; /// rudp_cipher_aes_gcm or rudp_cipher_chacha20
+    int direction; /// 0 on the sender, 1 on the receiver; goes into the nonce so the two sides never share one
+    uint8_t master[rudp_key_size]; /// The pre-shared key
+    uint8_t salt[seal_salt_size]; /// Picks the transfer's key
+    int keyed; /// The transfer's key is known: the sender's from the start, the receiver's once a datagram authenticated
+    uint8_t tried[seal_salt_size]; /// Before that, the salt in and out were last keyed for
+    int has_tried;
+    EVP_CIPHER_CTX *out; /// Seals our datagrams
+    EVP_CIPHER_CTX *in; /// Opens the other side's
+    EVP_CIPHER_CTX *salts; /// Tags salts (AES-256 on one block), keyed once from the pre-shared key
+    uint64_t counter; /// Counter of our next datagram
+    uint64_t highest; /// Highest counter of theirs accepted so far
+    uint64_t seen; /// Bit i is set if highest - i was accepted
+};
+
+int seal_init(struct seal *seal, int cipher, const uint8_t *key, int direction);
+size_t seal_packet(struct seal *seal, const struct iovec *iov, int count, uint8_t *out);
+ssize_t seal_open(struct seal *seal, uint8_t *packet, size_t length);
+const char *seal_name(int cipher);
+void seal_free(struct seal *seal);
+
+#endif
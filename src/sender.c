@@ -1,13 +1,10 @@
 /**  @file sender.c
  *
- *  @brief Client side for a more reliable file transfer using UDP sockets. 
+ *  @brief Client side for a more reliable file transfer using UDP sockets: the command line on top of librudp.
  *
  *  @author Ana Bandari (abandari)
  *  @author Dajeong Kim (dkim2)
  * 
- *  @bug When sending two competing UDP protocols in a lossy/noisy channel, the second socket entering experiences delays and a greater timeout. Works fine for no loss. 
- *  @bug Only accepts IPV4 Addresses, in whatever form they may be. Not meant for IPV6. 
- * 
  */
 
 
@@ -15,270 +12,193 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <netdb.h>
-#include <sys/types.h>
-#include <sys/socket.h>
 #include <unistd.h>
-#include <pthread.h>
 #include <errno.h>
 #include <time.h>
 
-
-/*   Defining Global Variables   */
-#define max_payload_size 1024 /// The maximum payload size sent over through the socket. 
-#define max_data_size 1018 /// The maximum payload size subtracted by the 6 byte header. 
-
-/** @brief rsend() sends data reliably using UDP Sockets
- * 
- *  Inputs: hostname, hostUDP port, filename, bytesToTransfer
- *  Outputs: Void 
- *
- *   Sender Algorithm Skeleton: 
- *        - Read from File (raw data).
- *        - Splice the file into sendable bits.
- *        - Create socket.
- *        - Send the file bits over through the socket.
- *        - Check for ack and increase index, repeat if nack received. 
- *        - Terminate connection and close socket and file. 
+#include "librudp.h"
+#include "trace.h"
+#include "pacer.h"
+
+/// Options from the command line every transfer starts with (-M, -u, -K, -E, -P, -B, -Y, -C, -i, -m)
+static struct rudp_sender_config options;
+/// The local addresses or interfaces given to -M
+static const char *paths[rudp_max_paths];
+/// Milliseconds between progress lines (-i), 0 for none
+static int interval_ms = 0;
+
+/// How the transfer on the loop ended
+struct transfer {
+    struct evloop *loop;
+    int error;
+    const struct rudp_stats *stats; /// The session's counters, for the progress lines
+    struct ev_timer progress_timer;
+};
+
+/** @brief Wall clock time for measuring transfers (clock() would only count our CPU time)
  *
- *  @param hostname The hostname can be an IP Address or a fully-qualified name.
- *  @param hostUDPport The port which you are sending data over. 
- *  @param filename The a char pointer to the file you are reading from. 
- *  @param bytesToTransfer The number of bytes you want to read from filename. 
- *  @return void 
+ *  @return Seconds on the monotonic clock
  */
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
 
-void rsend(char* hostname, 
-            unsigned short int hostUDPport, 
-            char* filename, 
-            unsigned long long int bytesToTransfer) {
-
-    /// Initializing a timer for measuring the total length of time the socket has been open for
-    clock_t socket_open_time, socket_close_time; 
-    double total_socket_open_time;  
-    
-    /// Initalizing file I/O and test that the file exists
-    FILE *read_file = fopen(filename, "rb");
-    if (read_file == NULL){
-       printf("Error! Could not open file\n");
-       exit(EXIT_FAILURE); // must include stdlib.h
-    }
-
-    /// Determining the maximum value of the readfile to check that bytestotransfer doesnt exceed the file
-    fseek(read_file, 0, SEEK_END);
-    long readfile_size = ftell(read_file);
-    fseek(read_file,0, SEEK_SET); 
-    if(bytesToTransfer>readfile_size){
-        printf("There are only %ld bytes in this file. Try again.\n", readfile_size);
-        exit(EXIT_FAILURE);
-    }
-
-    /// Creating the socket
-    int socket_desc = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if(socket_desc < 0){
-        printf("Error while creating socket\n");
-        exit(EXIT_FAILURE);
-    }
-    socket_open_time = clock();
-
-    /// Initializing the structures needed for the socket connection
-    struct sockaddr_in address, server_addr;
-    unsigned int struct_length = sizeof(server_addr);
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(hostUDPport);
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-
-    /// Here we resolve the hostname if it is fully defined
-    struct hostent *hp = gethostbyname(hostname);
-    char ip_address[INET_ADDRSTRLEN];
-    memset(ip_address, 0, INET_ADDRSTRLEN); 
-    struct in_addr **p1 = NULL;
-
-    switch (hp->h_addrtype) {
-        /// Only accepts IPV4 Addresses
-        case AF_INET:
-            p1 = (struct in_addr **)hp->h_addr_list;
-
-            /// Making sure to only use the first resolved IP address
-            if (p1[0] != NULL) {
-                inet_ntop(AF_INET, p1[0], ip_address, INET_ADDRSTRLEN);
-                printf("sending to: %s\n", ip_address);
-
-                /// Inet_aton turns the IP address into bytes and adds it to the structure
-                if (inet_aton(ip_address, &server_addr.sin_addr) == 0) {
-                    fprintf(stderr, "inet_aton() failed\n");
-                    exit(EXIT_FAILURE);
-                }
-            } 
-            
-            else{
-            fprintf(stderr, "No IP address found for the hostname\n");
-            exit(EXIT_FAILURE);
-            }
-            break;
-        
-        default:
-            fprintf(stderr, "Unsupported address type\n");
-            exit(EXIT_FAILURE);
+/** @brief Prints how long the transfer took and the resulting goodput
+ *
+ *  @param bytes Number of file bytes that were transferred
+ *  @param elapsed_time Wall clock seconds the socket was open for
+ *  @return void
+ */
+static void print_transfer_time(unsigned long long bytes, double elapsed_time) {
+    printf("The socket has been open for: %f seconds\n", elapsed_time);
+    if (elapsed_time > 0) {
+        printf("Goodput: %.3f Mbit/s\n", bytes * 8 / elapsed_time / 1000000.0);
     }
+}
 
+/** @brief Log callback: the library's messages go to stdout, one per line
+ *
+ *  @return void
+ */
+static void print_message(void* arg, const char* message) {
+    (void)arg;
+    printf("%s\n", message);
+}
 
-    /// Initalizing a structure for timeout values
-    struct timeval timeout;
-    timeout.tv_sec = 0;  /// seconds
-    timeout.tv_usec = 10000; /// microseconds
-    struct timeval start, end;
-    double elapsed_time;
+/** @brief Timer callback: prints the progress line to stderr every -i interval
+ *
+ *  @return void
+ */
+static void print_progress(struct evloop* loop, int fd, uint32_t events, void* arg) {
+    struct transfer* transfer = arg;
+    (void)loop; (void)fd; (void)events;
 
-    /// Utilizing the setsockopt() function to set a time out for the recvfrom
-    if (setsockopt(socket_desc, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout)) < 0) {
-        perror("setsockopt failed");
-        close(socket_desc);
-        exit(EXIT_FAILURE);
+    if (ev_timer_ack(&transfer->progress_timer) == 0) {
+        return;
     }
-    
-    printf("Socket created successfully\n");
+    char line[512];
+    fprintf(stderr, "%s\n", stats_format(transfer->stats, 0, line, sizeof(line)));
+}
 
-    /// Initializing a sender buffer of max payload size which is the total data send with a header of 6 bytes
-    void *sender_buffer = malloc(max_payload_size);
-    memset(sender_buffer, 0, max_payload_size);
-    if (sender_buffer == NULL) {
-        fprintf(stderr, "Memory allocation failed for sender_buffer\n");
-        exit(EXIT_FAILURE);
-    }
+/** @brief Done callback: keeps the result and stops the loop
+ *
+ *  @return void
+ */
+static void transfer_done(void* arg, int error) {
+    struct transfer* transfer = arg;
+    transfer->error = error;
+    evloop_stop(transfer->loop);
+}
 
-    /// Initializing a void pointer for sender message to get raw bytes from the file (It's purpose is to point at 1018 bytes of data)
-    void *readfile_data = malloc(max_data_size);
-    memset(readfile_data, 0, max_data_size);
-    if (readfile_data == NULL) {
-        fprintf(stderr, "Memory allocation failed for readfile_data buffer\n");
-        exit(EXIT_FAILURE);
+/** @brief Runs one transfer on its own event loop until it is over
+ *
+ *  @param config What to send where
+ *  @return rudp_ok or an error code
+ */
+static int run_transfer(const struct rudp_sender_config* config) {
+    struct evloop loop;
+    if (evloop_init(&loop) < 0) {
+        return rudp_err_system;
     }
-
-    /// Initializing a buffer of the maximum payload size to receieve acknowladgements from the receiver
-    void *ack_buffer= malloc(max_payload_size);
-    memset(ack_buffer, 0, max_payload_size);
-    if (ack_buffer == NULL) {
-        fprintf(stderr, "Memory allocation failed for ack_buffer\n");
-        exit(EXIT_FAILURE);
+    tuning_busy_poll_epoll(loop.epoll_fd, &config->tuning);
+    if (tuning_pin_thread(&config->tuning) < 0) {
+        fprintf(stderr, "pinning to CPU %d: %s\n", config->tuning.cpu, strerror(errno));
     }
 
-    /// Initallizing variables that will be used in the while loop below
-    int bytesRead = 0; /// Number of bytes already read from the file
-    useconds_t t = 1000; /// Time to wait in microseconds
-    unsigned index = 0; /// The index of the packet. It needs to send and receive the index in order.
-    int byteNumber = 0; /// Number of bytes to read in the current iteration of the while loop
-
-    /** While the number of bytes already read is less than the number of bytes to transfer exectute the sending loop */
-    while(bytesRead < bytesToTransfer) {
-        /// Determine number of bytes to read based on how many unread bytes remain 
-        byteNumber = (max_data_size < (bytesToTransfer - bytesRead)) ? max_data_size : (bytesToTransfer - bytesRead);
-
-        /// Initialize void pointers to contain values of zero for every iteration of the loop
-        memset(readfile_data, 0, max_data_size);
-        memset(sender_buffer, 0, max_payload_size);
-        memset(ack_buffer, 0, max_payload_size);
-
-        /// Read 'byteNumber' of bytes from the read_file  
-        fseek(read_file, bytesRead, SEEK_SET);
-        fread(readfile_data, 1, byteNumber, read_file);
-        
-        /// Copy the two uint8_t values to the start of the new buffer that will be used to send data
-        uint8_t ack_flag=0;
-        uint8_t fin_flag=0;
-        memcpy(sender_buffer, &ack_flag, 1);
-        memcpy(sender_buffer+1, &fin_flag, 1);
-
-        /// Copy the current index and the data to the file
-        memcpy(sender_buffer+2, &index, 4);
-        memcpy(sender_buffer+6, readfile_data, byteNumber);
-
-        /// Slows down how fast our data is being sent
-        usleep(t);
-        
-        /// Sends a message to the receiver 
-        if(sendto(socket_desc, sender_buffer, byteNumber+6, 0, (struct sockaddr*)&server_addr, struct_length)<0){
-            printf("Unable to send message\n");
+    struct transfer transfer = { &loop, rudp_ok, NULL, { -1 } };
+    struct rudp_callbacks callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.done = transfer_done;
+    callbacks.log = print_message;
+    callbacks.arg = &transfer;
+
+    double socket_open_time = now_seconds();
+    struct rudp_sender* sender;
+    int error = rudp_sender_open(&sender, &loop, config, &callbacks);
+    if (error == rudp_ok) {
+        transfer.stats = rudp_sender_stats(sender);
+        if (interval_ms > 0 && ev_timer_init(&loop, &transfer.progress_timer, print_progress, &transfer) == 0) {
+            ev_timer_arm(&transfer.progress_timer, interval_ms * 1000ULL, interval_ms * 1000ULL);
         }
-
-        /// Waits to receive an acknowlegement for the defined recvfrom timeout time specified prior
-        size_t client_message = recvfrom(socket_desc, ack_buffer, max_payload_size, 0, (struct sockaddr*)&server_addr, &struct_length);  
-        if (client_message < 0){
-            printf("Couldn't receive\n");
+        if (evloop_run(&loop) < 0) {
+            perror("epoll_wait");
         }
-
-        /// Instantializes a variable for checking the ack_message from the received ack_buffer
-        uint8_t ack_message;
-        memcpy(&ack_message, ack_buffer, 1);
-        
-        /// Testing if the ack_message and only moving onto the next index if they match
-        if(ack_message == 1){ 
-            index++;  /// Incrementing index if the ack messages match
-            bytesRead += byteNumber; /// Stating the bytes read from the file 
-            
-            /// Using a multiplicative decrease to reduce our socket waiting time. 
-            if(t>0){
-                t = t/2;
-            }
+        error = transfer.error;
+        if (interval_ms > 0) {
+            char line[512];
+            fprintf(stderr, "%s\n", stats_format(transfer.stats, 1, line, sizeof(line)));
         }
-
-        /// If a negative acknowlegement is recieved then it will resend the current packet until it gets a positive acknowladgement 
-        if(ack_message == 0){ 
-            /// We implement an additive increase to reduce the sending time if there is packet loss to try and mitigate packet loss. 
-            /// Note that these times are in microseconds
-            if(t<1000000) {
-                t += 1000;
-            }
+        rudp_sender_close(sender);
+        if (error == rudp_ok) {
+            print_transfer_time(config->bytes, now_seconds() - socket_open_time);
         }
-
-        
     }
+    int saved_errno = errno;
+    ev_timer_close(&loop, &transfer.progress_timer);
+    evloop_close(&loop);
+    errno = saved_errno;
+    return error;
+}
 
-    /// Setting up all the variables needed to terminate the connection
-    memset(sender_buffer, 0, max_payload_size);
-    uint8_t ack_flag = 0;
-    uint8_t fin_flag = 1;
-
-    /// Raising FIN Flag HIGH
-    memcpy(sender_buffer, &ack_flag, 1);
-    memcpy(sender_buffer+1, &fin_flag, 1);
-    
-    /// Sending the FIN message over through the socket to terminate the connection
-    if (sendto(socket_desc, sender_buffer, 2, 0, (struct sockaddr*)&server_addr, struct_length) < 0) {
-    printf("Unable to send message\n");
-    exit(EXIT_FAILURE);
-    }
-    
-    /// Instantializing the ack_message variable outside of the while loop
-    uint8_t ack_message = 0;
+/** @brief rsend() sends data reliably using UDP Sockets
+ * 
+ *  Inputs: hostname, hostUDP port, filename, bytesToTransfer
+ *  Outputs: rudp_ok or an error code
+ *
+ *  @param hostname The hostname can be an IP Address or a fully-qualified name.
+ *  @param hostUDPport The port which you are sending data over. 
+ *  @param filename The a char pointer to the file you are reading from. 
+ *  @param bytesToTransfer The number of bytes you want to read from filename. 
+ *  @return rudp_ok or an error code
+ */
+int rsend(char* hostname, 
+            unsigned short int hostUDPport, 
+            char* filename, 
+            unsigned long long int bytesToTransfer) {
 
-    /// Waiting for a FIN ack from recevier
-    while (ack_message != 1) {
-        size_t client_message = recvfrom(socket_desc, ack_buffer, max_payload_size, 0, (struct sockaddr*)&server_addr, &struct_length);  
-        if (client_message < 0){
-            printf("Couldn't receive\n");
-        }
-        memcpy(&ack_message, ack_buffer, 1);
-    }
+    struct rudp_sender_config config = options;
+    config.hostname = hostname;
+    config.port = hostUDPport;
+    config.filename = filename;
+    config.bytes = bytesToTransfer;
+    config.sync = 0;
+    return run_transfer(&config);
+}
 
-    /// Closing socket and file and noting the time the socket was open for 
-    close(socket_desc);
-    socket_close_time = clock(); 
-    fclose(read_file);
-   
-   total_socket_open_time = ((double) (socket_close_time - socket_open_time)) / CLOCKS_PER_SEC;
-    printf("The socket has been open for: %f seconds\n", total_socket_open_time);
+/** @brief rsend_sync() brings the receiver's copy of a file up to date by only sending what changed
+ *
+ *  @param hostname The hostname can be an IP Address or a fully-qualified name.
+ *  @param hostUDPport The port which you are sending data over. 
+ *  @param filename The a char pointer to the file you are reading from. 
+ *  @param bytesToTransfer The number of bytes you want to read from filename. 
+ *  @return rudp_ok or an error code
+ */
+int rsend_sync(char* hostname, 
+            unsigned short int hostUDPport, 
+            char* filename, 
+            unsigned long long int bytesToTransfer) {
 
-    elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
-    printf("The total elapsed time is: %f seconds\n", elapsed_time);
+    struct rudp_sender_config config = options;
+    config.hostname = hostname;
+    config.port = hostUDPport;
+    config.filename = filename;
+    config.bytes = bytesToTransfer;
+    config.sync = 1;
+    return run_transfer(&config);
 }
 
 
 
 /** @brief  main function made to allow for the invoking of the file transfer from the command line
+ *
+ *  The receiver may be an IPv4 or IPv6 address or a name; -4 or -6 keeps to one family instead of racing both.
+ *  -M spreads the transfer over several local addresses or interfaces (comma separated), a path each.
+ *  Passing -s sends only the differences against the receiver's existing copy of the file, -u uses the io_uring engine.
+ *  -K encrypts every datagram with the key in a file (64 hex digits, or a passphrase), -E picks the cipher for it.
+ *  -P picks the pacing: SO_TXTIME when the egress qdisc is fq (auto), always SO_TXTIME, or always in userspace.
+ *  -i prints a progress line every interval_ms, -m writes the metrics to a file (.json or Prometheus text) or unix:/socket.
  *
  * @return Returns an int of 1 if there is an error
  */
@@ -286,18 +206,135 @@ int main(int argc, char** argv) {
     int hostUDPport;
     unsigned long long int bytesToTransfer;
     char* hostname = NULL;
+    int sync_mode = 0;
+    char* key_path = NULL;
+    int option;
+
+    /// Get the options from commandline
+    rudp_sender_config_init(&options);
+    while ((option = getopt(argc, argv, "46M:suP:B:Y:C:i:m:K:E:")) != -1) {
+        switch (option) {
+            case '4':
+                options.family = AF_INET;
+                break;
+            case '6':
+                options.family = AF_INET6;
+                break;
+            case 'M':
+                for (char* local = strtok(optarg, ","); local != NULL; local = strtok(NULL, ",")) {
+                    if (options.path_count == rudp_max_paths) {
+                        fprintf(stderr, "-M takes at most %d local addresses or interfaces\n", rudp_max_paths);
+                        exit(1);
+                    }
+                    paths[options.path_count++] = local;
+                }
+                options.paths = paths;
+                break;
+            case 's':
+                sync_mode = 1;
+                break;
+            case 'u':
+                options.use_uring = 1;
+                break;
+            case 'P':
+                if (strcmp(optarg, "txtime") == 0) {
+                    options.pacing_mode = pacer_txtime;
+                } else if (strcmp(optarg, "user") == 0) {
+                    options.pacing_mode = pacer_user;
+                } else if (strcmp(optarg, "auto") == 0) {
+                    options.pacing_mode = pacer_auto;
+                } else {
+                    fprintf(stderr, "-P takes auto, txtime or user\n");
+                    exit(1);
+                }
+                break;
+            case 'K':
+                key_path = optarg;
+                break;
+            case 'E':
+                if (strcmp(optarg, "aes-gcm") == 0) {
+                    options.cipher = rudp_cipher_aes_gcm;
+                } else if (strcmp(optarg, "chacha20") == 0) {
+                    options.cipher = rudp_cipher_chacha20;
+                } else {
+                    fprintf(stderr, "-E takes aes-gcm or chacha20\n");
+                    exit(1);
+                }
+                break;
+            case 'B':
+                options.tuning.buffer_bytes = tuning_parse_buffer(optarg);
+                if (options.tuning.buffer_bytes < 0) {
+                    fprintf(stderr, "-B takes a size like 4M or a bandwidth-delay product like 1000x32\n");
+                    exit(1);
+                }
+                break;
+            case 'Y':
+                options.tuning.busy_poll_us = atoi(optarg);
+                break;
+            case 'C':
+                options.tuning.cpu = atoi(optarg);
+                break;
+            case 'i':
+                interval_ms = atoi(optarg);
+                options.metrics_interval_ms = interval_ms;
+                break;
+            case 'm':
+                options.metrics_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-4|-6] [-M local[,local...]] [-s] [-u] [-K keyfile [-E aes-gcm|chacha20]] [-P auto|txtime|user] [-B bytes|MbpsxRTTms] [-Y busy_poll_us] [-C cpu] [-i interval_ms] [-m metrics_path] receiver_hostname receiver_port filename_to_xfer bytes_to_xfer\n\n", argv[0]);
+                exit(1);
+        }
+    }
 
-    if (argc != 5) {
-        fprintf(stderr, "usage: %s receiver_hostname receiver_port filename_to_xfer bytes_to_xfer\n\n", argv[0]);
+    if (argc - optind != 4) {
+        fprintf(stderr, "usage: %s [-4|-6] [-M local[,local...]] [-s] [-u] [-K keyfile [-E aes-gcm|chacha20]] [-P auto|txtime|user] [-B bytes|MbpsxRTTms] [-Y busy_poll_us] [-C cpu] [-i interval_ms] [-m metrics_path] receiver_hostname receiver_port filename_to_xfer bytes_to_xfer\n\n", argv[0]);
         exit(1);
     }
 
+    /// Both ends need the same key file; -K alone encrypts with AES-256-GCM
+    if (options.cipher != rudp_cipher_none && key_path == NULL) {
+        fprintf(stderr, "-E needs a key file (-K)\n");
+        exit(1);
+    }
+    if (key_path != NULL) {
+        int key_error = rudp_key_load(key_path, options.key);
+        if (key_error != rudp_ok) {
+            fprintf(stderr, "Could not read a key from %s: %s\n", key_path, rudp_strerror(key_error));
+            exit(1);
+        }
+        if (options.cipher == rudp_cipher_none) {
+            options.cipher = rudp_cipher_aes_gcm;
+        }
+    }
+
     /// Get values from commandline
-    hostname = argv[1];
-    hostUDPport = (unsigned short int) atoi(argv[2]);
-    bytesToTransfer = atoll(argv[4]);
+    hostname = argv[optind];
+    hostUDPport = (unsigned short int) atoi(argv[optind+1]);
+    bytesToTransfer = atoll(argv[optind+3]);
+
+    trace_init("sender");
 
     /// Call sender function
-   rsend(hostname, hostUDPport, argv[3], bytesToTransfer);
+    int error;
+    if (sync_mode) {
+        error = rsend_sync(hostname, hostUDPport, argv[optind+2], bytesToTransfer);
+    } else {
+        error = rsend(hostname, hostUDPport, argv[optind+2], bytesToTransfer);
+    }
+    int saved_errno = errno;
+    if (trace_dump() < 0) {
+        perror("trace file");
+    }
+    errno = saved_errno;
+
+    if (error != rudp_ok) {
+        if (error == rudp_err_system) {
+            printf("Error: %s (%s)\n", rudp_strerror(error), strerror(errno));
+        } else {
+            printf("Error: %s\n", rudp_strerror(error));
+        }
+        return(EXIT_FAILURE);
+    }
    return(EXIT_SUCCESS);
-} 
\ No newline at end of file
+} 
@@ -0,0 +1,564 @@
+/** @file sim.c
+ *
+ *  @brief Deterministic simulator: the real sender and receiver sessions over a modeled bottleneck, in virtual time.
+ *
+ *  Every scenario opens one receiver and one sender session of librudp per flow on a single event
+ *  loop, the flows starting stagger_ms apart, and runs them to the end against simnet.c: the clock,
+ *  the sockets and the timers are virtual and the flows share one bottleneck of a given rate, delay,
+ *  queue and loss. It reports the goodput of every flow (its bytes over the time from its start
+ *  until its FIN was acknowledged), Jain's fairness index over them, how busy the bottleneck was
+ *  and what it dropped. The same scenario always gives the same numbers.
+ *
+ *  The sender's ack timeout follows each path's round trip time (srtt + max(10 ms, 4 rttvar)), so
+ *  the retransmissions reported are losses and queue overflows, not a timer that fires before
+ *  the ack can be back. Keep in mind what the protocol is: one packet in flight per path and an
+ *  AIMD gap between them, so a flow's goodput is bounded by a packet per round trip, and loss is
+ *  noticed no sooner than 10 ms after the ack was due.
+ *
+ *  With -S the senders share one scheduler (sched.h) capped at that rate, each flow with the weight
+ *  and priority -W and -P list for it, to see how the rate is split among transfers of one process.
+ *
+ *  A file of scenarios (-f), one line of options each on top of the command line's, runs them one
+ *  after another in the one process and prints a CSV row per scenario, so a sweep of thousands of
+ *  them can be charted straight away. The exit status is 1 if a flow of any scenario did not
+ *  complete intact.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "librudp.h"
+#include "pacer.h"
+#include "simnet.h"
+
+
+#define sim_usage "usage: %s [-n flows] [-b bytes[K|M|G]] [-r rate_mbps] [-d delay_ms] [-q queue_ms] [-l loss%%] [-B burst] [-L ack_loss%%] [-s stagger_ms] [-S cap_mbps [-W weights] [-P priorities]] [-z seed] [-t timeout_s] [-v] [-f scenarios|-]\n"
+#define sim_max_flows 32 /// A flow takes 7 virtual descriptors (simnet_max_fds)
+#define sim_first_port 9000 /// Receiver of flow i listens on sim_first_port + i
+#define sim_block_size (1 << 20) /// The senders send this block over and over; the receivers check what arrives against it
+#define sim_max_words 64 /// Options on one line of a scenario file
+
+/// One scenario
+struct sim_scenario {
+    int flows;
+    unsigned long long bytes; /// Per flow
+    struct simnet_link link;
+    double stagger_ms; /// Flow i starts i * stagger_ms into the scenario
+    double timeout_s; /// Virtual seconds after which the flows still running count as failed
+    double scheduler_mbps; /// The senders share a scheduler with this rate cap (0 for none), -1 for no scheduler
+    int weights[sim_max_flows]; /// Of flow i with the scheduler, 0 for the default
+    int priorities[sim_max_flows];
+};
+
+struct sim_run;
+
+/// One sender and its receiver
+struct sim_flow {
+    struct sim_run *run;
+    int index;
+    struct rudp_receiver *receiver;
+    struct rudp_sender *sender;
+    double started; /// Virtual seconds
+    double finished; /// When the sender was done, 0 while it runs
+    int sender_error;
+    int receiver_error;
+    unsigned long long received; /// Bytes the data callback saw
+    int corrupt; /// A payload differed from what was sent
+    unsigned long long retransmits;
+};
+
+/// A scenario while it runs
+struct sim_run {
+    const struct sim_scenario *scenario;
+    int verbose;
+    struct evloop loop;
+    struct ev_timer starter; /// Opens the senders at their start times
+    struct ev_timer deadline;
+    struct rudp_scheduler *scheduler; /// NULL unless -S
+    struct iovec *iov; /// What every sender sends: the block, as often as it takes
+    int iovcnt;
+    int next_flow; /// The next sender to open
+    int pending; /// Done callbacks still to come
+    struct sim_flow flows[sim_max_flows];
+};
+
+/// What a scenario came to
+struct sim_result {
+    double time_s; /// From the first start until the last flow was done
+    double goodput[sim_max_flows]; /// Mbit/s
+    double mean;
+    double min;
+    double max;
+    double jain; /// (sum x)^2 / (n sum x^2): 1 when all flows got the same, 1/n when one got everything
+    double busy; /// Fraction of the time the bottleneck was sending
+    double retransmit; /// Retransmissions over the packets sent
+    int completed; /// Flows that arrived intact
+    struct simnet_stats network;
+};
+
+static uint8_t block[sim_block_size];
+
+
+/** @brief Parses a byte count with an optional K, M or G suffix
+ *
+ *  @param text The command line argument
+ *  @return The number of bytes
+ */
+static unsigned long long parse_size(const char* text) {
+    char* end;
+    unsigned long long size = strtoull(text, &end, 10);
+    switch (*end) {
+        case 'G': case 'g': size <<= 10; /* fall through */
+        case 'M': case 'm': size <<= 10; /* fall through */
+        case 'K': case 'k': size <<= 10; break;
+        default: break;
+    }
+    return size;
+}
+
+/** @brief Parses a comma separated list of numbers, one per flow
+ *
+ *  @param text The command line argument
+ *  @param values Set to the numbers, the flows it does not reach to 0
+ *  @return 0, -1 if it is not such a list
+ */
+static int parse_list(const char* text, int* values) {
+    memset(values, 0, sim_max_flows * sizeof(*values));
+    for (int count = 0; count < sim_max_flows; count++) {
+        char* end;
+        values[count] = strtol(text, &end, 10);
+        if (end == text || (*end != ',' && *end != 0)) {
+            return -1;
+        }
+        if (*end == 0) {
+            return 0;
+        }
+        text = end + 1;
+    }
+    return -1;
+}
+
+/** @brief Reads scenario options into a scenario
+ *
+ *  @param argc Number of arguments
+ *  @param argv The arguments, argv[0] is skipped
+ *  @param scenario Set from the options, what they do not mention is left alone
+ *  @param verbose Set by -v, may be NULL to refuse it
+ *  @param file Set by -f, may be NULL to refuse it
+ *  @return 0, -1 on an unknown option or a value out of range
+ */
+static int parse_scenario(int argc, char** argv, struct sim_scenario* scenario, int* verbose, const char** file) {
+    int option;
+    optind = 1;
+    while ((option = getopt(argc, argv, "n:b:r:d:q:l:B:L:s:S:W:P:z:t:vf:")) != -1) {
+        switch (option) {
+            case 'n': scenario->flows = atoi(optarg); break;
+            case 'b': scenario->bytes = parse_size(optarg); break;
+            case 'r': scenario->link.rate_mbps = atof(optarg); break;
+            case 'd': scenario->link.delay_ms = atof(optarg); break;
+            case 'q': scenario->link.queue_ms = atof(optarg); break;
+            case 'l': scenario->link.loss = atof(optarg) / 100; break;
+            case 'B': scenario->link.burst = atof(optarg); break;
+            case 'L': scenario->link.ack_loss = atof(optarg) / 100; break;
+            case 's': scenario->stagger_ms = atof(optarg); break;
+            case 'S': scenario->scheduler_mbps = atof(optarg); break;
+            case 'W':
+                if (parse_list(optarg, scenario->weights) < 0) {
+                    return -1;
+                }
+                break;
+            case 'P':
+                if (parse_list(optarg, scenario->priorities) < 0) {
+                    return -1;
+                }
+                break;
+            case 'z': scenario->link.seed = atoi(optarg); break;
+            case 't': scenario->timeout_s = atof(optarg); break;
+            case 'v':
+                if (verbose == NULL) {
+                    return -1;
+                }
+                *verbose = 1;
+                break;
+            case 'f':
+                if (file == NULL) {
+                    return -1;
+                }
+                *file = optarg;
+                break;
+            default:
+                return -1;
+        }
+    }
+    if (optind < argc) {
+        return -1;
+    }
+    if (scenario->flows < 1 || scenario->flows > sim_max_flows || scenario->timeout_s <= 0) {
+        fprintf(stderr, "flows must be 1 to %d and the timeout positive\n", sim_max_flows);
+        return -1;
+    }
+    return 0;
+}
+
+/** @brief Log callback: with -v, every message of the sessions, stamped with the virtual time
+ *
+ *  @return void
+ */
+static void on_log(void* arg, const char* message) {
+    struct sim_flow* flow = arg;
+    if (flow->run->verbose) {
+        fprintf(stderr, "[%10.6f] flow %d: %s\n", (simnet_now() - simnet_epoch_ns) / 1000000000.0, flow->index, message);
+    }
+}
+
+/** @brief Data callback of a receiver: counts the payload and checks it against the block
+ *
+ *  @return void
+ */
+static void on_data(void* arg, const uint8_t* data, size_t length, unsigned long long offset) {
+    struct sim_flow* flow = arg;
+    while (length > 0) {
+        size_t at = offset % sim_block_size;
+        size_t piece = sim_block_size - at < length ? sim_block_size - at : length;
+        if (memcmp(data, block + at, piece) != 0) {
+            flow->corrupt = 1;
+        }
+        data += piece;
+        offset += piece;
+        length -= piece;
+        flow->received += piece;
+    }
+}
+
+/** @brief Counts a done callback and stops the loop after the last one
+ *
+ *  @param run The scenario
+ *  @return void
+ */
+static void session_done(struct sim_run* run) {
+    if (--run->pending == 0) {
+        evloop_stop(&run->loop);
+    }
+}
+
+/// Done callback of a sender
+static void on_sender_done(void* arg, int error) {
+    struct sim_flow* flow = arg;
+    flow->sender_error = error;
+    flow->finished = stats_now();
+    session_done(flow->run);
+}
+
+/// Done callback of a receiver
+static void on_receiver_done(void* arg, int error) {
+    struct sim_flow* flow = arg;
+    flow->receiver_error = error;
+    session_done(flow->run);
+}
+
+/** @brief Opens the sender of every flow whose start time has come and waits for the next one
+ *
+ *  @return void
+ */
+static void on_starter(struct evloop* loop, int fd, uint32_t events, void* arg) {
+    struct sim_run* run = arg;
+    (void)fd; (void)events;
+    if (ev_timer_ack(&run->starter) == 0) {
+        return;
+    }
+
+    double begin = simnet_epoch_ns / 1000000000.0;
+    while (run->next_flow < run->scenario->flows) {
+        double start = begin + run->next_flow * run->scenario->stagger_ms / 1000;
+        if (start > stats_now()) {
+            ev_timer_arm(&run->starter, (uint64_t)((start - stats_now()) * 1000000), 0);
+            return;
+        }
+
+        struct sim_flow* flow = &run->flows[run->next_flow++];
+        struct rudp_sender_config config;
+        rudp_sender_config_init(&config);
+        config.hostname = "10.0.0.2";
+        config.port = sim_first_port + flow->index;
+        config.iov = run->iov;
+        config.iovcnt = run->iovcnt;
+        config.bytes = run->scenario->bytes;
+        /// simnet holds SO_TXTIME packets until their time like fq; a spinning userspace pacer would never see the virtual clock move
+        config.pacing_mode = pacer_txtime;
+        config.scheduler = run->scheduler;
+        if (run->scenario->weights[flow->index] > 0) {
+            config.weight = run->scenario->weights[flow->index];
+        }
+        config.priority = run->scenario->priorities[flow->index];
+        struct rudp_callbacks callbacks = { NULL, NULL, on_sender_done, on_log, flow };
+
+        flow->started = stats_now();
+        int error = rudp_sender_open(&flow->sender, loop, &config, &callbacks);
+        if (error != rudp_ok) {
+            flow->sender = NULL;
+            on_sender_done(flow, error);
+        }
+    }
+}
+
+/// The scenario ran out of time
+static void on_deadline(struct evloop* loop, int fd, uint32_t events, void* arg) {
+    struct sim_run* run = arg;
+    (void)fd; (void)events;
+    if (ev_timer_ack(&run->deadline) == 0) {
+        return;
+    }
+    evloop_stop(loop);
+}
+
+/** @brief Runs one scenario to the end
+ *
+ *  @param scenario What to run
+ *  @param verbose Pass the sessions' messages on to stderr
+ *  @param result Filled in
+ *  @return 0, -1 if the scenario could not be set up
+ */
+static int run_scenario(const struct sim_scenario* scenario, int verbose, struct sim_result* result) {
+    static struct sim_run run;
+    memset(&run, 0, sizeof(run));
+    memset(result, 0, sizeof(*result));
+    run.starter.fd = -1;
+    run.deadline.fd = -1;
+    run.scenario = scenario;
+    run.verbose = verbose;
+    simnet_reset(&scenario->link);
+
+    /// The same block over and over, one iovec per time round
+    run.iovcnt = (scenario->bytes + sim_block_size - 1) / sim_block_size;
+    run.iov = calloc(run.iovcnt > 0 ? run.iovcnt : 1, sizeof(struct iovec));
+    if (run.iov == NULL || evloop_init(&run.loop) < 0) {
+        free(run.iov);
+        return -1;
+    }
+    for (int i = 0; i < run.iovcnt; i++) {
+        unsigned long long left = scenario->bytes - (unsigned long long)i * sim_block_size;
+        run.iov[i].iov_base = block;
+        run.iov[i].iov_len = left < sim_block_size ? left : sim_block_size;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < scenario->flows && !failed; i++) {
+        struct sim_flow* flow = &run.flows[i];
+        flow->run = &run;
+        flow->index = i;
+
+        struct rudp_receiver_config config;
+        rudp_receiver_config_init(&config);
+        config.port = sim_first_port + i;
+        config.idle_timeout = scenario->timeout_s;
+        struct rudp_callbacks callbacks = { NULL, on_data, on_receiver_done, on_log, flow };
+        if (rudp_receiver_open(&flow->receiver, &run.loop, &config, &callbacks) != rudp_ok) {
+            flow->receiver = NULL;
+            failed = 1;
+        }
+    }
+    if (!failed && scenario->scheduler_mbps >= 0 && rudp_scheduler_open(&run.scheduler, &run.loop, scenario->scheduler_mbps) != rudp_ok) {
+        failed = 1;
+    }
+    if (failed || ev_timer_init(&run.loop, &run.starter, on_starter, &run) < 0 ||
+        ev_timer_init(&run.loop, &run.deadline, on_deadline, &run) < 0) {
+        failed = 1;
+    } else {
+        run.pending = 2 * scenario->flows;
+        ev_timer_arm(&run.starter, 0, 0);
+        ev_timer_arm(&run.deadline, (uint64_t)(scenario->timeout_s * 1000000), 0);
+        evloop_run(&run.loop);
+    }
+
+    /// Goodput of a flow that did not finish counts what it got across until the end
+    double begin = simnet_epoch_ns / 1000000000.0;
+    double end = stats_now();
+    double last = begin;
+    double sum = 0, squares = 0;
+    unsigned long long sent = 0, retransmits = 0;
+    result->min = -1;
+    for (int i = 0; i < scenario->flows; i++) {
+        struct sim_flow* flow = &run.flows[i];
+        if (flow->sender != NULL) {
+            const struct rudp_stats* stats = rudp_sender_stats(flow->sender);
+            sent += stats->packets_sent;
+            retransmits += stats->retransmits;
+            flow->retransmits = stats->retransmits;
+        }
+        int intact = flow->sender != NULL && flow->finished > 0 && flow->sender_error == rudp_ok &&
+                     flow->receiver_error == rudp_ok && !flow->corrupt && flow->received == scenario->bytes;
+        double finished = flow->finished > 0 ? flow->finished : end;
+        double elapsed = finished - (flow->started > 0 ? flow->started : begin);
+        double goodput = elapsed > 0 ? flow->received * 8 / elapsed / 1000000.0 : 0;
+        result->goodput[i] = goodput;
+        result->completed += intact;
+        sum += goodput;
+        squares += goodput * goodput;
+        if (result->min < 0 || goodput < result->min) {
+            result->min = goodput;
+        }
+        if (goodput > result->max) {
+            result->max = goodput;
+        }
+        if (finished > last) {
+            last = finished;
+        }
+        if (verbose) {
+            fprintf(stderr, "flow %d: %llu bytes in %.3fs, %.3f Mbit/s, %llu retransmits%s\n", i, flow->received, elapsed, goodput,
+                    flow->retransmits, intact ? "" : flow->corrupt ? ", CORRUPT" : ", FAILED");
+        }
+    }
+    result->time_s = last - begin;
+    result->mean = sum / scenario->flows;
+    result->jain = squares > 0 ? sum * sum / (scenario->flows * squares) : 0;
+    result->retransmit = sent ? (double)retransmits / sent : 0;
+    result->network = *simnet_stats();
+    result->busy = result->time_s > 0 ? result->network.busy_ns / (result->time_s * 1000000000.0) : 0;
+
+    for (int i = 0; i < scenario->flows; i++) {
+        if (run.flows[i].sender != NULL) {
+            rudp_sender_close(run.flows[i].sender);
+        }
+        if (run.flows[i].receiver != NULL) {
+            rudp_receiver_close(run.flows[i].receiver);
+        }
+    }
+    rudp_scheduler_close(run.scheduler);
+    if (run.starter.fd >= 0) {
+        ev_timer_close(&run.loop, &run.starter);
+    }
+    if (run.deadline.fd >= 0) {
+        ev_timer_close(&run.loop, &run.deadline);
+    }
+    evloop_close(&run.loop);
+    free(run.iov);
+    return failed ? -1 : 0;
+}
+
+/** @brief Prints a scenario's result as one line for a person
+ *
+ *  @return void
+ */
+static void print_line(const struct sim_scenario* scenario, const struct sim_result* result) {
+    const struct simnet_link* link = &scenario->link;
+    char scheduler[32] = "";
+    if (scenario->scheduler_mbps >= 0) {
+        snprintf(scheduler, sizeof(scheduler), " scheduler=%gMbit/s", scenario->scheduler_mbps);
+    }
+    printf("flows=%d bytes=%llu rate=%.1fMbit/s delay=%.1fms queue=%.1fms loss=%.2f%% burst=%.1f ack_loss=%.2f%% stagger=%.1fms%s seed=%u | "
+           "time %.3fs goodput %.3f Mbit/s (min %.3f max %.3f) jain %.4f busy %.1f%% retransmit %.2f%% "
+           "queue_drops %llu losses %llu %s\n",
+           scenario->flows, scenario->bytes, link->rate_mbps, link->delay_ms, link->queue_ms, link->loss * 100, link->burst,
+           link->ack_loss * 100, scenario->stagger_ms, scheduler, link->seed,
+           result->time_s, result->mean, result->min, result->max, result->jain, result->busy * 100, result->retransmit * 100,
+           result->network.queue_drops, result->network.losses, result->completed == scenario->flows ? "OK" : "FAILED");
+}
+
+/** @brief Prints a scenario's result as a CSV row, the goodput of every flow in the last column separated by ';'
+ *
+ *  @return void
+ */
+static void print_row(const struct sim_scenario* scenario, const struct sim_result* result) {
+    const struct simnet_link* link = &scenario->link;
+    printf("%d,%llu,%g,%g,%g,%g,%g,%g,%g,%g,%u,%.6f,%.4f,%.4f,%.4f,%.5f,%.4f,%.5f,%llu,%llu,%d,",
+           scenario->flows, scenario->bytes, link->rate_mbps, link->delay_ms, link->queue_ms, link->loss, link->burst,
+           link->ack_loss, scenario->stagger_ms, scenario->scheduler_mbps, link->seed,
+           result->time_s, result->mean, result->min, result->max, result->jain, result->busy, result->retransmit,
+           result->network.queue_drops, result->network.losses, result->completed);
+    for (int i = 0; i < scenario->flows; i++) {
+        printf("%s%.4f", i > 0 ? ";" : "", result->goodput[i]);
+    }
+    printf("\n");
+}
+
+/** @brief Runs every scenario of a file, one line of options each, and prints a CSV row per scenario
+ *
+ *  @param path The file, - for stdin
+ *  @param base What the lines start from (the command line's options)
+ *  @param verbose Pass the sessions' messages on to stderr
+ *  @return 0 if every flow of every scenario completed intact, 1 otherwise
+ */
+static int run_file(const char* path, const struct sim_scenario* base, int verbose) {
+    FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return 1;
+    }
+
+    printf("flows,bytes,rate_mbps,delay_ms,queue_ms,loss,burst,ack_loss,stagger_ms,scheduler_mbps,seed,time_s,"
+           "goodput_mbps,goodput_min,goodput_max,jain,busy,retransmit,queue_drops,losses,completed,flow_goodputs\n");
+    double wall = simnet_wall_seconds();
+    int status = 0;
+    int count = 0;
+    char line[1024];
+    for (int number = 1; fgets(line, sizeof(line), file) != NULL; number++) {
+        /// Blank lines and # comments are skipped
+        char* words[sim_max_words];
+        int argc = 0;
+        words[argc++] = "rudp_sim";
+        for (char* word = strtok(line, " \t\r\n"); word != NULL && word[0] != '#' && argc < sim_max_words; word = strtok(NULL, " \t\r\n")) {
+            words[argc++] = word;
+        }
+        if (argc == 1) {
+            continue;
+        }
+
+        struct sim_scenario scenario = *base;
+        struct sim_result result;
+        if (parse_scenario(argc, words, &scenario, NULL, NULL) < 0 || run_scenario(&scenario, verbose, &result) < 0) {
+            fprintf(stderr, "%s:%d: scenario skipped\n", path, number);
+            status = 1;
+            continue;
+        }
+        print_row(&scenario, &result);
+        count++;
+        if (result.completed < scenario.flows) {
+            status = 1;
+        }
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+
+    wall = simnet_wall_seconds() - wall;
+    fprintf(stderr, "%d scenarios in %.2f s (%.0f per minute)\n", count, wall, wall > 0 ? count * 60 / wall : 0);
+    return status;
+}
+
+/** @brief Runs one scenario and prints a one line report, or every scenario of a file (-f) as CSV
+ *
+ * @return 0 if every flow completed intact, 1 otherwise
+ */
+int main(int argc, char** argv) {
+    struct sim_scenario scenario = { 1, 1 << 20, { 100, 10, 50, 0, 1, 0, 1 }, 0, 600, -1, { 0 }, { 0 } };
+    int verbose = 0;
+    const char* file = NULL;
+    if (parse_scenario(argc, argv, &scenario, &verbose, &file) < 0) {
+        fprintf(stderr, sim_usage, argv[0]);
+        exit(1);
+    }
+
+    unsigned int seed = 1;
+    for (size_t i = 0; i < sizeof(block); i++) {
+        block[i] = rand_r(&seed) >> 7;
+    }
+
+    if (file != NULL) {
+        return run_file(file, &scenario, verbose);
+    }
+
+    struct sim_result result;
+    if (run_scenario(&scenario, verbose, &result) < 0) {
+        fprintf(stderr, "Unable to set the scenario up\n");
+        return 1;
+    }
+    print_line(&scenario, &result);
+    return result.completed == scenario.flows ? 0 : 1;
+}
@@ -0,0 +1,980 @@
+/** @file simnet.c
+ *
+ *  @brief The simulator's virtual clock, sockets, timers and epoll, and the bottleneck they share.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#define _GNU_SOURCE /// for SO_RCVBUFFORCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "simnet.h"
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+
+/// The real calls behind the wrappers, for descriptors that are not ours (see the rudp_sim rule in the Makefile)
+int __real_clock_gettime(clockid_t clock, struct timespec *now);
+int __real_socket(int domain, int type, int protocol);
+int __real_bind(int fd, const struct sockaddr *address, socklen_t length);
+int __real_setsockopt(int fd, int level, int name, const void *value, socklen_t length);
+int __real_getsockopt(int fd, int level, int name, void *value, socklen_t *length);
+ssize_t __real_sendmsg(int fd, const struct msghdr *msg, int flags);
+ssize_t __real_sendto(int fd, const void *buffer, size_t length, int flags, const struct sockaddr *to, socklen_t to_length);
+ssize_t __real_recvmsg(int fd, struct msghdr *msg, int flags);
+ssize_t __real_recvfrom(int fd, void *buffer, size_t length, int flags, struct sockaddr *from, socklen_t *from_length);
+ssize_t __real_read(int fd, void *buffer, size_t count);
+int __real_close(int fd);
+int __real_epoll_create1(int flags);
+int __real_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+int __real_epoll_wait(int epfd, struct epoll_event *events, int max_events, int timeout);
+int __real_timerfd_create(int clock, int flags);
+int __real_timerfd_settime(int fd, int flags, const struct itimerspec *value, struct itimerspec *old);
+int __wrap_close(int fd);
+
+/// A datagram on its way, in an event and then in a socket's queue
+struct sim_packet {
+    int entering; /// Still waiting for its send time in front of the bottleneck
+    uint32_t from_address; /// Host byte order
+    uint16_t from_port;
+    uint16_t to_port;
+    struct sim_packet *next; /// In the socket's queue
+    size_t length;
+    uint8_t data[];
+};
+
+/// Something due at a time: a packet reaching the bottleneck or a socket, or a timer expiring
+struct sim_event {
+    uint64_t at;
+    uint64_t seq; /// Events due at the same time happen in the order they were scheduled
+    struct sim_packet *packet; /// NULL for a timer
+    int slot; /// The timer's descriptor slot
+    uint64_t generation; /// The arming of the timer it belongs to; once the timer is set again the event is stale
+};
+
+/// What a virtual descriptor is
+#define sim_free 0
+#define sim_socket 1
+#define sim_timer 2
+#define sim_epoll 3
+
+/// One watched descriptor of a virtual epoll
+struct sim_watch {
+    int fd;
+    uint32_t events;
+    epoll_data_t data;
+};
+
+/// A virtual descriptor
+struct sim_fd {
+    int kind;
+
+    /// Socket
+    int family;
+    uint16_t port; /// 0 until bound, on purpose or by the first send
+    int txtime; /// SO_TXTIME is on, sends are held until their time
+    long receive_buffer; /// Bytes its queue may hold, doubled as the kernel does
+    long send_buffer;
+    struct sim_packet *head;
+    struct sim_packet *tail;
+    long queued;
+
+    /// Timer
+    uint64_t expires; /// 0 while disarmed
+    uint64_t interval;
+    uint64_t expirations; /// Not read yet
+    uint64_t generation; /// Which arming its pending event belongs to
+
+    /// Epoll, in the order the descriptors were added
+    struct sim_watch *watches;
+    int watch_count;
+
+    int watched; /// Epolls it is in
+    int counted; /// Counted in ready_fds: watched and readable
+};
+
+static struct sim_fd fds[simnet_max_fds];
+static int fds_used; /// One past the highest slot ever taken in this scenario
+static int ready_fds; /// Watched descriptors that are readable, epoll_wait() lets time pass while there are none
+static int16_t port_slots[65536]; /// Slot + 1 of the socket bound to each port, 0 if none
+
+static struct simnet_link model; /// The link of the scenario
+static struct simnet_stats stats;
+static uint64_t now_ns;
+static uint64_t link_free_ns; /// When the bottleneck has sent everything queued in front of it
+static int bursting; /// Gilbert-Elliott: in the bad state, losing every packet
+static uint64_t next_seq;
+static uint64_t generations; /// Armings of timers so far, every arming gets a number of its own
+static uint16_t next_port;
+
+/// Events to come, a binary min-heap on (at, seq)
+static struct sim_event *heap;
+static size_t heap_count;
+static size_t heap_cap;
+
+
+/** @brief Finds the virtual descriptor behind fd
+ *
+ *  @param fd Any descriptor
+ *  @return The descriptor, NULL if fd is a real one (or a closed virtual one)
+ */
+static struct sim_fd *lookup(int fd) {
+    if (fd < simnet_fd_base || fd >= simnet_fd_base + simnet_max_fds) {
+        return NULL;
+    }
+    struct sim_fd *entry = &fds[fd - simnet_fd_base];
+    return entry->kind == sim_free ? NULL : entry;
+}
+
+/** @brief Takes the lowest free virtual descriptor, as the kernel hands out the lowest free fd
+ *
+ *  @param kind sim_socket, sim_timer or sim_epoll
+ *  @return The descriptor, -1 with EMFILE if all are taken
+ */
+static int allocate(int kind) {
+    for (int i = 0; i < simnet_max_fds; i++) {
+        if (fds[i].kind == sim_free) {
+            memset(&fds[i], 0, sizeof(fds[i]));
+            fds[i].kind = kind;
+            if (i >= fds_used) {
+                fds_used = i + 1;
+            }
+            return simnet_fd_base + i;
+        }
+    }
+    errno = EMFILE;
+    return -1;
+}
+
+/// Uniform random number in [0, 1) from the scenario's seed
+static double random01(void) {
+    return rand_r(&model.seed) / ((double)RAND_MAX + 1);
+}
+
+/** @brief Decides whether the bottleneck loses the next packet
+ *
+ *  A Gilbert-Elliott chain with a lossless good state and a bad state that loses everything: leaving
+ *  the bad state with probability 1/burst makes runs of losses burst packets long on average, and
+ *  entering it as often as it takes for the losses to average out at model.loss.
+ *
+ *  @return 1 if the packet is lost
+ */
+static int lose_forward(void) {
+    if (model.loss <= 0) {
+        return 0;
+    }
+    if (model.burst <= 1 || model.loss >= 1) {
+        return random01() < model.loss;
+    }
+    double leave = 1 / model.burst;
+    double enter = model.loss * leave / (1 - model.loss);
+    if (bursting) {
+        bursting = random01() >= leave;
+    } else {
+        bursting = random01() < enter;
+    }
+    return bursting;
+}
+
+/// Orders the heap: earlier first, then in the order of scheduling
+static int before(const struct sim_event *a, const struct sim_event *b) {
+    return a->at < b->at || (a->at == b->at && a->seq < b->seq);
+}
+
+/** @brief Schedules a packet or a timer expiry
+ *
+ *  @param at When it is due
+ *  @param packet The packet, NULL for a timer
+ *  @param slot The timer's slot
+ *  @param generation The timer's arming
+ *  @return void
+ */
+static void schedule(uint64_t at, struct sim_packet *packet, int slot, uint64_t generation) {
+    if (heap_count == heap_cap) {
+        size_t cap = heap_cap ? heap_cap * 2 : 1024;
+        struct sim_event *grown = realloc(heap, cap * sizeof(*heap));
+        if (grown == NULL) {
+            /// Lost like a packet the kernel had no memory for (a timer would never fire, but that needs 2^60 of them)
+            stats.losses++;
+            free(packet);
+            return;
+        }
+        heap = grown;
+        heap_cap = cap;
+    }
+
+    struct sim_event event = { at, next_seq++, packet, slot, generation };
+    size_t i = heap_count++;
+    while (i > 0 && before(&event, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = event;
+}
+
+/** @brief Takes the earliest event out of the heap
+ *
+ *  @return The event, the heap must not be empty
+ */
+static struct sim_event heap_pop(void) {
+    struct sim_event top = heap[0];
+    struct sim_event last = heap[--heap_count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= heap_count) {
+            break;
+        }
+        if (child + 1 < heap_count && before(&heap[child + 1], &heap[child])) {
+            child++;
+        }
+        if (!before(&heap[child], &last)) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (heap_count > 0) {
+        heap[i] = last;
+    }
+    return top;
+}
+
+/** @brief Recounts whether a descriptor is watched and readable, after anything that may have changed it
+ *
+ *  @param entry The descriptor
+ *  @return void
+ */
+static void update_ready(struct sim_fd *entry) {
+    int readable = entry->kind == sim_socket ? entry->head != NULL : entry->kind == sim_timer ? entry->expirations > 0 : 0;
+    int counted = readable && entry->watched > 0;
+    ready_fds += counted - entry->counted;
+    entry->counted = counted;
+}
+
+/** @brief Sends a packet into the bottleneck now: loss, then the queue and the rate, then the delay
+ *
+ *  @param packet The packet, towards the receivers
+ *  @return void
+ */
+static void enter_bottleneck(struct sim_packet *packet) {
+    if (lose_forward()) {
+        stats.losses++;
+        free(packet);
+        return;
+    }
+
+    /// The rate serializes packets one after another, tail dropping once the queue is too long
+    uint64_t depart = now_ns;
+    if (model.rate_mbps > 0) {
+        if (link_free_ns < now_ns) {
+            link_free_ns = now_ns;
+        }
+        if (model.queue_ms > 0 && link_free_ns - now_ns > model.queue_ms * 1000000) {
+            stats.queue_drops++;
+            free(packet);
+            return;
+        }
+        uint64_t serialize = (uint64_t)(packet->length * 8 * 1000 / model.rate_mbps);
+        link_free_ns += serialize;
+        stats.busy_ns += serialize;
+        depart = link_free_ns;
+    }
+
+    stats.forwarded++;
+    stats.forwarded_bytes += packet->length;
+    packet->entering = 0;
+    schedule(depart + (uint64_t)(model.delay_ms * 1000000), packet, 0, 0);
+}
+
+/** @brief Finds the socket bound to a port
+ *
+ *  @param port The port, host byte order
+ *  @return The socket, NULL if nobody listens there
+ */
+static struct sim_fd *bound_to(uint16_t port) {
+    return port_slots[port] > 0 ? &fds[port_slots[port] - 1] : NULL;
+}
+
+/** @brief Binds a socket to a free port
+ *
+ *  @param socket The socket
+ *  @param port The port, host byte order
+ *  @return void
+ */
+static void bind_port(struct sim_fd *socket, uint16_t port) {
+    socket->port = port;
+    port_slots[port] = socket - fds + 1;
+}
+
+/** @brief Hands a packet that arrived to its socket, or drops it if the socket's buffer is full
+ *
+ *  @param packet The packet
+ *  @return void
+ */
+static void deliver(struct sim_packet *packet) {
+    struct sim_fd *socket = bound_to(packet->to_port);
+    if (socket == NULL) {
+        free(packet);
+        return;
+    }
+    if (socket->queued + (long)packet->length > socket->receive_buffer) {
+        stats.socket_drops++;
+        free(packet);
+        return;
+    }
+    packet->next = NULL;
+    if (socket->tail != NULL) {
+        socket->tail->next = packet;
+    } else {
+        socket->head = packet;
+    }
+    socket->tail = packet;
+    socket->queued += packet->length;
+    update_ready(socket);
+}
+
+/** @brief Gives a socket the next free ephemeral port
+ *
+ *  @param socket The socket, not bound yet
+ *  @return 0, -1 with EADDRINUSE if every port is taken
+ */
+static int bind_ephemeral(struct sim_fd *socket) {
+    for (int tries = 0; tries < 32768; tries++) {
+        uint16_t port = next_port;
+        next_port = next_port == 65535 ? 32768 : next_port + 1;
+        if (bound_to(port) == NULL) {
+            bind_port(socket, port);
+            return 0;
+        }
+    }
+    errno = EADDRINUSE;
+    return -1;
+}
+
+/** @brief Reads the IPv4 address and the port out of a sockaddr_in or an IPv4 mapped sockaddr_in6
+ *
+ *  @param address The address
+ *  @param length Its length
+ *  @param host Set to the address, host byte order
+ *  @param port Set to the port, host byte order
+ *  @return 0, -1 for an address this network does not have
+ */
+static int parse_address(const struct sockaddr *address, socklen_t length, uint32_t *host, uint16_t *port) {
+    if (address->sa_family == AF_INET && length >= sizeof(struct sockaddr_in)) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)address;
+        *host = ntohl(in->sin_addr.s_addr);
+        *port = ntohs(in->sin_port);
+        return 0;
+    }
+    if (address->sa_family == AF_INET6 && length >= sizeof(struct sockaddr_in6)) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)address;
+        *port = ntohs(in6->sin6_port);
+        if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+            uint32_t mapped;
+            memcpy(&mapped, &in6->sin6_addr.s6_addr[12], 4);
+            *host = ntohl(mapped);
+            return 0;
+        }
+        if (IN6_IS_ADDR_UNSPECIFIED(&in6->sin6_addr)) {
+            *host = 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/** @brief Sends a datagram: through the bottleneck towards the receivers, straight back otherwise
+ *
+ *  @param socket The sending socket
+ *  @param to The destination
+ *  @param to_length Its length
+ *  @param iov The datagram
+ *  @param count Pieces in iov
+ *  @param send_at SO_TXTIME send time, 0 to send now
+ *  @return The bytes sent, -1 with errno set
+ */
+static ssize_t send_datagram(struct sim_fd *socket, const struct sockaddr *to, socklen_t to_length,
+                             const struct iovec *iov, size_t count, uint64_t send_at) {
+    uint32_t host;
+    uint16_t port;
+    if (to == NULL) {
+        errno = EDESTADDRREQ;
+        return -1;
+    }
+    if (parse_address(to, to_length, &host, &port) < 0 || (host != simnet_left && host != simnet_right)) {
+        errno = ENETUNREACH;
+        return -1;
+    }
+    if (socket->port == 0 && bind_ephemeral(socket) < 0) {
+        return -1;
+    }
+
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) {
+        length += iov[i].iov_len;
+    }
+    if (length > simnet_max_packet) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    struct sim_packet *packet = malloc(sizeof(*packet) + length);
+    if (packet == NULL) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    size_t at = 0;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(packet->data + at, iov[i].iov_base, iov[i].iov_len);
+        at += iov[i].iov_len;
+    }
+    packet->length = length;
+    packet->from_port = socket->port;
+    packet->to_port = port;
+    /// Two hosts: whatever goes to one of them comes from the other
+    packet->from_address = host == simnet_right ? simnet_left : simnet_right;
+
+    if (host == simnet_right) {
+        if (send_at > now_ns) {
+            packet->entering = 1;
+            schedule(send_at, packet, 0, 0);
+        } else {
+            enter_bottleneck(packet);
+        }
+    } else if (model.ack_loss > 0 && random01() < model.ack_loss) {
+        stats.losses++;
+        free(packet);
+    } else {
+        packet->entering = 0;
+        schedule(now_ns + (uint64_t)(model.delay_ms * 1000000), packet, 0, 0);
+    }
+    return length;
+}
+
+/** @brief Takes the next datagram off a socket's queue
+ *
+ *  @param socket The socket
+ *  @param iov Where the datagram goes
+ *  @param count Pieces in iov
+ *  @param from Set to the sender's address (IPv4 mapped on an AF_INET6 socket), may be NULL
+ *  @param from_length In: room in from, out: the address's length
+ *  @param truncated Set to 1 if the datagram did not fit, may be NULL
+ *  @return The bytes copied, -1 with EAGAIN if nothing is queued
+ */
+static ssize_t receive_datagram(struct sim_fd *socket, const struct iovec *iov, size_t count,
+                                struct sockaddr *from, socklen_t *from_length, int *truncated) {
+    struct sim_packet *packet = socket->head;
+    if (packet == NULL) {
+        errno = EAGAIN;
+        return -1;
+    }
+    socket->head = packet->next;
+    if (socket->head == NULL) {
+        socket->tail = NULL;
+    }
+    socket->queued -= packet->length;
+    update_ready(socket);
+
+    size_t copied = 0;
+    for (size_t i = 0; i < count && copied < packet->length; i++) {
+        size_t piece = packet->length - copied < iov[i].iov_len ? packet->length - copied : iov[i].iov_len;
+        memcpy(iov[i].iov_base, packet->data + copied, piece);
+        copied += piece;
+    }
+    if (truncated != NULL) {
+        *truncated = copied < packet->length;
+    }
+
+    if (from != NULL && from_length != NULL) {
+        struct sockaddr_storage address;
+        socklen_t length;
+        memset(&address, 0, sizeof(address));
+        if (socket->family == AF_INET6) {
+            struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&address;
+            uint32_t mapped = htonl(packet->from_address);
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port = htons(packet->from_port);
+            in6->sin6_addr.s6_addr[10] = 0xff;
+            in6->sin6_addr.s6_addr[11] = 0xff;
+            memcpy(&in6->sin6_addr.s6_addr[12], &mapped, 4);
+            length = sizeof(*in6);
+        } else {
+            struct sockaddr_in *in = (struct sockaddr_in *)&address;
+            in->sin_family = AF_INET;
+            in->sin_port = htons(packet->from_port);
+            in->sin_addr.s_addr = htonl(packet->from_address);
+            length = sizeof(*in);
+        }
+        memcpy(from, &address, *from_length < length ? *from_length : length);
+        *from_length = length;
+    }
+    free(packet);
+    return copied;
+}
+
+/** @brief Moves the clock to the next event and handles it: a packet reaching the bottleneck or a socket, or a timer expiring
+ *
+ *  @param limit Do not go past this time
+ *  @return 0 if an event was handled, -1 if none is due until limit (the clock is then at limit, if it is finite)
+ */
+static int step(uint64_t limit) {
+    for (;;) {
+        if (heap_count == 0 || heap[0].at > limit) {
+            if (limit != UINT64_MAX && limit > now_ns) {
+                now_ns = limit;
+            }
+            return -1;
+        }
+
+        struct sim_event event = heap_pop();
+        if (event.at > now_ns) {
+            now_ns = event.at;
+        }
+        if (event.packet != NULL) {
+            if (event.packet->entering) {
+                enter_bottleneck(event.packet);
+            } else {
+                deliver(event.packet);
+            }
+            return 0;
+        }
+
+        /// The expiry of an arming that was replaced (or of a closed timer) is nothing
+        struct sim_fd *timer = &fds[event.slot];
+        if (timer->kind != sim_timer || timer->generation != event.generation) {
+            continue;
+        }
+        timer->expirations++;
+        if (timer->interval > 0) {
+            timer->expires += timer->interval;
+            schedule(timer->expires, NULL, event.slot, event.generation);
+        } else {
+            timer->expires = 0;
+        }
+        update_ready(timer);
+        return 0;
+    }
+}
+
+/** @brief Starts a scenario: closes every virtual descriptor, empties the network and sets the clock back
+ *
+ *  @param scenario The link to model
+ *  @return void
+ */
+void simnet_reset(const struct simnet_link *scenario) {
+    for (int i = 0; i < fds_used; i++) {
+        if (fds[i].kind != sim_free) {
+            __wrap_close(simnet_fd_base + i);
+        }
+    }
+    fds_used = 0;
+    ready_fds = 0;
+    while (heap_count > 0) {
+        free(heap_pop().packet);
+    }
+
+    model = *scenario;
+    memset(&stats, 0, sizeof(stats));
+    now_ns = simnet_epoch_ns;
+    link_free_ns = now_ns;
+    bursting = 0;
+    next_seq = 0;
+    generations = 0;
+    next_port = 32768;
+}
+
+/** @brief The virtual clock
+ *
+ *  @return Nanoseconds since the scenario started, plus simnet_epoch_ns
+ */
+uint64_t simnet_now(void) {
+    return now_ns;
+}
+
+/** @brief What the network did so far
+ *
+ *  @return The counters of the scenario
+ */
+const struct simnet_stats *simnet_stats(void) {
+    return &stats;
+}
+
+/** @brief The real monotonic clock, for timing the simulator itself
+ *
+ *  @return Seconds
+ */
+double simnet_wall_seconds(void) {
+    struct timespec now;
+    __real_clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+
+/*   The wrapped calls   */
+
+int __wrap_clock_gettime(clockid_t clock, struct timespec *now) {
+    if (clock == CLOCK_PROCESS_CPUTIME_ID || clock == CLOCK_THREAD_CPUTIME_ID) {
+        return __real_clock_gettime(clock, now);
+    }
+    now->tv_sec = now_ns / 1000000000;
+    now->tv_nsec = now_ns % 1000000000;
+    return 0;
+}
+
+int __wrap_socket(int domain, int type, int protocol) {
+    if ((domain != AF_INET && domain != AF_INET6) || (type & 0xf) != SOCK_DGRAM) {
+        return __real_socket(domain, type, protocol);
+    }
+    int fd = allocate(sim_socket);
+    if (fd >= 0) {
+        struct sim_fd *socket = lookup(fd);
+        socket->family = domain;
+        socket->receive_buffer = simnet_socket_buffer;
+        socket->send_buffer = simnet_socket_buffer;
+    }
+    return fd;
+}
+
+int __wrap_bind(int fd, const struct sockaddr *address, socklen_t length) {
+    struct sim_fd *socket = lookup(fd);
+    if (socket == NULL) {
+        return __real_bind(fd, address, length);
+    }
+    uint32_t host;
+    uint16_t port;
+    if (socket->kind != sim_socket || parse_address(address, length, &host, &port) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (port == 0) {
+        return bind_ephemeral(socket);
+    }
+    if (bound_to(port) != NULL) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+    bind_port(socket, port);
+    return 0;
+}
+
+int __wrap_setsockopt(int fd, int level, int name, const void *value, socklen_t length) {
+    struct sim_fd *socket = lookup(fd);
+    if (socket == NULL) {
+        return __real_setsockopt(fd, level, name, value, length);
+    }
+    /// Everything else (IPV6_V6ONLY, SO_RXQ_OVFL, ...) is taken and has no effect
+    if (level == SOL_SOCKET && length >= sizeof(int)) {
+        int size = *(const int *)value;
+        if (name == SO_TXTIME) {
+            socket->txtime = 1;
+        } else if (name == SO_RCVBUF || name == SO_RCVBUFFORCE) {
+            socket->receive_buffer = 2L * size;
+        } else if (name == SO_SNDBUF || name == SO_SNDBUFFORCE) {
+            socket->send_buffer = 2L * size;
+        }
+    }
+    return 0;
+}
+
+int __wrap_getsockopt(int fd, int level, int name, void *value, socklen_t *length) {
+    struct sim_fd *socket = lookup(fd);
+    if (socket == NULL) {
+        return __real_getsockopt(fd, level, name, value, length);
+    }
+    int answer = 0;
+    if (level == SOL_SOCKET && name == SO_RCVBUF) {
+        answer = socket->receive_buffer;
+    } else if (level == SOL_SOCKET && name == SO_SNDBUF) {
+        answer = socket->send_buffer;
+    }
+    if (*length < sizeof(answer)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(value, &answer, sizeof(answer));
+    *length = sizeof(answer);
+    return 0;
+}
+
+ssize_t __wrap_sendmsg(int fd, const struct msghdr *msg, int flags) {
+    struct sim_fd *socket = lookup(fd);
+    if (socket == NULL) {
+        return __real_sendmsg(fd, msg, flags);
+    }
+    if (socket->kind != sim_socket) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+
+    uint64_t send_at = 0;
+    if (socket->txtime) {
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR((struct msghdr *)msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TXTIME) {
+                memcpy(&send_at, CMSG_DATA(cmsg), sizeof(send_at));
+            }
+        }
+    }
+    return send_datagram(socket, msg->msg_name, msg->msg_namelen, msg->msg_iov, msg->msg_iovlen, send_at);
+}
+
+ssize_t __wrap_sendto(int fd, const void *buffer, size_t length, int flags, const struct sockaddr *to, socklen_t to_length) {
+    struct sim_fd *socket = lookup(fd);
+    if (socket == NULL) {
+        return __real_sendto(fd, buffer, length, flags, to, to_length);
+    }
+    if (socket->kind != sim_socket) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+    struct iovec iov = { (void *)buffer, length };
+    return send_datagram(socket, to, to_length, &iov, 1, 0);
+}
+
+ssize_t __wrap_recvmsg(int fd, struct msghdr *msg, int flags) {
+    struct sim_fd *socket = lookup(fd);
+    if (socket == NULL) {
+        return __real_recvmsg(fd, msg, flags);
+    }
+    if (socket->kind != sim_socket) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+    int truncated = 0;
+    ssize_t length = receive_datagram(socket, msg->msg_iov, msg->msg_iovlen, msg->msg_name, &msg->msg_namelen, &truncated);
+    if (length >= 0) {
+        /// No SO_RXQ_OVFL counter rides along, socket drops are counted in simnet_stats instead
+        msg->msg_controllen = 0;
+        msg->msg_flags = truncated ? MSG_TRUNC : 0;
+    }
+    return length;
+}
+
+ssize_t __wrap_recvfrom(int fd, void *buffer, size_t length, int flags, struct sockaddr *from, socklen_t *from_length) {
+    struct sim_fd *socket = lookup(fd);
+    if (socket == NULL) {
+        return __real_recvfrom(fd, buffer, length, flags, from, from_length);
+    }
+    if (socket->kind != sim_socket) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+    struct iovec iov = { buffer, length };
+    return receive_datagram(socket, &iov, 1, from, from_length, NULL);
+}
+
+ssize_t __wrap_read(int fd, void *buffer, size_t count) {
+    struct sim_fd *entry = lookup(fd);
+    if (entry == NULL) {
+        return __real_read(fd, buffer, count);
+    }
+    if (entry->kind == sim_socket) {
+        struct iovec iov = { buffer, count };
+        return receive_datagram(entry, &iov, 1, NULL, NULL, NULL);
+    }
+    if (entry->kind != sim_timer || count < sizeof(uint64_t)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (entry->expirations == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    memcpy(buffer, &entry->expirations, sizeof(uint64_t));
+    entry->expirations = 0;
+    update_ready(entry);
+    return sizeof(uint64_t);
+}
+
+int __wrap_close(int fd) {
+    struct sim_fd *entry = lookup(fd);
+    if (entry == NULL) {
+        return __real_close(fd);
+    }
+
+    while (entry->head != NULL) {
+        struct sim_packet *packet = entry->head;
+        entry->head = packet->next;
+        free(packet);
+    }
+    for (int w = 0; w < entry->watch_count; w++) {
+        struct sim_fd *watched = lookup(entry->watches[w].fd);
+        watched->watched--;
+        update_ready(watched);
+    }
+    free(entry->watches);
+
+    /// A closed descriptor leaves every epoll it was in
+    for (int i = 0; i < fds_used && entry->watched > 0; i++) {
+        struct sim_fd *epoll = &fds[i];
+        if (epoll->kind != sim_epoll) {
+            continue;
+        }
+        for (int w = 0; w < epoll->watch_count; w++) {
+            if (epoll->watches[w].fd == fd) {
+                memmove(&epoll->watches[w], &epoll->watches[w + 1], (epoll->watch_count - w - 1) * sizeof(struct sim_watch));
+                epoll->watch_count--;
+                entry->watched--;
+                break;
+            }
+        }
+    }
+    if (entry->kind == sim_socket && entry->port != 0) {
+        port_slots[entry->port] = 0;
+    }
+    ready_fds -= entry->counted;
+    memset(entry, 0, sizeof(*entry));
+    return 0;
+}
+
+int __wrap_epoll_create1(int flags) {
+    (void)flags;
+    int fd = allocate(sim_epoll);
+    if (fd >= 0) {
+        struct sim_fd *epoll = lookup(fd);
+        epoll->watches = calloc(simnet_max_fds, sizeof(struct sim_watch));
+        if (epoll->watches == NULL) {
+            epoll->kind = sim_free;
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    return fd;
+}
+
+int __wrap_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    struct sim_fd *epoll = lookup(epfd);
+    if (epoll == NULL) {
+        return __real_epoll_ctl(epfd, op, fd, event);
+    }
+    /// Only virtual descriptors can become ready in virtual time
+    struct sim_fd *entry = lookup(fd);
+    if (epoll->kind != sim_epoll || entry == NULL) {
+        errno = EPERM;
+        return -1;
+    }
+
+    int at = 0;
+    while (at < epoll->watch_count && epoll->watches[at].fd != fd) {
+        at++;
+    }
+    switch (op) {
+        case EPOLL_CTL_ADD:
+            if (at < epoll->watch_count) {
+                errno = EEXIST;
+                return -1;
+            }
+            epoll->watches[at].fd = fd;
+            epoll->watches[at].events = event->events;
+            epoll->watches[at].data = event->data;
+            epoll->watch_count++;
+            entry->watched++;
+            update_ready(entry);
+            return 0;
+        case EPOLL_CTL_MOD:
+        case EPOLL_CTL_DEL:
+            if (at == epoll->watch_count) {
+                errno = ENOENT;
+                return -1;
+            }
+            if (op == EPOLL_CTL_MOD) {
+                epoll->watches[at].events = event->events;
+                epoll->watches[at].data = event->data;
+            } else {
+                memmove(&epoll->watches[at], &epoll->watches[at + 1], (epoll->watch_count - at - 1) * sizeof(struct sim_watch));
+                epoll->watch_count--;
+                entry->watched--;
+                update_ready(entry);
+            }
+            return 0;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+int __wrap_epoll_wait(int epfd, struct epoll_event *events, int max_events, int timeout) {
+    struct sim_fd *epoll = lookup(epfd);
+    if (epoll == NULL) {
+        return __real_epoll_wait(epfd, events, max_events, timeout);
+    }
+
+    uint64_t limit = timeout < 0 ? UINT64_MAX : now_ns + (uint64_t)timeout * 1000000;
+    for (;;) {
+        /// Level triggered, in the order the descriptors were added; only ever EPOLLIN, all the library waits for
+        int ready = 0;
+        for (int w = 0; w < epoll->watch_count && ready < max_events && ready < ready_fds; w++) {
+            struct sim_fd *entry = &fds[epoll->watches[w].fd - simnet_fd_base];
+            if (entry->counted && (epoll->watches[w].events & EPOLLIN)) {
+                events[ready].events = EPOLLIN;
+                events[ready].data = epoll->watches[w].data;
+                ready++;
+            }
+        }
+        if (ready > 0 || timeout == 0) {
+            return ready;
+        }
+
+        /// Nothing ready: time passes until something is
+        if (step(limit) < 0) {
+            if (limit != UINT64_MAX) {
+                return 0;
+            }
+            /// Nothing will ever happen again, the real call would sleep forever
+            errno = EDEADLK;
+            return -1;
+        }
+    }
+}
+
+int __wrap_timerfd_create(int clock, int flags) {
+    (void)clock;
+    (void)flags;
+    return allocate(sim_timer);
+}
+
+int __wrap_timerfd_settime(int fd, int flags, const struct itimerspec *value, struct itimerspec *old) {
+    struct sim_fd *timer = lookup(fd);
+    if (timer == NULL) {
+        return __real_timerfd_settime(fd, flags, value, old);
+    }
+    if (timer->kind != sim_timer) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (old != NULL) {
+        uint64_t left = timer->expires > now_ns ? timer->expires - now_ns : 0;
+        old->it_value.tv_sec = left / 1000000000;
+        old->it_value.tv_nsec = left % 1000000000;
+        old->it_interval.tv_sec = timer->interval / 1000000000;
+        old->it_interval.tv_nsec = timer->interval % 1000000000;
+    }
+
+    uint64_t first = (uint64_t)value->it_value.tv_sec * 1000000000 + value->it_value.tv_nsec;
+    timer->interval = (uint64_t)value->it_interval.tv_sec * 1000000000 + value->it_interval.tv_nsec;
+    timer->expirations = 0;
+    timer->generation = ++generations;
+    if (first == 0) {
+        timer->expires = 0;
+    } else {
+        timer->expires = flags & TFD_TIMER_ABSTIME ? (first > now_ns ? first : now_ns) : now_ns + first;
+        schedule(timer->expires, NULL, timer - fds, timer->generation);
+    }
+    update_ready(timer);
+    return 0;
+}
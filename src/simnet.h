@@ -0,0 +1,64 @@
+/** @file simnet.h
+ *
+ *  @brief A virtual kernel for the simulator: clock, UDP sockets, timerfds, epoll and one bottleneck link.
+ *
+ *  rudp_sim links the unchanged library against this file with the linker's --wrap, so every
+ *  clock_gettime(), socket call, timerfd and epoll_wait() of the protocol lands here instead of in
+ *  the kernel. Descriptors the library asks for are virtual (from simnet_fd_base up); anything else
+ *  (files, stdio) goes through to the real call. epoll_wait() never sleeps: when nothing is ready
+ *  it jumps the clock to the next event (a datagram arriving, a timer expiring), so a transfer of
+ *  minutes runs in as long as the protocol's own code takes.
+ *
+ *  The network is two hosts. Everything sent to simnet_right (the receivers) crosses the bottleneck:
+ *  a drop-tail queue in front of a link of a fixed rate, then random or bursty loss and the one way
+ *  delay. Everything sent back only sees the delay and its own random loss. Sockets with SO_TXTIME
+ *  are held until their send time, as fq would, and that is how the simulated senders pace.
+ *
+ *  Nothing in here looks at the wall clock or at a random number it was not seeded with, so a
+ *  scenario run twice comes out the same to the nanosecond.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef SIMNET_H
+#define SIMNET_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define simnet_fd_base 0x40000000 /// First virtual descriptor, far above anything the process has open
+#define simnet_max_fds 1024 /// Virtual descriptors alive at once
+#define simnet_max_packet 4096 /// Largest datagram carried (the receiver's acks are bigger than our data packets)
+#define simnet_socket_buffer 212992 /// Receive buffer of a socket that did not set SO_RCVBUF (net.core.rmem_default)
+#define simnet_epoch_ns 1000000000ULL /// The clock reads this at the start of every scenario, so no time is 0
+#define simnet_left 0x0a000001 /// 10.0.0.1, where the senders are
+#define simnet_right 0x0a000002 /// 10.0.0.2, where the receivers are
+
+/// The modeled network of one scenario
+struct simnet_link {
+    double rate_mbps; /// Bottleneck rate towards the receivers, 0 for unlimited
+    double delay_ms; /// One way delay, both directions
+    double queue_ms; /// Tail drop once this much is queued in front of the bottleneck
+    double loss; /// Average probability of losing a packet on the bottleneck (0..1)
+    double burst; /// Mean length of a run of losses in packets (Gilbert-Elliott), 1 or less for independent losses
+    double ack_loss; /// Probability of losing a packet on the way back
+    unsigned int seed;
+};
+
+/// What the network did during the scenario
+struct simnet_stats {
+    unsigned long long forwarded; /// Datagrams that crossed the bottleneck
+    unsigned long long forwarded_bytes;
+    unsigned long long queue_drops; /// Tail drops in front of the bottleneck
+    unsigned long long losses; /// Random or bursty losses, both directions
+    unsigned long long socket_drops; /// Datagrams that found the receiving socket's buffer full
+    uint64_t busy_ns; /// Time the bottleneck spent sending
+};
+
+void simnet_reset(const struct simnet_link *link);
+uint64_t simnet_now(void);
+const struct simnet_stats *simnet_stats(void);
+double simnet_wall_seconds(void);
+
+#endif
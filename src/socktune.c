@@ -0,0 +1,247 @@
+/** @file socktune.c
+ *
+ *  @brief Socket buffer sizes, busy polling, CPU steering and kernel drop counting.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#define _GNU_SOURCE /// for pthread_setaffinity_np
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+
+#include "socktune.h"
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+/// Per-epoll busy polling (Linux 6.9), not in every linux/eventpoll.h yet
+struct tuning_epoll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t pad;
+};
+#define tuning_epiocsparams _IOW(0x8A, 0x01, struct tuning_epoll_params)
+
+
+/** @brief The defaults: BDP-sized buffers, no busy polling, no pinning
+ *
+ *  @param tuning Filled in
+ *  @return void
+ */
+void tuning_defaults(struct socket_tuning *tuning) {
+    tuning->buffer_bytes = tuning_default_buffer;
+    tuning->busy_poll_us = 0;
+    tuning->cpu = -1;
+}
+
+/** @brief Parses a buffer size: bytes with an optional K/M/G suffix, or a bandwidth-delay product
+ *
+ *  "8M" is 8 MiB, "2500x40" is the BDP of 2500 Mbit/s over a 40 ms round trip (12.5 MB).
+ *
+ *  @param text The option argument
+ *  @return The size in bytes, -1 if it does not parse
+ */
+long tuning_parse_buffer(const char *text) {
+    char *end;
+    double value = strtod(text, &end);
+    if (end == text || value < 0) {
+        return -1;
+    }
+
+    if (*end == 'x') {
+        char *rtt_end;
+        double rtt_ms = strtod(end + 1, &rtt_end);
+        if (rtt_end == end + 1 || *rtt_end != '\0' || rtt_ms < 0) {
+            return -1;
+        }
+        /// Mbit/s times ms is kbit
+        return (long)(value * rtt_ms * 1000 / 8);
+    }
+
+    switch (*end) {
+        case '\0': break;
+        case 'k': case 'K': value *= 1024; end++; break;
+        case 'm': case 'M': value *= 1024 * 1024; end++; break;
+        case 'g': case 'G': value *= 1024 * 1024 * 1024; end++; break;
+        default: return -1;
+    }
+    return *end == '\0' ? (long)value : -1;
+}
+
+/** @brief Adds a problem to the ones tuning_apply() reports, separated by "; "
+ *
+ *  @param problems The report so far, cut short if it does not fit
+ *  @param size Room for it
+ *  @param format printf() format of the problem
+ *  @return void
+ */
+static void add_problem(char *problems, size_t size, const char *format, ...) {
+    size_t used = strlen(problems);
+    if (used > 0 && used + 2 < size) {
+        strcpy(problems + used, "; ");
+        used += 2;
+    }
+    va_list args;
+    va_start(args, format);
+    vsnprintf(problems + used, size - used, format, args);
+    va_end(args);
+}
+
+/** @brief Sets one buffer size, past the sysctl cap if we may, and says so if it came out smaller
+ *
+ *  @param socket_desc The socket
+ *  @param force SO_RCVBUFFORCE or SO_SNDBUFFORCE, which need CAP_NET_ADMIN
+ *  @param plain SO_RCVBUF or SO_SNDBUF, capped by net.core.rmem_max or wmem_max
+ *  @param bytes The size asked for
+ *  @param name For the report
+ *  @param problems Report of what did not work
+ *  @param size Room for the report
+ *  @return 0 if the socket got the whole size, -1 otherwise
+ */
+static int set_buffer(int socket_desc, int force, int plain, long bytes, const char *name, char *problems, size_t size) {
+    int value = bytes > 0x3fffffff ? 0x3fffffff : (int)bytes;
+    if (setsockopt(socket_desc, SOL_SOCKET, force, &value, sizeof(value)) < 0 &&
+        setsockopt(socket_desc, SOL_SOCKET, plain, &value, sizeof(value)) < 0) {
+        add_problem(problems, size, "%s: %s", name, strerror(errno));
+        return -1;
+    }
+
+    /// The kernel doubles what it was given for its bookkeeping and reports the doubled value
+    int actual = 0;
+    socklen_t length = sizeof(actual);
+    if (getsockopt(socket_desc, SOL_SOCKET, plain, &actual, &length) == 0 && actual / 2 < value) {
+        add_problem(problems, size, "%s is %d bytes instead of %d, raise net.core.%s",
+                    name, actual / 2, value, plain == SO_RCVBUF ? "rmem_max" : "wmem_max");
+        return -1;
+    }
+    return 0;
+}
+
+/** @brief Applies the buffer sizes, busy polling and steering to a socket
+ *
+ *  Whatever does not take is left at the kernel's default and named in problems, for the caller to log.
+ *
+ *  @param socket_desc The socket
+ *  @param tuning What to apply
+ *  @param count_drops Turn on SO_RXQ_OVFL, for the receiving side
+ *  @param problems Set to what did not work, "" if everything did
+ *  @param size Room for problems
+ *  @return 0 if everything was applied, -1 otherwise
+ */
+int tuning_apply(int socket_desc, const struct socket_tuning *tuning, int count_drops, char *problems, size_t size) {
+    problems[0] = 0;
+    int result = 0;
+    if (tuning->buffer_bytes > 0) {
+        result |= set_buffer(socket_desc, SO_RCVBUFFORCE, SO_RCVBUF, tuning->buffer_bytes, "SO_RCVBUF", problems, size);
+        result |= set_buffer(socket_desc, SO_SNDBUFFORCE, SO_SNDBUF, tuning->buffer_bytes, "SO_SNDBUF", problems, size);
+    }
+    if (tuning->busy_poll_us > 0 &&
+        setsockopt(socket_desc, SOL_SOCKET, SO_BUSY_POLL, &tuning->busy_poll_us, sizeof(tuning->busy_poll_us)) < 0) {
+        add_problem(problems, size, "SO_BUSY_POLL: %s", strerror(errno));
+        result = -1;
+    }
+    /// Only a hint: with RSS the flow hashes to one queue anyway, this keeps a reuseport group on our CPU
+    if (tuning->cpu >= 0 &&
+        setsockopt(socket_desc, SOL_SOCKET, SO_INCOMING_CPU, &tuning->cpu, sizeof(tuning->cpu)) < 0) {
+        add_problem(problems, size, "SO_INCOMING_CPU: %s", strerror(errno));
+        result = -1;
+    }
+    int on = 1;
+    if (count_drops && setsockopt(socket_desc, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0) {
+        add_problem(problems, size, "SO_RXQ_OVFL: %s", strerror(errno));
+        result = -1;
+    }
+    return result;
+}
+
+/** @brief Busy polls from epoll_wait() as well, where the event loop spends its time
+ *
+ *  Kernels before 6.9 do not have the ioctl and only poll with the net.core.busy_poll sysctl.
+ *
+ *  @param epoll_fd The event loop's epoll descriptor
+ *  @param tuning busy_poll_us is used
+ *  @return void
+ */
+void tuning_busy_poll_epoll(int epoll_fd, const struct socket_tuning *tuning) {
+    if (tuning->busy_poll_us <= 0) {
+        return;
+    }
+    struct tuning_epoll_params params;
+    memset(&params, 0, sizeof(params));
+    params.busy_poll_usecs = tuning->busy_poll_us;
+    params.busy_poll_budget = 8;
+    params.prefer_busy_poll = 1;
+    ioctl(epoll_fd, tuning_epiocsparams, &params);
+}
+
+/** @brief Pins the calling thread to the tuning's CPU
+ *
+ *  @param tuning cpu is used, -1 does nothing
+ *  @return 0 on success, -1 with errno set if the thread could not be pinned
+ */
+int tuning_pin_thread(const struct socket_tuning *tuning) {
+    if (tuning->cpu < 0) {
+        return 0;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(tuning->cpu, &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/** @brief Picks the SO_RXQ_OVFL counter out of a received message
+ *
+ *  @param msg The message, with the control data recvmsg() filled in
+ *  @param drops Set to the datagrams the socket has dropped so far
+ *  @return 1 if the message carried the counter, 0 otherwise
+ */
+int tuning_drops(struct msghdr *msg, unsigned long long *drops) {
+    if (msg->msg_control == NULL) {
+        return 0;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t counter;
+            memcpy(&counter, CMSG_DATA(cmsg), sizeof(counter));
+            *drops = counter;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/** @brief The CPU that handled the socket's last packet in the kernel, to check the steering
+ *
+ *  @param socket_desc The socket
+ *  @return The CPU, -1 if unknown
+ */
+int tuning_incoming_cpu(int socket_desc) {
+    int cpu = -1;
+    socklen_t length = sizeof(cpu);
+    if (getsockopt(socket_desc, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &length) < 0) {
+        return -1;
+    }
+    return cpu;
+}
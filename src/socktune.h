@@ -0,0 +1,44 @@
+/** @file socktune.h
+ *
+ *  @brief Socket buffer sizes, busy polling, CPU steering and kernel drop counting.
+ *
+ *  The kernel's default socket buffers (around 200 KB) fill up in a burst, and the datagrams
+ *  that do not fit are dropped before recvmsg() ever sees them, which looks exactly like loss on
+ *  the network. Both programs size their buffers from the bandwidth-delay product instead, can
+ *  busy poll the device queue and keep the socket, its interrupts and the thread on one CPU.
+ *  The receiver turns on SO_RXQ_OVFL so every datagram carries the socket's drop counter, which
+ *  ends up in the stats as socket_drops.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef SOCKTUNE_H
+#define SOCKTUNE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/// 1 Gbit/s over a 32 ms round trip, the default -B (net.core.rmem_max/wmem_max cap it without CAP_NET_ADMIN)
+#define tuning_default_buffer (4L * 1024 * 1024)
+
+/// Control buffer room for the SO_RXQ_OVFL counter
+#define tuning_control_size CMSG_SPACE(sizeof(uint32_t))
+
+/// What to do to a socket, set from -B, -Y and -C
+struct socket_tuning {
+    long buffer_bytes; /// SO_RCVBUF and SO_SNDBUF, 0 keeps the kernel default
+    int busy_poll_us; /// SO_BUSY_POLL and epoll busy polling, 0 is off
+    int cpu; /// CPU the thread is pinned to and the socket is steered to, -1 leaves scheduling alone
+};
+
+void tuning_defaults(struct socket_tuning *tuning);
+long tuning_parse_buffer(const char *text);
+int tuning_apply(int socket_desc, const struct socket_tuning *tuning, int count_drops, char *problems, size_t size);
+void tuning_busy_poll_epoll(int epoll_fd, const struct socket_tuning *tuning);
+int tuning_pin_thread(const struct socket_tuning *tuning);
+int tuning_drops(struct msghdr *msg, unsigned long long *drops);
+int tuning_incoming_cpu(int socket_desc);
+
+#endif
@@ -0,0 +1,145 @@
+/** @file sparse.c
+ *
+ *  @brief Holes from SEEK_DATA/SEEK_HOLE and a vectorised scan for runs of zeros.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#define _GNU_SOURCE /// for SEEK_DATA and SEEK_HOLE
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "sparse.h"
+
+
+/** @brief Leading zero bytes, a machine word at a time
+ *
+ *  @param data The bytes
+ *  @param length How many
+ *  @return Number of zero bytes before the first one that is not
+ */
+static size_t zero_prefix_words(const uint8_t *data, size_t length) {
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        if (word != 0) {
+            break;
+        }
+    }
+    while (i < length && data[i] == 0) {
+        i++;
+    }
+    return i;
+}
+
+#if defined(__x86_64__)
+/** @brief Leading zero bytes, 128 bytes per round with AVX2
+ *
+ *  @param data The bytes
+ *  @param length How many
+ *  @return Number of zero bytes before the first one that is not
+ */
+__attribute__((target("avx2")))
+static size_t zero_prefix_avx2(const uint8_t *data, size_t length) {
+    size_t i = 0;
+    for (; i + 128 <= length; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(data + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(data + i + 96));
+        __m256i any = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+        if (!_mm256_testz_si256(any, any)) {
+            break;
+        }
+    }
+    return i + zero_prefix_words(data + i, length - i);
+}
+#endif
+
+/** @brief Counts the zero bytes a buffer starts with
+ *
+ *  @param data The bytes
+ *  @param length How many
+ *  @return Number of zero bytes before the first one that is not, length if they all are
+ */
+size_t sparse_zero_prefix(const uint8_t *data, size_t length) {
+    /// Most payloads are not zero at all, the first word tells
+    if (length >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        if (word != 0) {
+            return zero_prefix_words(data, 8);
+        }
+    }
+#if defined(__x86_64__)
+    static int avx2 = -1;
+    if (avx2 < 0) {
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    if (avx2) {
+        return zero_prefix_avx2(data, length);
+    }
+#endif
+    return zero_prefix_words(data, length);
+}
+
+/** @brief Finds the data region at or after an offset, as the file system knows it
+ *
+ *  @param fd The file
+ *  @param offset Where to look from
+ *  @param data Set to where the next data starts: offset itself unless offset is in a hole, ~0ULL if only a hole follows
+ *  @param hole Set to where that data ends (the next hole, or the end of the file), ~0ULL if unknown
+ *  @return 0, -1 if the file system has no idea of holes (then everything is data)
+ */
+int sparse_data_region(int fd, unsigned long long offset, unsigned long long *data, unsigned long long *hole) {
+    off_t next = lseek(fd, offset, SEEK_DATA);
+    if (next < 0) {
+        if (errno == ENXIO) {
+            *data = *hole = ~0ULL;
+            return 0;
+        }
+        *data = offset;
+        *hole = ~0ULL;
+        return -1;
+    }
+    off_t end = lseek(fd, next, SEEK_HOLE);
+    *data = next;
+    *hole = end < 0 ? ~0ULL : (unsigned long long)end;
+    return 0;
+}
+
+/** @brief Measures a run of zeros in the file by reading it
+ *
+ *  @param fd The file, its offset is left alone
+ *  @param offset Where the run starts
+ *  @param limit Where to stop looking at the latest
+ *  @param scratch sparse_scan_size bytes to read into
+ *  @return Number of zero bytes from offset on, up to limit - offset
+ */
+unsigned long long sparse_zero_run(int fd, unsigned long long offset, unsigned long long limit, uint8_t *scratch) {
+    unsigned long long run = 0;
+    while (offset + run < limit) {
+        size_t want = limit - offset - run < sparse_scan_size ? limit - offset - run : sparse_scan_size;
+        ssize_t got = pread(fd, scratch, want, offset + run);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        size_t zeros = sparse_zero_prefix(scratch, got);
+        run += zeros;
+        if (zeros < (size_t)got) {
+            break;
+        }
+    }
+    return run;
+}
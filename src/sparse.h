@@ -0,0 +1,27 @@
+/** @file sparse.h
+ *
+ *  @brief Finding the holes and the runs of zeros in a file, so they go over the wire as one zero range packet.
+ *
+ *  Holes come from the file system (SEEK_DATA/SEEK_HOLE) without reading anything. Inside the data
+ *  the sender looks for zeros only when a payload it read anyway is all zero, and then reads ahead
+ *  a scan buffer at a time; the zero test runs 32 bytes at a time with AVX2 where the CPU has it.
+ *  A file system without SEEK_DATA looks like one data region, so only the zero scan finds anything.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define sparse_min_run 4096 /// Runs of zeros shorter than this go as plain data
+#define sparse_scan_size 65536 /// Bytes read ahead at a time while a run of zeros goes on
+
+size_t sparse_zero_prefix(const uint8_t *data, size_t length);
+int sparse_data_region(int fd, unsigned long long offset, unsigned long long *data, unsigned long long *hole);
+unsigned long long sparse_zero_run(int fd, unsigned long long offset, unsigned long long limit, uint8_t *scratch);
+
+#endif
@@ -0,0 +1,421 @@
+/** @file stats.c
+ *
+ *  @brief Progress reports and metrics export for the sender and the receiver.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#define _GNU_SOURCE /// for accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "stats.h"
+
+
+#define stats_poll_interval 0.1 /// Seconds between checks for metrics connections on the Unix socket
+
+
+/** @brief Copies a label, escaping what would end a JSON string or a Prometheus label value early
+ *
+ *  @param label Set to the escaped label, cut short if it does not fit
+ *  @param size Room for it
+ *  @param text The label as given
+ *  @return void
+ */
+static void escape_label(char *label, size_t size, const char *text) {
+    size_t used = 0;
+    for (; *text != 0 && used + 3 < size; text++) {
+        if (*text == '"' || *text == '\\') {
+            label[used++] = '\\';
+            label[used++] = *text;
+        } else if (*text == '\n') {
+            label[used++] = '\\';
+            label[used++] = 'n';
+        } else if ((unsigned char)*text >= ' ') {
+            label[used++] = *text;
+        }
+    }
+    label[used] = 0;
+}
+
+/** @brief Sets up where one transfer's metrics go
+ *
+ *  Every transfer needs a file or socket of its own; two sinks on one path overwrite each other.
+ *
+ *  @param sink The sink, its listen_fd has to be -1 or a socket of a sink opened before
+ *  @param path File to write the metrics to, or unix:/path for a Unix socket, NULL for none
+ *  @param interval_ms Milliseconds between metrics file updates, 0 for every second
+ *  @param label Names the transfer in the metrics
+ *  @return 0 on success, -1 with errno set if the Unix socket could not be set up
+ */
+int stats_sink_open(struct stats_sink *sink, const char *path, int interval_ms, const char *label) {
+    stats_sink_close(sink);
+    sink->path = path;
+    sink->interval = interval_ms > 0 ? interval_ms / 1000.0 : 1;
+    escape_label(sink->label, sizeof(sink->label), label);
+    sink->last_report = sink->last_poll = stats_now();
+
+    if (path == NULL || strncmp(path, "unix:", 5) != 0) {
+        return 0;
+    }
+
+    /// Metrics are served to whoever connects, without ever blocking the transfer
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path + 5, sizeof(address.sun_path) - 1);
+    /// A socket left behind by a run that did not get to close it would make bind fail
+    unlink(address.sun_path);
+
+    sink->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sink->listen_fd >= 0 && bind(sink->listen_fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+        memcpy(sink->socket_path, address.sun_path, sizeof(sink->socket_path));
+    }
+    if (sink->socket_path[0] == '\0' || listen(sink->listen_fd, 4) < 0) {
+        int saved_errno = errno;
+        stats_sink_close(sink);
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+/** @brief Stops serving a transfer's metrics and removes the socket it bound
+ *
+ *  @param sink The sink; one whose listen_fd is -1 only forgets its path
+ *  @return void
+ */
+void stats_sink_close(struct stats_sink *sink) {
+    if (sink->listen_fd >= 0) {
+        close(sink->listen_fd);
+    }
+    if (sink->socket_path[0] != '\0') {
+        unlink(sink->socket_path);
+        sink->socket_path[0] = '\0';
+    }
+    sink->listen_fd = -1;
+    sink->path = NULL;
+}
+
+/** @brief Seconds on the monotonic clock
+ *
+ *  @return The current time
+ */
+double stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+/** @brief Starts the counters of a new transfer
+ *
+ *  @param stats Counters to reset
+ *  @param role "sender" or "receiver"
+ *  @param total_bytes Size of the transfer if known, else 0
+ *  @return void
+ */
+void stats_init(struct rudp_stats *stats, const char *role, unsigned long long total_bytes) {
+    memset(stats, 0, sizeof(*stats));
+    stats->role = role;
+    stats->total_bytes = total_bytes;
+    stats->window = 1;
+    stats->start_time = stats_now();
+}
+
+/** @brief Folds a round trip time measurement into SRTT and RTTVAR (RFC 6298)
+ *
+ *  @param stats Counters
+ *  @param rtt_us The measurement in microseconds
+ *  @return void
+ */
+void stats_rtt_sample(struct rudp_stats *stats, double rtt_us) {
+    if (stats->srtt_us == 0) {
+        stats->srtt_us = rtt_us;
+        stats->rttvar_us = rtt_us / 2;
+        return;
+    }
+    double error = stats->srtt_us - rtt_us;
+    stats->rttvar_us = 0.75 * stats->rttvar_us + 0.25 * (error < 0 ? -error : error);
+    stats->srtt_us = 0.875 * stats->srtt_us + 0.125 * rtt_us;
+}
+
+/** @brief Adds one disk write to the latency histogram
+ *
+ *  @param stats Counters
+ *  @param latency_us How long the write took
+ *  @return void
+ */
+void stats_write_latency(struct rudp_stats *stats, double latency_us) {
+    int bucket = 0;
+    double bound = 1;
+    while (bucket < stats_histogram_buckets - 1 && latency_us > bound) {
+        bound *= 2;
+        bucket++;
+    }
+    stats->write_histogram[bucket]++;
+    stats->writes++;
+    stats->write_time_us += latency_us;
+}
+
+/** @brief Moves the write latencies counted elsewhere (by a writer thread) into a transfer's counters
+ *
+ *  @param stats Counters
+ *  @param writes Counters only the write latencies of are used, cleared
+ *  @return void
+ */
+void stats_merge_writes(struct rudp_stats *stats, struct rudp_stats *writes) {
+    for (int i = 0; i < stats_histogram_buckets; i++) {
+        stats->write_histogram[i] += writes->write_histogram[i];
+        writes->write_histogram[i] = 0;
+    }
+    stats->writes += writes->writes;
+    stats->write_time_us += writes->write_time_us;
+    writes->writes = 0;
+    writes->write_time_us = 0;
+}
+
+/// Upper bound of a histogram bucket in microseconds
+static double bucket_bound_us(int bucket) {
+    return (double)(1ULL << bucket);
+}
+
+/// Approximate write latency percentile: the upper bound of the bucket it falls in
+static double write_percentile_us(const struct rudp_stats *stats, double p) {
+    unsigned long long seen = 0;
+    for (int i = 0; i < stats_histogram_buckets; i++) {
+        seen += stats->write_histogram[i];
+        if (seen > 0 && seen >= p * stats->writes) {
+            return bucket_bound_us(i);
+        }
+    }
+    return 0;
+}
+
+/** @brief Writes the counters as one JSON object
+ *
+ *  @param stats Counters
+ *  @param label Names the transfer, escaped already
+ *  @param out Where to write
+ *  @return void
+ */
+void stats_dump_json(const struct rudp_stats *stats, const char *label, FILE *out) {
+    fprintf(out, "{\"role\":\"%s\",\"transfer\":\"%s\",\"elapsed_s\":%.6f,\"bytes\":%llu,\"total_bytes\":%llu,"
+                 "\"packets_sent\":%llu,\"retransmits\":%llu,\"nacks\":%llu,\"timeouts\":%llu,"
+                 "\"srtt_us\":%.1f,\"rttvar_us\":%.1f,\"send_delay_us\":%.0f,\"window\":%llu,"
+                 "\"packets_received\":%llu,\"duplicates\":%llu,\"out_of_order\":%llu,\"reordered\":%llu,\"sparse_bytes\":%llu,\"rejected\":%llu,\"socket_drops\":%llu,"
+                 "\"writes\":%llu,\"write_time_us\":%.1f,\"write_latency_us\":{",
+            stats->role, label, stats_now() - stats->start_time, stats->bytes, stats->total_bytes,
+            stats->packets_sent, stats->retransmits, stats->nacks, stats->timeouts,
+            stats->srtt_us, stats->rttvar_us, stats->send_delay_us, stats->window,
+            stats->packets_received, stats->duplicates, stats->out_of_order, stats->reordered, stats->sparse_bytes, stats->rejected, stats->socket_drops,
+            stats->writes, stats->write_time_us);
+
+    for (int i = 0; i < stats_histogram_buckets; i++) {
+        if (i < stats_histogram_buckets - 1) {
+            fprintf(out, "%s\"le_%.0f\":%llu", i ? "," : "", bucket_bound_us(i), stats->write_histogram[i]);
+        } else {
+            fprintf(out, ",\"inf\":%llu", stats->write_histogram[i]);
+        }
+    }
+    fprintf(out, "}}\n");
+}
+
+/** @brief Writes the counters in the Prometheus text format
+ *
+ *  @param stats Counters
+ *  @param label Names the transfer, escaped already; every sample is labelled with it and the role
+ *  @param out Where to write
+ *  @return void
+ */
+void stats_dump_prometheus(const struct rudp_stats *stats, const char *label, FILE *out) {
+    char labels[stats_label_size + 64];
+    snprintf(labels, sizeof(labels), "role=\"%s\",transfer=\"%s\"", stats->role, label);
+
+    fprintf(out, "# TYPE rudp_bytes_total counter\nrudp_bytes_total{%s} %llu\n", labels, stats->bytes);
+    fprintf(out, "# TYPE rudp_transfer_bytes gauge\nrudp_transfer_bytes{%s} %llu\n", labels, stats->total_bytes);
+    fprintf(out, "# TYPE rudp_elapsed_seconds gauge\nrudp_elapsed_seconds{%s} %.6f\n", labels, stats_now() - stats->start_time);
+    fprintf(out, "# TYPE rudp_packets_sent_total counter\nrudp_packets_sent_total{%s} %llu\n", labels, stats->packets_sent);
+    fprintf(out, "# TYPE rudp_retransmits_total counter\nrudp_retransmits_total{%s} %llu\n", labels, stats->retransmits);
+    fprintf(out, "# TYPE rudp_nacks_total counter\nrudp_nacks_total{%s} %llu\n", labels, stats->nacks);
+    fprintf(out, "# TYPE rudp_timeouts_total counter\nrudp_timeouts_total{%s} %llu\n", labels, stats->timeouts);
+    fprintf(out, "# TYPE rudp_srtt_seconds gauge\nrudp_srtt_seconds{%s} %.9f\n", labels, stats->srtt_us / 1000000);
+    fprintf(out, "# TYPE rudp_rttvar_seconds gauge\nrudp_rttvar_seconds{%s} %.9f\n", labels, stats->rttvar_us / 1000000);
+    fprintf(out, "# TYPE rudp_send_delay_seconds gauge\nrudp_send_delay_seconds{%s} %.9f\n", labels, stats->send_delay_us / 1000000);
+    fprintf(out, "# TYPE rudp_window_packets gauge\nrudp_window_packets{%s} %llu\n", labels, stats->window);
+    fprintf(out, "# TYPE rudp_packets_received_total counter\nrudp_packets_received_total{%s} %llu\n", labels, stats->packets_received);
+    fprintf(out, "# TYPE rudp_duplicates_total counter\nrudp_duplicates_total{%s} %llu\n", labels, stats->duplicates);
+    fprintf(out, "# TYPE rudp_out_of_order_total counter\nrudp_out_of_order_total{%s} %llu\n", labels, stats->out_of_order);
+    fprintf(out, "# TYPE rudp_reordered_total counter\nrudp_reordered_total{%s} %llu\n", labels, stats->reordered);
+    fprintf(out, "# TYPE rudp_sparse_bytes_total counter\nrudp_sparse_bytes_total{%s} %llu\n", labels, stats->sparse_bytes);
+    fprintf(out, "# TYPE rudp_rejected_total counter\nrudp_rejected_total{%s} %llu\n", labels, stats->rejected);
+    fprintf(out, "# TYPE rudp_socket_drops_total counter\nrudp_socket_drops_total{%s} %llu\n", labels, stats->socket_drops);
+
+    /// Prometheus histogram buckets are cumulative
+    fprintf(out, "# TYPE rudp_write_latency_seconds histogram\n");
+    unsigned long long cumulative = 0;
+    for (int i = 0; i < stats_histogram_buckets; i++) {
+        cumulative += stats->write_histogram[i];
+        if (i < stats_histogram_buckets - 1) {
+            fprintf(out, "rudp_write_latency_seconds_bucket{%s,le=\"%g\"} %llu\n", labels, bucket_bound_us(i) / 1000000, cumulative);
+        } else {
+            fprintf(out, "rudp_write_latency_seconds_bucket{%s,le=\"+Inf\"} %llu\n", labels, cumulative);
+        }
+    }
+    fprintf(out, "rudp_write_latency_seconds_sum{%s} %.9f\n", labels, stats->write_time_us / 1000000);
+    fprintf(out, "rudp_write_latency_seconds_count{%s} %llu\n", labels, stats->writes);
+}
+
+/** @brief Rewrites the metrics file, atomically so readers never see half of it
+ *
+ *  @param stats Counters
+ *  @param sink Where they go
+ *  @return void
+ */
+static void write_metrics_file(const struct rudp_stats *stats, const struct stats_sink *sink) {
+    if (sink->path == NULL || sink->listen_fd >= 0) {
+        return;
+    }
+
+    char temp_path[4096];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", sink->path);
+    FILE *out = fopen(temp_path, "w");
+    if (out == NULL) {
+        return;
+    }
+
+    size_t length = strlen(sink->path);
+    if (length >= 5 && strcmp(sink->path + length - 5, ".json") == 0) {
+        stats_dump_json(stats, sink->label, out);
+    } else {
+        stats_dump_prometheus(stats, sink->label, out);
+    }
+    fclose(out);
+    rename(temp_path, sink->path);
+}
+
+/** @brief Answers everyone waiting on the metrics Unix socket
+ *
+ *  A client gets what fits its socket buffer right away (all of it, unless it never reads) and is
+ *  closed: neither a slow nor a vanished client can block the transfer or raise SIGPIPE.
+ *
+ *  @param stats Counters
+ *  @param sink Where they go
+ *  @return void
+ */
+static void serve_metrics(const struct rudp_stats *stats, const struct stats_sink *sink) {
+    int client;
+    while ((client = accept4(sink->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        char *text = NULL;
+        size_t length = 0;
+        FILE *out = open_memstream(&text, &length);
+        if (out != NULL) {
+            stats_dump_prometheus(stats, sink->label, out);
+            fclose(out);
+            ssize_t sent = send(client, text, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+            (void)sent;
+            free(text);
+        }
+        close(client);
+    }
+}
+
+/// Appends to a line, cutting it short if it does not fit
+static void append(char *line, size_t size, const char *format, ...) {
+    size_t used = strlen(line);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line + used, size - used, format, args);
+    va_end(args);
+}
+
+/** @brief Formats the one line progress report, for the programs to print
+ *
+ *  @param stats Counters
+ *  @param final Whether the transfer is over
+ *  @param line Set to the report, without a newline
+ *  @param size Room for it
+ *  @return line
+ */
+const char *stats_format(const struct rudp_stats *stats, int final, char *line, size_t size) {
+    double elapsed = stats_now() - stats->start_time;
+    double rate = elapsed > 0 ? stats->bytes * 8 / elapsed / 1000000 : 0;
+
+    line[0] = 0;
+    append(line, size, "[%s%s] %.2f MB", stats->role, final ? " done" : "", stats->bytes / 1000000.0);
+    if (stats->total_bytes > 0) {
+        append(line, size, " / %.2f MB (%.0f%%)", stats->total_bytes / 1000000.0, 100.0 * stats->bytes / stats->total_bytes);
+    }
+    append(line, size, " %.3f Mbit/s", rate);
+
+    if (stats->packets_sent > 0) {
+        append(line, size, " sent %llu retx %llu nack %llu timeouts %llu srtt %.3fms delay %.0fus",
+               stats->packets_sent, stats->retransmits, stats->nacks, stats->timeouts, stats->srtt_us / 1000, stats->send_delay_us);
+    }
+    if (stats->packets_received > 0) {
+        append(line, size, " recv %llu dup %llu ooo %llu write p50 %.0fus p99 %.0fus",
+               stats->packets_received, stats->duplicates, stats->out_of_order,
+               write_percentile_us(stats, 0.5), write_percentile_us(stats, 0.99));
+    }
+    if (stats->reordered > 0) {
+        append(line, size, " reordered %llu", stats->reordered);
+    }
+    if (stats->sparse_bytes > 0) {
+        append(line, size, " sparse %.2f MB", stats->sparse_bytes / 1000000.0);
+    }
+    if (stats->rejected > 0) {
+        append(line, size, " rejected %llu", stats->rejected);
+    }
+    if (stats->socket_drops > 0) {
+        append(line, size, " kernel drops %llu", stats->socket_drops);
+    }
+    return line;
+}
+
+/** @brief Called from the transfer loops, updates the metrics when an interval has passed
+ *
+ *  Cheap enough to call for every packet: it only reads the clock unless something is due.
+ *
+ *  @param stats Counters
+ *  @param sink Where they go
+ *  @return void
+ */
+void stats_tick(struct rudp_stats *stats, struct stats_sink *sink) {
+    if (sink->path == NULL) {
+        return;
+    }
+
+    double now = stats_now();
+    if (sink->listen_fd >= 0 && now - sink->last_poll >= stats_poll_interval) {
+        sink->last_poll = now;
+        serve_metrics(stats, sink);
+    }
+    if (now - sink->last_report >= sink->interval) {
+        sink->last_report = now;
+        write_metrics_file(stats, sink);
+    }
+}
+
+/** @brief Final metrics once the transfer is over
+ *
+ *  @param stats Counters
+ *  @param sink Where they go
+ *  @return void
+ */
+void stats_finish(struct rudp_stats *stats, struct stats_sink *sink) {
+    write_metrics_file(stats, sink);
+    if (sink->listen_fd >= 0) {
+        serve_metrics(stats, sink);
+    }
+}
@@ -0,0 +1,80 @@
+/** @file stats.h
+ *
+ *  @brief Transfer counters with a progress line and a metrics dump.
+ *
+ *  Every session keeps one rudp_stats per transfer and calls stats_tick() from its callbacks.
+ *  A session given a metrics path has a stats_sink of its own: every interval the metrics are
+ *  written to that file (JSON if the name ends in .json, Prometheus text otherwise), and a path of
+ *  the form unix:/some/path serves the Prometheus text to anyone connecting to that Unix socket.
+ *  Each transfer's metrics carry its label, so several transfers can be told apart (and scraped)
+ *  side by side. stats_format() makes the one line progress report; printing it is up to the
+ *  program, the library never does.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+#define stats_histogram_buckets 22 /// Write latency buckets: <= 1us, 2us, 4us ... 2^20us (~1s), then everything slower
+#define stats_label_size 128 /// Room for a transfer's label once escaped
+#define stats_socket_path_size 108 /// sun_path of a struct sockaddr_un
+
+/// Counters of one transfer
+struct rudp_stats {
+    const char *role; /// "sender" or "receiver"
+    double start_time;
+    unsigned long long total_bytes; /// Bytes the sender was asked to send (0 if unknown)
+    unsigned long long bytes; /// Payload bytes acknowledged (sender) or written (receiver)
+
+    /// Sender side
+    unsigned long long packets_sent; /// Every sendto() of a data, delta or signature packet
+    unsigned long long retransmits; /// Sends of a packet that had been sent before
+    unsigned long long nacks; /// Negative or stale acks received
+    unsigned long long timeouts; /// recvfrom() timed out waiting for an ack
+    double srtt_us; /// Smoothed round trip time (RFC 6298), from packets that were not retransmitted
+    double rttvar_us;
+    double send_delay_us; /// The AIMD delay between packets, our stand-in for a congestion window
+    unsigned long long window; /// Packets allowed in flight
+
+    /// Receiver side
+    unsigned long long packets_received;
+    unsigned long long duplicates; /// Retransmissions of packets already written
+    unsigned long long out_of_order; /// Packets nacked because they were not the next index (nor within the reorder window)
+    unsigned long long reordered; /// Packets that arrived ahead of the next index and waited for it in the reorder buffer
+    unsigned long long sparse_bytes; /// Bytes that went as zero ranges (holes) instead of payloads (either side)
+    unsigned long long rejected; /// Datagrams dropped because they failed authentication or were replays (either side)
+    unsigned long long socket_drops; /// Datagrams the kernel dropped before we could read them (socket buffer or AF_XDP ring full)
+    unsigned long long write_histogram[stats_histogram_buckets];
+    unsigned long long writes;
+    double write_time_us; /// Sum of all write latencies
+};
+
+/// Where one transfer's metrics go
+struct stats_sink {
+    const char *path; /// Metrics file, NULL for none
+    double interval; /// Seconds between metrics file updates
+    int listen_fd; /// Unix socket serving the metrics, -1 for none
+    char socket_path[stats_socket_path_size]; /// Where that socket was bound, removed again on close; empty for none
+    char label[stats_label_size]; /// Names the transfer in the metrics, escaped for JSON and Prometheus
+    double last_report;
+    double last_poll;
+};
+
+int stats_sink_open(struct stats_sink *sink, const char *path, int interval_ms, const char *label);
+void stats_sink_close(struct stats_sink *sink);
+double stats_now(void);
+void stats_init(struct rudp_stats *stats, const char *role, unsigned long long total_bytes);
+void stats_rtt_sample(struct rudp_stats *stats, double rtt_us);
+void stats_write_latency(struct rudp_stats *stats, double latency_us);
+void stats_merge_writes(struct rudp_stats *stats, struct rudp_stats *writes);
+void stats_tick(struct rudp_stats *stats, struct stats_sink *sink);
+void stats_finish(struct rudp_stats *stats, struct stats_sink *sink);
+const char *stats_format(const struct rudp_stats *stats, int final, char *line, size_t size);
+void stats_dump_json(const struct rudp_stats *stats, const char *label, FILE *out);
+void stats_dump_prometheus(const struct rudp_stats *stats, const char *label, FILE *out);
+
+#endif
@@ -0,0 +1,127 @@
+/** @file trace.c
+ *
+ *  @brief Ring buffer registry and trace file writer (only built into the programs with `make TRACE=1`).
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#include "trace.h"
+
+#ifdef RUDP_TRACE
+
+/*   Includes   */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+
+__thread struct trace_ring *trace_self = NULL;
+
+/// Every ring ever created, pushed lock free so new threads never wait on each other
+static struct trace_ring *rings = NULL;
+static uint16_t next_thread = 0;
+
+/// Set up by trace_init()
+static char trace_role[16];
+static uint64_t start_tsc;
+static struct timespec start_time;
+
+
+/// Nanoseconds between two timespecs
+static double elapsed_ns(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1e9 + (to->tv_nsec - from->tv_nsec);
+}
+
+/** @brief Starts the clock of the trace
+ *
+ *  @param role "sender" or "receiver", stored in the file and used in the default file name
+ *  @return void
+ */
+void trace_init(const char *role) {
+    strncpy(trace_role, role, sizeof(trace_role) - 1);
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    start_tsc = trace_clock();
+}
+
+/** @brief Gives the calling thread its ring, on its first event
+ *
+ *  @return The ring, NULL if memory ran out
+ */
+struct trace_ring *trace_ring_create(void) {
+    struct trace_ring *ring = calloc(1, sizeof(struct trace_ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->events = malloc(trace_ring_size * sizeof(struct trace_record));
+    if (ring->events == NULL) {
+        free(ring);
+        return NULL;
+    }
+    ring->thread = __atomic_fetch_add(&next_thread, 1, __ATOMIC_RELAXED);
+
+    ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+
+    trace_self = ring;
+    return ring;
+}
+
+/** @brief Writes every ring to the trace file
+ *
+ *  Meant for the end of a transfer: events recorded while the dump runs may or may not make it in.
+ *
+ *  @return 0 on success, -1 with errno set if the file could not be opened
+ */
+int trace_dump(void) {
+    char default_path[64];
+    const char *path = getenv("RUDP_TRACE_FILE");
+    if (path == NULL) {
+        snprintf(default_path, sizeof(default_path), "rudp-%s-%d.trace", trace_role, (int)getpid());
+        path = default_path;
+    }
+
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) {
+        return -1;
+    }
+
+    /// Calibrate the TSC against the monotonic clock over the whole run
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    uint64_t end_tsc = trace_clock();
+    double ns = elapsed_ns(&start_time, &end_time);
+
+    struct trace_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, trace_magic, sizeof(header.magic));
+    memcpy(header.role, trace_role, sizeof(header.role));
+    header.ticks_per_us = ns > 0 ? (end_tsc - start_tsc) / (ns / 1000) : 1;
+    header.start_tsc = start_tsc;
+
+    struct trace_ring *first = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    for (struct trace_ring *ring = first; ring != NULL; ring = ring->next) {
+        header.rings++;
+    }
+    fwrite(&header, sizeof(header), 1, out);
+
+    for (struct trace_ring *ring = first; ring != NULL; ring = ring->next) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t count = head < trace_ring_size ? head : trace_ring_size;
+
+        struct trace_ring_header ring_header = { ring->thread, (uint32_t)count };
+        fwrite(&ring_header, sizeof(ring_header), 1, out);
+
+        /// Oldest first: the ring may have wrapped around
+        for (uint64_t i = head - count; i < head; i++) {
+            fwrite(&ring->events[i & (trace_ring_size - 1)], sizeof(struct trace_record), 1, out);
+        }
+    }
+    fclose(out);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,128 @@
+/** @file trace.h
+ *
+ *  @brief Per packet event trace, compiled in with `make TRACE=1`.
+ *
+ *  Every thread records its events into its own ring buffer with a TSC timestamp, so the hot
+ *  loop never takes a lock or makes a system call to trace. The rings are written to a binary
+ *  file when the transfer ends (RUDP_TRACE_FILE, default rudp-<role>-<pid>.trace), and
+ *  trace2json turns that file into the Chrome trace format (chrome://tracing, Perfetto).
+ *  Without TRACE=1 every trace_ call compiles to nothing.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*   Event Types   */
+#define trace_send 1 /// Sender: first transmission of a packet (arg = length)
+#define trace_retransmit 2 /// Sender: packet sent again (arg = length)
+#define trace_ack 3 /// Sender: matching ack received (arg = send delay in us)
+#define trace_nack 4 /// Sender: nack or stale ack received (arg = send delay in us)
+#define trace_timeout 5 /// Sender: no ack before the timeout (arg = send delay in us)
+#define trace_recv 6 /// Receiver: packet received (arg = length)
+#define trace_write 7 /// Receiver: payload written, or a chunk by the disk writer (index = chunk in the file), arg = write latency in ns
+#define trace_ack_sent 8 /// Receiver: ack sent
+#define trace_nack_sent 9 /// Receiver: nack sent (index = the index expected)
+#define trace_fin 10 /// Either side: FIN sent or received
+
+/*   File Format   */
+#define trace_magic "RUDPTRC1"
+#define trace_ring_size (1 << 20) /// Events kept per thread, older ones are overwritten
+
+/// One recorded event, 24 bytes
+struct trace_record {
+    uint64_t tsc;
+    uint32_t index;
+    uint32_t arg;
+    uint16_t type;
+    uint16_t thread;
+    uint32_t reserved;
+};
+
+/// Start of a trace file, followed by rings: a trace_ring_header and then its events oldest first
+struct trace_file_header {
+    char magic[8];
+    char role[16];
+    double ticks_per_us; /// Converts tsc values to time
+    uint64_t start_tsc; /// Timestamp of trace_init(), time zero in the converted trace
+    uint32_t rings;
+    uint32_t reserved;
+};
+
+struct trace_ring_header {
+    uint32_t thread;
+    uint32_t count;
+};
+
+#ifdef RUDP_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/// A thread's ring buffer; only its own thread writes to it
+struct trace_ring {
+    struct trace_record *events;
+    uint64_t head; /// Number of events ever recorded, published with release ordering
+    uint16_t thread;
+    struct trace_ring *next;
+};
+
+extern __thread struct trace_ring *trace_self;
+
+void trace_init(const char *role);
+struct trace_ring *trace_ring_create(void);
+int trace_dump(void);
+
+/// Timestamp counter, or nanoseconds where there is no TSC
+static inline uint64_t trace_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/** @brief Records one event in the calling thread's ring
+ *
+ *  @param type One of the trace_ event types
+ *  @param index Packet index
+ *  @param arg Meaning depends on the type
+ *  @return void
+ */
+static inline void trace_event(uint16_t type, uint32_t index, uint32_t arg) {
+    struct trace_ring *ring = trace_self;
+    if (ring == NULL) {
+        ring = trace_ring_create();
+        if (ring == NULL) {
+            return;
+        }
+    }
+
+    uint64_t head = ring->head;
+    struct trace_record *record = &ring->events[head & (trace_ring_size - 1)];
+    record->tsc = trace_clock();
+    record->index = index;
+    record->arg = arg;
+    record->type = type;
+    record->thread = ring->thread;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#else
+
+#define trace_init(role) ((void)0)
+#define trace_event(type, index, arg) ((void)0)
+#define trace_dump() (0)
+
+#endif
+
+#endif
@@ -0,0 +1,119 @@
+/** @file trace2json.c
+ *
+ *  @brief Converts a binary trace (see trace.h) into the Chrome trace event format.
+ *
+ *  The output loads in chrome://tracing or ui.perfetto.dev: one instant event per packet event,
+ *  disk writes as slices, and the sender's send delay as a counter track so the AIMD reaction
+ *  to losses is visible next to the retransmissions. Several trace files (sender and receiver)
+ *  can be merged into one view since every file starts at its own time zero.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+
+/// Name shown for each event type
+static const char* event_name(uint16_t type) {
+    switch (type) {
+        case trace_send: return "send";
+        case trace_retransmit: return "retransmit";
+        case trace_ack: return "ack";
+        case trace_nack: return "nack";
+        case trace_timeout: return "timeout";
+        case trace_recv: return "recv";
+        case trace_write: return "write";
+        case trace_ack_sent: return "ack_sent";
+        case trace_nack_sent: return "nack_sent";
+        case trace_fin: return "fin";
+        default: return "unknown";
+    }
+}
+
+/** @brief Converts one trace file, appending its events to the JSON array
+ *
+ *  @param path The binary trace
+ *  @param pid Process id to show the file's events under
+ *  @param first Set to 0 once an event has been written (for the commas)
+ *  @return 0 on success, -1 if the file could not be read
+ */
+static int convert(const char* path, int pid, int* first) {
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    struct trace_file_header header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, trace_magic, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s: not a trace file\n", path);
+        fclose(in);
+        return -1;
+    }
+    header.role[sizeof(header.role) - 1] = '\0';
+
+    printf("%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}", *first ? "" : ",\n", pid, header.role);
+    *first = 0;
+
+    for (uint32_t r = 0; r < header.rings; r++) {
+        struct trace_ring_header ring;
+        if (fread(&ring, sizeof(ring), 1, in) != 1) {
+            break;
+        }
+
+        for (uint32_t i = 0; i < ring.count; i++) {
+            struct trace_record record;
+            if (fread(&record, sizeof(record), 1, in) != 1) {
+                break;
+            }
+            double ts = (double)(int64_t)(record.tsc - header.start_tsc) / header.ticks_per_us;
+
+            if (record.type == trace_write) {
+                /// Writes become slices ending when the event was recorded
+                double duration = record.arg / 1000.0;
+                printf(",\n{\"name\":\"write\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"index\":%u}}",
+                       pid, record.thread, ts - duration, duration, record.index);
+                continue;
+            }
+
+            printf(",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"args\":{\"index\":%u,\"arg\":%u}}",
+                   event_name(record.type), pid, record.thread, ts, record.index, record.arg);
+
+            if (record.type == trace_ack || record.type == trace_nack || record.type == trace_timeout) {
+                printf(",\n{\"name\":\"send_delay_us\",\"ph\":\"C\",\"pid\":%d,\"ts\":%.3f,\"args\":{\"delay\":%u}}", pid, ts, record.arg);
+            }
+        }
+    }
+
+    fclose(in);
+    return 0;
+}
+
+/** @brief Converts the trace files given on the command line to one Chrome trace on stdout
+ *
+ * @return 0 on success, 1 if a file could not be converted
+ */
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s file.trace [more.trace ...] > trace.json\n\n", argv[0]);
+        exit(1);
+    }
+
+    int first = 1;
+    int status = 0;
+    printf("[\n");
+    for (int i = 1; i < argc; i++) {
+        if (convert(argv[i], i, &first) < 0) {
+            status = 1;
+        }
+    }
+    printf("\n]\n");
+    return status;
+}
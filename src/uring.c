@@ -0,0 +1,330 @@
+/** @file uring.c
+ *
+ *  @brief io_uring set up, submission and completion on the raw system calls.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+
+/// The kernel and we share the ring indices, these keep both sides' view ordered
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+/** @brief Creates a ring and maps its queues
+ *
+ *  @param ring The ring to set up
+ *  @param entries Size of the submission queue (the completion queue gets twice as many)
+ *  @return 0 on success, -1 if io_uring is missing or not allowed
+ */
+int uring_init(struct uring *ring, unsigned entries) {
+    memset(ring, 0, sizeof(*ring));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    /// Both rings live in one mapping on every kernel we can use (IORING_FEAT_SINGLE_MMAP, 5.4)
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(ring->fd);
+        return -1;
+    }
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    ring->cq_ring = ring->sq_ring;
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        return -1;
+    }
+
+    uint8_t *sq = ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sqe_head = ring->sqe_tail = *ring->sq_tail;
+
+    uint8_t *cq = ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/** @brief Unmaps the queues and closes the ring (registered files and buffers go with it)
+ *
+ *  @param ring The ring
+ *  @return void
+ */
+void uring_close(struct uring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+/** @brief Hands out the next free submission queue entry, cleared
+ *
+ *  Submits what is queued first if the queue is full.
+ *
+ *  @param ring The ring
+ *  @return The entry to fill in, NULL if the queue stays full
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+    if (ring->sqe_tail - load_acquire(ring->sq_head) > ring->sq_mask) {
+        if (uring_submit(ring, 0) < 0 || ring->sqe_tail - load_acquire(ring->sq_head) > ring->sq_mask) {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/** @brief Passes the queued entries to the kernel in one system call
+ *
+ *  @param ring The ring
+ *  @param wait Number of completions to wait for, 0 to return right away
+ *  @return Number of entries submitted, -1 on error
+ */
+int uring_submit(struct uring *ring, unsigned wait) {
+    unsigned tail = *ring->sq_tail;
+    unsigned count = ring->sqe_tail - ring->sqe_head;
+    for (unsigned i = 0; i < count; i++) {
+        ring->sq_array[tail & ring->sq_mask] = (ring->sqe_head + i) & ring->sq_mask;
+        tail++;
+    }
+    ring->sqe_head = ring->sqe_tail;
+    store_release(ring->sq_tail, tail);
+
+    if (count == 0 && wait == 0) {
+        return 0;
+    }
+
+    int submitted;
+    do {
+        submitted = syscall(__NR_io_uring_enter, ring->fd, count, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (submitted < 0 && errno == EINTR);
+    if (submitted < 0) {
+        return -1;
+    }
+    return submitted;
+}
+
+/** @brief Looks at the oldest completion without consuming it
+ *
+ *  @param ring The ring
+ *  @return The completion, NULL if there is none
+ */
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == load_acquire(ring->cq_tail)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+/** @brief Consumes the completion uring_peek_cqe() returned
+ *
+ *  @param ring The ring
+ *  @return void
+ */
+void uring_cqe_seen(struct uring *ring) {
+    store_release(ring->cq_head, *ring->cq_head + 1);
+}
+
+/** @brief Registers descriptors so entries can name them by slot (IOSQE_FIXED_FILE)
+ *
+ *  @param ring The ring
+ *  @param fds The descriptors
+ *  @param count Number of descriptors
+ *  @return 0 on success, -1 on error
+ */
+int uring_register_files(struct uring *ring, const int *fds, unsigned count) {
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, fds, count) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/** @brief Registers buffers for READ_FIXED and WRITE_FIXED, pinning them once instead of per request
+ *
+ *  @param ring The ring
+ *  @param buffers The buffers
+ *  @param count Number of buffers
+ *  @return 0 on success, -1 on error
+ */
+int uring_register_buffers(struct uring *ring, const struct iovec *buffers, unsigned count) {
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, buffers, count) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/** @brief Sets up a provided buffer ring and hands all of its buffers to the kernel
+ *
+ *  @param ring The ring
+ *  @param buffers The buffer ring to set up
+ *  @param group Buffer group id the requests select from
+ *  @param entries Number of buffers, a power of two
+ *  @param buffer_size Size of each buffer
+ *  @return 0 on success, -1 on error
+ */
+int uring_buf_ring_init(struct uring *ring, struct uring_buf_ring *buffers, uint16_t group, unsigned entries, size_t buffer_size) {
+    memset(buffers, 0, sizeof(*buffers));
+    buffers->ring_size = entries * sizeof(struct io_uring_buf);
+    buffers->ring = mmap(NULL, buffers->ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers->ring == MAP_FAILED) {
+        return -1;
+    }
+    buffers->buffers = malloc(entries * buffer_size);
+    if (buffers->buffers == NULL) {
+        munmap(buffers->ring, buffers->ring_size);
+        return -1;
+    }
+    buffers->buffer_size = buffer_size;
+    buffers->entries = entries;
+    buffers->group = group;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)buffers->ring;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        uring_buf_ring_free(buffers);
+        return -1;
+    }
+
+    for (unsigned id = 0; id < entries; id++) {
+        uring_buf_ring_recycle(buffers, id);
+    }
+    return 0;
+}
+
+/** @brief Gives a buffer back to the kernel once its contents were used
+ *
+ *  @param buffers The buffer ring
+ *  @param id Buffer id from the completion
+ *  @return void
+ */
+void uring_buf_ring_recycle(struct uring_buf_ring *buffers, uint16_t id) {
+    uint16_t tail = buffers->ring->tail;
+    struct io_uring_buf *buf = &buffers->ring->bufs[tail & (buffers->entries - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(buffers->buffers + (size_t)id * buffers->buffer_size);
+    buf->len = buffers->buffer_size;
+    buf->bid = id;
+    store_release(&buffers->ring->tail, (uint16_t)(tail + 1));
+}
+
+/** @brief Frees a buffer ring (unregistered when its io_uring is closed)
+ *
+ *  @param buffers The buffer ring
+ *  @return void
+ */
+void uring_buf_ring_free(struct uring_buf_ring *buffers) {
+    munmap(buffers->ring, buffers->ring_size);
+    free(buffers->buffers);
+    buffers->ring = NULL;
+    buffers->buffers = NULL;
+}
+
+/** @brief Fills in a multishot recvmsg: one request that completes once per datagram until it is cancelled or runs out of buffers
+ *
+ *  @param sqe The entry
+ *  @param file_slot Registered file slot of the socket
+ *  @param msg Only msg_namelen and msg_controllen are used, it must stay valid while the request lives
+ *  @param group Buffer group to take the buffers from
+ *  @return void
+ */
+void uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe, unsigned file_slot, struct msghdr *msg, uint16_t group) {
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = file_slot;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = group;
+}
+
+/** @brief Finds the datagram and the sender address inside the buffer of a multishot recvmsg completion
+ *
+ *  @param buffers The buffer ring the request selected from
+ *  @param cqe The completion
+ *  @param msg The msghdr the request was prepared with
+ *  @param payload Set to the datagram
+ *  @param length Set to its length
+ *  @param name Set to the sender address
+ *  @return The buffer id to recycle once the datagram is used, -1 if the completion carries no datagram
+ */
+int uring_recvmsg_payload(struct uring_buf_ring *buffers, const struct io_uring_cqe *cqe, const struct msghdr *msg,
+                          uint8_t **payload, size_t *length, struct sockaddr **name) {
+    if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+        return -1;
+    }
+    int id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (cqe->res < 0) {
+        return id;
+    }
+
+    /// Layout of the buffer: io_uring_recvmsg_out, the address, the control data, the payload
+    uint8_t *buffer = buffers->buffers + (size_t)id * buffers->buffer_size;
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buffer;
+    *name = (struct sockaddr *)(buffer + sizeof(*out));
+    *payload = buffer + sizeof(*out) + msg->msg_namelen + msg->msg_controllen;
+    *length = out->payloadlen;
+    size_t room = buffers->buffer_size - sizeof(*out) - msg->msg_namelen - msg->msg_controllen;
+    if (*length > room) {
+        *length = room;
+    }
+    return id;
+}
+
+/** @brief Points a message header at the control data multishot recvmsg stored in a buffer
+ *
+ *  @param buffers The buffer group
+ *  @param cqe A completion uring_recvmsg_payload() returned a buffer for
+ *  @param msg The msghdr the recvmsg was queued with
+ *  @param control Gets msg_control and msg_controllen set, for CMSG_FIRSTHDR()
+ *  @return void
+ */
+void uring_recvmsg_control(struct uring_buf_ring *buffers, const struct io_uring_cqe *cqe, const struct msghdr *msg,
+                           struct msghdr *control) {
+    uint8_t *buffer = buffers->buffers + (size_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) * buffers->buffer_size;
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buffer;
+    memset(control, 0, sizeof(*control));
+    if (msg->msg_controllen > 0 && out->controllen > 0) {
+        control->msg_control = buffer + sizeof(*out) + msg->msg_namelen;
+        control->msg_controllen = out->controllen;
+    }
+}
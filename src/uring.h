@@ -0,0 +1,76 @@
+/** @file uring.h
+ *
+ *  @brief Minimal io_uring wrapper on the raw system calls (no liburing needed).
+ *
+ *  Covers what the sender and receiver use: a submission and a completion queue, registered
+ *  files and buffers, and a provided buffer ring that multishot recvmsg picks its buffers from.
+ *  The ring descriptor is readable whenever completions are waiting, so it plugs into the
+ *  epoll event loop like a socket. Needs Linux 6.0 or later for multishot recvmsg; anything
+ *  older makes uring_init() fail and the programs keep using plain system calls.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/// A ring and the mappings of its queues
+struct uring {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail; /// Entries handed out by uring_get_sqe(), published by uring_submit()
+    unsigned sqe_head;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+/// Buffers the kernel picks from for IOSQE_BUFFER_SELECT reads (one group)
+struct uring_buf_ring {
+    struct io_uring_buf_ring *ring;
+    size_t ring_size;
+    uint8_t *buffers; /// entries buffers of buffer_size bytes each
+    size_t buffer_size;
+    unsigned entries;
+    uint16_t group;
+};
+
+int uring_init(struct uring *ring, unsigned entries);
+void uring_close(struct uring *ring);
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+int uring_submit(struct uring *ring, unsigned wait);
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+void uring_cqe_seen(struct uring *ring);
+
+int uring_register_files(struct uring *ring, const int *fds, unsigned count);
+int uring_register_buffers(struct uring *ring, const struct iovec *buffers, unsigned count);
+
+int uring_buf_ring_init(struct uring *ring, struct uring_buf_ring *buffers, uint16_t group, unsigned entries, size_t buffer_size);
+void uring_buf_ring_recycle(struct uring_buf_ring *buffers, uint16_t id);
+void uring_buf_ring_free(struct uring_buf_ring *buffers);
+
+void uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe, unsigned file_slot, struct msghdr *msg, uint16_t group);
+int uring_recvmsg_payload(struct uring_buf_ring *buffers, const struct io_uring_cqe *cqe, const struct msghdr *msg,
+                          uint8_t **payload, size_t *length, struct sockaddr **name);
+void uring_recvmsg_control(struct uring_buf_ring *buffers, const struct io_uring_cqe *cqe, const struct msghdr *msg,
+                           struct msghdr *control);
+
+#endif
@@ -0,0 +1,423 @@
+/** @file xdp.c
+ *
+ *  @brief XDP program, AF_XDP socket set up and the receive ring.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+
+/*   Includes   */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#include "xdp.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define xdp_ring_size 2048 /// Descriptors in the rx ring
+#define xdp_headers_size 42 /// Ethernet, IPv4 without options, UDP
+
+/// The kernel and we share the ring indices, these keep both sides' view ordered
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/*   BPF Instructions   */
+#define bpf_insn(c, d, s, o, i) ((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+#define bpf_load(size, dst, src, off) bpf_insn(BPF_LDX | BPF_MEM | (size), dst, src, off, 0)
+#define bpf_mov_imm(dst, imm) bpf_insn(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm)
+#define bpf_mov_reg(dst, src) bpf_insn(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0)
+#define bpf_add_imm(dst, imm) bpf_insn(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm)
+#define bpf_and_imm(dst, imm) bpf_insn(BPF_ALU64 | BPF_AND | BPF_K, dst, 0, 0, imm)
+#define bpf_jgt_reg(dst, src, off) bpf_insn(BPF_JMP | BPF_JGT | BPF_X, dst, src, off, 0)
+#define bpf_jne_imm(dst, imm, off) bpf_insn(BPF_JMP | BPF_JNE | BPF_K, dst, 0, off, imm)
+#define bpf_map_fd(dst, fd) bpf_insn(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd), bpf_insn(0, 0, 0, 0, 0)
+#define bpf_call(fn) bpf_insn(BPF_JMP | BPF_CALL, 0, 0, 0, fn)
+#define bpf_exit() bpf_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+
+/// bpf() has no glibc wrapper
+static int sys_bpf(int cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/** @brief Loads the program that steers our port into the XSKMAP
+ *
+ *  Equivalent C:
+ *      if (data + 42 > data_end) return XDP_PASS;
+ *      if (eth->h_proto != htons(ETH_P_IP) || ip->ihl_version != 0x45 || ip->protocol != IPPROTO_UDP) return XDP_PASS;
+ *      if (ip->frag_off & htons(0x3fff)) return XDP_PASS;
+ *      if (udp->dest != htons(port)) return XDP_PASS;
+ *      return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+ *
+ *  @param map_fd The XSKMAP
+ *  @param port Our UDP port
+ *  @return The program descriptor, -1 on error
+ */
+static int load_program(int map_fd, uint16_t port) {
+    struct bpf_insn program[] = {
+        bpf_load(BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data)),
+        bpf_load(BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end)),
+        bpf_mov_reg(BPF_REG_4, BPF_REG_2),
+        bpf_add_imm(BPF_REG_4, xdp_headers_size),
+        bpf_jgt_reg(BPF_REG_4, BPF_REG_3, 17),
+        bpf_load(BPF_H, BPF_REG_5, BPF_REG_2, 12),
+        bpf_jne_imm(BPF_REG_5, htons(ETH_P_IP), 15),
+        bpf_load(BPF_B, BPF_REG_5, BPF_REG_2, 14),
+        bpf_jne_imm(BPF_REG_5, 0x45, 13),
+        bpf_load(BPF_B, BPF_REG_5, BPF_REG_2, 23),
+        bpf_jne_imm(BPF_REG_5, IPPROTO_UDP, 11),
+        bpf_load(BPF_H, BPF_REG_5, BPF_REG_2, 20),
+        bpf_and_imm(BPF_REG_5, htons(0x3fff)),
+        bpf_jne_imm(BPF_REG_5, 0, 8),
+        bpf_load(BPF_H, BPF_REG_5, BPF_REG_2, 36),
+        bpf_jne_imm(BPF_REG_5, htons(port), 6),
+        bpf_load(BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, rx_queue_index)),
+        bpf_map_fd(BPF_REG_1, map_fd),
+        bpf_mov_imm(BPF_REG_3, XDP_PASS),
+        bpf_call(BPF_FUNC_redirect_map),
+        bpf_exit(),
+        /// pass:
+        bpf_mov_imm(BPF_REG_0, XDP_PASS),
+        bpf_exit(),
+    };
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(uintptr_t)program;
+    attr.insn_cnt = sizeof(program) / sizeof(program[0]);
+    attr.license = (uint64_t)(uintptr_t)"GPL";
+    strncpy(attr.prog_name, "rudp_steer", sizeof(attr.prog_name) - 1);
+
+    return sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+/** @brief Attaches the program to the interface, in the driver if it supports XDP, generic otherwise
+ *
+ *  @param xsk The socket, mode is set
+ *  @param ifindex The interface
+ *  @return The link descriptor, -1 on error
+ */
+static int attach_program(struct xdp_socket *xsk, int ifindex) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = xsk->prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+
+    attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+    xsk->mode = "native";
+    int fd = sys_bpf(BPF_LINK_CREATE, &attr);
+    if (fd < 0) {
+        attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+        xsk->mode = "generic";
+        fd = sys_bpf(BPF_LINK_CREATE, &attr);
+    }
+    return fd;
+}
+
+/** @brief Maps one of the socket's rings
+ *
+ *  @param fd The AF_XDP socket
+ *  @param ring The ring
+ *  @param offsets Where the ring's fields are in the mapping
+ *  @param entries Size of the ring
+ *  @param desc_size Size of one descriptor
+ *  @param pgoff Which ring to map
+ *  @return 0 on success, -1 on error
+ */
+static int map_ring(int fd, struct xdp_ring *ring, const struct xdp_ring_offset *offsets, uint32_t entries, size_t desc_size, off_t pgoff) {
+    ring->map_size = offsets->desc + entries * desc_size;
+    ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        return -1;
+    }
+    ring->producer = (uint32_t *)((uint8_t *)ring->map + offsets->producer);
+    ring->consumer = (uint32_t *)((uint8_t *)ring->map + offsets->consumer);
+    ring->descs = (uint8_t *)ring->map + offsets->desc;
+    ring->mask = entries - 1;
+    return 0;
+}
+
+/** @brief Gives a frame back to the kernel to receive into
+ *
+ *  @param xsk The socket
+ *  @param addr Address of the frame in the UMEM
+ *  @return void
+ */
+static void fill_frame(struct xdp_socket *xsk, uint64_t addr) {
+    uint32_t producer = *xsk->fill.producer;
+    ((uint64_t *)xsk->fill.descs)[producer & xsk->fill.mask] = addr & ~(uint64_t)(xdp_frame_size - 1);
+    store_release(xsk->fill.producer, producer + 1);
+}
+
+/** @brief Undoes a half done xdp_open() and says which step failed
+ *
+ *  @param xsk The socket, closed
+ *  @param step What failed, kept in xsk->failed
+ *  @return -1, with errno as the step left it
+ */
+static int open_failed(struct xdp_socket *xsk, const char *step) {
+    int saved_errno = errno;
+    xdp_close(xsk);
+    xsk->failed = step;
+    errno = saved_errno;
+    return -1;
+}
+
+/** @brief Sets up the AF_XDP socket on one queue of an interface and steers our port to it
+ *
+ *  @param xsk The socket to set up
+ *  @param ifname The interface
+ *  @param queue Its receive queue
+ *  @param port Our UDP port
+ *  @return 0 on success, -1 on error (nothing is left attached, xsk->failed and errno say what went wrong)
+ */
+int xdp_open(struct xdp_socket *xsk, const char *ifname, uint32_t queue, uint16_t port) {
+    memset(xsk, 0, sizeof(*xsk));
+    xsk->fd = xsk->map_fd = xsk->prog_fd = xsk->link_fd = -1;
+    xsk->queue = queue;
+
+    int ifindex = if_nametoindex(ifname);
+    if (ifindex == 0) {
+        xsk->failed = "if_nametoindex";
+        return -1;
+    }
+
+    xsk->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (xsk->fd < 0) {
+        return open_failed(xsk, "AF_XDP socket");
+    }
+
+    /// The UMEM: frames the kernel copies (or DMAs) packets into
+    xsk->umem_size = (size_t)xdp_frames * xdp_frame_size;
+    xsk->umem = mmap(NULL, xsk->umem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (xsk->umem == MAP_FAILED) {
+        xsk->umem = NULL;
+        return open_failed(xsk, "UMEM mmap");
+    }
+    struct xdp_umem_reg umem;
+    memset(&umem, 0, sizeof(umem));
+    umem.addr = (uint64_t)(uintptr_t)xsk->umem;
+    umem.len = xsk->umem_size;
+    umem.chunk_size = xdp_frame_size;
+
+    int fill_size = xdp_frames;
+    int completion_size = 64; /// Required by bind even though we never transmit
+    int rx_size = xdp_ring_size;
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &umem, sizeof(umem)) < 0 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &fill_size, sizeof(fill_size)) < 0 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &completion_size, sizeof(completion_size)) < 0 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &rx_size, sizeof(rx_size)) < 0) {
+        return open_failed(xsk, "AF_XDP setsockopt");
+    }
+
+    struct xdp_mmap_offsets offsets;
+    socklen_t length = sizeof(offsets);
+    if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &length) < 0 ||
+        map_ring(xsk->fd, &xsk->rx, &offsets.rx, rx_size, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) < 0 ||
+        map_ring(xsk->fd, &xsk->fill, &offsets.fr, fill_size, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) < 0) {
+        return open_failed(xsk, "mapping the rings");
+    }
+    for (uint32_t frame = 0; frame < xdp_frames; frame++) {
+        fill_frame(xsk, (uint64_t)frame * xdp_frame_size);
+    }
+
+    /// Zero copy when the driver can, copy mode otherwise (flags 0 lets the kernel pick)
+    struct sockaddr_xdp address;
+    memset(&address, 0, sizeof(address));
+    address.sxdp_family = AF_XDP;
+    address.sxdp_ifindex = ifindex;
+    address.sxdp_queue_id = queue;
+    if (bind(xsk->fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        return open_failed(xsk, "AF_XDP bind");
+    }
+
+    /// The map the program redirects through, with our socket at our queue
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = queue + 1;
+    xsk->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (xsk->map_fd < 0) {
+        return open_failed(xsk, "bpf map create");
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = xsk->map_fd;
+    attr.key = (uint64_t)(uintptr_t)&queue;
+    attr.value = (uint64_t)(uintptr_t)&xsk->fd;
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+        return open_failed(xsk, "bpf map update");
+    }
+
+    xsk->prog_fd = load_program(xsk->map_fd, port);
+    if (xsk->prog_fd < 0) {
+        return open_failed(xsk, "bpf prog load");
+    }
+    xsk->link_fd = attach_program(xsk, ifindex);
+    if (xsk->link_fd < 0) {
+        return open_failed(xsk, "bpf link create");
+    }
+    return 0;
+}
+
+/// Ones' complement sum used by the IP and UDP checksums
+static uint32_t checksum_add(uint32_t sum, const uint8_t *data, size_t length) {
+    for (size_t i = 0; i + 1 < length; i += 2) {
+        sum += (data[i] << 8) | data[i + 1];
+    }
+    if (length & 1) {
+        sum += data[length - 1] << 8;
+    }
+    return sum;
+}
+
+static uint16_t checksum_fold(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+/** @brief Checks the headers of a frame the program redirected and finds its payload
+ *
+ *  The kernel would have checked these for the UDP socket; here nobody did.
+ *
+ *  @param frame The Ethernet frame
+ *  @param length Its length
+ *  @param payload Set to the UDP payload
+ *  @param payload_length Set to its length
+ *  @param from Set to the sender
+ *  @return 0 if the datagram is good, -1 otherwise
+ */
+static int parse_frame(uint8_t *frame, size_t length, uint8_t **payload, size_t *payload_length, struct sockaddr_in *from) {
+    if (length < xdp_headers_size) {
+        return -1;
+    }
+    uint8_t *ip = frame + ETH_HLEN;
+    uint8_t *udp = ip + 20;
+
+    size_t ip_length = (ip[2] << 8) | ip[3];
+    size_t udp_length = (udp[4] << 8) | udp[5];
+    if (ip_length > length - ETH_HLEN || udp_length < 8 || udp_length > ip_length - 20) {
+        return -1;
+    }
+    if (checksum_fold(checksum_add(0, ip, 20)) != 0xffff) {
+        return -1;
+    }
+
+    /// A zero UDP checksum means the sender did not compute one. A local sender behind a veth leaves
+    /// the checksum to offload and the field holds just the pseudo header sum; the kernel trusts such
+    /// frames (they never crossed a wire) and so do we
+    uint16_t check = (udp[6] << 8) | udp[7];
+    if (check != 0) {
+        uint32_t pseudo = checksum_add(0, ip + 12, 8) + IPPROTO_UDP + udp_length;
+        if (check != checksum_fold(pseudo) && checksum_fold(checksum_add(pseudo, udp, udp_length)) != 0xffff) {
+            return -1;
+        }
+    }
+
+    memset(from, 0, sizeof(*from));
+    from->sin_family = AF_INET;
+    memcpy(&from->sin_addr, ip + 12, 4);
+    memcpy(&from->sin_port, udp, 2);
+    *payload = udp + 8;
+    *payload_length = udp_length - 8;
+    return 0;
+}
+
+/** @brief Hands out every datagram waiting in the rx ring and gives the frames back
+ *
+ *  @param xsk The socket
+ *  @param callback Called with each datagram
+ *  @param arg Passed to the callback
+ *  @return Number of datagrams handed out
+ */
+int xdp_receive(struct xdp_socket *xsk, xdp_packet_fn callback, void *arg) {
+    uint32_t consumer = *xsk->rx.consumer;
+    uint32_t producer = load_acquire(xsk->rx.producer);
+    int count = 0;
+
+    for (; consumer != producer; consumer++) {
+        struct xdp_desc *desc = &((struct xdp_desc *)xsk->rx.descs)[consumer & xsk->rx.mask];
+        uint8_t *payload;
+        size_t length;
+        struct sockaddr_in from;
+
+        if (parse_frame(xsk->umem + desc->addr, desc->len, &payload, &length, &from) == 0) {
+            callback(arg, payload, length, &from);
+            count++;
+        } else {
+            xsk->bad_packets++;
+        }
+        fill_frame(xsk, desc->addr);
+    }
+    store_release(xsk->rx.consumer, consumer);
+    return count;
+}
+
+/** @brief Frames the kernel dropped for us: the rx ring was full, the fill ring empty, or the descriptor bad
+ *
+ *  @param xsk The socket
+ *  @return The count so far, 0 if the kernel cannot tell
+ */
+unsigned long long xdp_drops(struct xdp_socket *xsk) {
+    struct xdp_statistics statistics;
+    socklen_t length = sizeof(statistics);
+    memset(&statistics, 0, sizeof(statistics));
+    if (getsockopt(xsk->fd, SOL_XDP, XDP_STATISTICS, &statistics, &length) < 0) {
+        return 0;
+    }
+    return statistics.rx_dropped + statistics.rx_invalid_descs + statistics.rx_ring_full;
+}
+
+/** @brief Detaches the program and releases the socket, the rings and the UMEM
+ *
+ *  @param xsk The socket
+ *  @return void
+ */
+void xdp_close(struct xdp_socket *xsk) {
+    if (xsk->link_fd >= 0) {
+        close(xsk->link_fd);
+    }
+    if (xsk->prog_fd >= 0) {
+        close(xsk->prog_fd);
+    }
+    if (xsk->map_fd >= 0) {
+        close(xsk->map_fd);
+    }
+    if (xsk->rx.map != NULL) {
+        munmap(xsk->rx.map, xsk->rx.map_size);
+    }
+    if (xsk->fill.map != NULL) {
+        munmap(xsk->fill.map, xsk->fill.map_size);
+    }
+    if (xsk->fd >= 0) {
+        close(xsk->fd);
+    }
+    if (xsk->umem != NULL) {
+        munmap(xsk->umem, xsk->umem_size);
+    }
+    memset(xsk, 0, sizeof(*xsk));
+    xsk->fd = xsk->map_fd = xsk->prog_fd = xsk->link_fd = -1;
+}
@@ -0,0 +1,60 @@
+/** @file xdp.h
+ *
+ *  @brief AF_XDP receive path: datagrams for our port skip the kernel's socket layer.
+ *
+ *  A small XDP program (assembled in xdp.c and loaded with the bpf() system call, no libbpf)
+ *  looks at every frame the interface receives and redirects IPv4/UDP frames addressed to our
+ *  port into an AF_XDP socket. The frames land in a UMEM shared with user space, where
+ *  xdp_receive() checks the IP and UDP headers and hands out the payload. Everything else,
+ *  including our traffic arriving on other queues, goes up the normal stack, so the receiver
+ *  keeps reading its UDP socket as well. Replies are sent through the UDP socket.
+ *
+ *  @author Ana Bandari (abandari)
+ *  @author Dajeong Kim (dkim2)
+ */
+
+#ifndef XDP_H
+#define XDP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define xdp_frames 4096 /// Frames in the UMEM, all of them start out on the fill ring
+#define xdp_frame_size 2048 /// Room for one Ethernet frame of ours
+
+/// Called with the UDP payload of every datagram, and who sent it
+typedef void (*xdp_packet_fn)(void *arg, uint8_t *payload, size_t length, const struct sockaddr_in *from);
+
+/// One side of a ring shared with the kernel
+struct xdp_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    void *descs;
+    uint32_t mask;
+    void *map;
+    size_t map_size;
+};
+
+/// The AF_XDP socket, its UMEM and the attached program
+struct xdp_socket {
+    int fd;
+    int map_fd; /// XSKMAP from queue id to socket
+    int prog_fd;
+    int link_fd; /// Closing it detaches the program
+    uint32_t queue;
+    uint8_t *umem;
+    size_t umem_size;
+    struct xdp_ring rx;
+    struct xdp_ring fill;
+    const char *mode; /// "native" or "generic" XDP
+    const char *failed; /// The step xdp_open() failed at, for the log
+    unsigned long long bad_packets; /// Frames dropped for a bad checksum or length
+};
+
+int xdp_open(struct xdp_socket *xsk, const char *ifname, uint32_t queue, uint16_t port);
+int xdp_receive(struct xdp_socket *xsk, xdp_packet_fn callback, void *arg);
+unsigned long long xdp_drops(struct xdp_socket *xsk);
+void xdp_close(struct xdp_socket *xsk);
+
+#endif